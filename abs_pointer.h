@@ -0,0 +1,63 @@
+#ifndef FOOTMOUSE_ABS_POINTER_H
+#define FOOTMOUSE_ABS_POINTER_H
+
+#include <stdint.h>
+
+#include "constants.h"
+
+/**
+ * Absolute pointer report matching the layout generated by TinyUSB's
+ * TUD_HID_REPORT_DESC_ABSMOUSE descriptor (see hid_abs_mouse_report_t).
+ * X and Y are screen fractions in the range [0, ABS_POINTER_MAX].
+ */
+struct __attribute__((packed)) AbsPointerReport
+{
+  uint8_t buttons;
+  int16_t x;
+  int16_t y;
+  int8_t wheel;
+  int8_t pan;
+};
+
+static_assert(sizeof(AbsPointerReport) == 7, "");
+
+/**
+ * Clamp a screen fraction into the logical range of the report.
+ */
+static inline int16_t
+clamp_abs_coordinate(uint16_t v)
+{
+  return static_cast<int16_t>(v > ABS_POINTER_MAX ? ABS_POINTER_MAX : v);
+}
+
+/**
+ * Build the report that warps the cursor to the given screen fraction.
+ * Buttons, wheel and pan are left untouched so the relative mouse keeps
+ * ownership of clicks.
+ */
+static inline AbsPointerReport
+make_abs_pointer_report(uint16_t x, uint16_t y)
+{
+  AbsPointerReport report = {};
+  report.x = clamp_abs_coordinate(x);
+  report.y = clamp_abs_coordinate(y);
+  return report;
+}
+
+/**
+ * Teensy's Mouse.moveTo() takes pixel positions relative to the size given
+ * to Mouse.screenSize(). Use a fixed virtual grid so the same screen fraction
+ * configuration works on both boards. Teensy caps the screen size at 7680.
+ */
+constexpr uint16_t ABS_POINTER_TEENSY_GRID = 4096;
+
+static inline uint16_t
+abs_fraction_to_teensy_grid(uint16_t v)
+{
+  return static_cast<uint16_t>(
+    (static_cast<uint32_t>(clamp_abs_coordinate(v)) *
+     (ABS_POINTER_TEENSY_GRID - 1)) /
+    ABS_POINTER_MAX);
+}
+
+#endif // FOOTMOUSE_ABS_POINTER_H
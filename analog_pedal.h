@@ -0,0 +1,172 @@
+#ifndef FOOTMOUSE_ANALOG_PEDAL_H
+#define FOOTMOUSE_ANALOG_PEDAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+/*
+ * Continuous expression pedal on a jack's pin.
+ *
+ * raw ADC -> sum of ANALOG_OVERSAMPLE samples -> first order IIR (fixed
+ * point) -> hysteresis -> position in [0, ANALOG_POSITION_MAX] -> lookup curve.
+ *
+ * Rate targets (scroll, pointer) treat the curve output as units per second
+ * and integrate it into whole steps. Joystick targets use it as the axis
+ * value.
+ */
+enum AnalogTarget : uint8_t
+{
+  ANALOG_TARGET_NONE = 0, // Pedal is a digital switch.
+  ANALOG_TARGET_SCROLL = 1,
+  ANALOG_TARGET_POINTER_X = 2,
+  ANALOG_TARGET_POINTER_Y = 3,
+  ANALOG_TARGET_JOYSTICK_X = 4,
+  ANALOG_TARGET_JOYSTICK_Y = 5,
+  ANALOG_TARGET_JOYSTICK_Z = 6,
+};
+
+constexpr uint16_t ANALOG_POSITION_MAX = (1 << ANALOG_READ_BITS) - 1;
+constexpr uint16_t ANALOG_CURVE_SEGMENT =
+  (ANALOG_POSITION_MAX + 1) / (ANALOG_CURVE_POINTS - 1);
+
+static_assert((ANALOG_CURVE_SEGMENT & (ANALOG_CURVE_SEGMENT - 1)) == 0,
+              "Curve segments must be a power of two wide.");
+
+// Naturally aligned, same layout as sent over serial.
+struct AnalogConfig
+{
+  uint8_t target = ANALOG_TARGET_NONE;
+  // Filter time constant is 2^iir_shift positions.
+  uint8_t iir_shift = 2;
+  // Position change needed before the output moves.
+  uint16_t hysteresis = 24;
+  // Output at positions 0, ANALOG_CURVE_SEGMENT, 2 * ANALOG_CURVE_SEGMENT...
+  int16_t curve[ANALOG_CURVE_POINTS] = { 0 };
+};
+
+static_assert(sizeof(AnalogConfig) == 4 + 2 * ANALOG_CURVE_POINTS, "");
+
+/**
+ * Piecewise linear lookup.
+ */
+static inline int16_t
+apply_curve(const int16_t* curve, uint16_t position)
+{
+  const size_t i = position / ANALOG_CURVE_SEGMENT;
+  if (i >= ANALOG_CURVE_POINTS - 1) {
+    return curve[ANALOG_CURVE_POINTS - 1];
+  }
+  const int32_t frac = position % ANALOG_CURVE_SEGMENT;
+  const int32_t delta = curve[i + 1] - curve[i];
+  return curve[i] + (delta * frac) / ANALOG_CURVE_SEGMENT;
+}
+
+/**
+ * Oversampling, IIR and hysteresis. All integer math, O(1) per sample.
+ */
+class AnalogFilter
+{
+public:
+  void reset(uint16_t position)
+  {
+    state = static_cast<int32_t>(position) << FRAC_BITS;
+    reported = position;
+    sum = 0;
+    n = 0;
+  }
+
+  /**
+   * Feed one raw ADC reading. Returns true when the reported position moved.
+   */
+  bool add_sample(uint16_t raw, uint8_t iir_shift, uint16_t hysteresis)
+  {
+    sum += raw;
+    if (++n < ANALOG_OVERSAMPLE) {
+      return false;
+    }
+    const int32_t x = static_cast<int32_t>(sum / ANALOG_OVERSAMPLE)
+                      << FRAC_BITS;
+    sum = 0;
+    n = 0;
+
+    state += (x - state) >> iir_shift;
+    const int32_t filtered = (state + (1 << (FRAC_BITS - 1))) >> FRAC_BITS;
+
+    const int32_t diff = filtered - reported;
+    // Always let the ends through so full travel is reachable.
+    if (diff > hysteresis || -diff > hysteresis ||
+        (filtered == 0 && reported != 0) ||
+        (filtered == ANALOG_POSITION_MAX && reported != ANALOG_POSITION_MAX)) {
+      reported = filtered;
+      return true;
+    }
+    return false;
+  }
+
+  uint16_t position() const { return reported; }
+
+private:
+  static constexpr int FRAC_BITS = 8;
+
+  int32_t state = 0;
+  volatile uint16_t reported = 0;
+  uint32_t sum = 0;
+  uint8_t n = 0;
+};
+
+/**
+ * Integrates a rate in units per second into whole steps. A report carries
+ * at most 127 steps; anything beyond is dropped rather than carried, so the
+ * output stops with the pedal instead of draining a backlog.
+ */
+class RateAccumulator
+{
+public:
+  int8_t take(int16_t rate_per_s, uint32_t dt_us)
+  {
+    static constexpr int64_t MAX_ACC = 128 * 1000000LL - 1;
+    acc += static_cast<int64_t>(rate_per_s) * dt_us;
+    if (acc > MAX_ACC) {
+      acc = MAX_ACC;
+    } else if (acc < -MAX_ACC) {
+      acc = -MAX_ACC;
+    }
+    const int32_t steps = acc / 1000000;
+    acc -= static_cast<int64_t>(steps) * 1000000;
+    return steps;
+  }
+
+  void reset() { acc = 0; }
+
+private:
+  int64_t acc = 0;
+};
+
+struct AnalogPedal
+{
+  AnalogConfig config;
+  AnalogFilter filter;
+  RateAccumulator rate;
+  int16_t last_output = 0;
+
+  bool active() const { return config.target != ANALOG_TARGET_NONE; }
+
+  void configure(const AnalogConfig& c)
+  {
+    config = c;
+    filter.reset(0);
+    rate.reset();
+    last_output = apply_curve(config.curve, 0);
+  }
+
+  void add_sample(uint16_t raw)
+  {
+    filter.add_sample(raw, config.iir_shift, config.hysteresis);
+  }
+
+  int16_t output() const { return apply_curve(config.curve, filter.position()); }
+};
+
+#endif // FOOTMOUSE_ANALOG_PEDAL_H
@@ -0,0 +1,59 @@
+#ifndef FOOTMOUSE_ASCII_HID_H
+#define FOOTMOUSE_ASCII_HID_H
+
+#include <stdint.h>
+
+// Keyboard report modifier bit for characters typed with shift.
+constexpr uint8_t HID_MODIFIER_LEFT_SHIFT = 0x02;
+
+/**
+ * US layout usage ID of an ASCII character, with the modifier it needs in
+ * out_mod. Returns 0 for characters without a mapping.
+ */
+static inline uint8_t
+ascii_to_hid_usage(char c, uint8_t& out_mod)
+{
+  out_mod = 0;
+  if (c >= 'a' && c <= 'z')
+    return 0x04 + (c - 'a'); // a..z
+  if (c >= 'A' && c <= 'Z') {
+    out_mod = HID_MODIFIER_LEFT_SHIFT;
+    return 0x04 + (c - 'A');
+  }
+  if (c >= '1' && c <= '9')
+    return 0x1E + (c - '1'); // 1..9
+  if (c == '0')
+    return 0x27;
+  if (c == ' ')
+    return 0x2C;
+  if (c == '\n' || c == '\r')
+    return 0x28; // Enter
+  if (c == '\t')
+    return 0x2B; // Tab
+  if (c == '-')
+    return 0x2D;
+  if (c == '=')
+    return 0x2E;
+  if (c == '[')
+    return 0x2F;
+  if (c == ']')
+    return 0x30;
+  if (c == '\\')
+    return 0x31;
+  if (c == ';')
+    return 0x33;
+  if (c == '\'')
+    return 0x34;
+  if (c == '`')
+    return 0x35;
+  if (c == ',')
+    return 0x36;
+  if (c == '.')
+    return 0x37;
+  if (c == '/')
+    return 0x38;
+  // Add more mappings as required.
+  return 0;
+}
+
+#endif // FOOTMOUSE_ASCII_HID_H
@@ -0,0 +1,158 @@
+#ifndef FOOTMOUSE_BENCH_H
+#define FOOTMOUSE_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cycles.h"
+
+constexpr uint8_t BENCH_VERSION = 1;
+
+// Runs per benchmark. Odd, so the median is a sample.
+constexpr size_t BENCH_RUNS = 33;
+
+// Never renumber, only append. Keep in sync with BENCH_NAMES in
+// serial_commands.py.
+enum BenchId : uint8_t
+{
+  BENCH_DEBOUNCE_ALL = 0, // One debounce step of every pedal.
+  BENCH_LOOP = 1,         // One main loop iteration, hid_task on nRF52.
+  BENCH_CRC32_512 = 2,
+  BENCH_HID_REPORT = 3, // Build a keyboard and mouse state from actions.
+  BENCH_ASCII_TO_HID = 4,
+  BENCH_STORAGE_LOAD = 5, // load_memory() of the stored config.
+};
+
+/**
+ * CMD_RUN_BENCH reply header, followed by count BenchResult.
+ */
+struct __attribute__((packed)) BenchHeader
+{
+  uint8_t version = BENCH_VERSION;
+  uint8_t count = 0;
+  uint16_t runs = BENCH_RUNS;
+  uint32_t cycles_per_s = 0;
+};
+
+struct __attribute__((packed)) BenchResult
+{
+  uint8_t id;
+  uint8_t reserved[3];
+  uint32_t min_cycles;
+  uint32_t median_cycles;
+  uint32_t max_cycles;
+};
+
+// Keeps the optimizer from dropping a benchmarked computation.
+static inline void
+bench_keep(uint32_t value)
+{
+  asm volatile("" : : "r"(value));
+}
+
+/**
+ * Sorts samples in place.
+ */
+static inline BenchResult
+bench_summarize(uint8_t id, uint32_t* samples, size_t n)
+{
+  for (size_t i = 1; i < n; i++) {
+    const uint32_t v = samples[i];
+    size_t j = i;
+    for (; j > 0 && samples[j - 1] > v; j--) {
+      samples[j] = samples[j - 1];
+    }
+    samples[j] = v;
+  }
+  BenchResult r = { id, { 0 }, 0, 0, 0 };
+  if (n) {
+    r.min_cycles = samples[0];
+    r.median_cycles = samples[n / 2];
+    r.max_cycles = samples[n - 1];
+  }
+  return r;
+}
+
+/**
+ * Cycles of a measurement of nothing, subtracted from every sample.
+ */
+static inline uint32_t
+bench_overhead()
+{
+  uint32_t best = UINT32_MAX;
+  for (int i = 0; i < 8; i++) {
+    const uint32_t c0 = cycle_count();
+    const uint32_t c1 = cycle_count();
+    if (c1 - c0 < best) {
+      best = c1 - c0;
+    }
+  }
+  return best;
+}
+
+template<typename F>
+uint32_t
+bench_time(F&& fn, uint32_t overhead)
+{
+  const uint32_t c0 = cycle_count();
+  fn();
+  const uint32_t cycles = cycle_count() - c0;
+  return cycles > overhead ? cycles - overhead : 0;
+}
+
+/**
+ * Time BENCH_RUNS calls of fn(). Interrupts stay enabled, so max includes
+ * whatever preempted a run. Compare medians.
+ */
+template<typename F>
+BenchResult
+run_bench(uint8_t id, F&& fn)
+{
+  const uint32_t overhead = bench_overhead();
+  uint32_t samples[BENCH_RUNS];
+  for (auto& s : samples) {
+    s = bench_time(fn, overhead);
+  }
+  return bench_summarize(id, samples, BENCH_RUNS);
+}
+
+/**
+ * Like run_bench() for code that can't be timed as one call, e.g. because
+ * setting up each step must not count. sample(overhead) returns the cycles
+ * of one run, usually a sum of bench_time().
+ */
+template<typename F>
+BenchResult
+run_bench_sampled(uint8_t id, F&& sample)
+{
+  const uint32_t overhead = bench_overhead();
+  uint32_t samples[BENCH_RUNS];
+  for (auto& s : samples) {
+    s = sample(overhead);
+  }
+  return bench_summarize(id, samples, BENCH_RUNS);
+}
+
+/**
+ * Cycles of the most recent loop iterations. A loop can't time itself from
+ * a command it is handling, so it records every iteration.
+ */
+struct LoopCycleLog
+{
+  uint32_t samples[BENCH_RUNS] = { 0 };
+  uint32_t count = 0;
+
+  void add(uint32_t cycles) { samples[count++ % BENCH_RUNS] = cycles; }
+
+  BenchResult result() const
+  {
+    uint32_t copy[BENCH_RUNS];
+    const size_t n = count < BENCH_RUNS ? count : BENCH_RUNS;
+    for (size_t i = 0; i < n; i++) {
+      copy[i] = samples[i];
+    }
+    return bench_summarize(BENCH_LOOP, copy, n);
+  }
+};
+
+#endif // FOOTMOUSE_BENCH_H
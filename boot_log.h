@@ -0,0 +1,47 @@
+#ifndef FOOTMOUSE_BOOT_LOG_H
+#define FOOTMOUSE_BOOT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr uint8_t BOOT_LOG_VERSION = 1;
+
+// Never renumber, only append. Keep in sync with BOOT_PHASES in
+// serial_commands.py.
+enum BootPhase : uint8_t
+{
+  BOOT_SETUP_START = 0,
+  BOOT_PINS_READY = 1,
+  BOOT_CONFIG_LOADED = 2,
+  BOOT_SAMPLING_STARTED = 3,
+  BOOT_USB_BEGUN = 4,
+  BOOT_SETUP_DONE = 5,
+  // First commit with the host ready. The state report goes out here, so
+  // this is the time to the first usable report.
+  BOOT_USB_READY = 6,
+  BOOT_FIRST_EDGE = 7,   // Raw time of the first pedal edge.
+  BOOT_FIRST_ACTION = 8, // First pedal action run, after USB_READY.
+  BOOT_PHASE_COUNT
+};
+
+/**
+ * micros() at which each boot phase was first reached, 0 if not yet. The
+ * CMD_GET_BOOT_LOG reply is the header followed by t_us.
+ */
+struct __attribute__((packed)) BootLog
+{
+  uint8_t version = BOOT_LOG_VERSION;
+  uint8_t phase_count = BOOT_PHASE_COUNT;
+  uint16_t reserved = 0;
+  uint32_t t_us[BOOT_PHASE_COUNT] = { 0 };
+
+  void mark(BootPhase phase, uint32_t now_us)
+  {
+    if (!t_us[phase]) {
+      // 0 means unset.
+      t_us[phase] = now_us ? now_us : 1;
+    }
+  }
+};
+
+#endif // FOOTMOUSE_BOOT_LOG_H
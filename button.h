@@ -2,66 +2,97 @@
 #define FOOTMOUSE_BUTTON_H
 
 #include "constants.h"
+#include "critical_section.h"
+#include "telemetry.h"
 
-class Button
+/**
+ * Debounce settings of a pedal, see Debouncer::set_debounce().
+ */
+struct DebounceConfig
 {
-public:
-  int pin;
-  int mode;
-  int trigger_direction = DOWN_CLICK;
-  bool enabled = true;
+  bool enabled;
+  uint8_t mode;
+  uint32_t holdoff_us;
+  uint32_t noise_guard_us;
+};
 
-  size_t nKeycodes;
-  std::array<uint16_t, 128> keycodes;
-  // unsigned long timout_ms = 3 * 60 * 1000;
+/**
+ * Debounce state of one pedal. Whatever samples the pedal owns it: the
+ * Teensy sampler interrupt and the main loop use the Button itself, the
+ * nRF52 input task a copy that takes settings from a mailbox.
+ *
+ * The glitch buffer length and the DEBOUNCE_INTEGRATE lockout are template
+ * parameters so tests/debounce_replay.cpp can sweep them; the firmware uses
+ * Debouncer.
+ */
+template<uint32_t GlitchSamples, uint32_t LockoutUs>
+class BasicDebouncer
+{
+public:
+  static_assert(GlitchSamples > 0 && GlitchSamples <= 32, "");
 
-  const int default_mode;
-  const int default_inverted;
+  bool enabled = true;
 
   int state = DIGITAL_READ_PEDAL_UP;
   uint32_t glitch_buf = 0;
   unsigned long last_change_time = 0;
 
-  Button() = delete;
-  Button(int pin, int mode, int trigger_direction)
-    : pin(pin)
-    , mode(mode)
-    , trigger_direction(trigger_direction)
-    , default_mode(mode)
-    , default_inverted(trigger_direction)
+  // See set_debounce().
+  uint8_t debounce_mode = DEBOUNCE_INTEGRATE;
+  uint32_t holdoff_us = DEBOUNCE_RESET;
+  uint32_t noise_guard_us = 0;
+  // An eager edge waits for the noise guard to confirm it.
+  bool guard_pending = false;
+
+  // Time of the first raw sample that differed from state.
+  unsigned long edge_time = 0;
+  bool edge_pending = false;
+  bool lockout_counted = false;
+
+  // Only written by the sampler, see PedalTelemetry.
+  uint32_t rejected_glitches = 0;
+  uint32_t lockout_hits = 0;
+
+  /**
+   * Select the debounce algorithm. In DEBOUNCE_EAGER mode, pin changes are
+   * ignored for holdoff_us after an accepted edge. With a non-zero
+   * noise_guard_us, an eager edge whose pin level settled back to the old
+   * state by then is reverted, so an EMI spike can't latch a held action.
+   * The sampler may be running, so the fields change together.
+   */
+  void set_debounce(uint8_t mode_,
+                    uint32_t holdoff_us_,
+                    uint32_t noise_guard_us_)
   {
+    IrqGuard guard;
+    debounce_mode = mode_;
+    holdoff_us = holdoff_us_;
+    noise_guard_us = noise_guard_us_;
+    guard_pending = false;
+    edge_pending = false;
   }
 
-  void set_mode(int mode_, int inverted_)
+  DebounceConfig debounce_config() const
   {
-    mode = mode_;
-    trigger_direction = inverted_;
+    return { enabled, debounce_mode, holdoff_us, noise_guard_us };
   }
 
-  void reset_to_defaults()
+  /**
+   * Take settings from another copy. Edge tracking only restarts when the
+   * algorithm changed.
+   */
+  void apply_debounce_config(const DebounceConfig& config)
   {
-    // Release any potenitally help down mouse buttons.
-    switch (mode) {
-      // For left, right, and middle button modes, the mode
-      // number corresponds  to the Mouse library button
-      // constant.
-      case MODE_MOUSE_LEFT:
-      case MODE_MOUSE_RIGHT:
-      case MODE_MOUSE_MIDDLE:
-        Mouse.release(mode);
-        break;
+    enabled = config.enabled;
+    if (config.mode != debounce_mode || config.holdoff_us != holdoff_us ||
+        config.noise_guard_us != noise_guard_us) {
+      set_debounce(config.mode, config.holdoff_us, config.noise_guard_us);
     }
-    mode = default_mode;
-    trigger_direction = default_inverted;
   }
 
-  /**
-   * Apply inversion settings to the pedal position
-   */
-  bool should_engage()
+  static constexpr uint32_t glitch_mask()
   {
-    return (trigger_direction && (state == DIGITAL_READ_PEDAL_UP)) ||
-           (!trigger_direction && (state == DIGITAL_READ_PEDAL_DOWN));
+    return static_cast<uint32_t>(-1) >> (32 - GlitchSamples);
   }
 
   /**
@@ -74,6 +105,10 @@ public:
       return false;
     }
 
+    if (debounce_mode == DEBOUNCE_EAGER) {
+      return debounce_eager(digital_read, now);
+    }
+
     // Can't implement a timeout feature without edge detection rather than
     // state detection. if ((now - last_change_time) > timout_ms) {
     //   // TODO: this will break button behavior if I use edge debouncing
@@ -84,25 +119,96 @@ public:
     // The bit mask is responsible for ignoring short glitches on the GPIO pins.
     // A minimum number of sequential samples must be all high or all low to
     // change state. The glitch duration is determined by POLL_PERIOD_US *
-    // GLITCH_SAMPLE_CNT.
-    const uint32_t mask =
-      static_cast<uint32_t>(-1) >> ((sizeof(uint32_t) * 8) - GLITCH_SAMPLE_CNT);
+    // GlitchSamples.
+    const uint32_t mask = glitch_mask();
 
     glitch_buf = mask & ((glitch_buf << 1) | digital_read);
 
+    const uint32_t settled_same = state ? mask : 0;
+    const uint32_t settled_other = state ? 0 : mask;
+
+    const bool locked_out = (now - last_change_time) < LockoutUs;
+
+    // Edges are tracked during the lockout too, so a change that is accepted
+    // when it ends still carries the time the pin moved. Bounce of the last
+    // accepted edge isn't counted as a glitch.
+    if (digital_read != state && !edge_pending) {
+      edge_pending = true;
+      edge_time = now;
+    } else if (glitch_buf == settled_same && edge_pending) {
+      if (!locked_out) {
+        rejected_glitches++;
+      }
+      edge_pending = false;
+    }
+
     // The debounce reset is used to acheive longer debounce times on the pedal
     // reset than can be represented in a sample buffer.
-    if ((now - last_change_time) < DEBOUNCE_RESET) {
+    if (locked_out) {
+      if (glitch_buf == settled_other && !lockout_counted) {
+        lockout_hits++;
+        lockout_counted = true;
+      }
       return false;
     }
 
-    if (state == 1 && glitch_buf == 0) {
-      state = 0;
+    if (glitch_buf == settled_other) {
+      state = !state;
       last_change_time = now;
+      edge_pending = false;
+      lockout_counted = false;
       return true;
-    } else if (state == 0 && glitch_buf == mask) {
-      state = 1;
+    }
+
+    return false;
+  }
+
+  /**
+   * Leading edge filter: the first sample that differs from state is
+   * accepted, so the action goes out one sample after the contact moves.
+   * Bounce is covered by the hold-off window instead of the glitch buffer.
+   */
+  bool debounce_eager(int digital_read, unsigned long now)
+  {
+    const uint32_t mask = glitch_mask();
+
+    glitch_buf = mask & ((glitch_buf << 1) | digital_read);
+
+    const uint32_t settled_same = state ? mask : 0;
+    const uint32_t settled_other = state ? 0 : mask;
+    const unsigned long since_change = now - last_change_time;
+
+    // Bounce may still be going on when the guard expires, so decide once the
+    // glitch buffer settled either way.
+    if (guard_pending && since_change >= noise_guard_us) {
+      if (glitch_buf == settled_same) {
+        guard_pending = false;
+      } else if (glitch_buf == settled_other) {
+        // The level didn't persist, undo the edge. No hold-off, so a real
+        // change right after the spike still goes out immediately.
+        guard_pending = false;
+        rejected_glitches++;
+        state = !state;
+        edge_time = now;
+        last_change_time = now - holdoff_us;
+        return true;
+      }
+    }
+
+    if (guard_pending || since_change < holdoff_us) {
+      if (glitch_buf == settled_other && !lockout_counted) {
+        lockout_hits++;
+        lockout_counted = true;
+      }
+      return false;
+    }
+
+    if (digital_read != state) {
+      state = !state;
+      edge_time = now;
       last_change_time = now;
+      lockout_counted = false;
+      guard_pending = noise_guard_us != 0;
       return true;
     }
 
@@ -110,4 +216,71 @@ public:
   }
 };
 
+using Debouncer = BasicDebouncer<GLITCH_SAMPLE_CNT, DEBOUNCE_RESET>;
+
+class Button : public Debouncer
+{
+public:
+  int pin;
+  int mode;
+  int trigger_direction = DOWN_CLICK;
+
+  size_t nKeycodes;
+  std::array<uint16_t, 128> keycodes;
+
+  // Cursor destination for MODE_WARP_CURSOR as a screen fraction.
+  uint16_t warp_x = ABS_POINTER_CENTER;
+  uint16_t warp_y = ABS_POINTER_CENTER;
+  // unsigned long timout_ms = 3 * 60 * 1000;
+
+  const int default_mode;
+  const int default_inverted;
+
+  unsigned long engage_time = 0;
+  // Raw edge time of the edge whose action is being sent.
+  uint32_t last_edge_us = 0;
+
+  PedalTelemetry telemetry;
+
+  Button() = delete;
+  Button(int pin, int mode, int trigger_direction)
+    : pin(pin)
+    , mode(mode)
+    , trigger_direction(trigger_direction)
+    , default_mode(mode)
+    , default_inverted(trigger_direction)
+  {
+  }
+
+  void set_mode(int mode_, int inverted_)
+  {
+    mode = mode_;
+    trigger_direction = inverted_;
+  }
+
+  /**
+   * Held mouse buttons are released by the caller, see g_hid.
+   */
+  void reset_to_defaults()
+  {
+    mode = default_mode;
+    trigger_direction = default_inverted;
+    set_debounce(DEBOUNCE_INTEGRATE, DEBOUNCE_RESET, 0);
+  }
+
+  /**
+   * Apply inversion settings to the pedal position
+   */
+  bool should_engage() { return should_engage(state); }
+
+  /**
+   * Same as above for a state captured earlier, e.g. in a queued event.
+   */
+  bool should_engage(int state_)
+  {
+    return (trigger_direction && (state_ == DIGITAL_READ_PEDAL_UP)) ||
+           (!trigger_direction && (state_ == DIGITAL_READ_PEDAL_DOWN));
+  }
+};
+
 #endif // FOOTMOUSE_BUTTON_H
\ No newline at end of file
@@ -0,0 +1,152 @@
+#ifndef FOOTMOUSE_CHORD_H
+#define FOOTMOUSE_CHORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+/**
+ * Pressing all pedals in pedal_mask within window_ms fires the key combo
+ * instead of the pedals' own actions. A pedal_mask of 0 marks an unused slot.
+ */
+struct Chord
+{
+  uint8_t pedal_mask = 0;
+  uint16_t window_ms = 0;
+  uint8_t nKeycodes = 0;
+  uint16_t keycodes[MAX_CHORD_KEYCODE_COUNT] = { 0 };
+};
+
+/**
+ * Resolves chords from the stream of debounced engage/disengage edges.
+ *
+ * Pedals that aren't part of any chord pass straight through, so solo presses
+ * keep their latency. An engage of a chord member is held back until either
+ * the chord completes or the window expires, in which case the pedal's own
+ * action is sent late. Disengages of pedals used by a chord are swallowed.
+ *
+ * When chords overlap, the first complete chord in the table wins, so list
+ * larger chords first.
+ *
+ * The Output type must provide:
+ *   void single(uint8_t pedal, bool engage);
+ *   void chord(const Chord& chord);
+ */
+template<size_t PEDAL_COUNT>
+class ChordEngine
+{
+  static_assert(PEDAL_COUNT <= 8, "Pedal masks are 8 bits.");
+
+public:
+  Chord chords[CHORD_COUNT];
+
+  /**
+   * Call after editing chords.
+   */
+  void update_members()
+  {
+    member_mask = 0;
+    for (const auto& c : chords) {
+      member_mask |= c.pedal_mask;
+    }
+  }
+
+  bool has_pending() const { return pending_mask != 0; }
+
+  template<typename Output>
+  void on_edge(uint8_t pedal, bool engage, uint32_t now_us, Output& out)
+  {
+    const uint8_t bit = 1 << pedal;
+
+    if (!engage) {
+      if (consumed_mask & bit) {
+        consumed_mask &= ~bit;
+      } else if (pending_mask & bit) {
+        // Short solo press of a chord member.
+        pending_mask &= ~bit;
+        out.single(pedal, true);
+        out.single(pedal, false);
+      } else {
+        out.single(pedal, false);
+      }
+      return;
+    }
+
+    if (!(member_mask & bit)) {
+      out.single(pedal, true);
+      return;
+    }
+
+    pending_mask |= bit;
+    pending_since_us[pedal] = now_us;
+
+    for (const auto& c : chords) {
+      if (c.pedal_mask && (c.pedal_mask & bit) &&
+          (c.pedal_mask & pending_mask) == c.pedal_mask &&
+          within_window(c, now_us)) {
+        pending_mask &= ~c.pedal_mask;
+        consumed_mask |= c.pedal_mask;
+        out.chord(c);
+        return;
+      }
+    }
+  }
+
+  /**
+   * Release held back engages whose window expired. Call periodically.
+   */
+  template<typename Output>
+  void tick(uint32_t now_us, Output& out)
+  {
+    if (!pending_mask) {
+      return;
+    }
+
+    for (size_t i = 0; i < PEDAL_COUNT; i++) {
+      const uint8_t bit = 1 << i;
+      if ((pending_mask & bit) &&
+          (now_us - pending_since_us[i]) >= window_us_for(i)) {
+        pending_mask &= ~bit;
+        out.single(i, true);
+      }
+    }
+  }
+
+private:
+  uint8_t member_mask = 0;
+  uint8_t pending_mask = 0;
+  uint8_t consumed_mask = 0;
+  uint32_t pending_since_us[PEDAL_COUNT] = { 0 };
+
+  // Same bound as tick(), so an edge at exactly window_ms is a single
+  // whether tick() ran first or not.
+  bool within_window(const Chord& c, uint32_t now_us) const
+  {
+    const uint32_t window_us = static_cast<uint32_t>(c.window_ms) * 1000;
+    for (size_t i = 0; i < PEDAL_COUNT; i++) {
+      if ((c.pedal_mask & (1 << i)) &&
+          (now_us - pending_since_us[i]) >= window_us) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Longest window of any chord the pedal belongs to.
+  uint32_t window_us_for(size_t pedal) const
+  {
+    uint32_t window_us = 0;
+    for (const auto& c : chords) {
+      if (c.pedal_mask & (1 << pedal)) {
+        const uint32_t w = static_cast<uint32_t>(c.window_ms) * 1000;
+        if (w > window_us) {
+          window_us = w;
+        }
+      }
+    }
+    return window_us;
+  }
+};
+
+#endif // FOOTMOUSE_CHORD_H
@@ -0,0 +1,81 @@
+#ifndef FOOTMOUSE_CONFIG_SNAPSHOT_H
+#define FOOTMOUSE_CONFIG_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "crc32.h"
+
+/*
+ * CMD_GET_CONFIG reply: ConfigHeader followed by the body
+ *   ConfigGlobals
+ *   per pedal: ConfigPedal + nKeycodes uint16 keycodes
+ *   persisted profiles: profile_count * pedal_count MemButton
+ *   persisted rules: rule_count ProfileRule
+ *   chord_count ConfigChord
+ * The hash is the crc32 of the body. CMD_GET_CONFIG_HASH returns only the
+ * hash, so a host holding a cached body can skip the full read.
+ */
+constexpr uint8_t CONFIG_SNAPSHOT_VERSION = 1;
+
+struct __attribute__((packed)) ConfigHeader
+{
+  uint8_t version = CONFIG_SNAPSHOT_VERSION;
+  uint8_t pedal_count = 0;
+  uint8_t profile_count = 0;
+  uint8_t rule_count = 0;
+  uint8_t chord_count = 0;
+  uint8_t chord_keycode_count = 0;
+  uint16_t body_length = 0;
+  uint32_t hash = 0;
+};
+
+static_assert(sizeof(ConfigHeader) == 12, "");
+
+struct __attribute__((packed)) ConfigGlobals
+{
+  uint8_t active_profile;
+  uint8_t default_profile;
+  uint8_t keep_awake;
+  uint8_t reserved;
+};
+
+struct __attribute__((packed)) ConfigPedal
+{
+  uint8_t mode;
+  uint8_t trigger_direction;
+  uint8_t enabled; // Cleared by AUTO_DISABLE_BTN_ON_START.
+  uint8_t nKeycodes;
+  uint16_t warp_x;
+  uint16_t warp_y;
+};
+
+struct __attribute__((packed)) ConfigChord
+{
+  uint8_t pedal_mask;
+  uint16_t window_ms;
+  uint8_t nKeycodes;
+  uint16_t keycodes[MAX_CHORD_KEYCODE_COUNT];
+};
+
+/**
+ * Sink that only measures and hashes the snapshot body.
+ */
+struct ConfigHashSink
+{
+  uint32_t crc = 0xFFFFFFFF;
+  size_t length = 0;
+
+  void write(const void* data, size_t len)
+  {
+    crc = crc::update_crc(
+      crc, const_cast<unsigned char*>(static_cast<const unsigned char*>(data)),
+      len);
+    length += len;
+  }
+
+  uint32_t hash() const { return crc ^ 0xFFFFFFFF; }
+};
+
+#endif // FOOTMOUSE_CONFIG_SNAPSHOT_H
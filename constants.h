@@ -11,17 +11,118 @@
 // at start up and leave all other pins open. This can be accomplished by
 // inserting a TS male jack into the second 3.5mm jack.
 #define ENABLE_BITLOCKER_RECOVERY_MODE_FOR_NRF
+// Time the host gets after USB is mounted before the key is typed.
+#define BITLOCKER_DELAY_MS 2000
 #endif
 
 #define DEVICE_ID_RESPONSE "footmouse\n"
 
-#define GLITCH_SAMPLE_CNT  10
-#define POLL_PERIOD_US     20
+#if defined(ARDUINO_ARCH_NRF52)
+// Run pedal sampling, HID output and serial commands in separate FreeRTOS
+// tasks so a slow command can't delay pedal input.
+#define ENABLE_NRF52_TASK_SPLIT
+#endif
+
+#if defined(TEENSYDUINO)
+// Sample the pedals from an IntervalTimer interrupt every POLL_PERIOD_US so the
+// glitch window is exact. The main loop only handles accepted edges.
+#define ENABLE_TEENSY_ISR_SAMPLER
+#define SAMPLER_ISR_PRIORITY 64 // 0 = highest, 255 = lowest.
+#define PEDAL_EVENT_RING_LEN 32 // Power of two.
+#endif
+
+#if defined(TEENSYDUINO)
+// Idle at the clock the sketch was built with (Tools > CPU Speed) and boost
+// to CPU_BOOST_HZ from the first pedal edge or serial byte until CPU_QUIET_MS
+// pass without activity, see cpu_clock.h. Both can be changed with
+// CMD_SET_CPU_CLOCK.
+#define ENABLE_TEENSY_CLOCK_SCALING
+#define CPU_BOOST_HZ     600000000
+#define CPU_MAX_BOOST_HZ 600000000 // Rated maximum, no overclocking.
+#define CPU_QUIET_MS     2000
+#endif
+
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+// Priorities: 0 = lowest. The Arduino loop task runs at 1 and the TinyUSB
+// device task at 3.
+#define INPUT_TASK_PRIORITY    3
+#define HID_TASK_PRIORITY      2
+#define SERIAL_TASK_PRIORITY   1
+#define INPUT_TASK_STACK_SIZE  256 // words
+#define HID_TASK_STACK_SIZE    512 // words
+#define SERIAL_TASK_STACK_SIZE 1024 // words
+#define PEDAL_EVENT_QUEUE_LEN  16
+// The input task wakes on the RTOS tick and takes a burst of
+// GLITCH_SAMPLE_CNT samples POLL_PERIOD_US apart, so the glitch window stays
+// near the 200 us of the polled loop instead of growing to several ticks.
+// An edge is accepted within INPUT_TASK_PERIOD_MS plus one burst.
+#define INPUT_TASK_PERIOD_MS   1
+#define SERIAL_TASK_PERIOD_MS  5
+#define GLITCH_SAMPLE_CNT      5
+#define POLL_PERIOD_US         40
+#else
+// The Teensy sampling interrupt must leave most of each period to the main
+// loop at the idle clock: at 24 MHz a period is 80 * 24 = 1920 cycles. Check
+// busy_duty from get_sampler_stats() after adding pedals. The glitch window
+// is 240 us, glitches under 160 us are always rejected.
+#define GLITCH_SAMPLE_CNT  3
+#define POLL_PERIOD_US     80
+#endif
+
 #define DEBOUNCE_RESET     (20 * 1000) // microseconds
 #define STRING_BUFFER_SIZE 512
 
 #define MAX_COMBO_KEYCODE_COUNT 64
 
+// Stored pedal mode profiles and the rules that pick one from the pedals
+// connected at boot.
+#define PROFILE_COUNT      4
+#define PROFILE_RULE_COUNT 8
+
+// Multi-pedal chords.
+#define CHORD_COUNT             4
+#define MAX_CHORD_KEYCODE_COUNT 8
+
+// Pedals with two contacts timed for press velocity, see velocity.h.
+#define VELOCITY_PAIR_COUNT 2
+
+// Absolute pointer coordinates are a fraction of the screen in the range
+// [0, ABS_POINTER_MAX]. Matches the logical range of TinyUSB's absolute mouse
+// report descriptor.
+#define ABS_POINTER_MAX    0x7FFF
+#define ABS_POINTER_CENTER (ABS_POINTER_MAX / 2)
+
+// Binary event tracing over the serial port.
+#define TRACE_RING_LEN      256 // Records, power of two.
+#define TRACE_FRAME_RECORDS 32  // Records per serial frame.
+#define TRACE_FLUSH_MS      20  // Send partial frames after this long.
+
+// Binary log messages, see log.h. Levels above LOG_MAX_LEVEL compile to
+// nothing: 0 = off, 1 = error, 2 = warn, 3 = info, 4 = debug.
+#define LOG_MAX_LEVEL     3
+#define LOG_RING_LEN      32 // Records, power of two.
+#define LOG_FRAME_RECORDS 8  // Records per serial frame.
+
+// Analog expression pedals, see analog_pedal.h.
+#define ANALOG_READ_BITS          12
+#define ANALOG_OVERSAMPLE         4    // Software samples summed per position.
+#define ANALOG_SAMPLE_PERIOD_US   1000
+#define ANALOG_OUTPUT_PERIOD_US   10000
+#define ANALOG_CURVE_POINTS       9    // Evenly spaced over the travel.
+
+// Raw pin capture for debounce tuning, see scope_capture.h.
+#define SCOPE_BUFFER_BYTES 8192
+#define SCOPE_FRAME_BYTES  512
+#define SCOPE_PRETRIGGER_DIV 8 // 1/8 of the capture precedes the trigger.
+
+// Keyboard and mouse button state is re-sent this long after a change and
+// periodically while anything is held, see hid_state.h.
+#define HID_RESYNC_MS 250
+
+// Debounced pedal edges streamed to the host, see event_stream.h.
+#define PEDAL_NOTIFY_RING_LEN      32 // Records, power of two.
+#define PEDAL_NOTIFY_FRAME_RECORDS 8  // Records per serial frame.
+
 #define KEEP_AWAKE_PERIOD_S      180
 #define KEEP_AWAKE_KEY           KEY_F22
 #define KEEP_AWAKE_DEFAULT_STATE true
@@ -43,6 +144,18 @@ enum TriggerDirection
   UP_CLICK = 1
 };
 
+/**
+ * Per-pedal debounce algorithm, see Debouncer::debounce().
+ * DEBOUNCE_INTEGRATE: change state after GLITCH_SAMPLE_CNT agreeing samples.
+ * DEBOUNCE_EAGER: change state on the first differing sample, then ignore the
+ * pin for a hold-off window. Optionally reverts changes that didn't persist.
+ */
+enum DebounceMode
+{
+  DEBOUNCE_INTEGRATE = 0,
+  DEBOUNCE_EAGER = 1
+};
+
 /**
  * PEDAL MODE DESCRIPTIONS:
  * MODE_MOUSE_LEFT: left mouse button
@@ -56,6 +169,10 @@ enum TriggerDirection
  * Triggers scroll wheel up/down events depending on the vertical position of
  * the cursor. The Teensy sends one of the rarely function keys (F20) and a
  * program running on the desktop captures this keypress to control the cursor.
+ * MODE_WARP_CURSOR: Moves the cursor directly to the pedal's configured screen
+ * coordinates using an absolute pointer HID report. Replaces the F18 hotkey
+ * hack of MODE_SCROLL_BAR without needing a desktop program.
+ * MODE_NEXT_PROFILE: Switches all pedals to the next stored profile.
  */
 enum PedalMode
 {
@@ -72,7 +189,9 @@ enum PedalMode
   MODE_SCROLL_ANYWHERE = 64,
   MODE_FUNCTION = 65,
   MODE_ORBIT = 67,
-  MODE_KEYCOMBO = 68
+  MODE_KEYCOMBO = 68,
+  MODE_WARP_CURSOR = 69,
+  MODE_NEXT_PROFILE = 70
 };
 
 enum CmdCode
@@ -88,5 +207,27 @@ enum CmdCode
   CMD_RETURN_CRC = 12,
   CMD_KEEP_AWAKE_ENABLE = 13,
   CMD_KEEP_AWAKE_DISABLE = 14,
-  CMD_LOCK_PC = 15
+  CMD_LOCK_PC = 15,
+  CMD_SET_WARP_TARGET = 16,
+  CMD_GET_SAMPLER_STATS = 17,
+  CMD_GET_TELEMETRY = 18,
+  CMD_TRACE_START = 19,
+  CMD_TRACE_STOP = 20,
+  CMD_SELECT_PROFILE = 21,
+  CMD_SET_PROFILE_BUTTON = 22,
+  CMD_SET_PROFILE_RULE = 23,
+  CMD_SET_CHORD = 24,
+  CMD_GET_CONFIG = 25,
+  CMD_GET_CONFIG_HASH = 26,
+  CMD_PEDAL_EVENTS_START = 27,
+  CMD_PEDAL_EVENTS_STOP = 28,
+  CMD_SET_ANALOG_PEDAL = 29,
+  CMD_SCOPE_CAPTURE = 30,
+  CMD_SET_DEBOUNCE = 31,
+  CMD_GET_BOOT_LOG = 32,
+  CMD_GET_MEMORY_STATS = 33,
+  CMD_GET_TIME = 34,
+  CMD_SET_VELOCITY = 35,
+  CMD_RUN_BENCH = 36,
+  CMD_SET_CPU_CLOCK = 37
 };
\ No newline at end of file
@@ -0,0 +1,136 @@
+#ifndef FOOTMOUSE_CPU_CLOCK_H
+#define FOOTMOUSE_CPU_CLOCK_H
+
+#include <stdint.h>
+
+#include "telemetry.h"
+
+/**
+ * Picks the core clock from input activity. The device idles at idle_hz and
+ * runs at boost_hz from the first activity (a pedal edge, a serial byte,
+ * typing) until quiet_ms pass without any. boost_hz == 0 disables boosting.
+ *
+ * Switches only happen from tick(), on its first call in a new millisecond,
+ * and never from an interrupt since a switch waits for the PLL. Teensy's
+ * micros() interpolates the current millisecond with the cycle counter at
+ * the current clock, so a switch late in a millisecond would make it jump by
+ * up to a millisecond. Switching on the first tick() after the millisecond
+ * ticked keeps the error to the time since then, usually one loop
+ * iteration. The cost is that a boost starts up to a millisecond after the
+ * activity that asked for it; the first edge is handled at idle_hz.
+ *
+ * All times are millis(), which doesn't depend on the core clock.
+ *
+ * The Clock type must provide:
+ *   // Switch the core clock. Returns how long the switch took in us.
+ *   uint32_t set(uint32_t hz);
+ */
+class CpuClockGovernor
+{
+public:
+  uint32_t idle_hz = 0;
+  uint32_t boost_hz = 0;
+  uint32_t quiet_ms = 0;
+
+  /**
+   * The clock is at idle_hz now.
+   */
+  void begin(uint32_t idle, uint32_t boost, uint32_t quiet, uint32_t now_ms)
+  {
+    idle_hz = current_hz = idle;
+    boost_hz = boost;
+    quiet_ms = quiet;
+    since_ms = last_tick_ms = now_ms;
+  }
+
+  bool boosted() const { return is_boosted; }
+
+  /**
+   * Takes effect on the next tick().
+   */
+  void configure(uint32_t boost, uint32_t quiet)
+  {
+    boost_hz = boost;
+    quiet_ms = quiet;
+    if (!boost_hz) {
+      want_boost = false;
+    }
+  }
+
+  /**
+   * Boost and restart the quiet period.
+   */
+  void activity(uint32_t now_ms)
+  {
+    last_activity_ms = now_ms;
+    if (boost_hz) {
+      want_boost = true;
+    }
+  }
+
+  /**
+   * Call every loop iteration.
+   */
+  template<typename Clock>
+  void tick(uint32_t now_ms, Clock& clock)
+  {
+    if (want_boost && now_ms - last_activity_ms >= quiet_ms) {
+      want_boost = false;
+    }
+    if (now_ms == last_tick_ms) {
+      return;
+    }
+    last_tick_ms = now_ms;
+
+    const uint32_t hz = want_boost ? boost_hz : idle_hz;
+    if (hz != current_hz) {
+      switch_to(want_boost, hz, now_ms, clock);
+    }
+  }
+
+  /**
+   * Time at each clock since the last reset, up to now_ms.
+   */
+  ClockTelemetry stats(uint32_t now_ms) const
+  {
+    ClockTelemetry t = telemetry;
+    t.idle_hz = idle_hz;
+    t.boost_hz = boost_hz;
+    (is_boosted ? t.boost_ms : t.idle_ms) += now_ms - since_ms;
+    return t;
+  }
+
+  void reset_stats(uint32_t now_ms)
+  {
+    telemetry = ClockTelemetry();
+    since_ms = now_ms;
+  }
+
+private:
+  ClockTelemetry telemetry;
+  uint32_t since_ms = 0;
+  uint32_t last_tick_ms = 0;
+  uint32_t last_activity_ms = 0;
+  uint32_t current_hz = 0;
+  bool want_boost = false;
+  bool is_boosted = false;
+
+  template<typename Clock>
+  void switch_to(bool boost, uint32_t hz, uint32_t now_ms, Clock& clock)
+  {
+    (is_boosted ? telemetry.boost_ms : telemetry.idle_ms) += now_ms - since_ms;
+    since_ms = now_ms;
+    if (boost && !is_boosted) {
+      telemetry.boosts++;
+    }
+    is_boosted = boost;
+    current_hz = hz;
+
+    const uint32_t us = clock.set(hz);
+    if (us > telemetry.max_switch_us) {
+      telemetry.max_switch_us = us;
+    }
+  }
+};
+
+#endif // FOOTMOUSE_CPU_CLOCK_H
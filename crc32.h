@@ -15,6 +15,11 @@ namespace crc
 void
 init();
 
+/* Update a running CRC with the bytes buf[0..len-1]. Start with all 1's and
+ * complement the final value. */
+uint32_t
+update_crc(uint32_t crc, unsigned char* buf, int len);
+
 /* Return the CRC of the bytes buf[0..len-1]. */
 uint32_t
 crc32(unsigned char* buf, int len);
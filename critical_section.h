@@ -0,0 +1,42 @@
+#ifndef FOOTMOUSE_CRITICAL_SECTION_H
+#define FOOTMOUSE_CRITICAL_SECTION_H
+
+#include <stdint.h>
+
+/**
+ * Masks interrupts for the lifetime of the object and restores the previous
+ * mask, so it is safe to nest and to use inside an interrupt. Keep the
+ * guarded section to a few instructions.
+ */
+class IrqGuard
+{
+public:
+#if defined(ARDUINO)
+  IrqGuard()
+  {
+    asm volatile("mrs %0, primask" : "=r"(primask));
+    asm volatile("cpsid i" ::: "memory");
+  }
+
+  ~IrqGuard()
+  {
+    if (!primask) {
+      asm volatile("cpsie i" ::: "memory");
+    }
+  }
+#else
+  // Host builds (tests) have no interrupts to mask.
+  IrqGuard()
+    : primask(0)
+  {
+  }
+#endif
+
+  IrqGuard(const IrqGuard&) = delete;
+  IrqGuard& operator=(const IrqGuard&) = delete;
+
+private:
+  uint32_t primask;
+};
+
+#endif // FOOTMOUSE_CRITICAL_SECTION_H
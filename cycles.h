@@ -0,0 +1,54 @@
+#ifndef FOOTMOUSE_CYCLES_H
+#define FOOTMOUSE_CYCLES_H
+
+#include <stdint.h>
+
+#if defined(ARDUINO)
+#include "boards.h"
+#else
+// Host builds count nanoseconds instead, there is no portable cycle counter.
+#include <chrono>
+#endif
+
+/**
+ * CPU cycle counter for measuring short code paths. Wraps every few seconds,
+ * so only differences of nearby reads are meaningful.
+ */
+static inline void
+cycle_counter_init()
+{
+#if defined(BOARD_NRF52)
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+  // The Teensy core starts ARM_DWT_CYCCNT before setup().
+}
+
+static inline uint32_t
+cycle_count()
+{
+#if defined(BOARD_TEENSY4)
+  return ARM_DWT_CYCCNT;
+#elif defined(ARDUINO)
+  return DWT->CYCCNT;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+#endif
+}
+
+// Rate of cycle_count().
+static inline uint32_t
+cycle_counter_hz()
+{
+#if defined(BOARD_TEENSY4)
+  return F_CPU_ACTUAL;
+#elif defined(ARDUINO)
+  return SystemCoreClock;
+#else
+  return 1000000000;
+#endif
+}
+
+#endif // FOOTMOUSE_CYCLES_H
@@ -0,0 +1,454 @@
+"""
+Offline debounce evaluation: replay recorded (scope_capture.py) or synthetic
+pin traces through the firmware's debouncer (button.h, built into
+tests/debounce_replay) and report per parameter set:
+    added latency per edge, false triggers, missed edges and the highest
+    press rate that still registers every press,
+then mark the Pareto-optimal settings of each pedal model (trace file).
+
+Build the replay binary with the host tests first:
+    cmake -S . -B build && cmake --build build --target debounce_replay
+
+Usage:
+    python debounce_eval.py eval --glitch 3 --poll 80 --reset 20000 \
+        --trace bounce.csv
+    python debounce_eval.py sweep --trace yamaha_fc5.csv --bounce-us 3000
+    python debounce_eval.py sweep --algorithm eager
+    python debounce_eval.py compare --guard 1000
+"""
+import argparse
+import itertools
+import os
+import random
+import statistics
+import subprocess
+
+PEDAL_UP = 0
+PEDAL_DOWN = 1
+
+# DebounceMode in constants.h.
+DEBOUNCE_INTEGRATE = 0
+DEBOUNCE_EAGER = 1
+
+# A level must hold this long in a recorded trace to count as a real edge.
+TRUTH_SETTLE_US = 5000
+# Output edges later than this after the true edge don't count as a match.
+MATCH_WINDOW_US = 100000
+
+DEFAULT_REPLAY = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              "build", "tests", "debounce_replay")
+
+
+class Replay:
+    """
+    A debounce_replay process, see tests/debounce_replay.cpp for the
+    protocol. One process serves every simulation of a run.
+    """
+
+    def __init__(self, path: str):
+        self.proc = subprocess.Popen([path],
+                                     stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE,
+                                     text=True)
+
+    def run(self, mode: int, glitch: int, poll: int, reset: int, guard: int,
+            phase_us: int, transitions: list[tuple[float, int]],
+            end_us: float) -> list[tuple[float, int]]:
+        lines = [
+            f"{mode} {glitch} {poll} {reset} {guard} {phase_us} {end_us} "
+            f"{len(transitions)}"
+        ]
+        lines += [f"{t} {level}" for t, level in transitions]
+        self.proc.stdin.write("\n".join(lines) + "\n")
+        self.proc.stdin.flush()
+        head = self.proc.stdout.readline()
+        if not head:
+            raise RuntimeError("debounce_replay exited")
+        if head.startswith("error"):
+            raise ValueError(head[len("error"):].strip())
+        edges = []
+        for _ in range(int(head)):
+            t, state = self.proc.stdout.readline().split()
+            edges.append((float(t), int(state)))
+        return edges
+
+
+_replay = None
+
+
+def start_replay(path: str | None = None):
+    """
+    Start the replay binary: path, else $DEBOUNCE_REPLAY, else
+    DEFAULT_REPLAY.
+    """
+    global _replay
+    path = path or os.environ.get("DEBOUNCE_REPLAY", DEFAULT_REPLAY)
+    if not os.path.exists(path):
+        raise SystemExit(f"{path} not found, build the debounce_replay "
+                         "target or pass --replay.")
+    _replay = Replay(path)
+
+
+class GlitchBufferDebounce:
+    """
+    DEBOUNCE_INTEGRATE, Debouncer::debounce (button.h). reset is the lockout
+    after an accepted edge. The SWEEP values must be built into
+    tests/debounce_replay.cpp, see variants().
+    """
+
+    name = "glitch_buffer"
+    mode = DEBOUNCE_INTEGRATE
+    SWEEP = {
+        "glitch": (2, 3, 5, 10, 16, 24),
+        "poll": (20, 100, 250, 1000),
+        "reset": (0, 5000, 10000, 20000, 40000),
+    }
+
+    def __init__(self, glitch: int, poll: int, reset: int, guard: int = 0,
+                 **_):
+        self.glitch = glitch
+        self.poll_us = poll
+        self.reset_us = reset
+        self.guard_us = guard
+
+
+class EagerDebounce(GlitchBufferDebounce):
+    """
+    DEBOUNCE_EAGER, Debouncer::debounce_eager (button.h). reset is the
+    hold-off window, guard the noise guard in us (0 = off).
+    """
+
+    name = "eager"
+    mode = DEBOUNCE_EAGER
+    SWEEP = {
+        "glitch": (2, 3, 5, 10),
+        "poll": (20, 100, 1000),
+        "reset": (5000, 10000, 20000, 40000),
+        "guard": (0, 200, 1000, 3000),
+    }
+
+
+ALGORITHMS = {
+    GlitchBufferDebounce.name: GlitchBufferDebounce,
+    EagerDebounce.name: EagerDebounce,
+}
+
+
+def simulate(algo, transitions: list[tuple[float, int]], end_us: float,
+             phase_us: float = 0.0) -> list[tuple[float, int]]:
+    """
+    Sample the piecewise constant trace every poll_us and return the
+    debounced edges as (time, new state). The phase is rounded down to whole
+    microseconds, the resolution of the firmware's clock.
+    """
+    if _replay is None:
+        start_replay()
+    return _replay.run(algo.mode, algo.glitch, algo.poll_us, algo.reset_us,
+                       algo.guard_us, int(phase_us), transitions, end_us)
+
+
+def truth_edges(transitions: list[tuple[float, int]],
+                end_us: float) -> list[tuple[float, int]]:
+    """
+    Real edges of a recorded trace: a burst of transitions whose final level
+    holds for TRUTH_SETTLE_US and differs from the previous stable level.
+    The edge time is the burst's first transition.
+    """
+    edges = []
+    stable = transitions[0][1]
+    burst_start = None
+    for i, (t, level) in enumerate(transitions[1:], start=1):
+        if burst_start is None:
+            burst_start = t
+        hold_end = transitions[i + 1][0] if i + 1 < len(transitions) else end_us
+        if hold_end - t >= TRUTH_SETTLE_US:
+            if level != stable:
+                edges.append((burst_start, level))
+                stable = level
+            burst_start = None
+    return edges
+
+
+def score(truth: list[tuple[float, int]],
+          output: list[tuple[float, int]]) -> dict:
+    latencies = []
+    used = set()
+    missed = 0
+    for i, (t, level) in enumerate(truth):
+        limit = min(truth[i + 1][0] if i + 1 < len(truth) else float("inf"),
+                    t + MATCH_WINDOW_US)
+        match = next((j for j, (ot, ol) in enumerate(output)
+                      if j not in used and ol == level and t <= ot < limit),
+                     None)
+        if match is None:
+            missed += 1
+        else:
+            used.add(match)
+            latencies.append(output[match][0] - t)
+    return {
+        "latencies": latencies,
+        "missed": missed,
+        "false": len(output) - len(used),
+    }
+
+
+def mismatch_us(truth: list[tuple[float, int]],
+                output: list[tuple[float, int]], level: int,
+                end_us: float) -> float:
+    """
+    Time the debounced state disagreed with the true level. Includes the
+    latency of every edge and how long false triggers stayed latched.
+    """
+    events = sorted([(t, 0, lv) for t, lv in truth] +
+                    [(t, 1, lv) for t, lv in output])
+    state = [level, level]
+    total = 0.0
+    last = 0.0
+    for t, which, lv in events:
+        if state[0] != state[1]:
+            total += t - last
+        state[which] = lv
+        last = t
+    if state[0] != state[1]:
+        total += end_us - last
+    return total
+
+
+def bounce_burst(t: float, level: int, bounce_us: float, rng: random.Random,
+                 max_pulses: int) -> list[tuple[float, int]]:
+    """Contact bounce: alternating pulses that shrink toward the settle."""
+    out = [(t, level)]
+    pulses = rng.randint(0, max_pulses)
+    cursor = t
+    for k in range(pulses):
+        width = rng.uniform(0.05, 1.0) * bounce_us / (k + 2)
+        cursor += width
+        out.append((cursor, level ^ ((k % 2) ^ 1)))
+    if out[-1][1] != level:
+        out.append((cursor + rng.uniform(1, 20), level))
+    return out
+
+
+def synthetic_trace(press_period_us: float,
+                    presses: int,
+                    bounce_us: float,
+                    glitch_rate_hz: float = 0.0,
+                    seed: int = 1):
+    """
+    Presses with a 50% duty cycle, bounce on both edges and optional short
+    noise glitches while the pedal is held still. Returns
+    (transitions, truth edges, end time).
+    """
+    rng = random.Random(seed)
+    transitions = [(0.0, PEDAL_UP)]
+    truth = []
+    t = press_period_us
+    for _ in range(presses):
+        for level, hold in ((PEDAL_DOWN, press_period_us / 2),
+                            (PEDAL_UP, press_period_us / 2)):
+            truth.append((t, level))
+            transitions += bounce_burst(t, level, bounce_us, rng, 6)
+            # EMI glitches in the stable part.
+            if glitch_rate_hz:
+                g = t + bounce_us * 2
+                while True:
+                    g += rng.expovariate(glitch_rate_hz) * 1e6
+                    if g >= t + hold - bounce_us:
+                        break
+                    width = rng.uniform(1, 30)
+                    transitions += [(g, level ^ 1), (g + width, level)]
+            t += hold
+    transitions.sort(key=lambda x: x[0])
+    return transitions, truth, t + press_period_us
+
+
+def trace_columns(path: str):
+    """One transition list per pedal of a scope_capture.py trace."""
+    # Not at the top, synthetic runs don't need it.
+    import scope_capture
+
+    trace = scope_capture.load_trace(path)
+    end = trace["meta"]["end_us"]
+    for col, pedal in enumerate(trace["pedals"], start=1):
+        transitions = []
+        for row in trace["rows"]:
+            if not transitions or transitions[-1][1] != row[col]:
+                transitions.append((row[0], row[col]))
+        yield f"{path}:p{pedal}", transitions, end
+
+
+def max_press_rate(make_algo, bounce_us: float) -> float:
+    """Highest press rate in Hz where no press is missed or doubled."""
+    best = 0.0
+    for period_ms in (500, 300, 200, 150, 120, 100, 80, 60, 50, 40, 30, 20,
+                      15, 10):
+        transitions, truth, end = synthetic_trace(period_ms * 1000, 10,
+                                                  bounce_us)
+        result = score(truth, simulate(make_algo(), transitions, end))
+        if result["missed"] or result["false"]:
+            break
+        best = 1000 / period_ms
+    return best
+
+
+def evaluate(make_algo, inputs, bounce_us: float, phases: int = 8) -> dict:
+    """Aggregate metrics of one parameter set over all inputs."""
+    latencies, missed, false, edges, wrong = [], 0, 0, 0, 0.0
+    for _, transitions, truth, end in inputs:
+        algo = make_algo()
+        for k in range(phases):
+            # Sampling phase relative to the edges changes the latency.
+            phase = algo.poll_us * k / phases
+            output = simulate(algo, transitions, end, phase)
+            result = score(truth, output)
+            wrong += mismatch_us(truth, output, transitions[0][1],
+                                 end) / phases
+            latencies += result["latencies"]
+            missed += result["missed"]
+            false += result["false"]
+            edges += len(truth)
+    latencies.sort()
+    return {
+        "edges": edges,
+        "lat_mean_us": statistics.fmean(latencies) if latencies else 0.0,
+        "lat_p99_us": latencies[int(0.99 *
+                                    (len(latencies) - 1))] if latencies else 0.0,
+        "missed": missed,
+        "false": false,
+        "wrong_ms": wrong / 1000,
+        "max_rate_hz": max_press_rate(make_algo, bounce_us),
+    }
+
+
+def pareto(rows: list[dict]) -> list[dict]:
+    """
+    Rows not dominated on (p99 latency, false, missed, time in the wrong
+    state, -max rate).
+    """
+
+    def key(r):
+        return (r["lat_p99_us"], r["false"], r["missed"], r["wrong_ms"],
+                -r["max_rate_hz"])
+
+    front = []
+    for r in rows:
+        kr = key(r)
+        dominated = any(
+            all(a <= b for a, b in zip(key(o), kr)) and key(o) != kr
+            for o in rows)
+        if not dominated:
+            front.append(r)
+    return front
+
+
+def build_inputs(args) -> dict[str, list]:
+    """
+    Inputs by pedal model: one trace file records one model, and different
+    models bounce differently, so each gets its own Pareto front.
+    """
+    models = {}
+    for path in args.trace or []:
+        models[path] = [(name, transitions, truth_edges(transitions,
+                                                        end), end)
+                        for name, transitions, end in trace_columns(path)]
+    if args.synthetic or not models:
+        transitions, truth, end = synthetic_trace(200000, 20, args.bounce_us,
+                                                  args.glitch_rate_hz)
+        models["synthetic"] = [("synthetic", transitions, truth, end)]
+    return models
+
+
+def print_row(params: dict, result: dict, mark: str = ""):
+    guard = f"guard={params['guard']:>5}us " if "guard" in params else ""
+    print(f"{mark:1} glitch={params['glitch']:>2} poll={params['poll']:>5}us "
+          f"reset={params['reset']:>6}us {guard}| "
+          f"lat mean={result['lat_mean_us']:8.0f}us "
+          f"p99={result['lat_p99_us']:8.0f}us | "
+          f"false={result['false']:>3} missed={result['missed']:>3} "
+          f"wrong={result['wrong_ms']:7.1f}ms | "
+          f"max rate={result['max_rate_hz']:5.1f}Hz")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest="action", required=True)
+    for name in ("eval", "sweep", "compare"):
+        p = sub.add_parser(name)
+        p.add_argument("--trace", nargs="*", help="scope_capture.py traces")
+        p.add_argument("--synthetic",
+                       action="store_true",
+                       help="add a synthetic trace (default without traces)")
+        p.add_argument("--bounce-us", type=float, default=2000)
+        p.add_argument("--glitch-rate-hz", type=float, default=2.0)
+        p.add_argument("--algorithm",
+                       choices=ALGORITHMS,
+                       default=GlitchBufferDebounce.name)
+        p.add_argument("--replay",
+                       help="debounce_replay binary, default "
+                       "$DEBOUNCE_REPLAY or build/tests/debounce_replay")
+        if name != "sweep":
+            p.add_argument("--glitch", type=int, default=3)
+            p.add_argument("--poll", type=int, default=80)
+            p.add_argument("--reset", type=int, default=20000)
+            p.add_argument("--guard",
+                           type=int,
+                           default=0,
+                           help="eager noise guard in us, longer than the "
+                           "bounce to not revert real presses")
+
+    args = parser.parse_args()
+    start_replay(args.replay)
+    models = build_inputs(args)
+
+    if args.action == "compare":
+        # The current integrator against eager mode with the same glitch
+        # buffer and hold-off, without and with the noise guard.
+        params = dict(glitch=args.glitch, poll=args.poll, reset=args.reset)
+        guard = args.guard or int(args.bounce_us * 1.5)
+        for model, inputs in models.items():
+            print(f"{model}: {', '.join(i[0] for i in inputs)}")
+            for algo_cls, guard in ((GlitchBufferDebounce, None),
+                                    (EagerDebounce, 0), (EagerDebounce,
+                                                         guard)):
+                p = dict(params) if guard is None else dict(params,
+                                                            guard=guard)
+                result = evaluate(lambda: algo_cls(**p), inputs,
+                                  args.bounce_us)
+                print(f"{algo_cls.name:>13}:", end="")
+                print_row(p, result)
+        return
+
+    algo_cls = ALGORITHMS[args.algorithm]
+    if args.action == "eval":
+        grid = [dict(glitch=args.glitch,
+                     poll=args.poll,
+                     reset=args.reset,
+                     guard=args.guard)]
+        if algo_cls is GlitchBufferDebounce:
+            del grid[0]["guard"]
+    else:
+        names = list(algo_cls.SWEEP)
+        grid = [
+            dict(zip(names, values))
+            for values in itertools.product(*algo_cls.SWEEP.values())
+        ]
+
+    for model, inputs in models.items():
+        print(f"{model}: {', '.join(i[0] for i in inputs)}")
+        rows = []
+        for params in grid:
+            result = evaluate(lambda: algo_cls(**params), inputs,
+                              args.bounce_us)
+            result.update(params)
+            rows.append(result)
+
+        front = pareto(rows)
+        for r in sorted(rows, key=lambda r: r["lat_p99_us"]):
+            print_row(r, r, "*" if r in front else "")
+    if args.action == "sweep":
+        print("* = Pareto optimal (p99 latency, false, missed, wrong, "
+              "max rate)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,579 @@
+"""
+End to end latency from the first raw pin change of a pedal to the input
+event the Linux kernel timestamps when the HID report arrives.
+
+The device streams debounced pedal edges (CMD_PEDAL_EVENTS_START) stamped
+with its own micros(). CMD_GET_TIME handshakes, repeated during the run,
+map the device clock onto CLOCK_MONOTONIC: each handshake keeps the
+round trip with the smallest RTT out of a burst and assumes the reply was
+stamped halfway. A line fitted through all handshakes absorbs crystal
+drift. The evdev devices are switched to CLOCK_MONOTONIC as well.
+
+Host events between one edge and the next belong to that edge. Latency is
+measured to the first of them, grouped by pedal mode and direction.
+
+"selftest" needs no hardware: the sketch built for the host
+(tests/device_emu) answers on a pty and a uinput device injects the key
+events of its HID reports with a known delay. It fails if the measured
+medians are off by more than SELFTEST_TOLERANCE_MS from the sketch's own
+report latency plus that delay. Build the emulator with the host tests:
+    cmake -S . -B build && cmake --build build --target device_emu
+
+Usage:
+    sudo python evdev_latency.py measure [--duration 60] [--devices ...]
+    sudo python evdev_latency.py selftest [--presses 200]
+"""
+from __future__ import annotations
+
+import argparse
+import fcntl
+import os
+import random
+import select
+import statistics
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+try:
+    import serial
+except ImportError:
+    # tests/test_device_emu.py drives the emulator without pyserial.
+    serial = None
+
+import serial_commands as sc
+
+REPLY_PEDAL_EVENT_FRAME = 0xF2
+FRAME_HEADER_FMT = "<IHxx"
+PEDAL_EVENT_FMT = "<IIBBBB"
+
+SYNC_BURST = 8
+SYNC_PERIOD_S = 5.0
+# Host events this much before the mapped edge time still count, to absorb
+# clock mapping error.
+CLOCK_TOLERANCE_NS = 1_000_000
+MATCH_WINDOW_NS = 250_000_000
+
+# Teensy and Seeed USB vendor ids, as in /proc/bus/input/devices.
+VENDOR_IDS = ("16c0", "2886")
+
+# linux/input.h and linux/uinput.h.
+INPUT_EVENT_FMT = "llHHi"
+EV_SYN = 0x00
+EV_KEY = 0x01
+SYN_REPORT = 0
+EVIOCSCLOCKID = 0x400445A0
+CLOCK_MONOTONIC = 1
+UI_SET_EVBIT = 0x40045564
+UI_SET_KEYBIT = 0x40045565
+UI_DEV_SETUP = 0x405C5503
+UI_DEV_CREATE = 0x5501
+UI_DEV_DESTROY = 0x5502
+UI_GET_SYSNAME_64 = 0x8040552C
+BUS_USB = 0x03
+KEY_LEFTCTRL = 29
+KEY_LEFTSHIFT = 42
+KEY_LEFTALT = 56
+KEY_LEFTMETA = 125
+BTN_LEFT = 0x110
+BTN_RIGHT = 0x111
+BTN_MIDDLE = 0x112
+
+
+def mode_name(mode: int) -> str:
+    try:
+        return sc.modes(mode).name
+    except ValueError:
+        return f"mode {mode}"
+
+
+class Unwrapper:
+    """Extends 32-bit micros() to 64 bits, for values near the last one."""
+
+    def __init__(self):
+        self.last32 = None
+        self.last64 = 0
+
+    def __call__(self, t32: int) -> int:
+        if self.last32 is None:
+            self.last32 = self.last64 = t32
+            return t32
+        delta = ((t32 - self.last32 + (1 << 31)) & 0xFFFFFFFF) - (1 << 31)
+        value = self.last64 + delta
+        if delta > 0:
+            self.last32, self.last64 = t32, value
+        return value
+
+
+class DeviceLink:
+    """
+    v2 requests on a port that also carries pedal event notifications,
+    which read_reply() would drop.
+    """
+
+    def __init__(self, s: serial.Serial):
+        self.s = s
+        self.rx = b""
+        self.seq = 0
+        self.unwrap = Unwrapper()
+        # (edge_us, pedal, engage, mode) with 64-bit device times.
+        self.edges = []
+        self.dropped = 0
+
+    def _on_frame(self, frame: sc.ReplyFrame):
+        if not (frame.notify and frame.cmd == REPLY_PEDAL_EVENT_FRAME):
+            return
+        dropped, count = struct.unpack_from(FRAME_HEADER_FMT, frame.payload)
+        self.dropped = dropped
+        offset = struct.calcsize(FRAME_HEADER_FMT)
+        size = struct.calcsize(PEDAL_EVENT_FMT)
+        for i in range(count):
+            edge_us, t_us, pedal, _, engage, mode = struct.unpack_from(
+                PEDAL_EVENT_FMT, frame.payload, offset + i * size)
+            self.unwrap(t_us)
+            self.edges.append(
+                (self.unwrap(edge_us), pedal, bool(engage), mode))
+
+    def poll(self, timeout_s: float) -> list[sc.ReplyFrame]:
+        """Read what arrives within timeout_s, handle notifications."""
+        self.s.timeout = timeout_s
+        data = self.s.read(max(1, self.s.in_waiting))
+        frames, self.rx = sc.split_reply_frames(self.rx + data)
+        for frame in frames:
+            self._on_frame(frame)
+        return frames
+
+    def transact(self, cmd: int, payload: bytes = b"") -> sc.ReplyFrame:
+        self.seq = self.seq % 255 + 1
+        seq = self.seq
+        self.s.write(sc.get_v2_bytes(cmd, payload, seq))
+        deadline = time.monotonic() + 1
+        while time.monotonic() < deadline:
+            for frame in self.poll(0.05):
+                if not frame.notify and frame.seq == seq:
+                    if frame.status != sc.ReplyStatus.ok:
+                        raise RuntimeError(
+                            f"Command {cmd} failed: "
+                            f"{sc.ReplyStatus(frame.status).name}")
+                    return frame
+        raise TimeoutError(f"No reply to command {cmd}.")
+
+    def sync(self) -> tuple[int, int]:
+        """(host_ns, device_us) of the fastest of SYNC_BURST round trips."""
+        best = None
+        for _ in range(SYNC_BURST):
+            t0 = time.monotonic_ns()
+            reply = self.transact(sc.CMD_GET_TIME)
+            t1 = time.monotonic_ns()
+            if best is None or t1 - t0 < best[0]:
+                (device_us, ) = struct.unpack("<I", reply.payload)
+                best = (t1 - t0, (t0 + t1) // 2, self.unwrap(device_us))
+        return best[1], best[2]
+
+
+class ClockMap:
+    """Least squares fit of host_ns = a + b * device_us."""
+
+    def __init__(self, points: list[tuple[int, int]]):
+        host0, dev0 = points[0]
+        self.host0, self.dev0 = host0, dev0
+        if len(points) < 2:
+            self.ns_per_us = 1000.0
+        else:
+            xs = [d - dev0 for _, d in points]
+            ys = [h - host0 for h, _ in points]
+            mx, my = statistics.fmean(xs), statistics.fmean(ys)
+            sxx = sum((x - mx)**2 for x in xs)
+            self.ns_per_us = (sum((x - mx) * (y - my)
+                                  for x, y in zip(xs, ys)) /
+                              sxx if sxx else 1000.0)
+            self.host0 = host0 + my - self.ns_per_us * mx
+        self.residual_ns = max(
+            (abs(self(d) - h) for h, d in points), default=0)
+
+    def __call__(self, device_us: int) -> float:
+        return self.host0 + (device_us - self.dev0) * self.ns_per_us
+
+    @property
+    def drift_ppm(self) -> float:
+        """How fast the device clock runs relative to the host."""
+        return (1000 / self.ns_per_us - 1) * 1e6
+
+
+def find_input_devices() -> list[str]:
+    """Event nodes of the footmouse's HID interfaces."""
+    devices = []
+    with open("/proc/bus/input/devices") as f:
+        for block in f.read().split("\n\n"):
+            if not any(f"Vendor={v}" in block for v in VENDOR_IDS):
+                continue
+            for line in block.splitlines():
+                if line.startswith("H: Handlers="):
+                    devices += [
+                        f"/dev/input/{h}" for h in line.split("=")[1].split()
+                        if h.startswith("event")
+                    ]
+    return devices
+
+
+class EvdevReader:
+    """Key events from evdev nodes, stamped with CLOCK_MONOTONIC."""
+
+    def __init__(self, paths: list[str]):
+        self.fds = []
+        for path in paths:
+            fd = os.open(path, os.O_RDONLY | os.O_NONBLOCK)
+            fcntl.ioctl(fd, EVIOCSCLOCKID, struct.pack("i", CLOCK_MONOTONIC))
+            self.fds.append(fd)
+        self.size = struct.calcsize(INPUT_EVENT_FMT)
+        # (t_ns, code, value)
+        self.events = []
+
+    def poll(self):
+        ready, _, _ = select.select(self.fds, [], [], 0)
+        for fd in ready:
+            while True:
+                try:
+                    data = os.read(fd, self.size * 64)
+                except BlockingIOError:
+                    break
+                for off in range(0, len(data), self.size):
+                    sec, usec, type_, code, value = struct.unpack_from(
+                        INPUT_EVENT_FMT, data, off)
+                    # Value 2 is auto repeat.
+                    if type_ == EV_KEY and value in (0, 1):
+                        self.events.append(
+                            (sec * 1_000_000_000 + usec * 1000, code, value))
+
+    def close(self):
+        for fd in self.fds:
+            os.close(fd)
+
+
+def match(edges: list, host_events: list, clock: ClockMap) -> dict:
+    """{(mode name, "down"|"up"): [latency_ms, ...], "missed": {...}}"""
+    host_events = sorted(host_events)
+    mapped = sorted((clock(e[0]), *e[1:]) for e in edges)
+    results = {}
+    missed = {}
+    i = 0
+    for k, (t, _, engage, mode) in enumerate(mapped):
+        key = (mode_name(mode), "down" if engage else "up")
+        start = t - CLOCK_TOLERANCE_NS
+        end = min(t + MATCH_WINDOW_NS,
+                  mapped[k + 1][0] - CLOCK_TOLERANCE_NS
+                  if k + 1 < len(mapped) else float("inf"))
+        while i < len(host_events) and host_events[i][0] < start:
+            i += 1
+        if i < len(host_events) and host_events[i][0] < end:
+            results.setdefault(key, []).append(
+                (host_events[i][0] - t) / 1e6)
+        else:
+            missed[key] = missed.get(key, 0) + 1
+    results["missed"] = missed
+    return results
+
+
+def print_results(results: dict, clock: ClockMap):
+    print(f"device clock {clock.drift_ppm:+.1f} ppm, max handshake residual "
+          f"{clock.residual_ns / 1e3:.0f} us")
+    print(f"{'mode':<20} {'edge':<5} {'n':>5} {'p50':>8} {'p90':>8} "
+          f"{'p99':>8} {'max':>8}  (ms)")
+    for key in sorted(k for k in results if k != "missed"):
+        samples = sorted(results[key])
+        n = len(samples)
+        q = lambda p: samples[int(p * (n - 1))]
+        print(f"{key[0]:<20} {key[1]:<5} {n:>5} {q(0.5):>8.2f} "
+              f"{q(0.9):>8.2f} {q(0.99):>8.2f} {samples[-1]:>8.2f}")
+    for key, n in sorted(results["missed"].items()):
+        print(f"{key[0]:<20} {key[1]:<5} {n:>5} edges without a host event")
+
+
+def run(port: str, devices: list[str], duration_s: float) -> tuple:
+    """Collect edges and host events for duration_s. Returns the matches."""
+    reader = EvdevReader(devices)
+    with serial.Serial(port, sc.BAUD_RATE, write_timeout=1) as s:
+        link = DeviceLink(s)
+        # Pedal events only come as v2 notifications once v2 is negotiated.
+        link.transact(sc.CMD_IDENTIFY, bytes([sc.PROTOCOL_V2]))
+        link.transact(sc.CMD_PEDAL_EVENTS_START)
+        points = [link.sync()]
+        end = time.monotonic() + duration_s
+        try:
+            while time.monotonic() < end:
+                link.poll(0.01)
+                reader.poll()
+                if time.monotonic() - points[-1][0] / 1e9 > SYNC_PERIOD_S:
+                    points.append(link.sync())
+        except KeyboardInterrupt:
+            pass
+        points.append(link.sync())
+        link.transact(sc.CMD_PEDAL_EVENTS_STOP)
+        # Edges that arrive after the last host event have nothing to match.
+        reader.poll()
+    reader.close()
+
+    if link.dropped:
+        print(f"warning: device dropped {link.dropped} pedal events")
+    clock = ClockMap(points)
+    return match(link.edges, reader.events, clock), clock
+
+
+# Self test.
+
+SELFTEST_TOLERANCE_MS = 0.5
+# Host side delay from a HID report to its input events, per mode. Pedal i
+# is set to the i-th mode.
+SELFTEST_MODES = {
+    sc.modes.left: 1.0,
+    sc.modes.control_click: 2.0,
+    sc.modes.keycombo: 3.0,
+}
+# MODIFIERKEY_CTRL and KEY_S in tinyusbkeycodes.h.
+SELFTEST_KEYCOMBO = (0xE001, 0xF016)
+# The emulated device clock runs fast and starts near the 32-bit wrap.
+SELFTEST_DRIFT_PPM = 40
+SELFTEST_CLOCK_START_US = 0xFFFFFFFF - 2_000_000
+DEFAULT_DEVICE_EMU = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                  "build", "tests", "device_emu")
+
+# Report kinds of tests/device_emu, FakeReportKind in
+# tests/fakes/teensy_core.h.
+HID_REPORT_KEYBOARD = 1
+HID_REPORT_MOUSE = 2
+# HID report bits and usages to evdev codes, for what the selftest sends.
+MOUSE_BUTTON_CODES = {0x01: BTN_LEFT, 0x02: BTN_RIGHT, 0x04: BTN_MIDDLE}
+MODIFIER_CODES = {
+    0x01: KEY_LEFTCTRL,
+    0x02: KEY_LEFTSHIFT,
+    0x04: KEY_LEFTALT,
+    0x08: KEY_LEFTMETA
+}
+# Usages 0x04 to 0x1D, a to z.
+LETTER_CODES = dict(
+    zip(range(0x04, 0x1E),
+        (30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38, 50, 49, 24, 25, 16,
+         19, 31, 20, 22, 47, 17, 45, 21, 44)))
+
+
+def report_keys(kind: int, data: bytes) -> set[int] | None:
+    """evdev codes held in a HID report, None for other reports."""
+    if kind == HID_REPORT_MOUSE:
+        return {c for bit, c in MOUSE_BUTTON_CODES.items() if data[0] & bit}
+    if kind == HID_REPORT_KEYBOARD:
+        keys = {c for bit, c in MODIFIER_CODES.items() if data[0] & bit}
+        return keys | {LETTER_CODES[u] for u in data[2:] if u in LETTER_CODES}
+    return None
+
+
+class Uinput:
+    """Virtual keyboard and mouse buttons."""
+
+    def __init__(self, keys: set[int]):
+        self.fd = os.open("/dev/uinput", os.O_WRONLY | os.O_NONBLOCK)
+        fcntl.ioctl(self.fd, UI_SET_EVBIT, EV_KEY)
+        for key in keys:
+            fcntl.ioctl(self.fd, UI_SET_KEYBIT, key)
+        setup = struct.pack("<HHHH80sI", BUS_USB, 0x1209, 0x0001, 1,
+                            b"footmouse selftest", 0)
+        fcntl.ioctl(self.fd, UI_DEV_SETUP, setup)
+        fcntl.ioctl(self.fd, UI_DEV_CREATE)
+
+        sysname = fcntl.ioctl(self.fd, UI_GET_SYSNAME_64,
+                              bytes(64)).rstrip(b"\0").decode()
+        sys_dir = f"/sys/devices/virtual/input/{sysname}"
+        (event, ) = [n for n in os.listdir(sys_dir) if n.startswith("event")]
+        self.path = f"/dev/input/{event}"
+
+    def emit(self, events: list[tuple[int, int]]):
+        data = b"".join(
+            struct.pack(INPUT_EVENT_FMT, 0, 0, EV_KEY, code, value) +
+            struct.pack(INPUT_EVENT_FMT, 0, 0, EV_SYN, SYN_REPORT, 0)
+            for code, value in events)
+        os.write(self.fd, data)
+
+    def close(self):
+        fcntl.ioctl(self.fd, UI_DEV_DESTROY)
+        os.close(self.fd)
+
+
+class Emulator:
+    """
+    The sketch built for the host (tests/device_emu) behind a pty: its
+    handle_message() answers the commands and its HID reports reach output
+    as key events, SELFTEST_MODES later. Presses pedals at random.
+    """
+
+    def __init__(self, path: str, output):
+        self.proc = subprocess.Popen(
+            [path, str(SELFTEST_CLOCK_START_US),
+             str(SELFTEST_DRIFT_PPM)],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            text=True)
+        _, self.port = self.proc.stdout.readline().split()
+        self.output = output
+        self.modes = list(SELFTEST_MODES)
+        self.held = {}
+        # (pedal, engage, pin_us) of a pin change whose output hasn't been
+        # seen yet.
+        self.pending = None
+        self.delay_ms = 0.0
+        # (mode name, "down"|"up"): [ms from the pin change to the host
+        # event, per edge]
+        self.expected = {}
+
+    def transact(self, fd: int, cmd: int, payload: bytes = b"",
+                 seq: int = 1) -> sc.ReplyFrame:
+        """A v2 request on the slave side of the pty, as a host sends it."""
+        os.write(fd, sc.get_v2_bytes(cmd, payload, seq))
+        rx = b""
+        deadline = time.monotonic() + 1
+        while time.monotonic() < deadline:
+            if select.select([fd], [], [], 0.05)[0]:
+                frames, rx = sc.split_reply_frames(rx + os.read(fd, 4096))
+                for frame in frames:
+                    if not frame.notify and frame.seq == seq:
+                        if frame.status != sc.ReplyStatus.ok:
+                            raise RuntimeError(f"Command {cmd} failed.")
+                        return frame
+        raise TimeoutError(f"No reply to command {cmd}.")
+
+    def configure(self):
+        """Give pedal i the i-th mode of SELFTEST_MODES."""
+        fd = os.open(self.port, os.O_RDWR | os.O_NOCTTY)
+        try:
+            for pedal, mode in enumerate(self.modes):
+                if mode == sc.modes.keycombo:
+                    self.transact(
+                        fd, sc.CMD_SET_BUTTON_FUNCTION_EX,
+                        bytes([pedal, 0, len(SELFTEST_KEYCOMBO)]) +
+                        sc.generate_keycode_bytes(list(SELFTEST_KEYCOMBO)))
+                else:
+                    self.transact(fd, sc.CMD_SET_BUTTON_FUNCTION,
+                                  struct.pack("<BBB", pedal, mode, 0))
+        finally:
+            os.close(fd)
+
+    def serve(self):
+        """Turn the HID reports into key events until the sketch exits."""
+        for line in self.proc.stdout:
+            what, t_us, *rest = line.split()
+            if what == "pin":
+                pedal, level = map(int, rest)
+                self.pending = (pedal, level == 1, int(t_us))
+                continue
+            kind, data = int(rest[0]), bytes.fromhex(rest[1])
+            keys = report_keys(kind, data)
+            if keys is None:
+                continue
+            old = self.held.get(kind, set())
+            self.held[kind] = keys
+            events = ([(c, 0) for c in sorted(old - keys)] +
+                      [(c, 1) for c in sorted(keys - old)])
+            # Resync reports repeat the state.
+            if not events:
+                continue
+            if self.pending:
+                pedal, engage, pin_us = self.pending
+                self.pending = None
+                mode = self.modes[pedal]
+                self.delay_ms = SELFTEST_MODES[mode]
+                firmware_ms = ((int(t_us) - pin_us) & 0xFFFFFFFF) / 1000
+                key = (mode_name(mode), "down" if engage else "up")
+                self.expected.setdefault(key, []).append(firmware_ms +
+                                                         self.delay_ms)
+            time.sleep(self.delay_ms / 1000)
+            self.output.emit(events)
+
+    def set_pedal(self, pedal: int, level: int):
+        self.proc.stdin.write(f"{pedal} {level}\n")
+        self.proc.stdin.flush()
+
+    def press(self, presses: int):
+        # Holds outlast the DEBOUNCE_RESET lockout.
+        for _ in range(presses):
+            pedal = random.randrange(len(self.modes))
+            for level in (1, 0):
+                self.set_pedal(pedal, level)
+                time.sleep(random.uniform(0.03, 0.05))
+
+    def close(self):
+        self.proc.stdin.close()
+        self.proc.wait()
+
+
+def selftest(presses: int, device_emu: str) -> bool:
+    keys = (set(MOUSE_BUTTON_CODES.values()) | set(MODIFIER_CODES.values())
+            | set(LETTER_CODES.values()))
+    output = Uinput(keys)
+    # Give udev a moment to create the node.
+    time.sleep(0.5)
+
+    emulator = Emulator(device_emu, output)
+    emulator.configure()
+    threading.Thread(target=emulator.serve, daemon=True).start()
+    presser = threading.Thread(target=emulator.press,
+                               args=(presses, ),
+                               daemon=True)
+
+    result = {}
+
+    def measure():
+        result["value"] = run(emulator.port, [output.path],
+                              presses * 0.1 + 2)
+
+    measurer = threading.Thread(target=measure)
+    measurer.start()
+    time.sleep(0.5)
+    presser.start()
+    measurer.join()
+    emulator.close()
+    output.close()
+
+    results, clock = result["value"]
+    print_results(results, clock)
+    ok = bool(emulator.expected)
+    for key, expected in sorted(emulator.expected.items()):
+        samples = results.get(key)
+        expected_ms = statistics.median(expected)
+        if not samples or abs(statistics.median(samples) -
+                              expected_ms) > SELFTEST_TOLERANCE_MS:
+            print(f"FAIL {key[0]} {key[1]}: expected {expected_ms:.2f} ms")
+            ok = False
+    print("PASS" if ok else "FAIL")
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest="action", required=True)
+    msr = sub.add_parser("measure", help="measure a connected footmouse")
+    msr.add_argument("--port", help="serial device, found if omitted")
+    msr.add_argument("--devices",
+                     nargs="+",
+                     help="evdev nodes, found by USB vendor if omitted")
+    msr.add_argument("--duration", type=float, default=60)
+    tst = sub.add_parser("selftest", help="pty device and uinput host")
+    tst.add_argument("--presses", type=int, default=200)
+    tst.add_argument("--device-emu",
+                     default=DEFAULT_DEVICE_EMU,
+                     help="host build of the sketch, tests/device_emu")
+
+    args = parser.parse_args()
+    if args.action == "selftest":
+        sys.exit(0 if selftest(args.presses, args.device_emu) else 1)
+
+    port = args.port or sc.find_footmouse_com_port_name()
+    devices = args.devices or find_input_devices()
+    if not port or not devices:
+        print("No footmouse serial port or input devices found.")
+        return
+    print(f"Press pedals for {args.duration:.0f} s, Ctrl+C to stop early.")
+    print_results(*run(port, devices, args.duration))
+
+
+if __name__ == "__main__":
+    main()
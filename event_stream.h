@@ -0,0 +1,73 @@
+#ifndef FOOTMOUSE_EVENT_STREAM_H
+#define FOOTMOUSE_EVENT_STREAM_H
+
+#include <Arduino.h>
+
+#include "constants.h"
+#include "spsc_ring.h"
+#include "trace.h"
+
+/*
+ * Debounced pedal edges streamed to the host, so host tools can react to the
+ * pedals directly instead of listening for synthetic keystrokes. A pedal in
+ * MODE_NONE sends nothing over HID but still shows up here.
+ *
+ * Edges are produced by the thread that resolves pedal actions and drained by
+ * the one that owns the serial port, one producer and one consumer.
+ */
+struct __attribute__((packed)) PedalEventRecord
+{
+  uint32_t edge_us; // First raw pin change.
+  uint32_t t_us;    // Debounce accepted the edge.
+  uint8_t pedal;
+  uint8_t state; // Debounced pin level.
+  uint8_t engage;
+  uint8_t mode;
+};
+
+static_assert(sizeof(PedalEventRecord) == 12, "");
+
+SpscRing<PedalEventRecord, PEDAL_NOTIFY_RING_LEN> g_pedal_notify_ring;
+volatile bool g_pedal_notify_enabled = false;
+
+static inline void
+pedal_notify(uint8_t pedal, int state, bool engage, int mode, uint32_t edge_us)
+{
+  if (!g_pedal_notify_enabled) {
+    return;
+  }
+
+  g_pedal_notify_ring.push({ edge_us,
+                             static_cast<uint32_t>(micros()),
+                             pedal,
+                             static_cast<uint8_t>(state),
+                             engage,
+                             static_cast<uint8_t>(mode) });
+}
+
+void
+pedal_events_start()
+{
+  g_pedal_notify_ring.dropped = 0;
+  g_pedal_notify_enabled = true;
+}
+
+void
+pedal_events_stop()
+{
+  g_pedal_notify_enabled = false;
+}
+
+/**
+ * Edges are latency sensitive, send them as soon as the port has room.
+ */
+void
+service_pedal_events()
+{
+  if (!g_pedal_notify_ring.empty()) {
+    send_ring_frame(
+      REPLY_PEDAL_EVENT_FRAME, g_pedal_notify_ring, PEDAL_NOTIFY_FRAME_RECORDS);
+  }
+}
+
+#endif // FOOTMOUSE_EVENT_STREAM_H
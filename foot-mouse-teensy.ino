@@ -41,7 +41,6 @@ resistor
 #define BOARD_TEENSY_4_3_BUTTONS
 // Alternate definers for Teensyduino:  || defined(ARDUINO_TEENSY40) ||
 // defined(__IMXRT1062__) Note that NRF and ESP boards do not have EEPROM.
-#include "persistent_storage.h"
 #include <EEPROM.h>
 #include <Keyboard.h>
 #include <Mouse.h>
@@ -57,25 +56,47 @@ The adafruit tinyusb library does not support the nRF52 core. */
 #include "tinyusbhidshim.h"
 HIDCompat::KeyboardTinyUsbShim Keyboard;
 HIDCompat::MouseTinyUsbShim Mouse;
+HIDCompat::AbsPointerTinyUsbShim AbsPointer;
 
 #else
 #error "No HID implementation configured for this board."
 #endif
 
 // TODO: fix include orders
+#include "abs_pointer.h"
+#include "analog_pedal.h"
 #include "arduino_secrets.h"
+#include "bench.h"
+#include "boot_log.h"
 #include "button.h"
+#include "chord.h"
+#include "config_snapshot.h"
 #include "constants.h"
+#include "cpu_clock.h"
+#include "cycles.h"
+#include "event_stream.h"
+#include "hid_state.h"
+#include "jitter_stats.h"
+#include "log.h"
+#include "memory_stats.h"
+#include "pedal_event.h"
+#include "persistent_storage.h"
+#include "pin_table.h"
+#include "scope_capture.h"
 #include "serial-msg-parsing.h"
+#include "spsc_ring.h"
+#include "telemetry.h"
 #include "timer.h"
+#include "trace.h"
+#include "velocity.h"
 
 // Add temporarily to your sketch to see which macros are defined.
 // #include "test-keycodes-serial-api.h"
 
-// FUTURE: Since pedals are detected at startup, I might want to provide a map
-// to determine what preset config the pedals are in depending on which pedals
-// are connected. This allows me to have say: Sheet music page turning mode if 1
-// & 3 connected. Or some other preset if only 2 & 3 are connected.
+// Pedal modes are stored as profiles. Since pedals are detected at startup,
+// profile rules map the set of connected pedals to a profile. This allows me to
+// have say: Sheet music page turning mode if 1 & 3 connected. Or some other
+// preset if only 2 & 3 are connected. See MemoryView::select_profile().
 
 ////////////////////////////////////////////////////////////////
 //                      DEFAULT BUTTONS                       //
@@ -84,23 +105,27 @@ HIDCompat::MouseTinyUsbShim Mouse;
 
 #if defined(BOARD_TEENSY_4_3_BUTTONS)
 std::array<Button, 3> buttons{
-  Button(4, MODE_MOUSE_LEFT, UP_CLICK),
-  Button(5, MODE_MOUSE_MIDDLE, DOWN_CLICK),
-  Button(6, MODE_MOUSE_RIGHT_QUICK_FIRE, DOWN_CLICK)
+  Button(PEDAL_PINS[0], MODE_MOUSE_LEFT, UP_CLICK),
+  Button(PEDAL_PINS[1], MODE_MOUSE_MIDDLE, DOWN_CLICK),
+  Button(PEDAL_PINS[2], MODE_MOUSE_RIGHT_QUICK_FIRE, DOWN_CLICK)
 };
 
 #elif defined(BOARD_NRF52840_SEEDSTUDIO_4_BUTTONS)
 std::array<Button, 4> buttons{
-  Button(D6, MODE_MOUSE_LEFT, UP_CLICK),                // J1 Tip
-  Button(D7, MODE_MOUSE_MIDDLE, DOWN_CLICK),            // J2 Ring
-  Button(D10, MODE_MOUSE_RIGHT_QUICK_FIRE, DOWN_CLICK), // J2 Tip
-  Button(D3, MODE_ORBIT, DOWN_CLICK)                    // J1 Ring
+  Button(PEDAL_PINS[0], MODE_MOUSE_LEFT, UP_CLICK),             // J1 Tip
+  Button(PEDAL_PINS[1], MODE_MOUSE_MIDDLE, DOWN_CLICK),         // J2 Ring
+  Button(PEDAL_PINS[2], MODE_MOUSE_RIGHT_QUICK_FIRE, DOWN_CLICK), // J2 Tip
+  Button(PEDAL_PINS[3], MODE_ORBIT, DOWN_CLICK)                 // J1 Ring
 };
 
 // Pins are pulled high. Tie J2R to gnd to engage.
 const std::array<int, sizeof(buttons)> g_special_pin_config{ 1, 0, 1, 1 };
 #endif
 
+// The samplers read pedal i from bit i of read_pedal_levels().
+static_assert(std::size(buttons) == PEDAL_PIN_COUNT,
+              "PEDAL_PINS must list every button's pin.");
+
 ////////////////////////////////////////////////////////////////
 //                     GLOBAL VARIABLES                       //
 ////////////////////////////////////////////////////////////////
@@ -108,6 +133,32 @@ const std::array<int, sizeof(buttons)> g_special_pin_config{ 1, 0, 1, 1 };
 // Holds persistent settings.
 MemoryView<std::size(buttons)> memview;
 
+// Profile in memview.profiles the buttons are currently configured from.
+uint8_t g_active_profile = 0;
+
+// Multi-pedal chords, configured over serial.
+ChordEngine<std::size(buttons)> g_chords;
+
+// Two-contact pedals timed for press velocity, configured over serial.
+VelocityEngine g_velocity;
+
+// Expression pedal pipeline of each jack, inactive unless configured.
+std::array<AnalogPedal, std::size(buttons)> g_analog_pedals;
+
+// Raw pin capture buffer for CMD_SCOPE_CAPTURE.
+ScopeCapture g_scope;
+
+// Cost of reading all pedals, measured at startup.
+PinReadCycles g_pin_read_cycles;
+
+// When each startup phase was reached, for CMD_GET_BOOT_LOG.
+BootLog g_boot_log;
+
+#if defined(BITLOCKER_RECOVERY_MODE_FOR_NRF)
+// Set at boot when the pins match g_special_pin_config.
+bool g_bitlocker_pending = false;
+#endif
+
 // Serial COM port command buffer.
 std::array<uint8_t, STRING_BUFFER_SIZE> g_payload_buf;
 
@@ -119,6 +170,160 @@ auto keep_awake_timer = Timer();
 // Used to re-enable keep awake.
 bool reenable_keep_awake_on_pedal = false;
 
+// Longest main loop iteration.
+uint32_t g_max_loop_us = 0;
+
+// Recent main loop iterations, for BENCH_LOOP.
+LoopCycleLog g_loop_cycles;
+
+// Pressed keys and mouse buttons. Actions edit g_hid.state, hid_commit()
+// sends it.
+HidStateModel g_hid;
+
+#if !defined(COMPILE_TINY_USB_HID_SHIM)
+// Non-zero once the host configured the device. From the Teensy core.
+extern "C" volatile uint8_t usb_configuration;
+#endif
+
+/**
+ * Hands g_hid's reports to the board's HID stack.
+ */
+struct HidSink
+{
+#if defined(COMPILE_TINY_USB_HID_SHIM)
+  bool ready()
+  {
+    return TinyUSBDevice.mounted() && !TinyUSBDevice.suspended();
+  }
+
+  bool send_keyboard(uint8_t modifiers, const uint8_t* keys)
+  {
+    return Keyboard.send_state(modifiers, keys);
+  }
+
+  bool send_mouse_buttons(uint8_t buttons)
+  {
+    return Mouse.set_buttons(buttons);
+  }
+#else
+  bool ready() { return usb_configuration != 0; }
+
+  // Keyboard.send_now() and Mouse.set_buttons() drop the result of the core
+  // calls below, which return -1 when the host didn't take the report in
+  // time.
+  bool send_keyboard(uint8_t modifiers, const uint8_t* keys)
+  {
+    Keyboard.set_modifier(modifiers);
+    Keyboard.set_key1(keys[0]);
+    Keyboard.set_key2(keys[1]);
+    Keyboard.set_key3(keys[2]);
+    Keyboard.set_key4(keys[3]);
+    Keyboard.set_key5(keys[4]);
+    Keyboard.set_key6(keys[5]);
+    return usb_keyboard_send() >= 0;
+  }
+
+  bool send_mouse_buttons(uint8_t buttons)
+  {
+    return usb_mouse_buttons((buttons & MOUSE_LEFT) != 0,
+                             (buttons & MOUSE_MIDDLE) != 0,
+                             (buttons & MOUSE_RIGHT) != 0,
+                             0,
+                             0) >= 0;
+  }
+#endif
+};
+
+HidSink g_hid_sink;
+
+// Worst case time from an accepted edge until its action starts.
+volatile uint32_t g_max_input_latency_us = 0;
+
+// The Arduino IDE generates these, the host test build doesn't.
+void
+cpu_activity();
+void
+send_input(int mode, bool engage, Button& btn);
+void
+send_memory_stats();
+void
+run_benchmarks();
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+void
+start_tasks();
+#endif
+
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+// Held while touching HID state or button configuration so serial commands
+// don't interleave with pedal actions. Never held while a task blocks, see
+// StateUnlock. The input task doesn't use it for the digital pedals.
+SemaphoreHandle_t g_state_mutex;
+
+// The input task's own debounce state, see start_tasks().
+std::array<Debouncer, std::size(buttons)> g_input_debouncers;
+// Bumped when the telemetry is reset, see DebounceMailbox.
+uint32_t g_debounce_counter_resets = 0;
+#endif
+
+/**
+ * Gives up g_state_mutex for the lifetime of the object if the calling task
+ * holds it, so a task waiting on time or the HID endpoint doesn't hold up
+ * the others. Shared state may change meanwhile. Does nothing without the
+ * task split.
+ */
+class StateUnlock
+{
+public:
+  StateUnlock()
+  {
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+    held = g_state_mutex && xSemaphoreGetMutexHolder(g_state_mutex) ==
+                              xTaskGetCurrentTaskHandle();
+    if (held) {
+      xSemaphoreGive(g_state_mutex);
+    }
+#endif
+  }
+
+  ~StateUnlock()
+  {
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+    if (held) {
+      xSemaphoreTake(g_state_mutex, portMAX_DELAY);
+    }
+#endif
+  }
+
+  StateUnlock(const StateUnlock&) = delete;
+  StateUnlock& operator=(const StateUnlock&) = delete;
+
+private:
+  bool held = false;
+};
+
+/**
+ * Wait between the steps of an action.
+ */
+void
+action_delay(uint32_t ms)
+{
+  StateUnlock unlock;
+  delay(ms);
+}
+
+/**
+ * The debounce state that samples pedal i.
+ */
+const Debouncer&
+pedal_debouncer(size_t i)
+{
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+  return g_input_debouncers[i];
+#else
+  return buttons[i];
+#endif
+}
+
 /**
  * Copy the contents of source null terminated
  * string into destination.
@@ -164,100 +369,903 @@ valid_button_parameters(const int pedal_index,
   return true;
 }
 
+/**
+ * Send g_hid.state if it changed. Runs once per tick, and between the steps
+ * of actions whose intermediate state must reach the host.
+ */
+void
+hid_commit()
+{
+  g_hid.commit(g_hid_sink, millis());
+  if (g_hid_sink.ready()) {
+    g_boot_log.mark(BOOT_USB_READY, micros());
+  }
+}
+
+// Keys outside the keyboard report, e.g. media keys, go to the HID stack
+// directly.
+void
+hid_press(uint16_t k)
+{
+  if (!g_hid.state.press(k)) {
+    Keyboard.press(k);
+  }
+}
+
+void
+hid_release(uint16_t k)
+{
+  if (!g_hid.state.release(k)) {
+    Keyboard.release(k);
+  }
+}
+
+void
+hid_click(uint8_t buttons)
+{
+  g_hid.state.press_buttons(buttons);
+  hid_commit();
+  g_hid.state.release_buttons(buttons);
+  hid_commit();
+}
+
 void
 type_string(const char* text)
 {
+  cpu_activity();
   for (int i = 0; i < STRING_BUFFER_SIZE; i++) {
     const char c = text[i];
     if ('\0' != c) {
+#if defined(USING_TINY_USB)
+      {
+        // Wait for the host unlocked. At most one more character stays
+        // queued, so a pedal's report isn't stuck behind the whole string.
+        StateUnlock unlock;
+        HIDCompat::wait_for_queue_space(HIDCompat::HID_TX_QUEUE_SIZE - 2);
+      }
+#endif
       Keyboard.write(c);
     } else {
       break;
     }
   }
+  // Typing writes keyboard reports around g_hid.
+  g_hid.request_resync();
+  // The quiet period starts when typing ends.
+  cpu_activity();
 }
 
 void
 fire_macro(const uint16_t* keycodes, const size_t count)
 {
+  cpu_activity();
   for (size_t i = 0; i < count; i++) {
-    Keyboard.press(keycodes[i]);
+    hid_press(keycodes[i]);
   }
+  hid_commit();
 
-  delay(1);
+  action_delay(1);
 
   for (size_t i = 0; i < count; i++) {
-    Keyboard.release(keycodes[i]);
+    hid_release(keycodes[i]);
   }
 }
 
 /**
- * Decode and handle the message.
+ * Feed one sample to btn, the debounce state of pedal i. Returns true if the
+ * debounced state changed.
+ */
+bool
+sample_button(size_t i, Debouncer& btn, int level, unsigned long now)
+{
+  const bool was_pending = btn.edge_pending;
+
+  if (btn.debounce(level, now)) {
+    // An eager pedal accepts the first sample that differs, so its edge is
+    // never pending. A noise guard revert moves last_change_time back and
+    // isn't a new edge.
+    if (btn.debounce_mode == DEBOUNCE_EAGER && btn.last_change_time == now) {
+      trace(TRACE_PIN_EDGE, i, level);
+    }
+    trace(TRACE_DEBOUNCE_ACCEPT, i, btn.state);
+    return true;
+  }
+
+  if (!was_pending && btn.edge_pending) {
+    trace(TRACE_PIN_EDGE, i, level);
+  }
+  return false;
+}
+
+#if defined(ENABLE_TEENSY_ISR_SAMPLER)
+IntervalTimer sample_timer;
+
+// Debounced edges from the sampling interrupt to the main loop.
+SpscRing<PedalEvent, PEDAL_EVENT_RING_LEN> g_pedal_events;
+
+// Sample interval and interrupt run time statistics, updated by the
+// interrupt.
+JitterStats g_sampler_jitter;
+JitterStats g_sampler_busy;
+uint32_t g_last_sample_cycles = 0;
+uint32_t g_last_sample_us = 0;
+
+/**
+ * Runs every POLL_PERIOD_US. Reads and debounces all pedals.
+ */
+void
+sample_isr()
+{
+  const uint32_t cycles = ARM_DWT_CYCCNT;
+  if (g_last_sample_cycles != 0) {
+    g_sampler_jitter.add(cycles - g_last_sample_cycles);
+  }
+  g_last_sample_cycles = cycles;
+
+  // micros() can step back a little right after a clock switch, see
+  // cpu_clock.h. Debounce windows may stretch but never shrink. The first
+  // sample has nothing to compare with, micros() may be past 2^31 by then.
+  uint32_t now = micros();
+  if (g_last_sample_us != 0 &&
+      static_cast<int32_t>(now - g_last_sample_us) < 0) {
+    now = g_last_sample_us;
+  }
+  g_last_sample_us = now;
+
+  const uint32_t levels = read_pedal_levels();
+  for (size_t i = 0; i < buttons.size(); i++) {
+    auto& btn = buttons[i];
+    if (sample_button(i, btn, (levels >> i) & 1, now)) {
+      g_pedal_events.push(PedalEvent{ static_cast<uint8_t>(i),
+                                      static_cast<uint8_t>(btn.state),
+                                      static_cast<uint32_t>(now),
+                                      static_cast<uint32_t>(btn.edge_time) });
+    }
+  }
+
+  // Misses the interrupt entry and exit, a few dozen cycles.
+  g_sampler_busy.add(ARM_DWT_CYCCNT - cycles);
+}
+
+void
+start_sampler()
+{
+  sample_timer.priority(SAMPLER_ISR_PRIORITY);
+  sample_timer.begin(sample_isr, POLL_PERIOD_US);
+}
+
+// Call with interrupts disabled.
+void
+reset_sampler_jitter()
+{
+  g_sampler_jitter.reset();
+  g_sampler_busy.reset();
+  g_last_sample_cycles = 0;
+}
+
+struct __attribute__((packed)) SamplerStatsReply
+{
+  uint32_t cpu_hz;
+  uint32_t period_us;
+  uint32_t dropped_events;
+  JitterStats jitter;
+  PinReadCycles pin_read;
+  JitterStats busy; // Run time of the interrupt in cycles.
+};
+
+/**
+ * Reply with the sample interval statistics and optionally reset them. A clock
+ * switch resets them as well, so they always cover a single cpu_hz.
+ */
+void
+send_sampler_stats(bool reset)
+{
+  SamplerStatsReply reply;
+  reply.cpu_hz = cycle_counter_hz();
+  reply.period_us = POLL_PERIOD_US;
+  reply.dropped_events = g_pedal_events.dropped;
+  reply.pin_read = g_pin_read_cycles;
+
+  noInterrupts();
+  reply.jitter = g_sampler_jitter;
+  reply.busy = g_sampler_busy;
+  if (reset) {
+    reset_sampler_jitter();
+  }
+  interrupts();
+
+  send_binary_reply(CMD_GET_SAMPLER_STATS, &reply, sizeof(reply));
+}
+#endif // ENABLE_TEENSY_ISR_SAMPLER
+
+#if defined(ENABLE_TEENSY_CLOCK_SCALING)
+extern "C" uint32_t
+set_arm_clock(uint32_t frequency);
+
+/**
+ * Switches the Teensy 4 core clock for g_cpu_clock. The pedal sampler's
+ * IntervalTimer, millis() and USB run from clocks of their own, so sampling
+ * and host polling carry on through the switch.
+ */
+struct ArmClock
+{
+  uint32_t set(uint32_t hz)
+  {
+    const uint32_t start_us = micros();
+    set_arm_clock(hz);
+    const uint32_t us = micros() - start_us;
+
+#if defined(ENABLE_TEENSY_ISR_SAMPLER)
+    // Intervals are counted in cycles of the old clock.
+    noInterrupts();
+    reset_sampler_jitter();
+    interrupts();
+#endif
+    return us;
+  }
+};
+
+ArmClock g_arm_clock;
+CpuClockGovernor g_cpu_clock;
+#endif // ENABLE_TEENSY_CLOCK_SCALING
+
+/**
+ * Input activity: boost the core clock where supported.
+ */
+void
+cpu_activity()
+{
+#if defined(ENABLE_TEENSY_CLOCK_SCALING)
+  g_cpu_clock.activity(millis());
+#endif
+}
+
+/**
+ * True for modes that keep keys or buttons pressed while the pedal is
+ * engaged and release them on disengage.
+ */
+bool
+mode_holds_output(int mode)
+{
+  switch (mode) {
+    case MODE_MOUSE_LEFT:
+    case MODE_MOUSE_MIDDLE:
+    case MODE_MOUSE_RIGHT:
+    case MODE_CTRL_CLICK:
+    case MODE_SHIFT_CLICK:
+    case MODE_SHIFT_MIDDLE_CLICK:
+    case MODE_SCROLL_ANYWHERE:
+    case MODE_ORBIT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * Switch all pedals to a stored profile. Only RAM is touched, storage is not
+ * rewritten.
+ *
+ * A pedal held down across the switch releases with its new mode, so the
+ * output of its old mode is released here or it would stay stuck.
+ */
+void
+apply_profile(uint8_t profile)
+{
+  if (profile >= PROFILE_COUNT) {
+    return;
+  }
+
+  const auto& config = memview.profiles[profile];
+  for (size_t i = 0; i < buttons.size(); i++) {
+    auto& btn = buttons[i];
+    const bool custom = config[i].mode > 0;
+    const int mode = custom ? config[i].mode : btn.default_mode;
+    const int direction =
+      custom ? config[i].trig_direction : btn.default_inverted;
+
+    // An analog pedal's digital level doesn't say whether it is engaged.
+    if (mode != btn.mode && btn.enabled && !g_analog_pedals[i].active() &&
+        btn.should_engage() && mode_holds_output(btn.mode)) {
+      send_input(btn.mode, false, btn);
+    }
+    btn.set_mode(mode, direction);
+  }
+  g_active_profile = profile;
+}
+
+/**
+ * Sink that writes the snapshot body into the current reply.
+ */
+struct ConfigReplySink
+{
+  void write(const void* data, size_t len) { reply_write(data, len); }
+};
+
+/**
+ * Serialize the live and persisted configuration, see config_snapshot.h.
+ */
+template<typename Sink>
+void
+write_config_body(Sink& out)
+{
+  const ConfigGlobals globals{ g_active_profile,
+                               memview.default_profile,
+                               keep_awake_timer.is_enabled(),
+                               0 };
+  out.write(&globals, sizeof(globals));
+
+  for (const auto& btn : buttons) {
+    const uint8_t n =
+      btn.nKeycodes < btn.keycodes.size() ? btn.nKeycodes : btn.keycodes.size();
+    const ConfigPedal pedal{ static_cast<uint8_t>(btn.mode),
+                             static_cast<uint8_t>(btn.trigger_direction),
+                             btn.enabled,
+                             n,
+                             btn.warp_x,
+                             btn.warp_y };
+    out.write(&pedal, sizeof(pedal));
+    out.write(btn.keycodes.data(), n * sizeof(uint16_t));
+  }
+
+  out.write(&memview.profiles, sizeof(memview.profiles));
+  out.write(&memview.rules, sizeof(memview.rules));
+
+  for (const auto& c : g_chords.chords) {
+    ConfigChord chord{ c.pedal_mask, c.window_ms, c.nKeycodes, { 0 } };
+    memcpy(chord.keycodes, c.keycodes, sizeof(chord.keycodes));
+    out.write(&chord, sizeof(chord));
+  }
+}
+
+/**
+ * Reply with the configuration snapshot or, if hash_only, just its hash.
+ */
+void
+send_config(bool hash_only)
+{
+  ConfigHashSink hasher;
+  write_config_body(hasher);
+
+  if (hash_only) {
+    const uint32_t hash = hasher.hash();
+    send_binary_reply(CMD_GET_CONFIG_HASH, &hash, sizeof(hash));
+    return;
+  }
+
+  ConfigHeader header;
+  header.pedal_count = buttons.size();
+  header.profile_count = PROFILE_COUNT;
+  header.rule_count = PROFILE_RULE_COUNT;
+  header.chord_count = CHORD_COUNT;
+  header.chord_keycode_count = MAX_CHORD_KEYCODE_COUNT;
+  header.body_length = hasher.length;
+  header.hash = hasher.hash();
+
+  ConfigReplySink sink;
+  reply_begin(CMD_GET_CONFIG, sizeof(header) + hasher.length);
+  reply_write(&header, sizeof(header));
+  write_config_body(sink);
+  reply_end();
+}
+
+/**
+ * Reply with the telemetry snapshot: a TelemetryHeader followed by one
+ * PedalTelemetry per pedal. Optionally reset all counters afterwards.
  */
 void
+send_telemetry(bool reset)
+{
+  TelemetryHeader header;
+  header.pedal_count = buttons.size();
+  header.uptime_ms = millis();
+  header.max_loop_us = g_max_loop_us;
+  header.max_input_latency_us = g_max_input_latency_us;
+
+#if defined(USING_TINY_USB)
+  auto hid_stats = HIDCompat::get_tx_queue_stats();
+  header.hid_dropped = hid_stats.dropped;
+  header.hid_send_failures = hid_stats.send_failures;
+  header.hid_coalesced = hid_stats.coalesced;
+#else
+  header.hid_send_failures = g_hid.stats.send_failures;
+#endif
+#if defined(ENABLE_TEENSY_CLOCK_SCALING)
+  header.clock = g_cpu_clock.stats(millis());
+#endif
+
+  reply_begin(CMD_GET_TELEMETRY,
+              sizeof(header) + buttons.size() * sizeof(PedalTelemetry));
+  reply_write(&header, sizeof(header));
+  for (size_t i = 0; i < buttons.size(); i++) {
+    PedalTelemetry telemetry = buttons[i].telemetry;
+    const Debouncer& debouncer = pedal_debouncer(i);
+    telemetry.rejected_glitches = debouncer.rejected_glitches;
+    telemetry.lockout_hits = debouncer.lockout_hits;
+    reply_write(&telemetry, sizeof(telemetry));
+  }
+  reply_end();
+
+  if (reset) {
+    // The sampler updates the debounce counters from its interrupt.
+    noInterrupts();
+    for (auto& btn : buttons) {
+      btn.telemetry = PedalTelemetry();
+      btn.rejected_glitches = 0;
+      btn.lockout_hits = 0;
+    }
+    g_max_loop_us = 0;
+    g_max_input_latency_us = 0;
+    interrupts();
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+    // The input task clears its own with the next settings it takes.
+    g_debounce_counter_resets++;
+#endif
+#if !defined(USING_TINY_USB)
+    g_hid.stats.send_failures = 0;
+#endif
+#if defined(ENABLE_TEENSY_CLOCK_SCALING)
+    g_cpu_clock.reset_stats(millis());
+#endif
+  }
+}
+
+/**
+ * Move the cursor to a screen fraction with an absolute pointer report.
+ */
+void
+warp_cursor(uint16_t x, uint16_t y)
+{
+#if defined(COMPILE_TINY_USB_HID_SHIM)
+  AbsPointer.moveTo(x, y);
+#else
+  Mouse.moveTo(abs_fraction_to_teensy_grid(x), abs_fraction_to_teensy_grid(y));
+#endif
+}
+
+/**
+ * Feed the ADC into the active analog pedals.
+ */
+void
+sample_analog_pedals()
+{
+  for (size_t i = 0; i < buttons.size(); i++) {
+    auto& ap = g_analog_pedals[i];
+    if (ap.active()) {
+      ap.add_sample(analogRead(buttons[i].pin));
+    }
+  }
+}
+
+static int8_t
+clamp_int8(int16_t v)
+{
+  return v > 127 ? 127 : (v < -127 ? -127 : v);
+}
+
+/**
+ * Turn analog pedal positions into HID output every ANALOG_OUTPUT_PERIOD_US.
+ */
+void
+service_analog_pedals(uint32_t now_us)
+{
+  static uint32_t last_us = 0;
+  uint32_t dt = now_us - last_us;
+  if (dt < ANALOG_OUTPUT_PERIOD_US) {
+    return;
+  }
+  last_us = now_us;
+  // Don't dump a burst of steps after a stall.
+  if (dt > 4 * ANALOG_OUTPUT_PERIOD_US) {
+    dt = ANALOG_OUTPUT_PERIOD_US;
+  }
+
+  int16_t dx = 0, dy = 0, wheel = 0;
+  for (size_t i = 0; i < buttons.size(); i++) {
+    auto& ap = g_analog_pedals[i];
+    if (!ap.active() || !buttons[i].enabled) {
+      continue;
+    }
+
+    const int16_t out = ap.output();
+    switch (ap.config.target) {
+      case ANALOG_TARGET_SCROLL:
+        wheel += ap.rate.take(out, dt);
+        break;
+      case ANALOG_TARGET_POINTER_X:
+        dx += ap.rate.take(out, dt);
+        break;
+      case ANALOG_TARGET_POINTER_Y:
+        dy += ap.rate.take(out, dt);
+        break;
+#if defined(JOYSTICK_INTERFACE)
+      // Teensy joystick axes take 0 to 1023.
+      case ANALOG_TARGET_JOYSTICK_X:
+      case ANALOG_TARGET_JOYSTICK_Y:
+      case ANALOG_TARGET_JOYSTICK_Z: {
+        if (out == ap.last_output) {
+          break;
+        }
+        const unsigned int axis = out < 0 ? 0 : (out > 1023 ? 1023 : out);
+        if (ap.config.target == ANALOG_TARGET_JOYSTICK_X) {
+          Joystick.X(axis);
+        } else if (ap.config.target == ANALOG_TARGET_JOYSTICK_Y) {
+          Joystick.Y(axis);
+        } else {
+          Joystick.Z(axis);
+        }
+      } break;
+#endif
+    }
+    ap.last_output = out;
+  }
+
+  if (dx || dy || wheel) {
+    Mouse.move(clamp_int8(dx), clamp_int8(dy), clamp_int8(wheel));
+  }
+}
+
+/**
+ * Capture the raw levels of the pedals in pedal_mask, see scope_capture.h.
+ */
+uint8_t
+run_scope_capture(uint32_t cmd, uint8_t pedal_mask, uint16_t timeout_ms)
+{
+  pedal_mask &= (1 << buttons.size()) - 1;
+  if (!pedal_mask) {
+    return STATUS_BAD_PARAM;
+  }
+
+  uint8_t pin_count = 0;
+  for (size_t i = 0; i < buttons.size(); i++) {
+    if (pedal_mask & (1 << i)) {
+      pin_count++;
+    }
+  }
+
+  // Pack the selected pedals' levels into the low bits.
+  auto read = [&]() -> uint8_t {
+    const uint32_t levels = read_pedal_levels();
+    uint8_t v = 0;
+    uint8_t k = 0;
+    for (size_t i = 0; i < buttons.size(); i++) {
+      if (pedal_mask & (1 << i)) {
+        v |= ((levels >> i) & 1) << k++;
+      }
+    }
+    return v;
+  };
+
+  // Spins until a pin changes, for up to the timeout, then streams the
+  // capture. Neither touches shared state.
+  StateUnlock unlock;
+  const bool triggered =
+    g_scope.capture(pin_count, timeout_ms ? timeout_ms : 5000, read);
+  g_scope.send(cmd, pedal_mask, triggered);
+  return STATUS_OK;
+}
+
+/**
+ * Decode and handle the message.
+ * Returns a ReplyStatus, sent back to the host in protocol v2.
+ */
+uint8_t
 handle_message(SerialMsgHeader* header, uint8_t* payload)
 {
+  uint8_t status = STATUS_OK;
+
+  trace(TRACE_CMD_RECEIVED, TRACE_NO_PEDAL, header->cmd);
+
   switch (header->cmd) {
     // Return an identifier code to confirm this is the board I
     // want to send serial commands to.
+    // A v2 request carries the highest protocol version the host speaks and
+    // the reply appends the version both will use from now on.
     case CMD_IDENTIFY:
-      Serial.print(DEVICE_ID_RESPONSE);
+      if (g_request.version == PROTOCOL_V2) {
+        const uint8_t requested = header->length ? payload[0] : PROTOCOL_V2;
+        g_protocol_version =
+          requested < PROTOCOL_MAX_VERSION ? requested : PROTOCOL_MAX_VERSION;
+
+        const size_t id_len = strlen(DEVICE_ID_RESPONSE);
+        reply_begin(header->cmd, id_len + 1);
+        reply_write(DEVICE_ID_RESPONSE, id_len);
+        reply_write(&g_protocol_version, 1);
+        reply_end();
+      } else {
+        // A v1 host, e.g. an older script after a v2 one, can't parse v2
+        // notifications.
+        g_protocol_version = PROTOCOL_V1;
+        Serial.print(DEVICE_ID_RESPONSE);
+      }
       break;
 
     // Reset all buttons to defaults.
     case CMD_RESET_BUTTONS_TO_DEFAULT:
-      // Lets go of all keys currently pressed. See Keyboard.press().
-      Keyboard.releaseAll();
+      // Lets go of all keys and mouse buttons currently pressed.
+      g_hid.state.release_all();
       invalidate_memory();
+      memset(&memview, 0, sizeof(memview));
+      g_active_profile = 0;
       for (auto& b : buttons) {
         b.reset_to_defaults();
       }
       break;
 
-    // Send hardware character keystrokes to computer.
-    case CMD_SEND_ASCII_KEYS:
-      type_string((const char*)payload);
+    // Send hardware character keystrokes to computer.
+    case CMD_SEND_ASCII_KEYS:
+      type_string((const char*)payload);
+      break;
+
+    // Echo back the message payload over serial.
+    // Used for testing.
+    case CMD_ECHO:
+      if (g_request.version == PROTOCOL_V2) {
+        send_binary_reply(header->cmd, payload, header->length);
+      } else {
+        Serial.write((const char*)payload, header->length);
+        Serial.write('\n');
+      }
+      break;
+
+    // Change the mode of a pedal.
+    case CMD_SET_BUTTON_MODE: {
+      auto mx = reinterpret_cast<const CmdPayloadSetButtonMode*>(payload);
+
+      if (valid_button_parameters(mx->pedal_index, mx->mode, mx->inversion)) {
+        buttons[mx->pedal_index].set_mode(mx->mode, mx->inversion);
+        memview.profiles[g_active_profile][mx->pedal_index] = { mx->mode,
+                                                                mx->inversion };
+        update_memory(reinterpret_cast<uint8_t*>(&memview), sizeof(memview));
+      } else {
+        status = STATUS_BAD_PARAM;
+      }
+      break;
+    }
+
+    case CMD_SELECT_PROFILE: {
+      auto mx = reinterpret_cast<const CmdPayloadSelectProfile*>(payload);
+
+      if (mx->profile < PROFILE_COUNT) {
+        apply_profile(mx->profile);
+        if (mx->make_default) {
+          memview.default_profile = mx->profile;
+          update_memory(reinterpret_cast<uint8_t*>(&memview), sizeof(memview));
+        }
+      } else {
+        status = STATUS_BAD_PARAM;
+      }
+    } break;
+
+    case CMD_SET_PROFILE_BUTTON: {
+      auto mx = reinterpret_cast<const CmdPayloadSetProfileButton*>(payload);
+
+      if (mx->profile < PROFILE_COUNT &&
+          valid_button_parameters(mx->pedal_index, mx->mode, mx->inversion)) {
+        memview.profiles[mx->profile][mx->pedal_index] = { mx->mode,
+                                                           mx->inversion };
+        update_memory(reinterpret_cast<uint8_t*>(&memview), sizeof(memview));
+        if (mx->profile == g_active_profile) {
+          apply_profile(g_active_profile);
+        }
+      } else {
+        status = STATUS_BAD_PARAM;
+      }
+    } break;
+
+    case CMD_SET_PROFILE_RULE: {
+      auto mx = reinterpret_cast<const CmdPayloadSetProfileRule*>(payload);
+
+      if (mx->rule_index < PROFILE_RULE_COUNT && mx->profile < PROFILE_COUNT) {
+        memview.rules[mx->rule_index] = { mx->connected_mask, mx->profile };
+        update_memory(reinterpret_cast<uint8_t*>(&memview), sizeof(memview));
+      } else {
+        status = STATUS_BAD_PARAM;
+      }
+    } break;
+
+    case CMD_SET_KEYCOMBO: {
+      auto mx = reinterpret_cast<CmdPayloadSetKeycombo*>(payload);
+      if (mx->pedal_index >= buttons.size()) {
+        status = STATUS_BAD_PARAM;
+        break;
+      }
+
+      auto& btn = buttons[mx->pedal_index];
+      if (mx->nKeycodes > btn.keycodes.size()) {
+        status = STATUS_TOO_BIG;
+        reply_text(header->cmd, "Data is too big.\n", status);
+        break;
+      }
+
+      memcpy(
+        btn.keycodes.data(), mx->keycodes, mx->nKeycodes * sizeof(uint16_t));
+      btn.nKeycodes = mx->nKeycodes;
+      btn.mode = MODE_KEYCOMBO;
+      btn.trigger_direction = mx->trigger_direction;
+
+    } break;
+
+    case CMD_SET_WARP_TARGET: {
+      auto mx = reinterpret_cast<const CmdPayloadSetWarpTarget*>(payload);
+
+      if (mx->pedal_index >= buttons.size()) {
+        status = STATUS_BAD_PARAM;
+        break;
+      }
+
+      auto& btn = buttons[mx->pedal_index];
+      btn.warp_x = mx->x;
+      btn.warp_y = mx->y;
+      btn.mode = MODE_WARP_CURSOR;
+    } break;
+
+    // Payload: optional reset flag.
+    case CMD_GET_SAMPLER_STATS:
+#if defined(ENABLE_TEENSY_ISR_SAMPLER)
+      send_sampler_stats(header->length > 0 && payload[0]);
+#else
+      status = STATUS_UNKNOWN_CMD;
+#endif
+      break;
+
+    // Payload: optional reset flag.
+    case CMD_GET_TELEMETRY:
+      send_telemetry(header->length > 0 && payload[0]);
+      break;
+
+    case CMD_RUN_BENCH:
+      run_benchmarks();
+      break;
+
+    case CMD_SET_CPU_CLOCK: {
+#if defined(ENABLE_TEENSY_CLOCK_SCALING)
+      auto mx = reinterpret_cast<const CmdPayloadSetCpuClock*>(payload);
+
+      if (mx->boost_hz > CPU_MAX_BOOST_HZ ||
+          (mx->boost_hz && mx->boost_hz < g_cpu_clock.idle_hz)) {
+        status = STATUS_BAD_PARAM;
+        break;
+      }
+      g_cpu_clock.configure(mx->boost_hz, mx->quiet_ms);
+#else
+      status = STATUS_UNKNOWN_CMD;
+#endif
+    } break;
+
+    // Reply: micros() as late as possible before the reply goes out, for the
+    // host's clock offset handshake.
+    case CMD_GET_TIME: {
+      const uint32_t now_us = micros();
+      send_binary_reply(header->cmd, &now_us, sizeof(now_us));
+    } break;
+
+    case CMD_GET_MEMORY_STATS:
+      send_memory_stats();
+      break;
+
+    case CMD_GET_BOOT_LOG:
+      send_binary_reply(header->cmd, &g_boot_log, sizeof(g_boot_log));
+      break;
+
+    case CMD_GET_CONFIG:
+      send_config(false);
+      break;
+
+    case CMD_GET_CONFIG_HASH:
+      send_config(true);
+      break;
+
+    case CMD_SET_ANALOG_PEDAL: {
+      auto mx = reinterpret_cast<const CmdPayloadSetAnalogPedal*>(payload);
+
+#if defined(JOYSTICK_INTERFACE)
+      constexpr uint8_t max_target = ANALOG_TARGET_JOYSTICK_Z;
+#else
+      constexpr uint8_t max_target = ANALOG_TARGET_POINTER_Y;
+#endif
+      if (mx->pedal_index >= buttons.size() || mx->target > max_target ||
+          mx->iir_shift > 7) {
+        status = STATUS_BAD_PARAM;
+        break;
+      }
+
+      AnalogConfig config;
+      config.target = mx->target;
+      config.iir_shift = mx->iir_shift;
+      config.hysteresis = mx->hysteresis;
+      memcpy(config.curve, mx->curve, sizeof(config.curve));
+      g_analog_pedals[mx->pedal_index].configure(config);
+      // A pot may read as an unplugged jack at boot.
+      if (config.target != ANALOG_TARGET_NONE) {
+        buttons[mx->pedal_index].enabled = true;
+      }
+    } break;
+
+    case CMD_SET_DEBOUNCE: {
+      auto mx = reinterpret_cast<const CmdPayloadSetDebounce*>(payload);
+
+      if (mx->pedal_index >= buttons.size() || mx->mode > DEBOUNCE_EAGER) {
+        status = STATUS_BAD_PARAM;
+        break;
+      }
+      buttons[mx->pedal_index].set_debounce(
+        mx->mode, mx->holdoff_us, mx->noise_guard_us);
+    } break;
+
+    case CMD_SET_VELOCITY: {
+      auto mx = reinterpret_cast<const CmdPayloadSetVelocity*>(payload);
+
+      if (mx->slot >= VELOCITY_PAIR_COUNT ||
+          mx->contact_a >= buttons.size() || mx->contact_b >= buttons.size()) {
+        status = STATUS_BAD_PARAM;
+        break;
+      }
+
+      VelocityConfig& c = g_velocity.configs[mx->slot];
+      c.contact_a = mx->contact_a;
+      c.contact_b = mx->contact_b;
+      c.fast_mode = mx->fast_mode;
+      c.slow_mode = mx->slow_mode;
+      c.scroll_max = mx->scroll_max;
+      c.threshold_us = mx->threshold_us;
+      c.max_travel_us = mx->max_travel_us;
+      g_velocity.reset();
+      // Either contact may read as an unplugged jack at boot.
+      if (c.used()) {
+        buttons[c.contact_a].enabled = true;
+        buttons[c.contact_b].enabled = true;
+      }
+    } break;
+
+    // Blocks until a pin changes and the buffer is full.
+    case CMD_SCOPE_CAPTURE: {
+      auto mx = reinterpret_cast<const CmdPayloadScopeCapture*>(payload);
+      status =
+        run_scope_capture(header->cmd, mx->pedal_mask, mx->trigger_timeout_ms);
+    } break;
+
+    case CMD_PEDAL_EVENTS_START:
+      pedal_events_start();
       break;
 
-    // Echo back the message payload over serial.
-    // Used for testing.
-    case CMD_ECHO:
-      Serial.write((const char*)payload, header->length);
-      Serial.write('\n');
+    case CMD_PEDAL_EVENTS_STOP:
+      pedal_events_stop();
       break;
 
-    // Change the mode of a pedal.
-    case CMD_SET_BUTTON_MODE: {
-      auto mx = reinterpret_cast<const CmdPayloadSetButtonMode*>(payload);
+    case CMD_TRACE_START:
+      trace_start();
+      break;
 
-      if (valid_button_parameters(mx->pedal_index, mx->mode, mx->inversion)) {
-        buttons[mx->pedal_index].set_mode(mx->mode, mx->inversion);
-        memview.buttons[mx->pedal_index] = { mx->mode, mx->inversion };
-        update_memory(reinterpret_cast<uint8_t*>(&memview), sizeof(memview));
-      }
+    case CMD_TRACE_STOP:
+      trace_stop();
       break;
-    }
 
-    case CMD_SET_KEYCOMBO: {
-      auto mx = reinterpret_cast<CmdPayloadSetKeycombo*>(payload);
-      auto& btn = buttons[mx->pedal_index];
+    case CMD_SET_CHORD: {
+      auto mx = reinterpret_cast<const CmdPayloadSetChord*>(payload);
 
-      if (mx->nKeycodes > btn.keycodes.size()) {
-        Serial.print("Data is too big.\n");
+      if (mx->chord_index >= CHORD_COUNT ||
+          mx->nKeycodes > MAX_CHORD_KEYCODE_COUNT ||
+          mx->pedal_mask >= (1 << buttons.size())) {
+        status = STATUS_BAD_PARAM;
         break;
       }
 
-      memcpy(
-        btn.keycodes.data(), mx->keycodes, mx->nKeycodes * sizeof(uint16_t));
-      btn.nKeycodes = mx->nKeycodes;
-      btn.mode = MODE_KEYCOMBO;
-      btn.trigger_direction = mx->trigger_direction;
-
+      auto& c = g_chords.chords[mx->chord_index];
+      c.pedal_mask = mx->pedal_mask;
+      c.window_ms = mx->window_ms;
+      c.nKeycodes = mx->nKeycodes;
+      memcpy(c.keycodes, mx->keycodes, mx->nKeycodes * sizeof(uint16_t));
+      g_chords.update_members();
     } break;
 
     case CMD_RETURN_CRC: {
       uint32_t result = crc::crc32(payload, header->length);
-      Serial.println(result);
+      if (g_request.version == PROTOCOL_V2) {
+        send_binary_reply(header->cmd, &result, sizeof(result));
+      } else {
+        Serial.println(result);
+      }
     } break;
 
     case CMD_KEEP_AWAKE_ENABLE:
@@ -271,14 +1279,20 @@ handle_message(SerialMsgHeader* header, uint8_t* payload)
     case CMD_LOCK_PC:
       reenable_keep_awake_on_pedal = keep_awake_timer.is_enabled();
       keep_awake_timer.disable();
-      Keyboard.press(MODIFIERKEY_LEFT_GUI);
-      Keyboard.press(KEY_L);
-      delay(10);
-      Keyboard.release(KEY_L);
-      Keyboard.release(MODIFIERKEY_LEFT_GUI);
+      hid_press(MODIFIERKEY_LEFT_GUI);
+      hid_press(KEY_L);
+      hid_commit();
+      action_delay(10);
+      hid_release(KEY_L);
+      hid_release(MODIFIERKEY_LEFT_GUI);
+      break;
+
     default:
+      status = STATUS_UNKNOWN_CMD;
       break;
   }
+
+  return status;
 }
 
 void
@@ -303,9 +1317,9 @@ send_input(int mode, bool engage, Button& btn)
       if (engage) {
         // prev = millis();
         // delay(150);
-        Mouse.press(mode);
+        g_hid.state.press_buttons(mode);
       } else {
-        Mouse.release(mode);
+        g_hid.state.release_buttons(mode);
         // if ((millis() - prev) > 150) {
         //   Keyboard.press(MODIFIERKEY_CTRL);
         //   delay(10);
@@ -316,47 +1330,50 @@ send_input(int mode, bool engage, Button& btn)
 
     case MODE_MOUSE_RIGHT_QUICK_FIRE:
       if (engage) {
-        Mouse.click(MOUSE_RIGHT);
+        hid_click(MOUSE_RIGHT);
       }
       break;
 
     case MODE_MOUSE_DOUBLE:
       if (engage) {
-        Mouse.click();
-        Mouse.click();
+        hid_click(MOUSE_LEFT);
+        hid_click(MOUSE_LEFT);
       }
       break;
 
     case MODE_CTRL_CLICK:
       if (engage) {
-        Keyboard.press(MODIFIERKEY_CTRL);
-        delay(20);
-        Mouse.press(MOUSE_LEFT);
+        hid_press(MODIFIERKEY_CTRL);
+        hid_commit();
+        action_delay(20);
+        g_hid.state.press_buttons(MOUSE_LEFT);
       } else {
-        Keyboard.release(MODIFIERKEY_CTRL);
-        Mouse.release(MOUSE_LEFT);
+        hid_release(MODIFIERKEY_CTRL);
+        g_hid.state.release_buttons(MOUSE_LEFT);
       }
       break;
 
     case MODE_SHIFT_CLICK:
       if (engage) {
-        Keyboard.press(MODIFIERKEY_SHIFT);
-        delay(20);
-        Mouse.press(MOUSE_LEFT);
+        hid_press(MODIFIERKEY_SHIFT);
+        hid_commit();
+        action_delay(20);
+        g_hid.state.press_buttons(MOUSE_LEFT);
       } else {
-        Keyboard.release(MODIFIERKEY_SHIFT);
-        Mouse.release(MOUSE_LEFT);
+        hid_release(MODIFIERKEY_SHIFT);
+        g_hid.state.release_buttons(MOUSE_LEFT);
       }
       break;
 
     case MODE_SHIFT_MIDDLE_CLICK:
       if (engage) {
-        Keyboard.press(MODIFIERKEY_SHIFT);
-        delay(20);
-        Mouse.press(MOUSE_MIDDLE);
+        hid_press(MODIFIERKEY_SHIFT);
+        hid_commit();
+        action_delay(20);
+        g_hid.state.press_buttons(MOUSE_MIDDLE);
       } else {
-        Keyboard.release(MODIFIERKEY_SHIFT);
-        Mouse.release(MOUSE_MIDDLE);
+        hid_release(MODIFIERKEY_SHIFT);
+        g_hid.state.release_buttons(MOUSE_MIDDLE);
       }
       break;
 
@@ -365,8 +1382,22 @@ send_input(int mode, bool engage, Button& btn)
     // Is implemented in my head tracking to mouse program
     // called TrackIRMouse.
     case MODE_SCROLL_BAR:
-      Keyboard.press(KEY_F18);
-      Keyboard.release(KEY_F18);
+      hid_press(KEY_F18);
+      hid_commit();
+      hid_release(KEY_F18);
+      break;
+
+    case MODE_NEXT_PROFILE:
+      if (engage) {
+        apply_profile((g_active_profile + 1) % PROFILE_COUNT);
+      }
+      break;
+
+    // Jump straight to the configured screen location, e.g. a scrollbar.
+    case MODE_WARP_CURSOR:
+      if (engage) {
+        warp_cursor(btn.warp_x, btn.warp_y);
+      }
       break;
 
     // Autohotkey script used to trigger scrollwheel commans.
@@ -374,20 +1405,21 @@ send_input(int mode, bool engage, Button& btn)
     // how far near the top or bottom my mouse pointer is.A
     case MODE_SCROLL_ANYWHERE:
       if (engage) {
-        Keyboard.press(KEY_F20);
+        hid_press(KEY_F20);
       } else {
-        Keyboard.release(KEY_F20);
+        hid_release(KEY_F20);
       }
       break;
 
     case MODE_ORBIT:
       if (engage) {
-        Keyboard.press(MODIFIERKEY_SHIFT);
-        delay(20);
-        Mouse.press(MOUSE_MIDDLE);
+        hid_press(MODIFIERKEY_SHIFT);
+        hid_commit();
+        action_delay(20);
+        g_hid.state.press_buttons(MOUSE_MIDDLE);
       } else {
-        Keyboard.release(MODIFIERKEY_SHIFT);
-        Mouse.release(MOUSE_MIDDLE);
+        hid_release(MODIFIERKEY_SHIFT);
+        g_hid.state.release_buttons(MOUSE_MIDDLE);
       }
       break;
 
@@ -405,58 +1437,76 @@ send_input(int mode, bool engage, Button& btn)
 void
 setup()
 {
-  Serial.begin(115200);
-  Keyboard.begin();
-  Mouse.begin();
+  g_boot_log.mark(BOOT_SETUP_START, micros());
+  paint_main_stack();
 
-  // invalidate_memory();
+  // Pedals come up before USB. Edges sampled while the host enumerates wait
+  // in the event queue until hid_commit() finds the host ready.
 
-#ifdef LOAD_BUTTONS_FROM_MEM
-  if (is_memory_initialized()) {
-    load_memory(reinterpret_cast<uint8_t*>(&memview), sizeof(memview));
-  }
-  int idx = 0;
-#endif
+  // Bit i is set when pedal i is plugged in.
+  uint8_t connected_mask = 0;
 
   // Set up input pins.
-  for (auto& btn : buttons) {
+  for (size_t i = 0; i < buttons.size(); i++) {
+    auto& btn = buttons[i];
     // I use external pull-up resistors, they are more stable.
     pinMode(btn.pin, INPUT);
 
+    if (digitalRead(btn.pin) == DIGITAL_READ_CONNECTED_PEDAL) {
+      connected_mask |= 1 << i;
+    }
+
 // Disable a butRton if no pedal is plugged into the jack.
 // Alternatively, hold a pedal down on boot to disable that pedal.
 #ifdef AUTO_DISABLE_BTN_ON_START
-    if (digitalRead(btn.pin) == DIGITAL_READ_DISCONNECTED_PEDAL) {
+    if (!(connected_mask & (1 << i))) {
       btn.enabled = false;
     }
 #endif
+  }
+  g_boot_log.mark(BOOT_PINS_READY, micros());
+
+  cycle_counter_init();
+#if defined(BOARD_NRF52)
+  if (!check_pedal_gpios()) {
+    log_msg<LOG_ERROR>(LOG_MSG_PIN_MAP_MISMATCH);
+  }
+#endif
+  g_pin_read_cycles = measure_pin_read_cycles();
+  log_msg<LOG_INFO>(LOG_MSG_PIN_READ_CYCLES,
+                    g_pin_read_cycles.generic,
+                    g_pin_read_cycles.fast);
+
+  // Hardware averaging on top of the analog pedals' own oversampling.
+  analogReadResolution(ANALOG_READ_BITS);
+#if defined(BOARD_TEENSY4)
+  analogReadAveraging(4);
+#elif defined(NRF52)
+  analogOversampling(4);
+#endif
+
+  // invalidate_memory();
 
 // Load value from memory.
 #ifdef LOAD_BUTTONS_FROM_MEM
-    if (is_memory_initialized()) {
-      auto btn_config = memview.buttons[idx++];
-      if (btn_config.mode > 0) {
-        btn.set_mode(btn_config.mode, btn_config.trig_direction);
-      }
-    }
-#endif
+  if (is_memory_initialized()) {
+    load_memory(reinterpret_cast<uint8_t*>(&memview), sizeof(memview));
+    apply_profile(memview.select_profile(connected_mask));
   }
+#endif
+  g_boot_log.mark(BOOT_CONFIG_LOADED, micros());
 
-// Ensure all pins match the bitlocker config.
+// Ensure all pins match the bitlocker config. The key is typed once the host
+// had time to settle, see service_bitlocker().
 #if defined(BITLOCKER_RECOVERY_MODE_FOR_NRF)
-  bool send_bitlocker_key_keystrokes = true;
+  g_bitlocker_pending = true;
   for (size_t i = 0; i < buttons.size(); i++) {
     auto config = g_special_pin_config[i];
     auto btn = buttons[i];
     if (digitalRead(btn.pin) != config) {
-      send_bitlocker_key_keystrokes = false;
+      g_bitlocker_pending = false;
     }
   }
-
-  if (send_bitlocker_key_keystrokes) {
-    delay(2000);
-    Keyboard.print(SECRET_BITLOCKER_RECOVERY_KEY);
-  }
 #endif
 
   keep_awake_timer.start(KEEP_AWAKE_PERIOD_S * 1000);
@@ -468,11 +1518,603 @@ setup()
   // BUG: Keep awake does not work on tinyusbshim on nrf boards.
   keep_awake_timer.disable();
 #endif
+
+#if defined(ENABLE_TEENSY_ISR_SAMPLER)
+  start_sampler();
+#endif
+#if defined(ENABLE_TEENSY_CLOCK_SCALING)
+  g_cpu_clock.begin(F_CPU_ACTUAL, CPU_BOOST_HZ, CPU_QUIET_MS, millis());
+#endif
+
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+  start_tasks();
+#endif
+  g_boot_log.mark(BOOT_SAMPLING_STARTED, micros());
+
+  Serial.begin(115200);
+  Keyboard.begin();
+  Mouse.begin();
+#if defined(COMPILE_TINY_USB_HID_SHIM)
+  AbsPointer.begin();
+#else
+  Mouse.screenSize(ABS_POINTER_TEENSY_GRID, ABS_POINTER_TEENSY_GRID);
+#endif
+  g_boot_log.mark(BOOT_USB_BEGUN, micros());
+
+  g_boot_log.mark(BOOT_SETUP_DONE, micros());
+}
+
+/**
+ * Send the pedal's own action and record its telemetry.
+ */
+void
+run_pedal_action(uint8_t idx, bool engage)
+{
+  auto& btn = buttons[idx];
+  send_input(btn.mode, engage, btn);
+  g_boot_log.mark(BOOT_FIRST_ACTION, micros());
+
+  trace(TRACE_REPORT_SENT, idx | (engage ? TRACE_ENGAGE_BIT : 0), btn.mode);
+
+  const uint32_t now = micros();
+  btn.telemetry.edge_to_report_us.add(now - btn.last_edge_us);
+  if (engage) {
+    btn.telemetry.engagements++;
+    btn.engage_time = now;
+  } else if (btn.engage_time) {
+    // No engage_time for a pedal that was held at boot or across a profile
+    // change.
+    btn.telemetry.hold_us.add(now - btn.engage_time);
+    btn.engage_time = 0;
+  }
+}
+
+// Receives the resolved actions from the chord engine.
+struct ChordOutput
+{
+  void single(uint8_t pedal, bool engage) { run_pedal_action(pedal, engage); }
+
+  void chord(const Chord& c) { fire_macro(c.keycodes, c.nKeycodes); }
+};
+
+ChordOutput g_chord_output;
+
+// Receives classified presses from the velocity engine. Modes act as if
+// contact_a's pedal had them, e.g. for its keycodes.
+struct VelocityOutput
+{
+  void press(const VelocityConfig& c, uint32_t travel_us)
+  {
+    if (c.scroll_max) {
+      Mouse.move(0, 0, c.scroll_lines(travel_us));
+      return;
+    }
+    send_input(c.is_fast(travel_us) ? c.fast_mode : c.slow_mode,
+               true,
+               buttons[c.contact_a]);
+  }
+
+  void release(const VelocityConfig& c, uint32_t travel_us)
+  {
+    if (!c.scroll_max) {
+      send_input(c.is_fast(travel_us) ? c.fast_mode : c.slow_mode,
+                 false,
+                 buttons[c.contact_a]);
+    }
+  }
+};
+
+VelocityOutput g_velocity_output;
+
+/**
+ * Handle a debounced pedal edge.
+ * edge_us is when the pin first changed, for latency telemetry.
+ */
+void
+on_pedal_edge(Button& btn, int state, uint32_t edge_us)
+{
+  const uint8_t idx = &btn - buttons.data();
+  if (g_analog_pedals[idx].active()) {
+    // The pin carries a pot, its digital level is meaningless.
+    return;
+  }
+
+  const bool engage = btn.should_engage(state);
+  btn.last_edge_us = edge_us;
+  g_boot_log.mark(BOOT_FIRST_EDGE, edge_us);
+  pedal_notify(idx, state, engage, btn.mode, edge_us);
+  if (!g_velocity.on_edge(idx, engage, edge_us, g_velocity_output)) {
+    g_chords.on_edge(idx, engage, micros(), g_chord_output);
+  }
+
+  keep_awake_timer.reset();
+
+  // Re-enable keep awake when pressing any pedal when this device was
+  // used to lock pc.
+  if (reenable_keep_awake_on_pedal) {
+    keep_awake_timer.enable();
+    reenable_keep_awake_on_pedal = false;
+  }
+}
+
+void
+service_keep_awake()
+{
+  if (keep_awake_timer.update()) {
+    hid_press(KEEP_AWAKE_KEY);
+    hid_commit();
+    action_delay(10);
+    hid_release(KEEP_AWAKE_KEY);
+  }
+}
+
+#if defined(BITLOCKER_RECOVERY_MODE_FOR_NRF)
+/**
+ * Type the recovery key once, BITLOCKER_DELAY_MS after the host got ready.
+ */
+void
+service_bitlocker()
+{
+  const uint32_t ready_us = g_boot_log.t_us[BOOT_USB_READY];
+  if (!g_bitlocker_pending || !ready_us ||
+      micros() - ready_us < BITLOCKER_DELAY_MS * 1000UL) {
+    return;
+  }
+  g_bitlocker_pending = false;
+  Keyboard.print(SECRET_BITLOCKER_RECOVERY_KEY);
+  g_hid.request_resync();
+}
+#endif
+
+/**
+ * Read one serial command frame if one is waiting.
+ * Returns true if a valid frame was read into header and g_payload_buf.
+ */
+bool
+read_serial_command(SerialMsgHeader* header)
+{
+  const int first = Serial.peek();
+  if (first == -1) {
+    return false;
+  }
+
+  if (first == V2_SOF) {
+    const uint8_t status = validate_frame_v2_and_get_payload(
+      header, g_payload_buf.data(), g_payload_buf.size());
+    if (status == STATUS_OK) {
+      return true;
+    }
+    log_msg<LOG_WARN>(LOG_MSG_FRAME_V2_ERROR, status, header->cmd);
+    finish_request(header->cmd, status);
+    return false;
+  }
+
+  if (first != V1_SOF_BYTE) {
+    // Not the start of any frame, resynchronize.
+    Serial.read();
+    return false;
+  }
+
+  if (validate_frame_and_get_payload(
+        header, g_payload_buf.data(), g_payload_buf.size())) {
+    return true;
+  }
+
+  log_msg<LOG_WARN>(LOG_MSG_FRAME_INVALID);
+  return false;
+}
+
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+// Debounced edges from the input task to the HID task.
+QueueHandle_t g_pedal_event_queue;
+
+/**
+ * Debounce settings for the input task, published after every serial
+ * command. The queue holds one, a newer one replaces it.
+ */
+struct DebounceMailbox
+{
+  std::array<DebounceConfig, std::size(buttons)> pedals;
+  // The input task clears its counters when this changes.
+  uint32_t counter_resets;
+};
+
+QueueHandle_t g_debounce_mailbox;
+
+volatile uint32_t g_dropped_pedal_events = 0;
+volatile uint32_t g_pedal_event_queue_peak = 0;
+
+// For the stack high-water marks in CMD_GET_MEMORY_STATS.
+TaskHandle_t g_loop_task;
+TaskHandle_t g_input_task;
+TaskHandle_t g_hid_task;
+TaskHandle_t g_serial_task;
+
+void
+publish_debounce_config()
+{
+  DebounceMailbox mail;
+  for (size_t i = 0; i < buttons.size(); i++) {
+    mail.pedals[i] = buttons[i].debounce_config();
+  }
+  mail.counter_resets = g_debounce_counter_resets;
+  xQueueOverwrite(g_debounce_mailbox, &mail);
+}
+
+/**
+ * Highest priority. Samples and debounces all pedals in a burst every
+ * INPUT_TASK_PERIOD_MS, see GLITCH_SAMPLE_CNT.
+ *
+ * The debounce state is the task's own, g_input_debouncers. Settings arrive
+ * through g_debounce_mailbox and the accepted states leave through
+ * g_pedal_event_queue, so sampling never waits for another task.
+ */
+void
+input_task(void* arg)
+{
+  (void)arg;
+  TickType_t last_wake = xTaskGetTickCount();
+  uint32_t counter_resets = 0;
+
+  for (;;) {
+    vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(INPUT_TASK_PERIOD_MS));
+
+    DebounceMailbox mail;
+    if (xQueueReceive(g_debounce_mailbox, &mail, 0) == pdTRUE) {
+      const bool reset = mail.counter_resets != counter_resets;
+      counter_resets = mail.counter_resets;
+      for (size_t i = 0; i < buttons.size(); i++) {
+        auto& btn = g_input_debouncers[i];
+        btn.apply_debounce_config(mail.pedals[i]);
+        if (reset) {
+          btn.rejected_glitches = 0;
+          btn.lockout_hits = 0;
+        }
+      }
+    }
+
+    for (size_t sample = 0; sample < GLITCH_SAMPLE_CNT; sample++) {
+      if (sample) {
+        delayMicroseconds(POLL_PERIOD_US);
+      }
+      const unsigned long now = micros();
+      const uint32_t levels = read_pedal_levels();
+      for (size_t i = 0; i < buttons.size(); i++) {
+        auto& btn = g_input_debouncers[i];
+        if (sample_button(i, btn, (levels >> i) & 1, now)) {
+          PedalEvent ev{ static_cast<uint8_t>(i),
+                         static_cast<uint8_t>(btn.state),
+                         static_cast<uint32_t>(now),
+                         static_cast<uint32_t>(btn.edge_time) };
+          if (xQueueSend(g_pedal_event_queue, &ev, 0) != pdTRUE) {
+            g_dropped_pedal_events++;
+          }
+          const uint32_t depth = uxQueueMessagesWaiting(g_pedal_event_queue);
+          if (depth > g_pedal_event_queue_peak) {
+            g_pedal_event_queue_peak = depth;
+          }
+        }
+      }
+    }
+
+    // The task period matches ANALOG_SAMPLE_PERIOD_US. The analog pedals
+    // are configured under the mutex, which is never held for long; if it is
+    // taken this sample is skipped.
+    if (xSemaphoreTake(g_state_mutex, 0) == pdTRUE) {
+      sample_analog_pedals();
+      xSemaphoreGive(g_state_mutex);
+    }
+  }
+}
+
+/**
+ * Sends HID input for queued pedal edges and services keep awake.
+ */
+void
+hid_task(void* arg)
+{
+  (void)arg;
+  PedalEvent ev;
+
+  for (;;) {
+    // Wake up often enough to release held back chord members on time and
+    // to keep analog pedal output smooth.
+    bool analog_active = false;
+    for (const auto& ap : g_analog_pedals) {
+      analog_active |= ap.active();
+    }
+    const TickType_t timeout =
+      g_chords.has_pending() || g_velocity.has_pending()
+        ? pdMS_TO_TICKS(1)
+        : (analog_active ? pdMS_TO_TICKS(ANALOG_OUTPUT_PERIOD_US / 1000)
+                         : pdMS_TO_TICKS(100));
+    // Edges stay queued until the host can receive their reports.
+    const bool host_ready = g_hid_sink.ready();
+    bool got_event =
+      host_ready && xQueueReceive(g_pedal_event_queue, &ev, timeout) == pdTRUE;
+    if (!host_ready) {
+      vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    // loop() is suspended, so this is what drops the in-flight report after
+    // a bus reset and retries reports the endpoint didn't take.
+    HIDCompat::service();
+
+    const uint32_t start_cycles = cycle_count();
+    xSemaphoreTake(g_state_mutex, portMAX_DELAY);
+    g_chords.tick(micros(), g_chord_output);
+    g_velocity.tick(micros(), g_velocity_output);
+    if (got_event) {
+      const uint32_t latency = micros() - ev.time_us;
+      if (latency > g_max_input_latency_us) {
+        g_max_input_latency_us = latency;
+      }
+      // What the input task accepted, for should_engage() and the pedal
+      // state commands.
+      buttons[ev.index].state = ev.state;
+      buttons[ev.index].edge_time = ev.edge_us;
+      on_pedal_edge(buttons[ev.index], ev.state, ev.edge_us);
+    }
+    service_analog_pedals(micros());
+    service_keep_awake();
+#if defined(BITLOCKER_RECOVERY_MODE_FOR_NRF)
+    service_bitlocker();
+#endif
+    hid_commit();
+    xSemaphoreGive(g_state_mutex);
+    g_loop_cycles.add(cycle_count() - start_cycles);
+  }
+}
+
+/**
+ * Lowest priority. Parses serial commands, which may write to storage.
+ */
+void
+serial_task(void* arg)
+{
+  (void)arg;
+
+  for (;;) {
+    service_pedal_events();
+    service_trace();
+    service_log();
+
+    SerialMsgHeader header;
+    if (read_serial_command(&header)) {
+      xSemaphoreTake(g_state_mutex, portMAX_DELAY);
+      const uint8_t status = handle_message(&header, g_payload_buf.data());
+      hid_commit();
+      publish_debounce_config();
+      xSemaphoreGive(g_state_mutex);
+      finish_request(header.cmd, status);
+    } else {
+      vTaskDelay(pdMS_TO_TICKS(SERIAL_TASK_PERIOD_MS));
+    }
+  }
+}
+
+void
+start_tasks()
+{
+  g_pedal_event_queue = xQueueCreate(PEDAL_EVENT_QUEUE_LEN, sizeof(PedalEvent));
+  g_debounce_mailbox = xQueueCreate(1, sizeof(DebounceMailbox));
+  g_state_mutex = xSemaphoreCreateMutex();
+  // setup() configured the pedals, the input task starts from there.
+  for (size_t i = 0; i < buttons.size(); i++) {
+    g_input_debouncers[i] = buttons[i];
+  }
+  g_loop_task = xTaskGetCurrentTaskHandle();
+
+  xTaskCreate(input_task,
+              "input",
+              INPUT_TASK_STACK_SIZE,
+              nullptr,
+              INPUT_TASK_PRIORITY,
+              &g_input_task);
+  xTaskCreate(hid_task,
+              "hid",
+              HID_TASK_STACK_SIZE,
+              nullptr,
+              HID_TASK_PRIORITY,
+              &g_hid_task);
+  xTaskCreate(serial_task,
+              "serial",
+              SERIAL_TASK_STACK_SIZE,
+              nullptr,
+              SERIAL_TASK_PRIORITY,
+              &g_serial_task);
+}
+#endif // ENABLE_NRF52_TASK_SPLIT
+
+/**
+ * Reply with a MemoryStatsHeader followed by the static RAM of each
+ * subsystem, stack high-water marks and queue peak depths.
+ */
+void
+send_memory_stats()
+{
+  const MemRegionEntry regions[] = {
+    { MEM_REGION_BUTTONS, { 0 }, sizeof(buttons) },
+    { MEM_REGION_PAYLOAD_BUF, { 0 }, sizeof(g_payload_buf) },
+#if defined(ENABLE_TEENSY_ISR_SAMPLER)
+    { MEM_REGION_PEDAL_EVENTS, { 0 }, sizeof(g_pedal_events) },
+#elif defined(ENABLE_NRF52_TASK_SPLIT)
+    { MEM_REGION_PEDAL_EVENTS,
+      { 0 },
+      PEDAL_EVENT_QUEUE_LEN * sizeof(PedalEvent) },
+#endif
+    { MEM_REGION_PEDAL_NOTIFY, { 0 }, sizeof(g_pedal_notify_ring) },
+    { MEM_REGION_TRACE, { 0 }, sizeof(g_trace_ring) },
+    { MEM_REGION_LOG, { 0 }, sizeof(LogRing) },
+    { MEM_REGION_SCOPE, { 0 }, sizeof(g_scope) },
+    { MEM_REGION_CONFIG, { 0 }, sizeof(memview) },
+    { MEM_REGION_CHORDS, { 0 }, sizeof(g_chords) },
+    { MEM_REGION_ANALOG, { 0 }, sizeof(g_analog_pedals) },
+    { MEM_REGION_HID_STATE, { 0 }, sizeof(g_hid) },
+  };
+
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+  const auto task_stack_unused = [](TaskHandle_t task) {
+    return static_cast<uint32_t>(uxTaskGetStackHighWaterMark(task) *
+                                 sizeof(StackType_t));
+  };
+#endif
+  const MemStackEntry stacks[] = {
+    { MEM_STACK_MAIN,
+      { 0 },
+      static_cast<uint32_t>((main_stack_top() - main_stack_bottom()) *
+                            sizeof(uint32_t)),
+      main_stack_unused_bytes() },
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+    // The core picks the loop task's stack size.
+    { MEM_STACK_LOOP_TASK,
+      { 0 },
+      0,
+      task_stack_unused(g_loop_task) },
+    { MEM_STACK_INPUT_TASK,
+      { 0 },
+      INPUT_TASK_STACK_SIZE * sizeof(StackType_t),
+      task_stack_unused(g_input_task) },
+    { MEM_STACK_HID_TASK,
+      { 0 },
+      HID_TASK_STACK_SIZE * sizeof(StackType_t),
+      task_stack_unused(g_hid_task) },
+    { MEM_STACK_SERIAL_TASK,
+      { 0 },
+      SERIAL_TASK_STACK_SIZE * sizeof(StackType_t),
+      task_stack_unused(g_serial_task) },
+#endif
+  };
+
+  const MemQueueEntry queues[] = {
+#if defined(ENABLE_TEENSY_ISR_SAMPLER)
+    { MEM_QUEUE_PEDAL_EVENTS,
+      0,
+      g_pedal_events.capacity(),
+      static_cast<uint16_t>(g_pedal_events.peak_depth),
+      0,
+      g_pedal_events.dropped },
+#elif defined(ENABLE_NRF52_TASK_SPLIT)
+    { MEM_QUEUE_PEDAL_EVENTS,
+      0,
+      PEDAL_EVENT_QUEUE_LEN,
+      static_cast<uint16_t>(g_pedal_event_queue_peak),
+      0,
+      g_dropped_pedal_events },
+#endif
+    { MEM_QUEUE_PEDAL_NOTIFY,
+      0,
+      g_pedal_notify_ring.capacity(),
+      static_cast<uint16_t>(g_pedal_notify_ring.peak_depth),
+      0,
+      g_pedal_notify_ring.dropped },
+    { MEM_QUEUE_TRACE,
+      0,
+      g_trace_ring.capacity(),
+      static_cast<uint16_t>(g_trace_ring.peak_depth),
+      0,
+      g_trace_ring.dropped },
+    { MEM_QUEUE_LOG,
+      0,
+      static_cast<uint16_t>(log_ring().capacity()),
+      static_cast<uint16_t>(log_ring().peak_depth),
+      0,
+      log_ring().dropped },
+#if defined(USING_TINY_USB)
+    { MEM_QUEUE_HID_TX,
+      0,
+      HIDCompat::HID_TX_QUEUE_SIZE,
+      HIDCompat::get_tx_queue_stats().peak_depth,
+      0,
+      HIDCompat::get_tx_queue_stats().dropped },
+#endif
+  };
+
+  MemoryStatsHeader header;
+  header.region_count = std::size(regions);
+  header.stack_count = std::size(stacks);
+  header.queue_count = std::size(queues);
+  fill_memory_layout(header);
+
+  reply_begin(CMD_GET_MEMORY_STATS,
+              sizeof(header) + sizeof(regions) + sizeof(stacks) +
+                sizeof(queues));
+  reply_write(&header, sizeof(header));
+  reply_write(regions, sizeof(regions));
+  reply_write(stacks, sizeof(stacks));
+  reply_write(queues, sizeof(queues));
+  reply_end();
+}
+
+/**
+ * Time the hot paths with the cycle counter and reply with a BenchHeader
+ * followed by one BenchResult per benchmark.
+ */
+void
+run_benchmarks()
+{
+  BenchResult results[6];
+  size_t n = 0;
+
+  const uint32_t levels = read_pedal_levels();
+  const unsigned long now = micros();
+  results[n++] =
+    run_bench_sampled(BENCH_DEBOUNCE_ALL, [&](uint32_t overhead) {
+      uint32_t total = 0;
+      for (size_t i = 0; i < buttons.size(); i++) {
+        // The sampler owns the real debounce state.
+        Button btn = buttons[i];
+        total += bench_time(
+          [&] { bench_keep(btn.debounce((levels >> i) & 1, now)); }, overhead);
+      }
+      return total;
+    });
+
+  results[n++] = g_loop_cycles.result();
+
+  results[n++] = run_bench(BENCH_CRC32_512, [] {
+    bench_keep(crc::crc32(g_payload_buf.data(), g_payload_buf.size()));
+  });
+
+  // The state a ctrl-click or a ctrl+s combo puts into the reports.
+  results[n++] = run_bench(BENCH_HID_REPORT, [] {
+    HidState s;
+    s.press(MODIFIERKEY_CTRL);
+    s.press(KEY_S);
+    s.press_buttons(MOUSE_LEFT);
+    bench_keep(s.same_keyboard(g_hid.state) + s.mouse_buttons);
+  });
+
+  results[n++] = run_bench(BENCH_ASCII_TO_HID, [] {
+    static const char text[] = "The quick brown fox, 42 jumps!\n";
+    uint32_t sum = 0;
+    for (const char c : text) {
+      uint8_t mod;
+      sum += ascii_to_hid_usage(c, mod) + mod;
+    }
+    bench_keep(sum);
+  });
+
+#if defined(LOAD_BUTTONS_FROM_MEM) && defined(BOARD_TEENSY4)
+  results[n++] = run_bench(BENCH_STORAGE_LOAD, [] {
+    decltype(memview) scratch;
+    load_memory(reinterpret_cast<uint8_t*>(&scratch), sizeof(scratch));
+    bench_keep(scratch.default_profile);
+  });
+#endif
+
+  BenchHeader header;
+  header.count = n;
+  header.cycles_per_s = cycle_counter_hz();
+  reply_begin(CMD_RUN_BENCH, sizeof(header) + n * sizeof(BenchResult));
+  reply_write(&header, sizeof(header));
+  reply_write(results, n * sizeof(BenchResult));
+  reply_end();
 }
 
 unsigned long previous_btn_check = 0;
 
-// TESTING: Measuring elapsed time between loop iterations.
+// TESTING: Measuring elapsed time between loop iterations. CMD_RUN_BENCH
+// reports loop cycles without a special build.
 // 2025-03-31 Test Results:
 // (24MHz Debug Build) Avg = 4.6 µs; Max = 12 µs; Min = 4 µs
 // (600MHz Fastest with LTO) Avg = 0.1 µs; Max = 1 µs; Min = 0 µs
@@ -486,14 +2128,33 @@ unsigned long times[TIMES_ARRAY_SIZE];
 void
 loop()
 {
+#if defined(ENABLE_NRF52_TASK_SPLIT)
+  // All work happens in the tasks created by start_tasks().
+  suspendLoop();
+  return;
+#endif
+
+#if defined(ENABLE_TEENSY_CLOCK_SCALING)
+  // Before anything is timed, a switch stalls the loop.
+  g_cpu_clock.tick(millis(), g_arm_clock);
+#endif
+
   unsigned long now = micros();
+  const uint32_t start_cycles = cycle_count();
   // Serial.println("Serial started.");
   // delay(1000);
 
 #if defined(USING_TINY_USB)
+  HIDCompat::service();
+
   // Wait until USB mounted.
-  if (!TinyUSBDevice.mounted()) {
-    Serial.println("Not yet mounted.");
+  static bool was_mounted = false;
+  const bool mounted = TinyUSBDevice.mounted();
+  if (mounted != was_mounted) {
+    was_mounted = mounted;
+    log_msg<LOG_INFO>(LOG_MSG_USB_MOUNTED, mounted);
+  }
+  if (!mounted) {
     return;
   }
 #endif // USING_TINY_USB
@@ -512,21 +2173,28 @@ loop()
 
 #endif // TEST_ELAPSED_TIME_IN_MAIN_LOOP
 
+#if defined(ENABLE_TEENSY_ISR_SAMPLER)
+  // Edges stay queued until the host can receive their reports.
+  PedalEvent ev;
+  while (g_hid_sink.ready() && g_pedal_events.pop(ev)) {
+    cpu_activity();
+    // Slightly negative right after a clock switch, see cpu_clock.h.
+    const int32_t latency = micros() - ev.time_us;
+    if (latency > static_cast<int32_t>(g_max_input_latency_us)) {
+      g_max_input_latency_us = latency;
+    }
+    on_pedal_edge(buttons[ev.index], ev.state, ev.edge_us);
+  }
+#else
   if ((now - previous_btn_check) > POLL_PERIOD_US) {
     previous_btn_check = now;
 
     // Check each button.
-    for (auto& btn : buttons) {
-      if (btn.debounce(digitalRead(btn.pin), now)) {
-        send_input(btn.mode, btn.should_engage(), btn);
-        keep_awake_timer.reset();
-
-        // Re-enable keep awake when pressing any pedal when this device was
-        // used to lock pc.
-        if (reenable_keep_awake_on_pedal) {
-          keep_awake_timer.enable();
-          reenable_keep_awake_on_pedal = false;
-        }
+    const uint32_t levels = read_pedal_levels();
+    for (size_t i = 0; i < buttons.size(); i++) {
+      auto& btn = buttons[i];
+      if (sample_button(i, btn, (levels >> i) & 1, now)) {
+        on_pedal_edge(btn, btn.state, btn.edge_time);
       }
       // Serial.print(btn.pin);
       // Serial.print(": ");
@@ -535,21 +2203,40 @@ loop()
       // Serial.println(digitalRead(btn.pin));
     }
   }
+#endif // ENABLE_TEENSY_ISR_SAMPLER
 
-  if (keep_awake_timer.update()) {
-    Keyboard.press(KEEP_AWAKE_KEY);
-    delay(10);
-    Keyboard.release(KEEP_AWAKE_KEY);
+  static unsigned long previous_analog_sample = 0;
+  if ((now - previous_analog_sample) >= ANALOG_SAMPLE_PERIOD_US) {
+    previous_analog_sample = now;
+    sample_analog_pedals();
   }
+  service_analog_pedals(micros());
 
-  if (Serial.available()) {
-    SerialMsgHeader header;
+  g_chords.tick(micros(), g_chord_output);
+  g_velocity.tick(micros(), g_velocity_output);
+  service_keep_awake();
+#if defined(BITLOCKER_RECOVERY_MODE_FOR_NRF)
+  service_bitlocker();
+#endif
+  service_pedal_events();
+  service_trace();
+  service_log();
 
-    if (validate_frame_and_get_payload(
-          &header, g_payload_buf.data(), g_payload_buf.size())) {
-      handle_message(&header, g_payload_buf.data());
-    } else {
-      Serial.println("Not a valid message.");
-    }
+  if (Serial.available() > 0) {
+    cpu_activity();
+  }
+  SerialMsgHeader header;
+  if (read_serial_command(&header)) {
+    finish_request(header.cmd, handle_message(&header, g_payload_buf.data()));
+  }
+
+  // All of this tick's pedal and command actions go out as one report per
+  // device.
+  hid_commit();
+
+  const uint32_t elapsed = micros() - now;
+  if (elapsed > g_max_loop_us) {
+    g_max_loop_us = elapsed;
   }
+  g_loop_cycles.add(cycle_count() - start_cycles);
 }
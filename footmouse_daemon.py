@@ -0,0 +1,317 @@
+"""
+Long running daemon that owns the footmouse serial port and serves local
+clients over a Unix socket, so scripts don't rediscover and reopen the port.
+
+Clients exchange JSON lines. A command:
+    {"id": 1, "cmd": 7, "payload": "68656c6c6f"}
+is answered with the device's protocol v2 reply:
+    {"id": 1, "status": 0, "payload": "68656c6c6f"}
+Payloads are hex. {"id": 2, "subscribe": "pedal_events"} streams every
+debounced pedal edge as
+    {"event": "pedal", "pedal": 0, "state": 1, "engage": true, "mode": 1,
+     "edge_us": 123, "t_us": 456}
+
+Usage:
+    python footmouse_daemon.py serve [--port /dev/ttyACM0] [--socket PATH]
+    python footmouse_daemon.py bench [--count 2000]
+"""
+import argparse
+import asyncio
+import json
+import os
+import struct
+import tempfile
+import threading
+import time
+import zlib
+
+import serial
+
+import serial_commands as sc
+
+DEFAULT_SOCKET_PATH = os.path.join(tempfile.gettempdir(), "footmouse.sock")
+COMMAND_TIMEOUT_S = 1.0
+
+REPLY_LOG_FRAME = 0xF1
+REPLY_PEDAL_EVENT_FRAME = 0xF2
+
+FRAME_HEADER_FMT = "<IHxx"
+PEDAL_EVENT_FMT = "<IIBBBB"
+
+
+def decode_pedal_events(payload: bytes):
+    _, count = struct.unpack_from(FRAME_HEADER_FMT, payload)
+    offset = struct.calcsize(FRAME_HEADER_FMT)
+    size = struct.calcsize(PEDAL_EVENT_FMT)
+    for i in range(count):
+        edge_us, t_us, pedal, state, engage, mode = struct.unpack_from(
+            PEDAL_EVENT_FMT, payload, offset + i * size)
+        yield {
+            "event": "pedal",
+            "pedal": pedal,
+            "state": state,
+            "engage": bool(engage),
+            "mode": mode,
+            "edge_us": edge_us,
+            "t_us": t_us,
+        }
+
+
+class Daemon:
+
+    def __init__(self, port: str, socket_path: str):
+        self.port = port
+        self.socket_path = socket_path
+        self.serial = None
+        self.rx = b""
+        self.pending: dict[int, asyncio.Future] = {}
+        self.next_seq = 1
+        self.subscribers: set[asyncio.StreamWriter] = set()
+
+    async def start(self):
+        loop = asyncio.get_running_loop()
+        self.serial = serial.Serial(self.port,
+                                    sc.BAUD_RATE,
+                                    timeout=0,
+                                    write_timeout=1)
+        loop.add_reader(self.serial.fileno(), self._on_serial_readable)
+
+        reply = await self.command(sc.CMD_IDENTIFY, bytes([sc.PROTOCOL_V2]))
+        if not reply.payload.startswith(sc.NAME):
+            raise RuntimeError(f"{self.port} is not a footmouse.")
+        await self.command(sc.CMD_PEDAL_EVENTS_START)
+
+        if os.path.exists(self.socket_path):
+            os.unlink(self.socket_path)
+        return await asyncio.start_unix_server(self._serve_client,
+                                               self.socket_path)
+
+    def close(self):
+        if self.serial:
+            asyncio.get_running_loop().remove_reader(self.serial.fileno())
+            self.serial.close()
+
+    def _alloc_seq(self) -> int:
+        # seq 0 is reserved for unsolicited frames.
+        for _ in range(255):
+            seq = self.next_seq
+            self.next_seq = seq % 255 + 1
+            if seq not in self.pending:
+                return seq
+        raise RuntimeError("Too many commands in flight.")
+
+    async def command(self, cmd: int, payload: bytes = b"") -> sc.ReplyFrame:
+        seq = self._alloc_seq()
+        future = asyncio.get_running_loop().create_future()
+        self.pending[seq] = future
+        try:
+            self.serial.write(sc.get_v2_bytes(cmd, payload, seq))
+            return await asyncio.wait_for(future, COMMAND_TIMEOUT_S)
+        finally:
+            self.pending.pop(seq, None)
+
+    def _on_serial_readable(self):
+        data = self.serial.read(max(1, self.serial.in_waiting))
+        frames, self.rx = sc.split_reply_frames(self.rx + data)
+        for frame in frames:
+            if frame.notify:
+                if frame.cmd == REPLY_PEDAL_EVENT_FRAME:
+                    for event in decode_pedal_events(frame.payload):
+                        self._broadcast(event)
+            elif (future := self.pending.get(frame.seq)) and not future.done():
+                future.set_result(frame)
+
+    def _broadcast(self, message: dict):
+        line = (json.dumps(message) + "\n").encode()
+        for writer in list(self.subscribers):
+            if writer.is_closing():
+                self.subscribers.discard(writer)
+            else:
+                writer.write(line)
+
+    async def _run_client_command(self, request: dict,
+                                  writer: asyncio.StreamWriter):
+        response = {"id": request.get("id")}
+        try:
+            reply = await self.command(
+                int(request["cmd"]), bytes.fromhex(request.get("payload",
+                                                               "")))
+            response.update(status=reply.status, payload=reply.payload.hex())
+        except asyncio.TimeoutError:
+            response.update(status=int(sc.ReplyStatus.timeout))
+        except (KeyError, ValueError) as ex:
+            response.update(status=int(sc.ReplyStatus.bad_param),
+                            error=str(ex))
+        writer.write((json.dumps(response) + "\n").encode())
+
+    async def _serve_client(self, reader: asyncio.StreamReader,
+                            writer: asyncio.StreamWriter):
+        tasks = set()
+        try:
+            while line := await reader.readline():
+                request = json.loads(line)
+                if request.get("subscribe") == "pedal_events":
+                    self.subscribers.add(writer)
+                    writer.write(
+                        (json.dumps({"id": request.get("id")}) +
+                         "\n").encode())
+                    continue
+                # Commands from one client may overlap, replies carry the id.
+                task = asyncio.create_task(
+                    self._run_client_command(request, writer))
+                tasks.add(task)
+                task.add_done_callback(tasks.discard)
+        except (ConnectionError, json.JSONDecodeError):
+            pass
+        finally:
+            self.subscribers.discard(writer)
+            writer.close()
+
+
+class DaemonClient:
+    """Minimal client for scripts talking to the daemon."""
+
+    def __init__(self, reader, writer):
+        self.reader = reader
+        self.writer = writer
+        self.next_id = 1
+
+    @classmethod
+    async def connect(cls, socket_path: str = DEFAULT_SOCKET_PATH):
+        return cls(*await asyncio.open_unix_connection(socket_path))
+
+    async def command(self, cmd: int, payload: bytes = b"") -> tuple:
+        """Returns (status, payload). Not safe to call concurrently."""
+        request_id = self.next_id
+        self.next_id += 1
+        self.writer.write((json.dumps({
+            "id": request_id,
+            "cmd": cmd,
+            "payload": payload.hex()
+        }) + "\n").encode())
+        while True:
+            response = json.loads(await self.reader.readline())
+            if response.get("id") == request_id:
+                return response["status"], bytes.fromhex(
+                    response.get("payload", ""))
+
+    async def pedal_events(self):
+        self.writer.write(b'{"id": 0, "subscribe": "pedal_events"}\n')
+        while line := await self.reader.readline():
+            message = json.loads(line)
+            if message.get("event") == "pedal":
+                yield message
+
+    def close(self):
+        self.writer.close()
+
+
+def run_emulator(fd: int, stop: threading.Event):
+    """
+    Answer v2 requests on the master side of a pty like the firmware would:
+    CMD_IDENTIFY with the device name, everything else with an echo.
+    """
+    data = b""
+    while not stop.is_set():
+        try:
+            data += os.read(fd, 4096)
+        except OSError:
+            return
+        while (start := data.find(bytes([sc.V2_SOF]))) != -1:
+            pos = start + 4
+            length = shift = 0
+            while pos < len(data):
+                b = data[pos]
+                pos += 1
+                length |= (b & 0x7F) << shift
+                shift += 7
+                if not b & 0x80:
+                    break
+            else:
+                break
+            end = pos + length + 4
+            if len(data) < end:
+                break
+            seq, cmd = data[start + 2], data[start + 3]
+            payload = data[pos:end - 4]
+            data = data[end:]
+
+            if cmd == sc.CMD_IDENTIFY:
+                payload = sc.NAME + bytes([sc.PROTOCOL_V2])
+            body = bytes([sc.PROTOCOL_V2 | sc.V2_REPLY_FLAG, seq, cmd, 0
+                          ]) + sc.encode_varint(len(payload)) + payload
+            os.write(
+                fd,
+                bytes([sc.V2_SOF]) + body +
+                struct.pack("<I", zlib.crc32(body)))
+
+
+async def bench(count: int):
+    """Round trip latency through the daemon to a pty device emulator."""
+    import pty
+    import tty
+
+    master, slave = pty.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    stop = threading.Event()
+    threading.Thread(target=run_emulator, args=(master, stop),
+                     daemon=True).start()
+
+    socket_path = os.path.join(tempfile.mkdtemp(), "bench.sock")
+    daemon = Daemon(os.ttyname(slave), socket_path)
+    server = await daemon.start()
+    client = await DaemonClient.connect(socket_path)
+
+    samples = []
+    payload = bytes(range(16))
+    for _ in range(count):
+        t0 = time.perf_counter_ns()
+        status, reply = await client.command(sc.CMD_ECHO, payload)
+        samples.append((time.perf_counter_ns() - t0) / 1000)
+        assert status == 0 and reply == payload
+
+    client.close()
+    await client.writer.wait_closed()
+    server.close()
+    await server.wait_closed()
+    daemon.close()
+    stop.set()
+    samples.sort()
+    print(f"{count} echo round trips, client -> daemon -> pty -> emulator:")
+    for name, q in (("p50", 0.50), ("p90", 0.90), ("p99", 0.99)):
+        print(f"  {name}: {samples[int(q * (count - 1))]:8.1f} us")
+    print(f"  max: {samples[-1]:8.1f} us")
+
+
+async def serve(port: str, socket_path: str):
+    server = await Daemon(port, socket_path).start()
+    print(f"Serving {port} on {socket_path}")
+    async with server:
+        await server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest="action", required=True)
+    srv = sub.add_parser("serve", help="own the port and serve clients")
+    srv.add_argument("--port", help="serial device, found if omitted")
+    srv.add_argument("--socket", default=DEFAULT_SOCKET_PATH)
+    bch = sub.add_parser("bench", help="latency against a pty emulator")
+    bch.add_argument("--count", type=int, default=2000)
+
+    args = parser.parse_args()
+    if args.action == "bench":
+        asyncio.run(bench(args.count))
+        return
+
+    port = args.port or sc.find_footmouse_com_port_name()
+    if not port:
+        return
+    if not os.path.isabs(port) and os.name == "posix":
+        port = os.path.join("/dev", port)
+    asyncio.run(serve(port, args.socket))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,248 @@
+#ifndef FOOTMOUSE_HID_REPORT_QUEUE_H
+#define FOOTMOUSE_HID_REPORT_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Largest report sent through the queue (keyboard: modifiers, reserved and 6
+// keycodes).
+constexpr size_t HID_REPORT_MAX_LEN = 8;
+
+enum HidReportKind : uint8_t
+{
+  // Report holds the full pressed state of a device (keyboard, mouse buttons).
+  HID_REPORT_STATE = 0,
+  // Report is an event that must never be merged (absolute warps, movement).
+  HID_REPORT_EVENT = 1
+};
+
+struct HidReport
+{
+  uint8_t report_id;
+  uint8_t kind;
+  uint8_t len;
+  uint8_t data[HID_REPORT_MAX_LEN];
+};
+
+struct HidQueueStats
+{
+  uint32_t enqueued = 0;
+  uint32_t sent = 0;
+  uint32_t bytes_sent = 0;
+  uint32_t coalesced = 0;
+  uint32_t dropped = 0;
+  uint32_t send_failures = 0;
+  uint16_t depth = 0;
+  uint16_t peak_depth = 0;
+};
+
+static inline bool
+hid_same_state_device(const HidReport& a, const HidReport& b)
+{
+  return a.report_id == b.report_id && a.len == b.len &&
+         a.kind == HID_REPORT_STATE && b.kind == HID_REPORT_STATE;
+}
+
+/**
+ * Returns true if every pressed bit of prev is still pressed in next and prev
+ * carries no movement.
+ */
+static inline bool
+hid_state_contains(const HidReport& prev, const HidReport& next)
+{
+  if (!hid_same_state_device(prev, next)) {
+    return false;
+  }
+
+  if (0 == memcmp(prev.data, next.data, prev.len)) {
+    return true;
+  }
+
+  // First byte is the modifier / button bitmap for both keyboard and mouse.
+  if (prev.data[0] & ~next.data[0]) {
+    return false;
+  }
+
+  // Keyboard: every key in prev must still be present in next.
+  // Mouse: any other non-zero byte is movement, which can't be merged.
+  for (size_t i = 1; i < prev.len; i++) {
+    const uint8_t v = prev.data[i];
+    if (0 == v) {
+      continue;
+    }
+    if (prev.len != HID_REPORT_MAX_LEN || i < 2) {
+      return false;
+    }
+    bool found = false;
+    for (size_t j = 2; j < next.len; j++) {
+      if (next.data[j] == v) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Bounded FIFO of HID reports. Producers enqueue without blocking and the
+ * endpoint is drained from the report-complete callback.
+ *
+ * Sending is split so the caller can keep the endpoint call out of its
+ * critical section: take_next() hands out the head report and marks it in
+ * flight, the caller sends it unguarded and passes the outcome to
+ * send_done(). The head stays queued until on_complete(), so a failed send
+ * leaves it first in line for the next attempt.
+ *
+ * Not thread safe; callers guard access (e.g. with a critical section).
+ */
+template<size_t CAPACITY>
+class HidReportQueue
+{
+public:
+  /**
+   * Queue a report. Superseded state reports still waiting in the queue are
+   * merged: the pending tail is replaced when the sequence
+   * predecessor -> tail -> report only ever presses, so the host observes the
+   * same edges, just slightly later. When full, the newest pending state
+   * report for the same device is overwritten since state reports are
+   * authoritative; the intermediate transition is counted as dropped.
+   */
+  bool push(const HidReport& report)
+  {
+    stats.enqueued++;
+
+    // Never touch the head while it is in flight.
+    const size_t first_mutable = in_flight ? 1 : 0;
+
+    if (count > first_mutable && supersedes_tail(report)) {
+      at(count - 1) = report;
+      stats.coalesced++;
+      return true;
+    }
+
+    if (count >= CAPACITY) {
+      for (size_t i = count; i-- > first_mutable;) {
+        HidReport& r = at(i);
+        if (r.report_id == report.report_id && r.kind == HID_REPORT_STATE &&
+            report.kind == HID_REPORT_STATE) {
+          r = report;
+          stats.dropped++;
+          return true;
+        }
+      }
+      stats.dropped++;
+      return false;
+    }
+
+    at(count) = report;
+    count++;
+    update_depth();
+    return true;
+  }
+
+  /**
+   * Copy the head report for sending and mark it in flight. Returns false if
+   * the queue is empty or a report is already in flight.
+   */
+  bool take_next(HidReport& report)
+  {
+    if (in_flight || 0 == count) {
+      return false;
+    }
+    report = at(0);
+    in_flight = true;
+    return true;
+  }
+
+  /**
+   * Outcome of sending the report from take_next(). The completion may
+   * already have been handled, so a successful send only updates stats.
+   */
+  void send_done(const HidReport& report, bool sent)
+  {
+    if (!sent) {
+      in_flight = false;
+      stats.send_failures++;
+      return;
+    }
+    stats.sent++;
+    stats.bytes_sent += report.len;
+  }
+
+  /**
+   * Called when the endpoint finished sending the in-flight report.
+   */
+  void on_complete()
+  {
+    if (in_flight) {
+      in_flight = false;
+      pop();
+    }
+  }
+
+  /**
+   * Forget the in-flight marker, e.g. after a bus reset where the completion
+   * callback will never come.
+   */
+  void abort_in_flight() { in_flight = false; }
+
+  size_t depth() const { return count; }
+  bool empty() const { return 0 == count; }
+  size_t free_slots() const { return CAPACITY - count; }
+
+  HidQueueStats stats;
+
+private:
+  HidReport buf[CAPACITY];
+  size_t head = 0;
+  size_t count = 0;
+  bool in_flight = false;
+
+  HidReport& at(size_t i) { return buf[(head + i) % CAPACITY]; }
+
+  bool supersedes_tail(const HidReport& report)
+  {
+    const HidReport& tail = at(count - 1);
+    if (!hid_same_state_device(tail, report)) {
+      return false;
+    }
+    if (0 == memcmp(tail.data, report.data, tail.len)) {
+      return true;
+    }
+
+    // Releasing and re-pressing a key would be lost, so the tail must itself
+    // have been a pure press relative to the previous report of this device.
+    for (size_t i = count - 1; i-- > 0;) {
+      const HidReport& prev = at(i);
+      if (prev.report_id == report.report_id) {
+        return hid_state_contains(prev, tail) &&
+               hid_state_contains(tail, report);
+      }
+    }
+    return false;
+  }
+
+  void pop()
+  {
+    if (count) {
+      head = (head + 1) % CAPACITY;
+      count--;
+      update_depth();
+    }
+  }
+
+  void update_depth()
+  {
+    stats.depth = count;
+    if (count > stats.peak_depth) {
+      stats.peak_depth = count;
+    }
+  }
+};
+
+#endif // FOOTMOUSE_HID_REPORT_QUEUE_H
@@ -0,0 +1,214 @@
+#ifndef FOOTMOUSE_HID_STATE_H
+#define FOOTMOUSE_HID_STATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ascii_hid.h"
+#include "constants.h"
+
+constexpr size_t HID_KEY_SLOTS = 6;
+
+/**
+ * Pressed keyboard keys and mouse buttons. Keycodes use the Teensy encoding
+ * shared with tinyusbkeycodes.h: modifier bits as 0xE0xx, usage IDs as
+ * 0xF0xx and plain ASCII characters below 0x100.
+ */
+struct HidState
+{
+  uint8_t modifiers = 0;
+  uint8_t keys[HID_KEY_SLOTS] = { 0 };
+  uint8_t mouse_buttons = 0;
+
+  /**
+   * Returns false for keycodes that aren't part of the keyboard report, e.g.
+   * media keys. The caller sends those itself.
+   */
+  bool press(uint16_t k)
+  {
+    uint8_t mod = 0;
+    const uint8_t usage = usage_of(k, mod);
+    if (!usage && !mod) {
+      return false;
+    }
+    modifiers |= mod;
+    add_key(usage);
+    return true;
+  }
+
+  bool release(uint16_t k)
+  {
+    uint8_t mod = 0;
+    const uint8_t usage = usage_of(k, mod);
+    if (!usage && !mod) {
+      return false;
+    }
+    modifiers &= ~mod;
+    remove_key(usage);
+    return true;
+  }
+
+  void press_buttons(uint8_t buttons) { mouse_buttons |= buttons; }
+  void release_buttons(uint8_t buttons) { mouse_buttons &= ~buttons; }
+  void release_all() { *this = HidState(); }
+
+  bool keyboard_idle() const { return !modifiers && !keys[0]; }
+
+  bool same_keyboard(const HidState& other) const
+  {
+    return modifiers == other.modifiers &&
+           0 == memcmp(keys, other.keys, sizeof(keys));
+  }
+
+private:
+  static uint8_t usage_of(uint16_t k, uint8_t& mod)
+  {
+    mod = 0;
+    switch (k & 0xFF00) {
+      case 0xE000:
+        mod = k & 0xFF;
+        return 0;
+      case 0xF000:
+        return k & 0xFF;
+      case 0x0000:
+        return ascii_to_hid_usage(static_cast<char>(k), mod);
+      default:
+        return 0;
+    }
+  }
+
+  // Keys stay packed at the front in press order, so reports are
+  // deterministic.
+  void add_key(uint8_t usage)
+  {
+    if (!usage) {
+      return;
+    }
+    for (size_t i = 0; i < HID_KEY_SLOTS; i++) {
+      if (keys[i] == usage) {
+        return;
+      }
+      if (!keys[i]) {
+        keys[i] = usage;
+        return;
+      }
+    }
+  }
+
+  void remove_key(uint8_t usage)
+  {
+    if (!usage) {
+      return;
+    }
+    size_t out = 0;
+    for (size_t i = 0; i < HID_KEY_SLOTS; i++) {
+      if (keys[i] != usage) {
+        keys[out++] = keys[i];
+      }
+    }
+    while (out < HID_KEY_SLOTS) {
+      keys[out++] = 0;
+    }
+  }
+};
+
+struct __attribute__((packed)) HidStateStats
+{
+  uint32_t keyboard_reports = 0;
+  uint32_t mouse_reports = 0;
+  uint32_t send_failures = 0;
+  uint32_t resyncs = 0;
+};
+
+/**
+ * The one authoritative keyboard and mouse button state. Pedal actions only
+ * edit `state`; commit() runs once per tick and sends a report for each
+ * device whose state differs from what was last sent, so several pedals
+ * changing in one tick produce one report.
+ *
+ * A report that failed to send is retried on the next commit. To heal
+ * reports the host lost after they were sent, the full state is sent again
+ * when the endpoint becomes ready (mount, resume), HID_RESYNC_MS after a
+ * change and every HID_RESYNC_MS while anything is held. An idle device
+ * sends nothing.
+ *
+ * Actions that need an intermediate state on the wire, like a click, call
+ * commit() between the steps.
+ *
+ * The Sink type must provide:
+ *   bool ready();
+ *   bool send_keyboard(uint8_t modifiers, const uint8_t* keys);
+ *   bool send_mouse_buttons(uint8_t buttons);
+ */
+class HidStateModel
+{
+public:
+  HidState state;
+  HidStateStats stats;
+
+  /**
+   * Send the full state on the next commit, e.g. after something else wrote
+   * keyboard reports behind the model's back.
+   */
+  void request_resync() { keyboard_synced = mouse_synced = false; }
+
+  template<typename Sink>
+  void commit(Sink& sink, uint32_t now_ms)
+  {
+    if (!sink.ready()) {
+      was_ready = false;
+      return;
+    }
+
+    if (!was_ready || (resync_pending &&
+                       static_cast<int32_t>(now_ms - resync_at_ms) >= 0)) {
+      was_ready = true;
+      resync_pending = false;
+      request_resync();
+      stats.resyncs++;
+    }
+
+    const bool changed = !sent.same_keyboard(state) ||
+                         sent.mouse_buttons != state.mouse_buttons;
+
+    if (!keyboard_synced || !sent.same_keyboard(state)) {
+      if (sink.send_keyboard(state.modifiers, state.keys)) {
+        sent.modifiers = state.modifiers;
+        memcpy(sent.keys, state.keys, sizeof(sent.keys));
+        keyboard_synced = true;
+        stats.keyboard_reports++;
+      } else {
+        keyboard_synced = false;
+        stats.send_failures++;
+      }
+    }
+
+    if (!mouse_synced || sent.mouse_buttons != state.mouse_buttons) {
+      if (sink.send_mouse_buttons(state.mouse_buttons)) {
+        sent.mouse_buttons = state.mouse_buttons;
+        mouse_synced = true;
+        stats.mouse_reports++;
+      } else {
+        mouse_synced = false;
+        stats.send_failures++;
+      }
+    }
+
+    const bool held = !state.keyboard_idle() || state.mouse_buttons;
+    if ((changed || held) && !resync_pending) {
+      resync_pending = true;
+      resync_at_ms = now_ms + HID_RESYNC_MS;
+    }
+  }
+
+private:
+  HidState sent;
+  bool keyboard_synced = false;
+  bool mouse_synced = false;
+  bool was_ready = false;
+  bool resync_pending = false;
+  uint32_t resync_at_ms = 0;
+};
+
+#endif // FOOTMOUSE_HID_STATE_H
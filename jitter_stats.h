@@ -0,0 +1,35 @@
+#ifndef FOOTMOUSE_JITTER_STATS_H
+#define FOOTMOUSE_JITTER_STATS_H
+
+#include <stdint.h>
+
+/**
+ * Running statistics of sample intervals in CPU cycles. O(1) per sample so it
+ * can be updated from the sampling interrupt. The host derives the mean and
+ * standard deviation from the sums.
+ */
+struct __attribute__((packed)) JitterStats
+{
+  uint32_t count = 0;
+  uint32_t min_cycles = UINT32_MAX;
+  uint32_t max_cycles = 0;
+  uint64_t sum_cycles = 0;
+  uint64_t sum_sq_cycles = 0;
+
+  void add(uint32_t interval)
+  {
+    count++;
+    if (interval < min_cycles) {
+      min_cycles = interval;
+    }
+    if (interval > max_cycles) {
+      max_cycles = interval;
+    }
+    sum_cycles += interval;
+    sum_sq_cycles += static_cast<uint64_t>(interval) * interval;
+  }
+
+  void reset() { *this = JitterStats(); }
+};
+
+#endif // FOOTMOUSE_JITTER_STATS_H
@@ -0,0 +1,92 @@
+#ifndef FOOTMOUSE_LOG_H
+#define FOOTMOUSE_LOG_H
+
+#include <Arduino.h>
+#include <type_traits>
+
+#include "constants.h"
+#include "critical_section.h"
+#include "spsc_ring.h"
+
+/*
+ * Logging without printf or blocking serial writes.
+ *
+ * A message is a fixed id plus two integer arguments, pushed into a RAM ring
+ * and sent in binary frames by service_log() when the serial port has room.
+ * Messages above LOG_MAX_LEVEL compile to an empty inline function. The
+ * format strings live in log_decode.py, keep LogMsgId in sync with it.
+ */
+
+enum LogLevel : uint8_t
+{
+  LOG_ERROR = 1,
+  LOG_WARN = 2,
+  LOG_INFO = 3,
+  LOG_DEBUG = 4,
+};
+
+// Never renumber, only append.
+enum LogMsgId : uint8_t
+{
+  LOG_MSG_USB_INIT = 1,
+  LOG_MSG_USB_HID_BEGIN_FAILED = 2,
+  LOG_MSG_USB_REMOUNT = 3,
+  LOG_MSG_USB_MOUNTED = 4,   // a: 1 mounted, 0 unmounted
+  LOG_MSG_RELEASE_ALL = 5,
+  LOG_MSG_TYPE_STRING = 6,   // a: length
+  LOG_MSG_SERIAL_TIMEOUT = 7,
+  LOG_MSG_FRAME_NO_SOF = 8,
+  LOG_MSG_FRAME_TRUNCATED = 9,  // a: bytes received, b: bytes expected
+  LOG_MSG_FRAME_TOO_BIG = 10,   // a: length, b: buffer size
+  LOG_MSG_FRAME_INVALID = 11,
+  LOG_MSG_FRAME_V2_ERROR = 12,  // a: ReplyStatus, b: cmd
+  LOG_MSG_PIN_READ_CYCLES = 13, // a: digitalRead loop, b: read_pedal_levels
+  LOG_MSG_PIN_MAP_MISMATCH = 14,
+};
+
+struct __attribute__((packed)) LogRecord
+{
+  uint32_t t_us;
+  uint8_t level;
+  uint8_t id;
+  uint16_t reserved;
+  uint32_t a;
+  uint32_t b;
+};
+
+static_assert(sizeof(LogRecord) == 16, "");
+
+using LogRing = SpscRing<LogRecord, LOG_RING_LEN>;
+
+/**
+ * Shared by every translation unit that logs. Not static: an inline function
+ * has one instance, and with it one ring, across the whole program.
+ */
+inline LogRing&
+log_ring()
+{
+  static LogRing ring;
+  return ring;
+}
+
+/**
+ * Messages come from the main loop, the USB shim and FreeRTOS tasks, so
+ * pushes are serialized by masking interrupts. The timestamp is taken under
+ * the mask, so messages are in time order. A full ring drops the message.
+ */
+template<LogLevel LEVEL>
+static inline typename std::enable_if<(LEVEL <= LOG_MAX_LEVEL)>::type
+log_msg(LogMsgId id, uint32_t a = 0, uint32_t b = 0)
+{
+  IrqGuard guard;
+  const LogRecord record{ static_cast<uint32_t>(micros()), LEVEL, id, 0, a, b };
+  log_ring().push(record);
+}
+
+template<LogLevel LEVEL>
+static inline typename std::enable_if<(LEVEL > LOG_MAX_LEVEL)>::type
+log_msg(LogMsgId, uint32_t = 0, uint32_t = 0)
+{
+}
+
+#endif // FOOTMOUSE_LOG_H
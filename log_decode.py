@@ -0,0 +1,114 @@
+"""
+Decode the footmouse binary log frames (see log.h).
+
+Usage:
+    python log_decode.py live
+    python log_decode.py decode capture.bin
+"""
+import argparse
+import struct
+
+import serial
+
+import serial_commands as sc
+
+REPLY_LOG_FRAME = 0xF1
+
+FRAME_HEADER_FMT = "<IHxx"
+RECORD_FMT = "<IBBxxII"
+
+LEVEL_NAMES = {1: "ERROR", 2: "WARN", 3: "INFO", 4: "DEBUG"}
+
+# Keep in sync with LogMsgId in log.h. Formatted with the record's a and b.
+MESSAGES = {
+    1: "Initializing usb.",
+    2: "Failed to begin usb_hid.",
+    3: "tusb already mounted, re-attaching.",
+    4: "USB mounted={a}.",
+    5: "Releasing all keys.",
+    6: "Typing string of {a} chars.",
+    7: "Serial read timed out.",
+    8: "No start-of-frame found.",
+    9: "Frame truncated, received {a} of {b} bytes.",
+    10: "Frame payload of {a} bytes exceeds buffer of {b} bytes.",
+    11: "Not a valid message.",
+    12: "Rejected v2 frame for cmd {b}: {status}.",
+    13: "Reading all pedals takes {a} cycles with digitalRead, {b} direct.",
+    14: "PEDAL_GPIOS doesn't match the core's pin map.",
+}
+
+
+def format_record(id_: int, a: int, b: int) -> str:
+    fmt = MESSAGES.get(id_)
+    if fmt is None:
+        return f"unknown message {id_} a={a} b={b}"
+    status = sc.ReplyStatus(a).name if a < len(sc.ReplyStatus) else a
+    return fmt.format(a=a, b=b, status=status)
+
+
+def decode_frame(payload: bytes):
+    """Yield (t_us, level, text) for every record in a log frame."""
+    _, count = struct.unpack_from(FRAME_HEADER_FMT, payload)
+    offset = struct.calcsize(FRAME_HEADER_FMT)
+    record_size = struct.calcsize(RECORD_FMT)
+    for i in range(count):
+        t, level, id_, a, b = struct.unpack_from(RECORD_FMT, payload,
+                                                 offset + i * record_size)
+        yield t, LEVEL_NAMES.get(level, str(level)), format_record(id_, a, b)
+
+
+class LogPrinter:
+
+    def __init__(self):
+        self.dropped_seen = 0
+
+    def feed(self, frame: sc.ReplyFrame):
+        if frame.cmd != REPLY_LOG_FRAME:
+            return
+        (dropped, ) = struct.unpack_from("<I", frame.payload)
+        if dropped != self.dropped_seen:
+            print(f"warning: {dropped - self.dropped_seen} log messages "
+                  "dropped on device")
+            self.dropped_seen = dropped
+        for t, level, text in decode_frame(frame.payload):
+            print(f"{t / 1e6:12.6f} {level:<5} {text}")
+
+
+def live():
+    port = sc.find_footmouse_com_port_name()
+    if not port:
+        return
+
+    printer = LogPrinter()
+    data = b""
+    with serial.Serial(port, sc.BAUD_RATE, timeout=0.1) as s:
+        try:
+            while True:
+                frames, data = sc.split_reply_frames(
+                    data + s.read(max(1, s.in_waiting)))
+                for frame in frames:
+                    printer.feed(frame)
+        except KeyboardInterrupt:
+            pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest="action", required=True)
+    sub.add_parser("live", help="print log messages from the device")
+    dec = sub.add_parser("decode", help="decode a raw serial capture")
+    dec.add_argument("input")
+
+    args = parser.parse_args()
+    if args.action == "live":
+        live()
+    else:
+        printer = LogPrinter()
+        with open(args.input, "rb") as f:
+            frames, _ = sc.split_reply_frames(f.read())
+        for frame in frames:
+            printer.feed(frame)
+
+
+if __name__ == "__main__":
+    main()
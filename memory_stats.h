@@ -0,0 +1,239 @@
+#ifndef FOOTMOUSE_MEMORY_STATS_H
+#define FOOTMOUSE_MEMORY_STATS_H
+
+#include <malloc.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "boards.h"
+
+constexpr uint8_t MEMORY_STATS_VERSION = 1;
+
+// Same fill as FreeRTOS uses for task stacks, so one scan works for both.
+constexpr uint32_t STACK_PAINT = 0xA5A5A5A5;
+
+// Words below the painting function's frame left alone.
+constexpr size_t STACK_PAINT_MARGIN_WORDS = 32;
+
+// Never renumber, only append. Keep in sync with the name lists in
+// serial_commands.py.
+enum MemRegionId : uint8_t
+{
+  MEM_REGION_BUTTONS = 0,
+  MEM_REGION_PAYLOAD_BUF = 1,
+  MEM_REGION_PEDAL_EVENTS = 2,
+  MEM_REGION_PEDAL_NOTIFY = 3,
+  MEM_REGION_TRACE = 4,
+  MEM_REGION_LOG = 5,
+  MEM_REGION_SCOPE = 6,
+  MEM_REGION_CONFIG = 7,
+  MEM_REGION_CHORDS = 8,
+  MEM_REGION_ANALOG = 9,
+  MEM_REGION_HID_STATE = 10,
+};
+
+enum MemStackId : uint8_t
+{
+  // The MSP: main loop and interrupts on Teensy, interrupts only on nRF52.
+  MEM_STACK_MAIN = 0,
+  MEM_STACK_LOOP_TASK = 1,
+  MEM_STACK_INPUT_TASK = 2,
+  MEM_STACK_HID_TASK = 3,
+  MEM_STACK_SERIAL_TASK = 4,
+};
+
+enum MemQueueId : uint8_t
+{
+  MEM_QUEUE_PEDAL_EVENTS = 0,
+  MEM_QUEUE_PEDAL_NOTIFY = 1,
+  MEM_QUEUE_TRACE = 2,
+  MEM_QUEUE_LOG = 3,
+  MEM_QUEUE_HID_TX = 4,
+};
+
+/**
+ * CMD_GET_MEMORY_STATS reply header, followed by region_count
+ * MemRegionEntry, stack_count MemStackEntry and queue_count MemQueueEntry.
+ */
+struct __attribute__((packed)) MemoryStatsHeader
+{
+  uint8_t version = MEMORY_STATS_VERSION;
+  uint8_t region_count = 0;
+  uint8_t stack_count = 0;
+  uint8_t queue_count = 0;
+  uint32_t flash_bytes = 0;
+  uint32_t data_bytes = 0;
+  uint32_t bss_bytes = 0;
+  uint32_t heap_bytes = 0;
+  uint32_t heap_free = 0;
+  uint32_t heap_largest_block = 0;
+};
+
+// Static RAM owned by one subsystem.
+struct __attribute__((packed)) MemRegionEntry
+{
+  uint8_t id;
+  uint8_t reserved[3];
+  uint32_t bytes;
+};
+
+// size_bytes is 0 when the stack size isn't known.
+struct __attribute__((packed)) MemStackEntry
+{
+  uint8_t id;
+  uint8_t reserved[3];
+  uint32_t size_bytes;
+  uint32_t unused_bytes;
+};
+
+struct __attribute__((packed)) MemQueueEntry
+{
+  uint8_t id;
+  uint8_t reserved;
+  uint16_t capacity;
+  uint16_t peak_depth;
+  uint16_t reserved2;
+  uint32_t dropped;
+};
+
+#if !defined(ARDUINO)
+// Host test builds have no linker script symbols or main stack to scan, so
+// the main stack reads as empty and the layout as all zeros.
+static inline uint32_t*
+main_stack_bottom()
+{
+  return nullptr;
+}
+
+static inline uint32_t*
+main_stack_top()
+{
+  return nullptr;
+}
+
+static inline void
+paint_main_stack()
+{
+}
+
+static inline void
+fill_memory_layout(MemoryStatsHeader&)
+{
+}
+#else
+// Linker script symbols.
+#if defined(BOARD_TEENSY4)
+extern "C" char _flashimagelen, _sdata, _edata, _sbss, _ebss, _estack;
+extern "C" char _heap_start, _heap_end;
+#elif defined(BOARD_NRF52)
+extern "C" char __isr_vector, __etext, __data_start__, __data_end__;
+extern "C" char __bss_start__, __bss_end__, __HeapBase, __HeapLimit;
+extern "C" char __StackLimit, __StackTop;
+#endif
+
+static inline uint32_t*
+main_stack_bottom()
+{
+#if defined(BOARD_TEENSY4)
+  // The stack grows down from the top of DTCM towards .bss.
+  return reinterpret_cast<uint32_t*>((reinterpret_cast<uintptr_t>(&_ebss) + 3) &
+                                     ~uintptr_t(3));
+#else
+  return reinterpret_cast<uint32_t*>(&__StackLimit);
+#endif
+}
+
+static inline uint32_t*
+main_stack_top()
+{
+#if defined(BOARD_TEENSY4)
+  return reinterpret_cast<uint32_t*>(&_estack);
+#else
+  return reinterpret_cast<uint32_t*>(&__StackTop);
+#endif
+}
+
+/**
+ * Fill the unused part of the main stack with STACK_PAINT. Call first thing
+ * in setup(). Interrupt frames below the current stack pointer are dead
+ * whenever this code runs, so interrupts can stay enabled.
+ */
+__attribute__((noinline)) static void
+paint_main_stack()
+{
+#if defined(BOARD_TEENSY4)
+  uint32_t marker;
+  uint32_t* const sp = &marker;
+#else
+  // setup() runs on a task stack, the MSP is idle here.
+  uint32_t* const sp = reinterpret_cast<uint32_t*>(__get_MSP());
+#endif
+  for (uint32_t* p = main_stack_bottom(); p < sp - STACK_PAINT_MARGIN_WORDS;
+       p++) {
+    *p = STACK_PAINT;
+  }
+}
+
+/**
+ * Fill in the link time sizes and the heap figures of header.
+ */
+static inline void
+fill_memory_layout(MemoryStatsHeader& header)
+{
+  char* heap_start;
+  char* heap_end;
+#if defined(BOARD_TEENSY4)
+  header.flash_bytes = reinterpret_cast<uintptr_t>(&_flashimagelen);
+  header.data_bytes = &_edata - &_sdata;
+  header.bss_bytes = &_ebss - &_sbss;
+  heap_start = &_heap_start;
+  heap_end = &_heap_end;
+#else
+  header.data_bytes = &__data_end__ - &__data_start__;
+  // .data is stored in flash right after the code.
+  header.flash_bytes = &__etext - &__isr_vector + header.data_bytes;
+  header.bss_bytes = &__bss_end__ - &__bss_start__;
+  heap_start = &__HeapBase;
+  heap_end = &__HeapLimit;
+#endif
+  header.heap_bytes = heap_end - heap_start;
+
+  // Free chunks inside the arena plus what sbrk() hasn't handed out yet.
+  char* const brk = static_cast<char*>(sbrk(0));
+  header.heap_free = mallinfo().fordblks + (heap_end - brk);
+
+  // Binary search for the largest allocation that succeeds.
+  uint32_t lo = 0;
+  uint32_t hi = header.heap_free;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo + 1) / 2;
+    void* p = malloc(mid);
+    if (p) {
+      free(p);
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  header.heap_largest_block = lo;
+}
+#endif // ARDUINO
+
+/**
+ * Bytes at the bottom of the main stack that were never written.
+ */
+static inline uint32_t
+main_stack_unused_bytes()
+{
+  const uint32_t* const bottom = main_stack_bottom();
+  const uint32_t* const top = main_stack_top();
+  const uint32_t* p = bottom;
+  while (p < top && *p == STACK_PAINT) {
+    p++;
+  }
+  return (p - bottom) * sizeof(uint32_t);
+}
+
+#endif // FOOTMOUSE_MEMORY_STATS_H
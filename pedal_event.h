@@ -0,0 +1,18 @@
+#ifndef FOOTMOUSE_PEDAL_EVENT_H
+#define FOOTMOUSE_PEDAL_EVENT_H
+
+#include <stdint.h>
+
+/**
+ * A debounced pedal edge, handed from the input sampler to the code that
+ * sends HID input.
+ */
+struct PedalEvent
+{
+  uint8_t index;    // Index into buttons.
+  uint8_t state;    // Debounced pin state after the edge.
+  uint32_t time_us; // micros() when the edge was accepted.
+  uint32_t edge_us; // micros() when the pin first changed.
+};
+
+#endif // FOOTMOUSE_PEDAL_EVENT_H
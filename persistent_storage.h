@@ -2,29 +2,63 @@
 
 #include <Arduino.h>
 
-#include <EEPROM.h>
-
+#include "boards.h"
 #include "constants.h"
 
+#if defined(BOARD_TEENSY4)
+#include <EEPROM.h>
+#endif
+
 constexpr int flashed_index = 0;
 constexpr int starting_index = 1;
 
+// Stored in the flashed byte. Bump when the MemoryView layout changes so old
+// contents are treated as uninitialized.
+constexpr uint8_t memory_layout_version = 0x02;
+
+// A mode of 0 means the pedal uses its default mode.
 struct MemButton
 {
   uint8_t mode;
   uint8_t trig_direction;
 } __attribute__((packed));
 
+// Select a profile when exactly these pedals are connected at boot.
+// A connected_mask of 0 marks an unused rule.
+struct ProfileRule
+{
+  uint8_t connected_mask;
+  uint8_t profile;
+} __attribute__((packed));
+
 template<int BUTTON_COUNT>
 struct MemoryView
 {
-  std::array<MemButton, BUTTON_COUNT> buttons;
+  // Used when no rule matches the connected pedals.
+  uint8_t default_profile;
+  std::array<std::array<MemButton, BUTTON_COUNT>, PROFILE_COUNT> profiles;
+  std::array<ProfileRule, PROFILE_RULE_COUNT> rules;
+
+  /**
+   * Pick the profile for the pedals detected at boot.
+   */
+  uint8_t select_profile(uint8_t connected_mask) const
+  {
+    for (const auto& rule : rules) {
+      if (rule.connected_mask != 0 && rule.connected_mask == connected_mask &&
+          rule.profile < PROFILE_COUNT) {
+        return rule.profile;
+      }
+    }
+    return default_profile < PROFILE_COUNT ? default_profile : 0;
+  }
 } __attribute__((packed));
 
+#if defined(BOARD_TEENSY4)
 bool
 is_memory_initialized()
 {
-  return (0x01 == EEPROM[flashed_index]);
+  return (memory_layout_version == EEPROM[flashed_index]);
 }
 
 void
@@ -33,23 +67,46 @@ invalidate_memory()
   EEPROM[flashed_index] = 0x00;
 }
 
+// One block read instead of a read per byte, this runs before USB starts.
 void
 load_memory(uint8_t* buf, size_t size)
 {
-  for (size_t i = 0; i < size; i++) {
-    buf[i] = EEPROM[starting_index + i];
-  }
+  eeprom_read_block(buf, reinterpret_cast<const void*>(starting_index), size);
 }
 
 void
 update_memory(uint8_t* buf, size_t size)
 {
-  EEPROM.update(flashed_index, 0x01);
+  EEPROM.update(flashed_index, memory_layout_version);
 
   for (size_t i = 0; i < size; i++) {
     EEPROM.update(starting_index + i, buf[i]);
   }
 }
+#else
+// The nRF52 boards have no EEPROM. Settings last until the next reset, which
+// boots with the defaults.
+bool
+is_memory_initialized()
+{
+  return false;
+}
+
+void
+invalidate_memory()
+{
+}
+
+void
+load_memory(uint8_t*, size_t)
+{
+}
+
+void
+update_memory(uint8_t*, size_t)
+{
+}
+#endif
 
 // MemButton
 // get_button(int idx)
@@ -0,0 +1,144 @@
+#ifndef FOOTMOUSE_PIN_TABLE_H
+#define FOOTMOUSE_PIN_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+#include "boards.h"
+#include "critical_section.h"
+#include "cycles.h"
+
+/**
+ * Pedal pins of the selected board in pedal index order. Since every pin is
+ * a compile time constant, read_pedal_levels() compiles to direct GPIO
+ * register reads and bit extraction instead of a digitalRead() pin lookup per
+ * pedal.
+ */
+#if defined(BOARD_TEENSY_4_3_BUTTONS)
+constexpr uint8_t PEDAL_PINS[] = { 4, 5, 6 };
+
+#elif defined(BOARD_NRF52840_SEEDSTUDIO_4_BUTTONS)
+constexpr uint8_t PEDAL_PINS[] = { D6, D7, D10, D3 };
+
+// GPIO of each pin as port * 32 + bit, must match the XIAO variant's
+// g_ADigitalPinMap. check_pedal_gpios() verifies this at startup.
+constexpr uint8_t PEDAL_GPIOS[] = {
+  32 + 11, // D6 = P1.11
+  32 + 12, // D7 = P1.12
+  32 + 15, // D10 = P1.15
+  29,      // D3 = P0.29
+};
+static_assert(sizeof(PEDAL_GPIOS) == sizeof(PEDAL_PINS), "");
+#endif
+
+constexpr size_t PEDAL_PIN_COUNT = sizeof(PEDAL_PINS) / sizeof(PEDAL_PINS[0]);
+
+static_assert(PEDAL_PIN_COUNT <= 32, "Levels are returned as a bit mask.");
+
+#if defined(BOARD_TEENSY4)
+
+template<size_t I>
+static inline typename std::enable_if<(I == PEDAL_PIN_COUNT), uint32_t>::type
+read_pedal_levels()
+{
+  return 0;
+}
+
+template<size_t I = 0>
+static inline typename std::enable_if<(I < PEDAL_PIN_COUNT), uint32_t>::type
+read_pedal_levels()
+{
+  return (static_cast<uint32_t>(digitalReadFast(PEDAL_PINS[I])) << I) |
+         read_pedal_levels<I + 1>();
+}
+
+#else
+
+template<size_t I>
+static inline typename std::enable_if<(I == PEDAL_PIN_COUNT), uint32_t>::type
+extract_pedal_levels(uint32_t, uint32_t)
+{
+  return 0;
+}
+
+template<size_t I = 0>
+static inline typename std::enable_if<(I < PEDAL_PIN_COUNT), uint32_t>::type
+extract_pedal_levels(uint32_t port0, uint32_t port1)
+{
+  constexpr uint8_t gpio = PEDAL_GPIOS[I];
+  return ((((gpio < 32 ? port0 : port1) >> (gpio & 31)) & 1) << I) |
+         extract_pedal_levels<I + 1>(port0, port1);
+}
+
+/**
+ * Both ports are latched once, so all pedals are sampled at the same time.
+ */
+static inline uint32_t
+read_pedal_levels()
+{
+  return extract_pedal_levels(NRF_P0->IN, NRF_P1->IN);
+}
+
+/**
+ * Returns false if PEDAL_GPIOS disagrees with the core's pin map.
+ */
+static inline bool
+check_pedal_gpios()
+{
+  for (size_t i = 0; i < PEDAL_PIN_COUNT; i++) {
+    if (g_ADigitalPinMap[PEDAL_PINS[i]] != PEDAL_GPIOS[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif // BOARD_TEENSY4
+
+/**
+ * Cycles for one read of all pedals with digitalRead() on runtime pin numbers,
+ * as the sampler used to, and with read_pedal_levels().
+ */
+struct __attribute__((packed)) PinReadCycles
+{
+  uint32_t generic = 0;
+  uint32_t fast = 0;
+};
+
+static inline PinReadCycles
+measure_pin_read_cycles()
+{
+  constexpr uint32_t ROUNDS = 64;
+
+  // volatile keeps the pins runtime values and the reads from being dropped.
+  volatile uint8_t pins[PEDAL_PIN_COUNT];
+  for (size_t i = 0; i < PEDAL_PIN_COUNT; i++) {
+    pins[i] = PEDAL_PINS[i];
+  }
+  volatile uint32_t sink = 0;
+
+  PinReadCycles result;
+  IrqGuard guard;
+
+  uint32_t start = cycle_count();
+  for (uint32_t r = 0; r < ROUNDS; r++) {
+    uint32_t levels = 0;
+    for (size_t i = 0; i < PEDAL_PIN_COUNT; i++) {
+      levels |= static_cast<uint32_t>(digitalRead(pins[i])) << i;
+    }
+    sink = levels;
+  }
+  result.generic = (cycle_count() - start) / ROUNDS;
+
+  start = cycle_count();
+  for (uint32_t r = 0; r < ROUNDS; r++) {
+    sink = read_pedal_levels();
+  }
+  result.fast = (cycle_count() - start) / ROUNDS;
+
+  (void)sink;
+  return result;
+}
+
+#endif // FOOTMOUSE_PIN_TABLE_H
@@ -0,0 +1,164 @@
+"""
+Bytes and round trip times of serial protocol v1 and v2 on a pty loopback.
+
+A thread plays the device on the master side of a pty and answers every
+request in the framing it came in: v1 requests with a v1 binary reply,
+v2 requests with a v2 reply. The payload is echoed back. The host side
+goes through serial_commands.py like the real tools do. With no USB in the
+path, the times are host overhead. Real devices add the bus.
+
+v1 replies are modelled as binary replies, its best case. Most v1
+commands answer with text or nothing, and the host waits for a read
+timeout instead.
+
+Usage:
+    python protocol_bench.py [--count 2000]
+"""
+import argparse
+import os
+import statistics
+import struct
+import threading
+import time
+import zlib
+
+import serial
+
+import serial_commands as sc
+
+V1_REQUEST_FMT = "<IIII"
+V1_REQUEST_SOF = 0xFFFFFFFF
+
+# Typical requests: (name, cmd, payload).
+REQUESTS = (
+    ("set_button_function", sc.CMD_SET_BUTTON_FUNCTION, bytes(3)),
+    ("keep_awake_enable", sc.CMD_KEEP_AWAKE_ENABLE, b""),
+    ("set_warp_target", sc.CMD_SET_WARP_TARGET, bytes(5)),
+    ("type_ascii_str", sc.CMD_TYPE_ASCII_STR, b"hello world\0"),
+    ("echo_64", sc.CMD_ECHO, bytes(range(64))),
+)
+
+
+def v1_request(cmd: int, payload: bytes) -> bytes:
+    return struct.pack(V1_REQUEST_FMT, V1_REQUEST_SOF, len(payload),
+                       0xCAFECAFE, cmd) + payload
+
+
+def v2_reply(seq: int, cmd: int, payload: bytes) -> bytes:
+    body = bytes([sc.PROTOCOL_V2 | sc.V2_REPLY_FLAG, seq, cmd, 0
+                  ]) + sc.encode_varint(len(payload)) + payload
+    return bytes([sc.V2_SOF]) + body + struct.pack("<I", zlib.crc32(body))
+
+
+def parse_request(data: bytes):
+    """
+    Returns (version, seq, cmd, payload, consumed) for the request at the
+    start of data, None if it is incomplete.
+    """
+    if data[0] == sc.V2_SOF:
+        pos = 4
+        length = shift = 0
+        while True:
+            if pos >= len(data):
+                return None
+            b = data[pos]
+            pos += 1
+            length |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        end = pos + length + 4
+        if len(data) < end:
+            return None
+        return 2, data[2], data[3], data[pos:end - 4], end
+
+    header_size = struct.calcsize(V1_REQUEST_FMT)
+    if len(data) < header_size:
+        return None
+    _, length, _, cmd = struct.unpack_from(V1_REQUEST_FMT, data)
+    end = header_size + length
+    if len(data) < end:
+        return None
+    return 1, None, cmd, data[header_size:end], end
+
+
+def run_device(fd: int, stop: threading.Event):
+    data = b""
+    while not stop.is_set():
+        try:
+            data += os.read(fd, 4096)
+        except OSError:
+            return
+        while data and (request := parse_request(data)):
+            version, seq, cmd, payload, consumed = request
+            data = data[consumed:]
+            if version == 2:
+                reply = v2_reply(seq, cmd, payload)
+            else:
+                reply = struct.pack(sc.REPLY_HEADER_FMT, sc.REPLY_SOF,
+                                    len(payload), cmd) + payload
+            os.write(fd, reply)
+
+
+def print_sizes():
+    v2_ack = len(v2_reply(1, 0, b""))
+    print(f"{'request':<22} {'v1_B':>5} {'v2_B':>5}")
+    for name, cmd, payload in REQUESTS:
+        print(f"{name:<22} {len(v1_request(cmd, payload)):>5} "
+              f"{len(sc.get_v2_bytes(cmd, payload)):>5}")
+    print(f"v2 ACK/NAK reply: {v2_ack} bytes, v1 has none")
+
+
+def time_round_trips(s: serial.Serial, count: int, version: int,
+                     payload: bytes) -> list[float]:
+    samples = []
+    for _ in range(count):
+        t0 = time.perf_counter_ns()
+        if version == 2:
+            reply = sc.transact_v2(s, sc.CMD_ECHO, payload)
+            ok = reply is not None and reply.payload == payload
+        else:
+            s.write(v1_request(sc.CMD_ECHO, payload))
+            s.flush()
+            ok = sc.read_binary_reply(s, sc.CMD_ECHO) == payload
+        samples.append((time.perf_counter_ns() - t0) / 1000)
+        assert ok, f"v{version} round trip failed"
+    return samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--count", type=int, default=2000)
+    args = parser.parse_args()
+
+    import pty
+    import tty
+
+    master, slave = pty.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    stop = threading.Event()
+    threading.Thread(target=run_device, args=(master, stop),
+                     daemon=True).start()
+
+    print_sizes()
+    print()
+    print(f"{args.count} echo round trips per row, times in us:")
+    print(f"{'':<12} {'p50':>8} {'p90':>8} {'p99':>8} {'mean':>8}")
+    with serial.Serial(os.ttyname(slave), sc.BAUD_RATE, timeout=1) as s:
+        for payload in (bytes(3), bytes(range(64))):
+            for version in (1, 2):
+                samples = sorted(
+                    time_round_trips(s, args.count, version, payload))
+                q = [
+                    samples[int(p * (len(samples) - 1))]
+                    for p in (0.5, 0.9, 0.99)
+                ]
+                label = f"v{version} {len(payload)} B"
+                print(f"{label:<12} {q[0]:8.1f} {q[1]:8.1f} {q[2]:8.1f} "
+                      f"{statistics.fmean(samples):8.1f}")
+    stop.set()
+
+
+if __name__ == "__main__":
+    main()
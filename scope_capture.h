@@ -0,0 +1,170 @@
+#ifndef FOOTMOUSE_SCOPE_CAPTURE_H
+#define FOOTMOUSE_SCOPE_CAPTURE_H
+
+#include <Arduino.h>
+
+#include "constants.h"
+#include "serial-msg-parsing.h"
+#include "trace.h"
+
+/*
+ * Raw pin capture ("scope mode") for tuning the debounce parameters.
+ *
+ * The selected pins are sampled in a tight loop, as fast as the pin reads
+ * allow, into a bit packed ring (pin_count bits per sample). Capture runs
+ * until the first change on any selected pin plus the rest of the buffer, so
+ * 1/SCOPE_PRETRIGGER_DIV of it shows the time before the edge. Blocks the
+ * caller for the whole capture.
+ *
+ * The command's reply is a ScopeCaptureHeader. The samples follow, oldest
+ * first, in REPLY_SCOPE_FRAME frames of a uint32 byte offset plus data.
+ */
+constexpr uint8_t SCOPE_CAPTURE_VERSION = 1;
+
+struct __attribute__((packed)) ScopeCaptureHeader
+{
+  uint8_t version = SCOPE_CAPTURE_VERSION;
+  uint8_t pedal_mask = 0;
+  uint8_t pin_count = 0;
+  uint8_t triggered = 0;
+  uint32_t sample_count = 0;
+  uint32_t trigger_index = 0; // Sample where the first change was seen.
+  uint32_t post_trigger_us = 0; // Sampling time from trigger to the end.
+  uint32_t data_length = 0;
+};
+
+class ScopeCapture
+{
+public:
+  /**
+   * read() returns the selected pin levels in bits [0, pin_count).
+   * Returns false if no pin changed within timeout_ms.
+   */
+  template<typename ReadFn>
+  bool capture(uint8_t pin_count, uint32_t timeout_ms, ReadFn read)
+  {
+    bits = pin_count;
+    total = (SCOPE_BUFFER_BYTES * 8) / bits;
+    memset(buf, 0, sizeof(buf));
+
+    const uint32_t pre = total / SCOPE_PRETRIGGER_DIV;
+    const uint8_t initial = read();
+    const uint32_t start_ms = millis();
+    uint32_t i = 0;
+    uint32_t written = 0;
+
+    // Fill the ring until the first change.
+    for (;;) {
+      const uint8_t v = read();
+      put(i, v);
+      i = (i + 1 == total) ? 0 : i + 1;
+      written++;
+      if (v != initial) {
+        break;
+      }
+      if ((written & 0xFF) == 0 && (millis() - start_ms) > timeout_ms) {
+        return false;
+      }
+    }
+
+    // Then the rest of the buffer after the trigger.
+    const uint32_t trigger_us = micros();
+    const uint32_t before = written < pre ? written : pre;
+    const uint32_t after = total - before;
+    for (uint32_t n = 0; n < after; n++) {
+      put(i, read());
+      i = (i + 1 == total) ? 0 : i + 1;
+      written++;
+    }
+    post_trigger_us = micros() - trigger_us;
+
+    // Oldest sample of the window.
+    count = written < total ? written : total;
+    first = (i + total - count) % total;
+    trigger_index = before - 1;
+    return true;
+  }
+
+  /**
+   * Reply with the header and stream the samples, oldest first.
+   */
+  void send(uint32_t cmd, uint8_t pedal_mask, bool triggered)
+  {
+    ScopeCaptureHeader header;
+    header.pedal_mask = pedal_mask;
+    header.pin_count = bits;
+    header.triggered = triggered;
+    if (triggered) {
+      header.sample_count = count;
+      header.trigger_index = trigger_index;
+      header.post_trigger_us = post_trigger_us;
+      header.data_length = (count * bits + 7) / 8;
+    }
+    send_binary_reply(cmd, &header, sizeof(header));
+
+    uint8_t frame[SCOPE_FRAME_BYTES];
+    for (uint32_t offset = 0; offset < header.data_length;
+         offset += sizeof(frame)) {
+      const uint32_t len = header.data_length - offset < sizeof(frame)
+                             ? header.data_length - offset
+                             : sizeof(frame);
+      // Repack from the ring so the host sees a straight sequence. Samples
+      // may straddle frames.
+      memset(frame, 0, len);
+      const uint32_t first_bit = offset * 8;
+      const uint32_t end_bit = (offset + len) * 8;
+      for (uint32_t s = first_bit / bits; s * bits < end_bit && s < count;
+           s++) {
+        const uint8_t v = get((first + s) % total);
+        for (uint8_t b = 0; b < bits; b++) {
+          const uint32_t bit = s * bits + b;
+          if (bit >= first_bit && bit < end_bit) {
+            frame[(bit - first_bit) / 8] |= ((v >> b) & 1)
+                                            << ((bit - first_bit) % 8);
+          }
+        }
+      }
+
+      notify_begin(REPLY_SCOPE_FRAME, sizeof(offset) + len);
+      reply_write(&offset, sizeof(offset));
+      reply_write(frame, len);
+      reply_end();
+    }
+  }
+
+private:
+  uint8_t buf[SCOPE_BUFFER_BYTES];
+  uint8_t bits = 1;
+  uint32_t total = 0;
+  uint32_t count = 0;
+  uint32_t first = 0;
+  uint32_t trigger_index = 0;
+  uint32_t post_trigger_us = 0;
+
+  void put(uint32_t sample, uint8_t v)
+  {
+    const uint32_t pos = sample * bits;
+    for (uint8_t b = 0; b < bits; b++) {
+      const uint32_t bit = pos + b;
+      const uint8_t mask = 1 << (bit % 8);
+      if ((v >> b) & 1) {
+        buf[bit / 8] |= mask;
+      } else {
+        buf[bit / 8] &= ~mask;
+      }
+    }
+  }
+
+  uint8_t get(uint32_t sample) const
+  {
+    const uint32_t pos = sample * bits;
+    uint8_t v = 0;
+    for (uint8_t b = 0; b < bits; b++) {
+      const uint32_t bit = pos + b;
+      v |= ((buf[bit / 8] >> (bit % 8)) & 1) << b;
+    }
+    return v;
+  }
+};
+
+#endif // FOOTMOUSE_SCOPE_CAPTURE_H
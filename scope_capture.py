@@ -0,0 +1,193 @@
+"""
+Capture raw pedal pin levels around the first edge ("scope mode") and save
+them as a replayable trace for debounce tuning.
+
+The trace is CSV with one row per change of any captured pin, times in
+microseconds relative to the trigger:
+    # footmouse scope v1 period_us=0.52 start_us=-1064.9 end_us=7455.0
+    t_us,p0,p2
+    -1064.9,1,1
+    0.0,0,1
+    ...
+
+Usage:
+    python scope_capture.py capture bounce.csv --pedals 0 2
+    python scope_capture.py show bounce.csv [--plot]
+"""
+from __future__ import annotations
+
+import argparse
+import struct
+
+try:
+    import serial
+except ImportError:
+    # Loading and showing traces works without pyserial, only capturing
+    # needs it.
+    serial = None
+
+import serial_commands as sc
+
+REPLY_SCOPE_FRAME = 0xF3
+SCOPE_HEADER_FMT = "<BBBBIIII"
+DEFAULT_TRIGGER_TIMEOUT_MS = 5000
+
+
+def _collect(s: serial.Serial, header: bytes, pedals: list[int]) -> dict:
+    (_, _, pin_count, triggered, sample_count, trigger_index, post_trigger_us,
+     data_length) = struct.unpack(SCOPE_HEADER_FMT, header)
+    if not triggered:
+        raise TimeoutError("No pin changed before the trigger timeout.")
+
+    data = bytearray(data_length)
+    received = 0
+    while received < data_length:
+        frame = sc.read_reply(s, lambda f: f.cmd == REPLY_SCOPE_FRAME)
+        if frame is None:
+            raise TimeoutError(f"Got {received} of {data_length} bytes.")
+        (offset, ) = struct.unpack_from("<I", frame.payload)
+        chunk = frame.payload[4:]
+        data[offset:offset + len(chunk)] = chunk
+        received += len(chunk)
+
+    samples = []
+    for i in range(sample_count):
+        v = 0
+        for b in range(pin_count):
+            bit = i * pin_count + b
+            v |= ((data[bit // 8] >> (bit % 8)) & 1) << b
+        samples.append(v)
+
+    return {
+        "pedals": pedals,
+        "period_us": post_trigger_us / (sample_count - trigger_index),
+        "trigger_index": trigger_index,
+        "samples": samples,
+    }
+
+
+def capture(pedals: list[int],
+            timeout_ms: int = DEFAULT_TRIGGER_TIMEOUT_MS) -> dict | None:
+    """Press or release a pedal after calling. Blocks until captured."""
+    port = sc.find_footmouse_com_port_name()
+    if not port:
+        return None
+
+    mask = 0
+    for pedal in pedals:
+        mask |= 1 << pedal
+    payload = struct.pack("<BH", mask, timeout_ms)
+    use_v2 = sc.footmouse_supports_v2()
+
+    with serial.Serial(port,
+                       sc.BAUD_RATE,
+                       write_timeout=1,
+                       timeout=timeout_ms / 1000 + 1) as s:
+        if use_v2:
+            reply = sc.transact_v2(s, sc.CMD_SCOPE_CAPTURE, payload)
+            header = reply.payload if reply else None
+        else:
+            s.write(sc.get_structured_bytes(sc.CMD_SCOPE_CAPTURE, payload))
+            header = sc.read_binary_reply(s, sc.CMD_SCOPE_CAPTURE)
+        if not header:
+            print("No reply to the capture command.")
+            return None
+        return _collect(s, header, sorted(pedals))
+
+
+def to_changes(cap: dict) -> list[tuple]:
+    """(t_us, levels...) rows for the first sample and every change."""
+    rows = []
+    prev = None
+    n = len(cap["pedals"])
+    for i, v in enumerate(cap["samples"]):
+        if v != prev:
+            t = (i - cap["trigger_index"]) * cap["period_us"]
+            rows.append((t, *[(v >> b) & 1 for b in range(n)]))
+            prev = v
+    return rows
+
+
+def save_trace(path: str, cap: dict):
+    start = -cap["trigger_index"] * cap["period_us"]
+    end = (len(cap["samples"]) - cap["trigger_index"]) * cap["period_us"]
+    with open(path, "w") as f:
+        f.write(f"# footmouse scope v1 period_us={cap['period_us']:.4f} "
+                f"start_us={start:.1f} end_us={end:.1f}\n")
+        f.write("t_us," + ",".join(f"p{p}" for p in cap["pedals"]) + "\n")
+        for t, *levels in to_changes(cap):
+            f.write(f"{t:.2f}," + ",".join(map(str, levels)) + "\n")
+
+
+def load_trace(path: str) -> dict:
+    """Returns {"meta": {...}, "pedals": [...], "rows": [(t_us, levels...)]}."""
+    meta = {}
+    with open(path) as f:
+        first = f.readline()
+        for field in first.split()[4:]:
+            key, value = field.split("=")
+            meta[key] = float(value)
+        columns = f.readline().strip().split(",")
+        rows = []
+        for line in f:
+            t, *levels = line.strip().split(",")
+            rows.append((float(t), *map(int, levels)))
+    return {
+        "meta": meta,
+        "pedals": [int(c[1:]) for c in columns[1:]],
+        "rows": rows
+    }
+
+
+def show(trace: dict, plot: bool = False):
+    print(f"sample period: {trace['meta']['period_us']:.3f} us")
+    for col, pedal in enumerate(trace["pedals"], start=1):
+        changes = [
+            row[0] for prev, row in zip(trace["rows"], trace["rows"][1:])
+            if row[col] != prev[col]
+        ]
+        if not changes:
+            print(f"pedal {pedal}: no transitions")
+            continue
+        print(f"pedal {pedal}: {len(changes)} transitions, bouncing for "
+              f"{changes[-1] - changes[0]:.1f} us")
+        for prev_t, t in zip(changes, changes[1:]):
+            print(f"    pulse {t - prev_t:9.2f} us")
+
+    if plot:
+        import matplotlib.pyplot as plt
+        end = trace["meta"]["end_us"]
+        for col, pedal in enumerate(trace["pedals"], start=1):
+            ts = [row[0] for row in trace["rows"]] + [end]
+            ys = [row[col] + 1.5 * (col - 1) for row in trace["rows"]]
+            plt.step(ts, ys + ys[-1:], where="post", label=f"pedal {pedal}")
+        plt.xlabel("us from trigger")
+        plt.legend()
+        plt.show()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest="action", required=True)
+    cap = sub.add_parser("capture", help="capture the next pedal edge")
+    cap.add_argument("output")
+    cap.add_argument("--pedals", type=int, nargs="+", default=[0])
+    cap.add_argument("--timeout-ms",
+                     type=int,
+                     default=DEFAULT_TRIGGER_TIMEOUT_MS)
+    shw = sub.add_parser("show", help="summarize a saved trace")
+    shw.add_argument("input")
+    shw.add_argument("--plot", action="store_true")
+
+    args = parser.parse_args()
+    if args.action == "capture":
+        print("Waiting for a pedal edge...")
+        if result := capture(args.pedals, args.timeout_ms):
+            save_trace(args.output, result)
+            show(load_trace(args.output))
+    else:
+        show(load_trace(args.input), args.plot)
+
+
+if __name__ == "__main__":
+    main()
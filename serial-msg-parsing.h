@@ -3,7 +3,22 @@
 
 #include "constants.h"
 #include "crc32.h"
+#include "log.h"
 
+/*
+ * Protocol v1 request frame:
+ *   SerialMsgHeader (sof 0xFFFFFFFF, length, crc32, cmd) + payload
+ * cmd isn't covered by the crc and the crc isn't checked.
+ *
+ * Protocol v2 frames (host -> device and device -> host):
+ *   sof (0xA5), version, seq, cmd, [status], length (varint), payload, crc32
+ * The crc32 covers everything after sof. Device frames set V2_REPLY_FLAG in
+ * the version byte and carry a status byte. Unsolicited frames (e.g. trace
+ * data) also set V2_NOTIFY_FLAG and use seq 0. The host negotiates v2 by
+ * sending CMD_IDENTIFY as a v2 frame; v1 frames are always accepted.
+ *
+ * Decoded v1 and v2 requests are both described by SerialMsgHeader.
+ */
 struct __attribute__((packed)) SerialMsgHeader
 {
   uint32_t sof = 0;
@@ -13,6 +28,59 @@ struct __attribute__((packed)) SerialMsgHeader
   uint32_t cmd = 0xDEADBEEF;
 };
 
+constexpr uint8_t PROTOCOL_V1 = 1;
+constexpr uint8_t PROTOCOL_V2 = 2;
+constexpr uint8_t PROTOCOL_MAX_VERSION = PROTOCOL_V2;
+
+constexpr uint8_t V1_SOF_BYTE = 0xFF;
+constexpr uint8_t V2_SOF = 0xA5;
+constexpr uint8_t V2_REPLY_FLAG = 0x80;
+constexpr uint8_t V2_NOTIFY_FLAG = 0x40;
+constexpr size_t V2_MAX_VARINT_BYTES = 3;
+
+// Worst case bytes a reply adds around its payload, for either protocol.
+constexpr size_t REPLY_FRAME_OVERHEAD = 12;
+
+// Machine readable result of a v2 request.
+enum ReplyStatus : uint8_t
+{
+  STATUS_OK = 0,
+  STATUS_BAD_CRC = 1,
+  STATUS_UNKNOWN_CMD = 2,
+  STATUS_BAD_PARAM = 3,
+  STATUS_TOO_BIG = 4,
+  STATUS_TIMEOUT = 5,
+  STATUS_BAD_FRAME = 6
+};
+
+// Binary replies from the device in protocol v1. Text logs may be interleaved
+// on the same port, so the host scans for the reply start-of-frame.
+constexpr uint32_t REPLY_SOF = 0xFFFFFFFE;
+
+struct __attribute__((packed)) SerialReplyHeader
+{
+  uint32_t sof = REPLY_SOF;
+  uint32_t length = 0;
+  uint32_t cmd = 0;
+};
+
+// The request currently being handled.
+struct RequestContext
+{
+  uint8_t version = PROTOCOL_V1;
+  uint8_t seq = 0;
+  bool replied = false;
+};
+
+RequestContext g_request;
+
+// Protocol used for unsolicited frames. Set by CMD_IDENTIFY.
+uint8_t g_protocol_version = PROTOCOL_V1;
+
+// State of the frame being written.
+bool g_reply_is_v2 = false;
+uint32_t g_reply_crc = 0;
+
 struct __attribute__((packed)) CmdPayloadSetButtonMode
 {
   uint8_t pedal_index;
@@ -29,8 +97,225 @@ struct __attribute__((packed)) CmdPayloadSetKeycombo
   uint16_t keycodes[MAX_COMBO_KEYCODE_COUNT];
 };
 
+// Screen fractions in the range [0, ABS_POINTER_MAX].
+struct __attribute__((packed)) CmdPayloadSetWarpTarget
+{
+  uint8_t pedal_index;
+  uint16_t x;
+  uint16_t y;
+};
+
+struct __attribute__((packed)) CmdPayloadSelectProfile
+{
+  uint8_t profile;
+  uint8_t make_default; // Also use this profile at boot when no rule matches.
+};
+
+struct __attribute__((packed)) CmdPayloadSetProfileButton
+{
+  uint8_t profile;
+  uint8_t pedal_index;
+  uint8_t mode;
+  uint8_t inversion;
+};
+
+struct __attribute__((packed)) CmdPayloadSetProfileRule
+{
+  uint8_t rule_index;
+  uint8_t connected_mask; // Bit i set = pedal i connected. 0 clears the rule.
+  uint8_t profile;
+};
+
+struct __attribute__((packed)) CmdPayloadSetChord
+{
+  uint8_t chord_index;
+  uint8_t pedal_mask; // Bit i set = pedal i is part of the chord. 0 clears.
+  uint16_t window_ms;
+  uint8_t nKeycodes;
+  uint16_t keycodes[MAX_CHORD_KEYCODE_COUNT];
+};
+
+// See AnalogConfig. A target of 0 turns the pedal back into a switch.
+struct __attribute__((packed)) CmdPayloadSetAnalogPedal
+{
+  uint8_t pedal_index;
+  uint8_t target;
+  uint8_t iir_shift;
+  uint16_t hysteresis;
+  int16_t curve[ANALOG_CURVE_POINTS];
+};
+
+struct __attribute__((packed)) CmdPayloadScopeCapture
+{
+  uint8_t pedal_mask; // Bit i captures pedal i.
+  uint16_t trigger_timeout_ms;
+};
+
+// See Debouncer::set_debounce(). Hold-off and noise guard only apply to
+// DEBOUNCE_EAGER.
+struct __attribute__((packed)) CmdPayloadSetDebounce
+{
+  uint8_t pedal_index;
+  uint8_t mode;
+  uint32_t holdoff_us;
+  uint16_t noise_guard_us; // 0 disables the noise guard.
+};
+
+// See VelocityConfig. contact_a == contact_b clears the slot.
+struct __attribute__((packed)) CmdPayloadSetVelocity
+{
+  uint8_t slot;
+  uint8_t contact_a;
+  uint8_t contact_b;
+  uint8_t fast_mode;
+  uint8_t slow_mode;
+  int8_t scroll_max;
+  uint32_t threshold_us;
+  uint32_t max_travel_us;
+};
+
+// See CpuClockGovernor. boost_hz == 0 stays at the idle clock.
+struct __attribute__((packed)) CmdPayloadSetCpuClock
+{
+  uint32_t boost_hz;
+  uint32_t quiet_ms;
+};
+
 static_assert(sizeof(CmdPayloadSetButtonMode) < STRING_BUFFER_SIZE, "");
 static_assert(sizeof(CmdPayloadSetKeycombo) < STRING_BUFFER_SIZE, "");
+static_assert(sizeof(CmdPayloadSetWarpTarget) < STRING_BUFFER_SIZE, "");
+
+/*
+ * Write bytes of the current frame, updating its crc.
+ */
+void
+reply_write(const void* data, size_t length)
+{
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  if (g_reply_is_v2) {
+    g_reply_crc =
+      crc::update_crc(g_reply_crc, const_cast<uint8_t*>(bytes), length);
+  }
+  Serial.write(bytes, length);
+}
+
+void
+reply_write_varint(uint32_t value)
+{
+  do {
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    if (value) {
+      b |= 0x80;
+    }
+    reply_write(&b, 1);
+  } while (value);
+}
+
+static void
+frame_begin(uint8_t version,
+            uint8_t flags,
+            uint8_t seq,
+            uint32_t cmd,
+            uint8_t status,
+            size_t length)
+{
+  g_reply_is_v2 = (version == PROTOCOL_V2);
+
+  if (!g_reply_is_v2) {
+    SerialReplyHeader header;
+    header.length = length;
+    header.cmd = cmd;
+    Serial.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    return;
+  }
+
+  Serial.write(V2_SOF);
+  g_reply_crc = 0xFFFFFFFF;
+  const uint8_t head[] = { static_cast<uint8_t>(PROTOCOL_V2 | flags),
+                           seq,
+                           static_cast<uint8_t>(cmd),
+                           status };
+  reply_write(head, sizeof(head));
+  reply_write_varint(length);
+}
+
+/*
+ * Start the reply to the current request with 'length' payload bytes. The
+ * caller writes the payload with reply_write(), e.g. when it is assembled
+ * from several structs, and finishes with reply_end().
+ */
+void
+reply_begin(uint32_t cmd, size_t length, uint8_t status = STATUS_OK)
+{
+  g_request.replied = true;
+  frame_begin(
+    g_request.version, V2_REPLY_FLAG, g_request.seq, cmd, status, length);
+}
+
+/*
+ * Start an unsolicited frame in the negotiated protocol.
+ */
+void
+notify_begin(uint32_t code, size_t length)
+{
+  frame_begin(g_protocol_version,
+              V2_REPLY_FLAG | V2_NOTIFY_FLAG,
+              0,
+              code,
+              STATUS_OK,
+              length);
+}
+
+void
+reply_end()
+{
+  if (g_reply_is_v2) {
+    const uint32_t crc = g_reply_crc ^ 0xFFFFFFFF;
+    Serial.write(reinterpret_cast<const uint8_t*>(&crc), sizeof(crc));
+  }
+}
+
+/*
+ * Send a binary reply for the command.
+ */
+void
+send_binary_reply(uint32_t cmd, const void* data, size_t length)
+{
+  reply_begin(cmd, length);
+  reply_write(data, length);
+  reply_end();
+}
+
+/*
+ * Reply with text. Protocol v1 prints it as is, v2 puts it in the payload.
+ */
+void
+reply_text(uint32_t cmd, const char* text, uint8_t status = STATUS_OK)
+{
+  if (g_request.version != PROTOCOL_V2) {
+    Serial.print(text);
+    return;
+  }
+
+  const size_t length = strlen(text);
+  reply_begin(cmd, length, status);
+  reply_write(text, length);
+  reply_end();
+}
+
+/*
+ * Called after a request was handled. Protocol v2 always answers with a
+ * status, so send an empty ACK/NAK if the command didn't reply itself.
+ */
+void
+finish_request(uint32_t cmd, uint8_t status)
+{
+  if (g_request.version == PROTOCOL_V2 && !g_request.replied) {
+    reply_begin(cmd, 0, status);
+    reply_end();
+  }
+}
 
 /*
  * Get the next byte with a timeout built in.
@@ -50,7 +335,7 @@ read_next_byte()
     return rb;
   }
 
-  Serial.print("Serial read timed out of retires.\n");
+  log_msg<LOG_DEBUG>(LOG_MSG_SERIAL_TIMEOUT);
   return -1;
 }
 
@@ -65,6 +350,9 @@ validate_frame_and_get_payload(SerialMsgHeader* header,
   constexpr uint32_t MYSOF = 0xFFFFFFFF;
   size_t index = 0;
 
+  g_request = RequestContext();
+  g_request.version = PROTOCOL_V1;
+
   // Clear the input buffer.
   memset(buf, 0, bufsize);
 
@@ -76,33 +364,28 @@ validate_frame_and_get_payload(SerialMsgHeader* header,
   for (size_t i = 0; i < sizeof(SerialMsgHeader); i++) {
     auto rb = read_next_byte();
     if (rb == -1) {
-      Serial.printf("%d: Serial read was -1.\n", i);
+      log_msg<LOG_WARN>(LOG_MSG_FRAME_TRUNCATED, i, sizeof(SerialMsgHeader));
       return false;
     }
     reinterpret_cast<unsigned char*>(header)[i] = (unsigned char)rb;
   }
 
-  Serial.printf("sof: %X\n", header->sof);
-  Serial.printf("length: %d\n", header->length);
-  Serial.printf("crc32: %X\n", header->crc32);
-  Serial.printf("cmd: %d\n", header->cmd);
-
   // Check SOF
   if (MYSOF != header->sof) {
-    Serial.print("No start-of-frame found.\n");
+    log_msg<LOG_WARN>(LOG_MSG_FRAME_NO_SOF);
     return false;
   }
 
   // Load payload into buf.
   while (index < header->length) {
     if (index >= bufsize) {
-      Serial.print("Message payload size exceded buffer.\n");
+      log_msg<LOG_WARN>(LOG_MSG_FRAME_TOO_BIG, header->length, bufsize);
       return false;
     }
 
     auto rb = read_next_byte();
     if (rb == -1) {
-      Serial.printf("%d: Serial read was -1.\n", index);
+      log_msg<LOG_WARN>(LOG_MSG_FRAME_TRUNCATED, index, header->length);
       return false;
     }
 
@@ -111,10 +394,7 @@ validate_frame_and_get_payload(SerialMsgHeader* header,
 
   // Check payload length.
   if (index != header->length) {
-    Serial.printf("Payload length not correct. Recieved '%d' bytes but "
-                  "expected '%d' bytes.",
-                  index,
-                  header->length);
+    log_msg<LOG_WARN>(LOG_MSG_FRAME_TRUNCATED, index, header->length);
     return false;
   }
 
@@ -128,4 +408,93 @@ validate_frame_and_get_payload(SerialMsgHeader* header,
   return true;
 }
 
+/*
+ * Read one byte of a v2 frame and add it to the running crc.
+ */
+static bool
+read_v2_byte(uint8_t& out, uint32_t& crc)
+{
+  auto rb = read_next_byte();
+  if (rb == -1) {
+    return false;
+  }
+  out = static_cast<uint8_t>(rb);
+  crc = crc::update_crc(crc, &out, 1);
+  return true;
+}
+
+/* Validates a protocol v2 frame. Returns a ReplyStatus.
+ * buf is filled with the message payload.
+ */
+uint8_t
+validate_frame_v2_and_get_payload(SerialMsgHeader* header,
+                                  uint8_t* buf,
+                                  size_t bufsize)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  uint8_t version, seq, cmd, b;
+
+  g_request = RequestContext();
+  g_request.version = PROTOCOL_V2;
+
+  memset(buf, 0, bufsize);
+
+  if (read_next_byte() != V2_SOF) {
+    return STATUS_BAD_FRAME;
+  }
+
+  if (!read_v2_byte(version, crc) || !read_v2_byte(seq, crc) ||
+      !read_v2_byte(cmd, crc)) {
+    return STATUS_TIMEOUT;
+  }
+  g_request.seq = seq;
+  header->cmd = cmd;
+
+  if (version != PROTOCOL_V2) {
+    return STATUS_BAD_FRAME;
+  }
+
+  uint32_t length = 0;
+  for (size_t i = 0;; i++) {
+    if (i >= V2_MAX_VARINT_BYTES) {
+      return STATUS_BAD_FRAME;
+    }
+    if (!read_v2_byte(b, crc)) {
+      return STATUS_TIMEOUT;
+    }
+    length |= static_cast<uint32_t>(b & 0x7F) << (7 * i);
+    if (!(b & 0x80)) {
+      break;
+    }
+  }
+
+  if (length > bufsize) {
+    return STATUS_TOO_BIG;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    if (!read_v2_byte(buf[i], crc)) {
+      return STATUS_TIMEOUT;
+    }
+  }
+
+  uint32_t received_crc = 0;
+  for (size_t i = 0; i < sizeof(received_crc); i++) {
+    auto rb = read_next_byte();
+    if (rb == -1) {
+      return STATUS_TIMEOUT;
+    }
+    received_crc |= static_cast<uint32_t>(rb) << (8 * i);
+  }
+
+  header->sof = V2_SOF;
+  header->length = length;
+  header->crc32 = received_crc;
+
+  if ((crc ^ 0xFFFFFFFF) != received_crc) {
+    return STATUS_BAD_CRC;
+  }
+  return STATUS_OK;
+}
+
 #endif // FOOTMOUSE_SERIAL_MSG_PARSING
\ No newline at end of file
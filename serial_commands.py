@@ -1,16 +1,25 @@
 """
 Python API for interacting with the footmouse using the serial port.
 """
+from __future__ import annotations
+
 import functools
 import inspect
+import itertools
+import json
+import os
+from collections import namedtuple
 from enum import IntEnum
 import struct
+import zlib
 
-import serial
-import serial.tools.list_ports
-
-# For future crc verification.
-# import zlib
+try:
+    import serial
+    import serial.tools.list_ports
+except ImportError:
+    # Frame parsing and the offline tools work without pyserial, only talking
+    # to a device needs it.
+    serial = None
 
 TEENSY_PAYLOAD_BUFFER_SIZE = 512
 BAUD_RATE = 115200
@@ -32,6 +41,8 @@ class modes(IntEnum):
     anywhere = 64
     orbit = 67
     keycombo = 68
+    warp_cursor = 69
+    next_profile = 70
 
 
 # Command codes.
@@ -47,6 +58,77 @@ CMD_RETURN_CRC = 12
 CMD_KEEP_AWAKE_ENABLE = 13
 CMD_KEEP_AWAKE_DISABLE = 14
 CMD_LOCK_PC = 15
+CMD_SET_WARP_TARGET = 16
+CMD_GET_SAMPLER_STATS = 17
+CMD_GET_TELEMETRY = 18
+CMD_TRACE_START = 19
+CMD_TRACE_STOP = 20
+CMD_SELECT_PROFILE = 21
+CMD_SET_PROFILE_BUTTON = 22
+CMD_SET_PROFILE_RULE = 23
+CMD_SET_CHORD = 24
+CMD_GET_CONFIG = 25
+CMD_GET_CONFIG_HASH = 26
+CMD_PEDAL_EVENTS_START = 27
+CMD_PEDAL_EVENTS_STOP = 28
+CMD_SET_ANALOG_PEDAL = 29
+CMD_SCOPE_CAPTURE = 30
+CMD_SET_DEBOUNCE = 31
+CMD_GET_BOOT_LOG = 32
+CMD_GET_MEMORY_STATS = 33
+CMD_GET_TIME = 34
+CMD_SET_VELOCITY = 35
+CMD_RUN_BENCH = 36
+CMD_SET_CPU_CLOCK = 37
+
+MAX_CHORD_KEYCODE_COUNT = 8
+
+DEBOUNCE_INTEGRATE = 0
+DEBOUNCE_EAGER = 1
+ANALOG_CURVE_POINTS = 9
+
+
+class analog_targets(IntEnum):
+    none = 0
+    scroll = 1
+    pointer_x = 2
+    pointer_y = 3
+    joystick_x = 4  # Teensy only.
+    joystick_y = 5
+    joystick_z = 6
+
+# Start-of-frame for protocol v1 binary replies from the device.
+REPLY_SOF = 0xFFFFFFFE
+REPLY_HEADER_FMT = "<III"
+
+# Protocol v2 framing, see serial-msg-parsing.h.
+PROTOCOL_V1 = 1
+PROTOCOL_V2 = 2
+V2_SOF = 0xA5
+V2_REPLY_FLAG = 0x80
+V2_NOTIFY_FLAG = 0x40
+V2_VERSION_MASK = 0x3F
+V2_MAX_VARINT_BYTES = 3
+
+
+class ReplyStatus(IntEnum):
+    ok = 0
+    bad_crc = 1
+    unknown_cmd = 2
+    bad_param = 3
+    too_big = 4
+    timeout = 5
+    bad_frame = 6
+
+
+# seq is None and status ok for v1 replies.
+ReplyFrame = namedtuple("ReplyFrame", "cmd status seq notify payload")
+
+# seq 0 is used by the device for unsolicited frames.
+_v2_seq = itertools.cycle(range(1, 256))
+
+# Absolute pointer coordinates are screen fractions scaled to this value.
+ABS_POINTER_MAX = 0x7FFF
 
 
 def convert_to_zstr_bytes(string: str):
@@ -94,6 +176,148 @@ def send_serial(port, buf: bytes, block_for_response=False):
             return True
 
 
+def encode_varint(value: int) -> bytes:
+    out = bytearray()
+    while True:
+        b = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def get_v2_bytes(cmd: int, payload: bytes = b"", seq: int = 1) -> bytes:
+    """Build a protocol v2 request frame."""
+    if len(payload) > TEENSY_PAYLOAD_BUFFER_SIZE:
+        raise Exception(f"Payload of {len(payload)} bytes is too big.")
+    body = bytes([PROTOCOL_V2, seq, cmd]) + encode_varint(
+        len(payload)) + payload
+    return bytes([V2_SOF]) + body + struct.pack("<I", zlib.crc32(body))
+
+
+_INCOMPLETE = object()
+
+
+def _parse_v1_reply(data: bytes, start: int):
+    header_size = struct.calcsize(REPLY_HEADER_FMT)
+    if len(data) - start < header_size:
+        return _INCOMPLETE
+    _, length, cmd = struct.unpack_from(REPLY_HEADER_FMT, data, start)
+    end = start + header_size + length
+    if len(data) < end:
+        return _INCOMPLETE
+    frame = ReplyFrame(cmd, ReplyStatus.ok, None, False,
+                       data[start + header_size:end])
+    return frame, end
+
+
+def _parse_v2_reply(data: bytes, start: int):
+    pos = start + 1
+    if len(data) < pos + 4:
+        return _INCOMPLETE
+    version, seq, cmd, status = data[pos:pos + 4]
+    if (version & V2_VERSION_MASK) != PROTOCOL_V2 or not (version
+                                                          & V2_REPLY_FLAG):
+        return None
+    pos += 4
+
+    length = 0
+    for i in range(V2_MAX_VARINT_BYTES + 1):
+        if i == V2_MAX_VARINT_BYTES:
+            return None
+        if pos >= len(data):
+            return _INCOMPLETE
+        b = data[pos]
+        pos += 1
+        length |= (b & 0x7F) << (7 * i)
+        if not b & 0x80:
+            break
+
+    end = pos + length + 4
+    if len(data) < end:
+        return _INCOMPLETE
+    (crc, ) = struct.unpack_from("<I", data, end - 4)
+    if zlib.crc32(data[start + 1:end - 4]) != crc:
+        return None
+    frame = ReplyFrame(cmd, status, seq, bool(version & V2_NOTIFY_FLAG),
+                       data[pos:end - 4])
+    return frame, end
+
+
+def split_reply_frames(data: bytes) -> tuple[list[ReplyFrame], bytes]:
+    """
+    Extract the complete v1 and v2 frames from a byte stream. Text logs in
+    between are skipped. Returns the frames and the unconsumed tail.
+    """
+    v1_sof = struct.pack("<I", REPLY_SOF)
+    v2_sof = bytes([V2_SOF])
+    frames = []
+    pos = 0
+    while True:
+        candidates = [
+            i for i in (data.find(v1_sof, pos), data.find(v2_sof, pos))
+            if i != -1
+        ]
+        if not candidates:
+            # Keep what could be the start of a v1 start-of-frame.
+            return frames, data[max(pos, len(data) - len(v1_sof) + 1):]
+
+        start = min(candidates)
+        if data.startswith(v1_sof, start):
+            result = _parse_v1_reply(data, start)
+        else:
+            result = _parse_v2_reply(data, start)
+
+        if result is _INCOMPLETE:
+            return frames, data[start:]
+        if result is None:
+            # Not a frame, e.g. a stray 0xA5.
+            pos = start + 1
+            continue
+        frame, pos = result
+        frames.append(frame)
+
+
+def read_reply(s: serial.Serial, match) -> ReplyFrame | None:
+    """Read until a frame for which match(frame) is true arrives."""
+    data = b""
+    while True:
+        chunk = s.read(max(1, s.in_waiting))
+        if not chunk:
+            return None
+        frames, data = split_reply_frames(data + chunk)
+        for frame in frames:
+            if match(frame):
+                return frame
+
+
+def read_binary_reply(s: serial.Serial, cmd: int) -> bytes | None:
+    """
+    Read until a v1 binary reply for cmd arrives.
+    """
+    frame = read_reply(s, lambda f: f.seq is None and f.cmd == cmd)
+    return frame.payload if frame else None
+
+
+def transact_v2(s: serial.Serial,
+                cmd: int,
+                payload: bytes = b"") -> ReplyFrame | None:
+    """Send a v2 request and wait for the reply with the same seq."""
+    seq = next(_v2_seq)
+    s.write(get_v2_bytes(cmd, payload, seq))
+    s.flush()
+    return read_reply(s, lambda f: not f.notify and f.seq == seq)
+
+
+def send_serial_and_get_reply(port, buf: bytes, cmd: int) -> bytes | None:
+    with serial.Serial(port, BAUD_RATE, write_timeout=1, timeout=1) as s:
+        s.write(buf)
+        s.flush()
+        return read_binary_reply(s, cmd)
+
+
 def send_serial_and_get_lines(port, buf: bytes):
     result = send_serial(port, buf, block_for_response=True)
     if isinstance(result, list):
@@ -119,6 +343,42 @@ def get_structured_bytes(cmd: int, payload: bytes = b""):
     return msg_bytes
 
 
+@MemoizeCallNoArgs
+def footmouse_supports_v2() -> bool:
+    """
+    Negotiate protocol v2. Older firmware doesn't answer v2 frames, in which
+    case everything falls back to v1.
+    """
+    port_name = find_footmouse_com_port_name()
+    if not port_name:
+        return False
+    try:
+        with serial.Serial(port_name, BAUD_RATE, write_timeout=1,
+                           timeout=1) as s:
+            reply = transact_v2(s, CMD_IDENTIFY, bytes([PROTOCOL_V2]))
+    except serial.SerialException as ex:
+        print(ex)
+        return False
+
+    return (reply is not None and reply.status == ReplyStatus.ok
+            and reply.payload.startswith(NAME)
+            and len(reply.payload) > len(NAME)
+            and reply.payload[len(NAME)] >= PROTOCOL_V2)
+
+
+def send_cmd_v2(cmd: int, payload: bytes = b"") -> ReplyFrame | None:
+    port_name = find_footmouse_com_port_name()
+    if not port_name:
+        return None
+    with serial.Serial(port_name, BAUD_RATE, write_timeout=1, timeout=1) as s:
+        reply = transact_v2(s, cmd, payload)
+    if reply is None:
+        print(f"No reply to command {cmd}.")
+    elif reply.status != ReplyStatus.ok:
+        print(f"Command {cmd} failed: {ReplyStatus(reply.status).name}")
+    return reply
+
+
 @MemoizeCallNoArgs
 def find_footmouse_com_port_name() -> str | None:
     """
@@ -150,6 +410,10 @@ def send_cmd_to_foot_pedal(cmd: int,
                            payload: bytes = b"",
                            block_for_response=False):
     try:
+        # Text replies are only printed by v1 requests.
+        if not block_for_response and footmouse_supports_v2():
+            reply = send_cmd_v2(cmd, payload)
+            return reply is not None and reply.status == ReplyStatus.ok
         if port_name := find_footmouse_com_port_name():
             return send_serial(port_name,
                                get_structured_bytes(cmd, payload),
@@ -161,6 +425,23 @@ def send_cmd_to_foot_pedal(cmd: int,
         return False
 
 
+def send_cmd_and_get_reply(cmd: int, payload: bytes = b"") -> bytes | None:
+    try:
+        if footmouse_supports_v2():
+            reply = send_cmd_v2(cmd, payload)
+            if reply is None or reply.status != ReplyStatus.ok:
+                return None
+            return reply.payload
+        if port_name := find_footmouse_com_port_name():
+            return send_serial_and_get_reply(
+                port_name, get_structured_bytes(cmd, payload), cmd)
+        else:
+            return None
+    except serial.SerialException as ex:
+        print(ex)
+        return None
+
+
 def echo_test():
     msg = "Hello World!"
     if result := send_cmd_to_foot_pedal(CMD_ECHO,
@@ -219,6 +500,138 @@ def set_keycombo(btn: int, keycodes: list[int | str], inverted: int = 0):
         print(f"result: {result}")
 
 
+def abs_pointer_coordinate(f: float) -> int:
+    """Screen fraction to the device's absolute pointer range."""
+    return round(min(max(f, 0.0), 1.0) * ABS_POINTER_MAX)
+
+
+def set_warp_target(btn: int, x: float, y: float):
+    """
+    Set the pedal to warp the cursor to a point on the screen.
+    x & y are screen fractions from 0.0 (left/top) to 1.0 (right/bottom).
+    """
+    payload = struct.pack("<BHH", btn, abs_pointer_coordinate(x),
+                          abs_pointer_coordinate(y))
+    return send_cmd_to_foot_pedal(CMD_SET_WARP_TARGET, payload)
+
+
+def select_profile(profile: int, make_default: bool = False):
+    """
+    Switch all pedals to a stored profile. Optionally make it the profile
+    used at boot when no rule matches the connected pedals.
+    """
+    return send_cmd_to_foot_pedal(CMD_SELECT_PROFILE,
+                                  struct.pack("<BB", profile, make_default))
+
+
+def set_profile_button(profile: int, pedal: int, mode: int, inverted: int):
+    """
+    Store a pedal mode in a profile. Mode 0 uses the pedal's default.
+    """
+    return send_cmd_to_foot_pedal(
+        CMD_SET_PROFILE_BUTTON,
+        struct.pack("<BBBB", profile, pedal, mode, inverted))
+
+
+def set_profile_rule(rule: int, connected_pedals: list[int], profile: int):
+    """
+    Select profile at boot when exactly connected_pedals are plugged in.
+    An empty list clears the rule.
+    """
+    mask = 0
+    for pedal in connected_pedals:
+        mask |= 1 << pedal
+    return send_cmd_to_foot_pedal(CMD_SET_PROFILE_RULE,
+                                  struct.pack("<BBB", rule, mask, profile))
+
+
+def set_chord(chord: int,
+              pedals: list[int],
+              keycodes: list[int | str],
+              window_ms: int = 50):
+    """
+    Fire keycodes when all pedals are pressed within window_ms of each other.
+    An empty pedals list clears the chord.
+    """
+    if len(keycodes) > MAX_CHORD_KEYCODE_COUNT:
+        raise ValueError(f"At most {MAX_CHORD_KEYCODE_COUNT} keycodes.")
+
+    mask = 0
+    for pedal in pedals:
+        mask |= 1 << pedal
+    # Firmware reads a fixed size keycode array.
+    padded = list(keycodes) + [0] * (MAX_CHORD_KEYCODE_COUNT - len(keycodes))
+    payload = (struct.pack("<BBHB", chord, mask, window_ms, len(keycodes)) +
+               generate_keycode_bytes(padded))
+    return send_cmd_to_foot_pedal(CMD_SET_CHORD, payload)
+
+
+def set_analog_pedal(pedal: int,
+                     target: int,
+                     curve: list[int],
+                     hysteresis: int = 24,
+                     iir_shift: int = 2):
+    """
+    Read the pedal's jack as an expression pedal.
+    curve holds ANALOG_CURVE_POINTS outputs evenly spaced over the pedal
+    travel: units per second for scroll and pointer targets, 0 to 1023 for
+    joystick axes. Target none turns the jack back into a switch.
+    """
+    if len(curve) != ANALOG_CURVE_POINTS:
+        raise ValueError(f"curve needs {ANALOG_CURVE_POINTS} points.")
+    payload = struct.pack(f"<BBBH{ANALOG_CURVE_POINTS}h", pedal, target,
+                          iir_shift, hysteresis, *curve)
+    return send_cmd_to_foot_pedal(CMD_SET_ANALOG_PEDAL, payload)
+
+
+def set_debounce(pedal: int,
+                 mode: int,
+                 holdoff_us: int = 20000,
+                 noise_guard_us: int = 0):
+    """
+    DEBOUNCE_EAGER fires on the first pin change and ignores the pin for
+    holdoff_us. A noise_guard_us > 0 reverts eager edges whose level
+    didn't persist that long. See debounce_eval.py for the trade-offs.
+    """
+    payload = struct.pack("<BBIH", pedal, mode, holdoff_us, noise_guard_us)
+    return send_cmd_to_foot_pedal(CMD_SET_DEBOUNCE, payload)
+
+
+def set_velocity(slot: int,
+                 contact_a: int,
+                 contact_b: int,
+                 fast_mode: int = modes.none,
+                 slow_mode: int = modes.none,
+                 threshold_us: int = 30000,
+                 max_travel_us: int = 250000,
+                 scroll_max: int = 0):
+    """
+    Time a pedal wired to two contacts: contact_a closes at the start of the
+    travel, contact_b at the end. Presses reaching contact_b within
+    threshold_us run fast_mode, slower ones slow_mode. A non-zero scroll_max
+    scrolls up to that many lines instead, fewer for slower presses. The
+    pedal event stream shows both contacts' edge times for calibration.
+    """
+    payload = struct.pack("<BBBBBbII", slot, contact_a, contact_b, fast_mode,
+                          slow_mode, scroll_max, threshold_us, max_travel_us)
+    return send_cmd_to_foot_pedal(CMD_SET_VELOCITY, payload)
+
+
+def clear_velocity(slot: int):
+    return set_velocity(slot, 0, 0)
+
+
+def set_cpu_clock(boost_hz: int = 600_000_000, quiet_ms: int = 2000):
+    """
+    Teensy only: run at boost_hz from the first pedal edge or serial byte
+    until quiet_ms pass without activity, at the build's CPU speed
+    otherwise. boost_hz=0 stays at the build's speed. get_telemetry() reports
+    the time at each clock.
+    """
+    payload = struct.pack("<II", boost_hz, quiet_ms)
+    return send_cmd_to_foot_pedal(CMD_SET_CPU_CLOCK, payload)
+
+
 def keep_awake_enable():
     send_cmd_to_foot_pedal(CMD_KEEP_AWAKE_ENABLE)
 
@@ -227,6 +640,479 @@ def keep_awake_disable():
     send_cmd_to_foot_pedal(CMD_KEEP_AWAKE_DISABLE)
 
 
+def get_sampler_stats(reset: bool = False) -> dict | None:
+    """
+    Interval statistics of the interrupt driven pedal sampler (Teensy only).
+    Times are in microseconds.
+    """
+    reply = send_cmd_and_get_reply(CMD_GET_SAMPLER_STATS,
+                                   int(reset).to_bytes(1))
+    if not reply:
+        return None
+
+    (cpu_hz, period_us, dropped, count, min_c, max_c, sum_c,
+     sum_sq_c) = struct.unpack_from("<IIIIIIQQ", reply)
+    us_per_cycle = 1e6 / cpu_hz
+    stats = {
+        "period_us": period_us,
+        "dropped_events": dropped,
+        "count": count,
+    }
+    # Cycles to read all pedal pins, generic digitalRead vs direct.
+    if len(reply) >= 48:
+        stats["pin_read_cycles"], stats["pin_read_cycles_fast"] = (
+            struct.unpack_from("<II", reply, 40))
+    # Run time of the sampling interrupt. busy_duty is the share of the CPU
+    # it takes at cpu_hz.
+    if len(reply) >= 80:
+        (busy_count, _, busy_max, busy_sum,
+         _) = struct.unpack_from("<IIIQQ", reply, 48)
+        if busy_count:
+            stats["busy_mean_us"] = busy_sum / busy_count * us_per_cycle
+            stats["busy_max_us"] = busy_max * us_per_cycle
+            if count and sum_c:
+                stats["busy_duty"] = busy_sum / busy_count / (sum_c / count)
+    if count:
+        mean = sum_c / count
+        variance = max(sum_sq_c / count - mean * mean, 0.0)
+        stats.update({
+            "min_us": min_c * us_per_cycle,
+            "max_us": max_c * us_per_cycle,
+            "mean_us": mean * us_per_cycle,
+            "sigma_us": variance**0.5 * us_per_cycle,
+        })
+    return stats
+
+
+# Keep in sync with BootPhase in boot_log.h.
+BOOT_PHASES = ("setup_start", "pins_ready", "config_loaded",
+               "sampling_started", "usb_begun", "setup_done", "usb_ready",
+               "first_edge", "first_action")
+
+
+def get_boot_log() -> dict | None:
+    """
+    Milliseconds since reset at which each startup phase was reached, None
+    for phases not reached yet. usb_ready is when the first report could
+    reach the host.
+    """
+    reply = send_cmd_and_get_reply(CMD_GET_BOOT_LOG)
+    if not reply:
+        return None
+
+    _, phase_count = struct.unpack_from("<BB", reply)
+    times = struct.unpack_from(f"<{phase_count}I", reply, 4)
+    log = {
+        name: t / 1000 if t else None
+        for name, t in zip(BOOT_PHASES, times)
+    }
+    log["time_to_first_report_ms"] = log["usb_ready"]
+    if log["first_edge"] is not None and log["first_action"] is not None:
+        # Includes the time an early edge waited for USB.
+        log["first_edge_to_action_ms"] = (log["first_action"] -
+                                          log["first_edge"])
+    return log
+
+
+# Keep in sync with the ids in memory_stats.h.
+MEMORY_REGIONS = ("buttons", "payload_buf", "pedal_events", "pedal_notify",
+                  "trace", "log", "scope", "config", "chords", "analog",
+                  "hid_state")
+MEMORY_STACKS = ("main", "loop_task", "input_task", "hid_task", "serial_task")
+MEMORY_QUEUES = ("pedal_events", "pedal_notify", "trace", "log", "hid_tx")
+MEMORY_HEADER_FMT = "<BBBBIIIIII"
+MEMORY_HEADER_FIELDS = ("flash_bytes", "data_bytes", "bss_bytes",
+                        "heap_bytes", "heap_free", "heap_largest_block")
+
+
+def decode_memory_stats(reply: bytes) -> dict:
+    """Decode the CMD_GET_MEMORY_STATS reply, see memory_stats.h."""
+    (_, region_count, stack_count, queue_count,
+     *layout) = struct.unpack_from(MEMORY_HEADER_FMT, reply)
+    result = dict(zip(MEMORY_HEADER_FIELDS, layout))
+    offset = struct.calcsize(MEMORY_HEADER_FMT)
+
+    result["regions"] = {}
+    for _ in range(region_count):
+        id_, size = struct.unpack_from("<B3xI", reply, offset)
+        offset += 8
+        result["regions"][MEMORY_REGIONS[id_]] = size
+
+    # A size of None means the device doesn't know it.
+    result["stacks"] = {}
+    for _ in range(stack_count):
+        id_, size, unused = struct.unpack_from("<B3xII", reply, offset)
+        offset += 12
+        result["stacks"][MEMORY_STACKS[id_]] = {
+            "size": size or None,
+            "unused": unused,
+        }
+
+    result["queues"] = {}
+    for _ in range(queue_count):
+        id_, capacity, peak, dropped = struct.unpack_from(
+            "<BxHH2xI", reply, offset)
+        offset += 12
+        result["queues"][MEMORY_QUEUES[id_]] = {
+            "capacity": capacity,
+            "peak_depth": peak,
+            "dropped": dropped,
+        }
+    return result
+
+
+def get_memory_stats() -> dict | None:
+    """
+    Static RAM by subsystem, stack high-water marks, heap and queue peaks.
+    Finding the largest heap block briefly allocates it on the device.
+    """
+    reply = send_cmd_and_get_reply(CMD_GET_MEMORY_STATS)
+    return decode_memory_stats(reply) if reply else None
+
+
+def print_memory_stats(stats: dict):
+    for key in MEMORY_HEADER_FIELDS:
+        print(f"{key}: {stats[key]}")
+    print("static RAM:")
+    for name, size in sorted(stats["regions"].items(),
+                             key=lambda item: -item[1]):
+        print(f"  {name:<14} {size:>7}")
+    print("stacks (used / size):")
+    for name, stack in stats["stacks"].items():
+        if stack["size"]:
+            used = stack["size"] - stack["unused"]
+            print(f"  {name:<14} {used:>7} / {stack['size']}")
+        else:
+            print(f"  {name:<14}       ? / ?, "
+                  f"{stack['unused']} never used")
+    print("queues (peak / capacity):")
+    for name, queue in stats["queues"].items():
+        print(f"  {name:<14} {queue['peak_depth']:>7} / {queue['capacity']}"
+              f", {queue['dropped']} dropped")
+
+
+# Keep in sync with BenchId in bench.h.
+BENCH_NAMES = ("debounce_all", "loop", "crc32_512", "hid_report",
+               "ascii_to_hid", "storage_load")
+
+
+def run_bench() -> dict | None:
+    """
+    Run the on-device microbenchmarks. Returns cycles per benchmark and the
+    counter rate, cycles_per_s.
+    """
+    reply = send_cmd_and_get_reply(CMD_RUN_BENCH)
+    if not reply:
+        return None
+
+    _, count, runs, cycles_per_s = struct.unpack_from("<BBHI", reply)
+    results = {}
+    for i in range(count):
+        id_, min_c, median_c, max_c = struct.unpack_from(
+            "<B3xIII", reply, 8 + 16 * i)
+        results[BENCH_NAMES[id_]] = {
+            "min": min_c,
+            "median": median_c,
+            "max": max_c
+        }
+    return {"cycles_per_s": cycles_per_s, "runs": runs, "results": results}
+
+
+def print_bench(bench: dict):
+    us_per_cycle = 1e6 / bench["cycles_per_s"]
+    print(f"{bench['runs']} runs at {bench['cycles_per_s'] / 1e6:.0f} MHz, "
+          "cycles (median us):")
+    print(f"  {'benchmark':<14} {'min':>9} {'median':>9} {'max':>9}")
+    for name, r in bench["results"].items():
+        print(f"  {name:<14} {r['min']:>9} {r['median']:>9} {r['max']:>9}"
+              f"  ({r['median'] * us_per_cycle:.2f} us)")
+
+
+def save_bench(path: str, bench: dict):
+    with open(path, "w") as f:
+        json.dump(bench, f, indent=1)
+
+
+def print_bench_diff(old: dict, new: dict):
+    """Compare median cycles of two saved runs, e.g. of two builds."""
+    if old["cycles_per_s"] != new["cycles_per_s"]:
+        print(f"note: clock changed from {old['cycles_per_s']} to "
+              f"{new['cycles_per_s']} Hz")
+    print(f"  {'benchmark':<14} {'old':>9} {'new':>9} {'change':>8}")
+    for name in BENCH_NAMES:
+        a = old["results"].get(name)
+        b = new["results"].get(name)
+        if not a or not b:
+            continue
+        change = ((b["median"] - a["median"]) / a["median"] *
+                  100 if a["median"] else 0.0)
+        print(f"  {name:<14} {a['median']:>9} {b['median']:>9} "
+              f"{change:>+7.1f}%")
+
+
+TELEMETRY_HEADER_FMT = "<BBBxIIIIII"
+TELEMETRY_HEADER_FIELDS = ("version", "pedal_count", "bucket_count",
+                           "uptime_ms", "max_loop_us", "max_input_latency_us",
+                           "hid_dropped", "hid_send_failures", "hid_coalesced")
+# Since version 2. All zero without clock scaling.
+TELEMETRY_CLOCK_FMT = "<IIIIII"
+TELEMETRY_CLOCK_FIELDS = ("idle_hz", "boost_hz", "idle_ms", "boost_ms",
+                          "boosts", "max_switch_us")
+
+
+def decode_telemetry(reply: bytes) -> dict:
+    """
+    Decode the binary telemetry snapshot. Histogram bucket i counts values
+    in [2^(i-1), 2^i) microseconds, bucket 0 counts zero.
+    """
+    values = struct.unpack_from(TELEMETRY_HEADER_FMT, reply)
+    result = dict(zip(TELEMETRY_HEADER_FIELDS, values))
+    offset = struct.calcsize(TELEMETRY_HEADER_FMT)
+    if result["version"] >= 2:
+        values = struct.unpack_from(TELEMETRY_CLOCK_FMT, reply, offset)
+        result["clock"] = dict(zip(TELEMETRY_CLOCK_FIELDS, values))
+        offset += struct.calcsize(TELEMETRY_CLOCK_FMT)
+
+    n = result["bucket_count"]
+    pedal_fmt = "<III" + ("I" * n) * 2
+    pedals = []
+    for _ in range(result["pedal_count"]):
+        fields = struct.unpack_from(pedal_fmt, reply, offset)
+        offset += struct.calcsize(pedal_fmt)
+        pedals.append({
+            "engagements": fields[0],
+            "rejected_glitches": fields[1],
+            "lockout_hits": fields[2],
+            "hold_us": list(fields[3:3 + n]),
+            "edge_to_report_us": list(fields[3 + n:3 + 2 * n]),
+        })
+    result["pedals"] = pedals
+    return result
+
+
+def get_telemetry(reset: bool = False) -> dict | None:
+    reply = send_cmd_and_get_reply(CMD_GET_TELEMETRY, int(reset).to_bytes(1))
+    return decode_telemetry(reply) if reply else None
+
+
+def print_histogram(name: str, buckets: list[int]):
+    print(f"  {name}:")
+    for i, count in enumerate(buckets):
+        if count:
+            low = 0 if i == 0 else 1 << (i - 1)
+            print(f"    >= {low:>8} us: {count}")
+
+
+def print_telemetry(telemetry: dict):
+    for key in TELEMETRY_HEADER_FIELDS:
+        print(f"{key}: {telemetry[key]}")
+    clock = telemetry.get("clock")
+    if clock and clock["idle_hz"]:
+        total_ms = clock["idle_ms"] + clock["boost_ms"]
+        boosted = clock["boost_ms"] / total_ms * 100 if total_ms else 0.0
+        print(f"cpu clock: {clock['idle_hz'] / 1e6:.0f} MHz idle, "
+              f"{clock['boost_hz'] / 1e6:.0f} MHz boost, "
+              f"{boosted:.1f}% of {total_ms} ms boosted, "
+              f"{clock['boosts']} boosts, "
+              f"max switch {clock['max_switch_us']} us")
+    for idx, pedal in enumerate(telemetry["pedals"]):
+        print(f"pedal {idx}: engagements={pedal['engagements']} "
+              f"glitches={pedal['rejected_glitches']} "
+              f"lockouts={pedal['lockout_hits']}")
+        print_histogram("hold", pedal["hold_us"])
+        print_histogram("edge to report", pedal["edge_to_report_us"])
+
+
+CONFIG_HEADER_FMT = "<BBBBBBHI"
+CONFIG_GLOBALS_FMT = "<BBBx"
+CONFIG_PEDAL_FMT = "<BBBBHH"
+CONFIG_CACHE_PATH = os.path.join(os.path.expanduser("~"),
+                                 ".footmouse_config.bin")
+
+
+def decode_config(reply: bytes) -> dict:
+    """Decode the CMD_GET_CONFIG snapshot, see config_snapshot.h."""
+    (version, pedal_count, profile_count, rule_count, chord_count,
+     chord_keycode_count, body_length,
+     hash_) = struct.unpack_from(CONFIG_HEADER_FMT, reply)
+    offset = struct.calcsize(CONFIG_HEADER_FMT)
+
+    active_profile, default_profile, keep_awake = struct.unpack_from(
+        CONFIG_GLOBALS_FMT, reply, offset)
+    offset += struct.calcsize(CONFIG_GLOBALS_FMT)
+
+    pedals = []
+    for _ in range(pedal_count):
+        mode, direction, enabled, n, warp_x, warp_y = struct.unpack_from(
+            CONFIG_PEDAL_FMT, reply, offset)
+        offset += struct.calcsize(CONFIG_PEDAL_FMT)
+        keycodes = list(struct.unpack_from(f"<{n}H", reply, offset))
+        offset += 2 * n
+        pedals.append({
+            "mode": mode,
+            "inverted": direction,
+            "enabled": bool(enabled),
+            "keycodes": keycodes,
+            "warp": (warp_x, warp_y),
+        })
+
+    profiles = []
+    for _ in range(profile_count):
+        fields = struct.unpack_from("<" + "BB" * pedal_count, reply, offset)
+        offset += 2 * pedal_count
+        profiles.append(list(zip(fields[::2], fields[1::2])))
+
+    rules = []
+    for _ in range(rule_count):
+        rules.append(struct.unpack_from("<BB", reply, offset))
+        offset += 2
+
+    chords = []
+    chord_fmt = f"<BHB{chord_keycode_count}H"
+    for _ in range(chord_count):
+        mask, window_ms, n, *keycodes = struct.unpack_from(
+            chord_fmt, reply, offset)
+        offset += struct.calcsize(chord_fmt)
+        chords.append({
+            "pedal_mask": mask,
+            "window_ms": window_ms,
+            "keycodes": keycodes[:n],
+        })
+
+    return {
+        "version": version,
+        "hash": hash_,
+        "active_profile": active_profile,
+        "default_profile": default_profile,
+        "keep_awake": bool(keep_awake),
+        "pedals": pedals,
+        "profiles": profiles,
+        "rules": rules,
+        "chords": chords,
+    }
+
+
+def get_config_hash() -> int | None:
+    reply = send_cmd_and_get_reply(CMD_GET_CONFIG_HASH)
+    return struct.unpack("<I", reply)[0] if reply else None
+
+
+def _load_cached_config(hash_: int) -> bytes | None:
+    try:
+        with open(CONFIG_CACHE_PATH, "rb") as f:
+            reply = f.read()
+    except OSError:
+        return None
+    header_size = struct.calcsize(CONFIG_HEADER_FMT)
+    if len(reply) < header_size or zlib.crc32(reply[header_size:]) != hash_:
+        return None
+    return reply
+
+
+def get_config(use_cache: bool = True) -> dict | None:
+    """
+    Read the device configuration. With use_cache, only the hash is read when
+    it matches the snapshot cached from the last full read.
+    """
+    if use_cache and (hash_ := get_config_hash()) is not None:
+        if reply := _load_cached_config(hash_):
+            return decode_config(reply)
+
+    reply = send_cmd_and_get_reply(CMD_GET_CONFIG)
+    if not reply:
+        return None
+    try:
+        with open(CONFIG_CACHE_PATH, "wb") as f:
+            f.write(reply)
+    except OSError as ex:
+        print(ex)
+    return decode_config(reply)
+
+
+def _keycode_ints(keycodes: list[int | str]) -> list[int]:
+    return [ord(k) if isinstance(k, str) else k for k in keycodes]
+
+
+def sync(profile: dict) -> int:
+    """
+    Bring the device to the desired configuration, sending only the settings
+    that differ. Costs one round trip when nothing changed and the cached
+    snapshot is current. Returns the number of commands sent.
+
+    profile = {
+        "active_profile": 1,
+        "keep_awake": True,
+        "pedals": {
+            0: {"mode": modes.left, "inverted": 0},
+            1: {"mode": modes.warp_cursor, "warp": (0.5, 0.5)},
+            2: {"mode": modes.keycombo, "keycodes": [MODIFIERKEY_CTRL, "s"]},
+        },
+        "chords": {0: {"pedals": [0, 2], "keycodes": ["z"], "window_ms": 60}},
+    }
+    """
+    current = get_config()
+    if current is None:
+        return 0
+    sent = 0
+
+    # Selecting a profile rewrites all pedal modes, so it goes first.
+    if "active_profile" in profile and (profile["active_profile"]
+                                        != current["active_profile"]):
+        select_profile(profile["active_profile"])
+        sent += 1
+        current = get_config(use_cache=False)
+        if current is None:
+            return sent
+
+    for idx, want in profile.get("pedals", {}).items():
+        have = current["pedals"][idx]
+        mode = int(want["mode"])
+        inverted = int(want.get("inverted", 0))
+        same_mode = have["mode"] == mode and have["inverted"] == inverted
+
+        if mode == modes.keycombo:
+            keycodes = _keycode_ints(want["keycodes"])
+            if not same_mode or have["keycodes"] != keycodes:
+                set_keycombo(idx, keycodes, inverted)
+                sent += 1
+        elif mode == modes.warp_cursor:
+            warp = tuple(map(abs_pointer_coordinate, want["warp"]))
+            if have["mode"] != mode or tuple(have["warp"]) != warp:
+                set_warp_target(idx, *want["warp"])
+                sent += 1
+            if have["inverted"] != inverted:
+                change_mode(idx, mode, inverted)
+                sent += 1
+        elif not same_mode:
+            change_mode(idx, mode, inverted)
+            sent += 1
+
+    for idx, want in profile.get("chords", {}).items():
+        have = current["chords"][idx]
+        mask = 0
+        for pedal in want["pedals"]:
+            mask |= 1 << pedal
+        keycodes = _keycode_ints(want.get("keycodes", []))
+        window_ms = want.get("window_ms", 50)
+        if (have["pedal_mask"] != mask or have["keycodes"] != keycodes
+                or (mask and have["window_ms"] != window_ms)):
+            set_chord(idx, want["pedals"], keycodes, window_ms)
+            sent += 1
+
+    if "keep_awake" in profile and (bool(profile["keep_awake"])
+                                    != current["keep_awake"]):
+        if profile["keep_awake"]:
+            keep_awake_enable()
+        else:
+            keep_awake_disable()
+        sent += 1
+
+    if sent:
+        # Refresh the cache for the next sync.
+        get_config(use_cache=False)
+    return sent
+
+
 def print_available_serial_ports():
     print("Available serial ports:")
     print(serial.tools.list_ports.main())
@@ -256,3 +1142,20 @@ if __name__ == "__main__":
     # set_keycombo(2, [MODIFIERKEY_SHIFT, "c"])
     # keep_awake_disable()
     # keep_awake_enable()
+    # set_warp_target(0, 0.99, 0.5)
+    # print(get_sampler_stats(reset=True))
+    # print_telemetry(get_telemetry())
+    # print(get_boot_log())
+    # print_memory_stats(get_memory_stats())
+    # set_velocity(0, 3, 0, modes.keycombo, modes.left, threshold_us=25000)
+    # print_bench(run_bench())
+    # set_cpu_clock(600_000_000, quiet_ms=2000)
+    # save_bench("bench_new.json", run_bench())
+    # set_profile_button(1, 0, modes.keycombo, 0)
+    # set_profile_rule(0, [0, 2], 1)
+    # select_profile(1)
+    # set_chord(0, [0, 2], [MODIFIERKEY_CTRL, "s"], window_ms=60)
+    # set_analog_pedal(1, analog_targets.scroll,
+    #                  [0, 0, 2, 5, 10, 20, 40, 70, 100])
+    # print(get_config())
+    # sync({"pedals": {0: {"mode": modes.left, "inverted": 0}}})
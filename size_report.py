@@ -0,0 +1,142 @@
+"""
+Per-symbol flash and RAM size report of the firmware, so memory regressions
+show up in review.
+
+"build" compiles the sketch for each board with arduino-cli and reports its
+ELF. Sizes are from nm: text and rodata count as flash, bss as RAM, and data
+as both since its initial values are stored in flash.
+
+Usage:
+    python size_report.py build [--board teensy nrf] [--save DIR]
+    python size_report.py report firmware.elf [--top 30] [--save out.json]
+    python size_report.py diff old.json new.json
+"""
+import argparse
+import json
+import os
+import subprocess
+import tempfile
+
+SKETCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+BOARDS = {
+    "teensy": "teensy:avr:teensy40:usb=serialhid,speed=24,opt=o3std",
+    "nrf": "Seeeduino:nrf52:xiaonRF52840",
+}
+
+NM = "arm-none-eabi-nm"
+
+FLASH_TYPES = "tTrRdD"
+RAM_TYPES = "dDbB"
+
+
+def read_symbols(elf: str) -> dict[str, dict]:
+    """{name: {"size": bytes, "type": nm type letter}} for sized symbols."""
+    out = subprocess.run(
+        [NM, "--print-size", "--size-sort", "--demangle", elf],
+        check=True,
+        capture_output=True,
+        text=True).stdout
+    symbols = {}
+    for line in out.splitlines():
+        # address size type name, the name may contain spaces.
+        fields = line.split(maxsplit=3)
+        if len(fields) < 4:
+            continue
+        _, size, type_, name = fields
+        if type_ not in FLASH_TYPES + RAM_TYPES:
+            continue
+        entry = symbols.setdefault(name, {"size": 0, "type": type_})
+        entry["size"] += int(size, 16)
+    return symbols
+
+
+def totals(symbols: dict) -> tuple[int, int]:
+    flash = sum(s["size"] for s in symbols.values()
+                if s["type"] in FLASH_TYPES)
+    ram = sum(s["size"] for s in symbols.values() if s["type"] in RAM_TYPES)
+    return flash, ram
+
+
+def print_report(symbols: dict, top: int):
+    flash, ram = totals(symbols)
+    print(f"flash: {flash} bytes, static RAM: {ram} bytes")
+    for title, types in (("flash", FLASH_TYPES), ("RAM", RAM_TYPES)):
+        largest = sorted(
+            ((s["size"], name) for name, s in symbols.items()
+             if s["type"] in types),
+            reverse=True)[:top]
+        print(f"largest {title} symbols:")
+        for size, name in largest:
+            print(f"  {size:>8}  {name}")
+
+
+def print_diff(old: dict, new: dict):
+    old_flash, old_ram = totals(old)
+    new_flash, new_ram = totals(new)
+    print(f"flash: {old_flash} -> {new_flash} ({new_flash - old_flash:+})")
+    print(f"static RAM: {old_ram} -> {new_ram} ({new_ram - old_ram:+})")
+
+    changes = []
+    for name in old.keys() | new.keys():
+        delta = (new.get(name, {}).get("size", 0) -
+                 old.get(name, {}).get("size", 0))
+        if delta:
+            type_ = (new.get(name) or old[name])["type"]
+            changes.append((abs(delta), delta, type_, name))
+    for _, delta, type_, name in sorted(changes, reverse=True):
+        print(f"  {delta:>+8}  {type_}  {name}")
+
+
+def build(board: str) -> str:
+    """Compile the sketch and return the ELF path."""
+    out_dir = tempfile.mkdtemp(prefix=f"footmouse-{board}-")
+    subprocess.run([
+        "arduino-cli", "compile", "--fqbn", BOARDS[board], "--output-dir",
+        out_dir, SKETCH_DIR
+    ],
+                   check=True)
+    (elf, ) = [f for f in os.listdir(out_dir) if f.endswith(".elf")]
+    return os.path.join(out_dir, elf)
+
+
+def save(path: str, symbols: dict):
+    with open(path, "w") as f:
+        json.dump(symbols, f, indent=1, sort_keys=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest="action", required=True)
+    bld = sub.add_parser("build", help="compile and report each board")
+    bld.add_argument("--board", nargs="+", choices=BOARDS, default=[*BOARDS])
+    bld.add_argument("--save", help="directory for <board>.json reports")
+    bld.add_argument("--top", type=int, default=20)
+    rpt = sub.add_parser("report", help="report an existing ELF")
+    rpt.add_argument("elf")
+    rpt.add_argument("--save", help="write the symbol sizes as JSON")
+    rpt.add_argument("--top", type=int, default=20)
+    dif = sub.add_parser("diff", help="compare two saved reports")
+    dif.add_argument("old")
+    dif.add_argument("new")
+
+    args = parser.parse_args()
+    if args.action == "diff":
+        with open(args.old) as f, open(args.new) as g:
+            print_diff(json.load(f), json.load(g))
+    elif args.action == "report":
+        symbols = read_symbols(args.elf)
+        print_report(symbols, args.top)
+        if args.save:
+            save(args.save, symbols)
+    else:
+        for board in args.board:
+            print(f"== {board}")
+            symbols = read_symbols(build(board))
+            print_report(symbols, args.top)
+            if args.save:
+                save(os.path.join(args.save, f"{board}.json"), symbols)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,70 @@
+#ifndef FOOTMOUSE_SPSC_RING_H
+#define FOOTMOUSE_SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Lock-free single producer, single consumer ring buffer. Safe for one
+ * interrupt (or task) pushing while the main loop pops, without disabling
+ * interrupts. CAPACITY must be a power of two.
+ */
+template<typename T, size_t CAPACITY>
+class SpscRing
+{
+  static_assert((CAPACITY & (CAPACITY - 1)) == 0,
+                "Capacity must be a power of two.");
+
+public:
+  /**
+   * Producer side. Returns false and counts a drop if the ring is full.
+   */
+  bool push(const T& item)
+  {
+    const uint32_t h = head;
+    if (h - tail >= CAPACITY) {
+      dropped++;
+      return false;
+    }
+    buf[h & (CAPACITY - 1)] = item;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    head = h + 1;
+
+    const uint32_t depth = h + 1 - tail;
+    if (depth > peak_depth) {
+      peak_depth = depth;
+    }
+    return true;
+  }
+
+  /**
+   * Consumer side. Returns false if the ring is empty.
+   */
+  bool pop(T& item)
+  {
+    const uint32_t t = tail;
+    if (t == head) {
+      return false;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    item = buf[t & (CAPACITY - 1)];
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    tail = t + 1;
+    return true;
+  }
+
+  size_t size() const { return head - tail; }
+  bool empty() const { return head == tail; }
+  static constexpr size_t capacity() { return CAPACITY; }
+
+  // Written by the producer only.
+  volatile uint32_t dropped = 0;
+  volatile uint32_t peak_depth = 0;
+
+private:
+  T buf[CAPACITY];
+  volatile uint32_t head = 0;
+  volatile uint32_t tail = 0;
+};
+
+#endif // FOOTMOUSE_SPSC_RING_H
@@ -0,0 +1,74 @@
+#ifndef FOOTMOUSE_TELEMETRY_H
+#define FOOTMOUSE_TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr uint8_t TELEMETRY_VERSION = 2;
+
+// Bucket i counts values in [2^(i-1), 2^i). Bucket 0 counts zero and the
+// last bucket also counts everything larger. 24 buckets of microseconds
+// cover up to ~8 seconds.
+constexpr size_t TELEMETRY_HIST_BUCKETS = 24;
+
+/**
+ * Fixed size histogram with power of two buckets. O(1) update.
+ */
+template<size_t N>
+struct __attribute__((packed)) Log2Histogram
+{
+  uint32_t buckets[N] = { 0 };
+
+  void add(uint32_t value)
+  {
+    size_t idx = value ? 32 - __builtin_clz(value) : 0;
+    if (idx >= N) {
+      idx = N - 1;
+    }
+    buckets[idx]++;
+  }
+};
+
+struct __attribute__((packed)) PedalTelemetry
+{
+  uint32_t engagements = 0;
+  // These two are counted by the pedal's Debouncer and copied in when the
+  // telemetry is sent.
+  // Pin changes that reverted before GLITCH_SAMPLE_CNT samples agreed, and
+  // eager edges undone by the noise guard.
+  uint32_t rejected_glitches = 0;
+  // Settled changes held back by the DEBOUNCE_RESET or hold-off lockout.
+  uint32_t lockout_hits = 0;
+  Log2Histogram<TELEMETRY_HIST_BUCKETS> hold_us;
+  // From the first raw pin change until the HID action was issued.
+  Log2Histogram<TELEMETRY_HIST_BUCKETS> edge_to_report_us;
+};
+
+// Core clock scaling, see cpu_clock.h. All zero on boards without it.
+struct __attribute__((packed)) ClockTelemetry
+{
+  uint32_t idle_hz = 0;
+  uint32_t boost_hz = 0;
+  uint32_t idle_ms = 0;
+  uint32_t boost_ms = 0;
+  uint32_t boosts = 0;
+  // Longest clock switch, during which the main loop stalls.
+  uint32_t max_switch_us = 0;
+};
+
+struct __attribute__((packed)) TelemetryHeader
+{
+  uint8_t version = TELEMETRY_VERSION;
+  uint8_t pedal_count = 0;
+  uint8_t bucket_count = TELEMETRY_HIST_BUCKETS;
+  uint8_t reserved = 0;
+  uint32_t uptime_ms = 0;
+  uint32_t max_loop_us = 0;
+  uint32_t max_input_latency_us = 0;
+  uint32_t hid_dropped = 0;
+  uint32_t hid_send_failures = 0;
+  uint32_t hid_coalesced = 0;
+  ClockTelemetry clock;
+};
+
+#endif // FOOTMOUSE_TELEMETRY_H
@@ -0,0 +1,48 @@
+#ifndef FOOTMOUSE_TESTS_CHECK_H
+#define FOOTMOUSE_TESTS_CHECK_H
+
+#include <stdio.h>
+
+/*
+ * Minimal assertions for the host tests. A failed check is reported and the
+ * test keeps going; main() returns test_result().
+ */
+
+static int g_check_failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      g_check_failures++;                                                      \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+  do {                                                                         \
+    const long long check_a = static_cast<long long>(a);                       \
+    const long long check_b = static_cast<long long>(b);                       \
+    if (check_a != check_b) {                                                  \
+      fprintf(stderr,                                                          \
+              "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n",                \
+              __FILE__,                                                        \
+              __LINE__,                                                        \
+              #a,                                                              \
+              #b,                                                              \
+              check_a,                                                         \
+              check_b);                                                        \
+      g_check_failures++;                                                      \
+    }                                                                          \
+  } while (0)
+
+static inline int
+test_result()
+{
+  if (g_check_failures) {
+    fprintf(stderr, "%d check(s) failed\n", g_check_failures);
+    return 1;
+  }
+  return 0;
+}
+
+#endif // FOOTMOUSE_TESTS_CHECK_H
@@ -0,0 +1,174 @@
+/*
+ * Replays pin traces through the firmware's debouncer (button.h) for
+ * debounce_eval.py. Reads jobs from stdin until EOF, each a header line
+ *     <mode> <glitch> <poll_us> <reset_us> <guard_us> <phase_us> <end_us> <n>
+ * followed by n "<t_us> <level>" transitions of a piecewise constant trace.
+ * mode is a DebounceMode, reset_us the DEBOUNCE_INTEGRATE lockout or the
+ * DEBOUNCE_EAGER hold-off. The trace is sampled every poll_us starting
+ * phase_us after its first transition, up to end_us. Replies with a line
+ * holding the number of accepted edges, then "<t_us> <state>" per edge, or
+ * with "error <message>".
+ */
+#include <math.h>
+#include <stdio.h>
+
+#include <array>
+#include <vector>
+
+#include "button.h"
+
+struct Transition
+{
+  double t_us;
+  int level;
+};
+
+struct Job
+{
+  int mode;
+  uint32_t glitch;
+  uint32_t poll_us;
+  uint32_t reset_us;
+  uint32_t guard_us;
+  uint32_t phase_us;
+  double end_us;
+  std::vector<Transition> trace;
+};
+
+using Edges = std::vector<Transition>;
+
+/**
+ * Samples are timed relative to the first transition, the debouncer's clock
+ * starts at 0 like micros().
+ */
+template<uint32_t G, uint32_t L>
+static Edges
+replay(const Job& job)
+{
+  using Filter = BasicDebouncer<G, L>;
+  const uint32_t mask = Filter::glitch_mask();
+  const double start_us = job.trace[0].t_us;
+  const uint32_t lockout_us = job.mode == DEBOUNCE_EAGER ? job.reset_us : L;
+
+  Filter filter;
+  filter.set_debounce(job.mode, job.reset_us, job.guard_us);
+  filter.state = job.trace[0].level;
+  filter.glitch_buf = filter.state ? mask : 0;
+  // Long settled at the start.
+  filter.last_change_time = -static_cast<unsigned long>(lockout_us) - 1;
+
+  Edges edges;
+  size_t idx = 0;
+  unsigned long now = job.phase_us;
+  while (start_us + now <= job.end_us) {
+    const double t = start_us + now;
+    while (idx + 1 < job.trace.size() && job.trace[idx + 1].t_us <= t) {
+      idx++;
+    }
+    const int raw = job.trace[idx].level;
+    if (filter.debounce(raw, now)) {
+      edges.push_back({ t, filter.state });
+    }
+
+    // Further samples of a settled level change nothing: jump to the first
+    // sample at or after the next transition.
+    const bool quiet = raw == filter.state &&
+                       filter.glitch_buf == (filter.state ? mask : 0) &&
+                       !filter.edge_pending && !filter.guard_pending &&
+                       now - filter.last_change_time >= lockout_us;
+    if (quiet) {
+      if (idx + 1 >= job.trace.size()) {
+        break;
+      }
+      const double gap = job.trace[idx + 1].t_us - t;
+      const double polls = ceil(gap / job.poll_us);
+      now += static_cast<unsigned long>(polls > 1 ? polls : 1) * job.poll_us;
+    } else {
+      now += job.poll_us;
+    }
+  }
+  return edges;
+}
+
+struct Variant
+{
+  uint32_t glitch;
+  uint32_t reset_us;
+  Edges (*replay)(const Job&);
+};
+
+template<uint32_t G, uint32_t... L>
+static void
+add_variants(std::vector<Variant>& out)
+{
+  (out.push_back({ G, L, replay<G, L> }), ...);
+}
+
+// The values debounce_eval.py sweeps, and the firmware's.
+static std::vector<Variant>
+variants()
+{
+  std::vector<Variant> out;
+  add_variants<GLITCH_SAMPLE_CNT, DEBOUNCE_RESET>(out);
+  add_variants<2, 0, 5000, 10000, 20000, 40000>(out);
+  add_variants<3, 0, 5000, 10000, 20000, 40000>(out);
+  add_variants<5, 0, 5000, 10000, 20000, 40000>(out);
+  add_variants<10, 0, 5000, 10000, 20000, 40000>(out);
+  add_variants<16, 0, 5000, 10000, 20000, 40000>(out);
+  add_variants<24, 0, 5000, 10000, 20000, 40000>(out);
+  return out;
+}
+
+static const Variant*
+find_variant(const std::vector<Variant>& all, const Job& job)
+{
+  for (const auto& v : all) {
+    // The lockout only exists in DEBOUNCE_INTEGRATE.
+    if (v.glitch == job.glitch &&
+        (job.mode == DEBOUNCE_EAGER || v.reset_us == job.reset_us)) {
+      return &v;
+    }
+  }
+  return nullptr;
+}
+
+int
+main()
+{
+  const std::vector<Variant> all = variants();
+  Job job;
+  size_t n;
+  while (scanf("%d %u %u %u %u %u %lf %zu",
+               &job.mode,
+               &job.glitch,
+               &job.poll_us,
+               &job.reset_us,
+               &job.guard_us,
+               &job.phase_us,
+               &job.end_us,
+               &n) == 8) {
+    job.trace.resize(n);
+    for (auto& tr : job.trace) {
+      if (scanf("%lf %d", &tr.t_us, &tr.level) != 2) {
+        return 1;
+      }
+    }
+
+    const Variant* v = find_variant(all, job);
+    if (!n || !job.poll_us || job.mode > DEBOUNCE_EAGER) {
+      printf("error bad job\n");
+    } else if (!v) {
+      printf("error glitch=%u reset=%u not built in, see variants()\n",
+             job.glitch,
+             job.reset_us);
+    } else {
+      const Edges edges = v->replay(job);
+      printf("%zu\n", edges.size());
+      for (const auto& e : edges) {
+        printf("%.3f %d\n", e.t_us, e.level);
+      }
+    }
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * The Teensy sketch on the fake core, run against the real clock for
+ * evdev_latency.py selftest. Serial goes through a pty, so the host side
+ * talks to the sketch's own handle_message(). Pedals and HID reports are
+ * lines on stdin and stdout:
+ *     stdin:  "<pedal> <level>" sets the pedal's pin.
+ *     stdout: "pty <slave path>" once at start,
+ *             "pin <t_us> <pedal> <level>" when a pin was set,
+ *             "report <t_us> <kind> <hex bytes>" per HID report, kinds as
+ *             in FakeReportKind.
+ * Times are the sketch's micros(). Exits at EOF on stdin.
+ *
+ * Usage: device_emu [start_us] [drift_ppm]
+ * The device clock starts at start_us and runs drift_ppm fast.
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "foot-mouse-teensy.ino"
+
+static uint64_t g_host_start_ns;
+static uint32_t g_device_start_us;
+static double g_drift_ppm;
+
+static uint64_t
+host_ns()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t
+device_now_us()
+{
+  const double elapsed_us = (host_ns() - g_host_start_ns) / 1000.0;
+  return g_device_start_us +
+         static_cast<uint32_t>(elapsed_us * (1 + g_drift_ppm * 1e-6));
+}
+
+// The fake clock follows the real one, running the sampler on the way.
+// Busy waits in the sketch may have moved it ahead, then it waits.
+static void
+catch_up()
+{
+  const int32_t behind = device_now_us() - fake_micros;
+  if (behind > 0) {
+    fake_advance(behind);
+  }
+}
+
+// delay() blocks for real, the sampler keeps running.
+static void
+sleep_real(uint32_t us)
+{
+  const uint32_t end = fake_micros + us;
+  while (static_cast<int32_t>(end - device_now_us()) > 0) {
+    const timespec step{ 0, POLL_PERIOD_US * 1000 };
+    nanosleep(&step, nullptr);
+    catch_up();
+  }
+  catch_up();
+}
+
+static int
+open_pty()
+{
+  const int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master)) {
+    return -1;
+  }
+  // Held open so the master doesn't see a hangup between host connections.
+  const int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  termios tio;
+  if (slave < 0 || tcgetattr(slave, &tio)) {
+    return -1;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  return master;
+}
+
+// Apply "<pedal> <level>" lines, returns the unparsed rest.
+static std::string
+set_pins(std::string lines)
+{
+  size_t end;
+  while ((end = lines.find('\n')) != std::string::npos) {
+    unsigned pedal;
+    int level;
+    if (sscanf(lines.c_str(), "%u %d", &pedal, &level) == 2 &&
+        pedal < PEDAL_PIN_COUNT) {
+      fake_pins[PEDAL_PINS[pedal]] = level;
+      printf("pin %u %u %d\n",
+             static_cast<unsigned>(fake_micros),
+             pedal,
+             level);
+    }
+    lines.erase(0, end + 1);
+  }
+  return lines;
+}
+
+int
+main(int argc, char** argv)
+{
+  g_device_start_us = argc > 1 ? strtoul(argv[1], nullptr, 0) : 0;
+  g_drift_ppm = argc > 2 ? atof(argv[2]) : 0;
+  g_host_start_ns = host_ns();
+
+  const int pty = open_pty();
+  if (pty < 0) {
+    perror("pty");
+    return 1;
+  }
+  printf("pty %s\n", ptsname(pty));
+  fflush(stdout);
+
+  fake_micros = device_now_us();
+  fake_sleep = sleep_real;
+  setup();
+  usb_configuration = 1;
+
+  std::string input;
+  for (;;) {
+    pollfd fds[] = { { STDIN_FILENO, POLLIN, 0 }, { pty, POLLIN, 0 } };
+    const timespec timeout{ 0, POLL_PERIOD_US * 1000 };
+    ppoll(fds, 2, &timeout, nullptr);
+    catch_up();
+
+    char buf[4096];
+    if (fds[0].revents) {
+      const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      input = set_pins(input + std::string(buf, n));
+    }
+    if (fds[1].revents & POLLIN) {
+      const ssize_t n = read(pty, buf, sizeof(buf));
+      if (n > 0) {
+        Serial.rx.insert(Serial.rx.end(), buf, buf + n);
+      }
+    }
+
+    loop();
+
+    size_t sent = 0;
+    while (sent < Serial.tx.size()) {
+      const ssize_t n =
+        write(pty, Serial.tx.data() + sent, Serial.tx.size() - sent);
+      if (n <= 0) {
+        break;
+      }
+      sent += n;
+    }
+    Serial.tx.clear();
+
+    for (const auto& r : fake_teensy_usb.reports) {
+      printf("report %u %u ", static_cast<unsigned>(r.t_us), r.kind);
+      for (uint8_t b : r.data) {
+        printf("%02x", b);
+      }
+      printf("\n");
+    }
+    fake_teensy_usb.reports.clear();
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef FOOTMOUSE_FAKE_ADAFRUIT_TINYUSB_H
+#define FOOTMOUSE_FAKE_ADAFRUIT_TINYUSB_H
+
+/*
+ * A USB device with one HID endpoint that records every report handed to
+ * it. Like the real endpoint it takes one report at a time: it is busy until
+ * the test plays the host and calls tud_hid_report_complete_cb().
+ */
+
+#include <Arduino.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#define CFG_TUD_HID 1
+#define CFG_TUD_CDC 1
+
+#define HID_REPORT_ID(x) 0x85, x,
+#define TUD_HID_REPORT_DESC_KEYBOARD(...) 0x05, 0x01, __VA_ARGS__ 0xC0
+#define TUD_HID_REPORT_DESC_MOUSE(...) 0x05, 0x01, __VA_ARGS__ 0xC0
+#define TUD_HID_REPORT_DESC_CONSUMER(...) 0x05, 0x0C, __VA_ARGS__ 0xC0
+#define TUD_HID_REPORT_DESC_ABSMOUSE(...) 0x05, 0x01, __VA_ARGS__ 0xC0
+
+typedef struct __attribute__((packed))
+{
+  uint8_t buttons;
+  int16_t x;
+  int16_t y;
+  int8_t wheel;
+  int8_t pan;
+} hid_abs_mouse_report_t;
+
+struct FakeHidReport
+{
+  uint8_t id;
+  std::vector<uint8_t> data;
+  // When the report was handed to the endpoint.
+  uint32_t t_us = 0;
+};
+
+struct FakeUsbBus
+{
+  std::vector<FakeHidReport> reports;
+  bool in_flight = false;
+  // sendReport() fails this many more times, like a busy endpoint.
+  int fail_sends = 0;
+  int failed_sends = 0;
+  // Cleared by a test to play a bus reset, which also cancels the in-flight
+  // transfer without a completion callback.
+  bool mounted = true;
+};
+
+inline FakeUsbBus fake_usb;
+
+struct FakeUsbDevice
+{
+  bool isInitialized() { return true; }
+  void begin(int) {}
+  bool mounted() { return fake_usb.mounted; }
+  bool suspended() { return false; }
+  void remoteWakeup() {}
+  void detach() {}
+  void attach() {}
+};
+
+inline FakeUsbDevice TinyUSBDevice;
+
+struct Adafruit_USBD_HID
+{
+  void setReportDescriptor(const uint8_t*, size_t) {}
+  void setPollInterval(int) {}
+  bool begin() { return true; }
+  bool ready() { return !fake_usb.in_flight; }
+
+  bool sendReport(uint8_t id, const void* data, uint8_t len)
+  {
+    if (fake_usb.fail_sends > 0) {
+      fake_usb.fail_sends--;
+      fake_usb.failed_sends++;
+      return false;
+    }
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    fake_usb.reports.push_back(
+      { id, std::vector<uint8_t>(p, p + len), micros() });
+    fake_usb.in_flight = true;
+    return true;
+  }
+};
+
+#endif // FOOTMOUSE_FAKE_ADAFRUIT_TINYUSB_H
@@ -0,0 +1,196 @@
+#ifndef FOOTMOUSE_FAKE_ARDUINO_H
+#define FOOTMOUSE_FAKE_ARDUINO_H
+
+/*
+ * The parts of the Arduino core the tested modules use. Time only moves when
+ * a test advances fake_micros (or calls delay()), and Serial is a pair of
+ * byte buffers.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+
+inline uint32_t fake_micros = 0;
+
+// Runs after delay() advanced the clock, e.g. to let a fake host collect
+// reports while the code under test waits.
+inline void (*fake_delay_hook)() = nullptr;
+
+/**
+ * A periodic interrupt, e.g. Teensy's IntervalTimer. It fires whenever the
+ * clock is moved with fake_advance(), delay() or delayMicroseconds().
+ */
+struct FakeTimer
+{
+  void (*isr)() = nullptr;
+  uint32_t period_us = 0;
+  uint32_t next_us = 0;
+};
+
+inline FakeTimer fake_timer;
+
+inline uint32_t
+micros()
+{
+  return fake_micros;
+}
+
+inline uint32_t
+millis()
+{
+  return fake_micros / 1000;
+}
+
+/**
+ * Move the clock forward by us, running the timer interrupt when it is due.
+ */
+inline void
+fake_advance(uint32_t us)
+{
+  const uint32_t end = fake_micros + us;
+  while (fake_timer.isr &&
+         static_cast<int32_t>(end - fake_timer.next_us) >= 0) {
+    fake_micros = fake_timer.next_us;
+    fake_timer.next_us += fake_timer.period_us;
+    fake_timer.isr();
+  }
+  fake_micros = end;
+}
+
+// Set by the FreeRTOS fake once tasks exist: delay() blocks the calling task
+// and lets the others run, a busy wait may let a higher priority task in.
+inline void (*fake_sleep)(uint32_t us) = nullptr;
+inline void (*fake_busy_wait_done)() = nullptr;
+
+inline void
+delay(uint32_t ms)
+{
+  if (fake_sleep) {
+    fake_sleep(ms * 1000);
+  } else {
+    fake_advance(ms * 1000);
+  }
+  if (fake_delay_hook) {
+    fake_delay_hook();
+  }
+}
+
+inline void
+delayMicroseconds(uint32_t us)
+{
+  fake_advance(us);
+  if (fake_busy_wait_done) {
+    fake_busy_wait_done();
+  }
+}
+
+// Nothing runs concurrently with the code under test.
+inline void
+noInterrupts()
+{
+}
+
+inline void
+interrupts()
+{
+}
+
+#define INPUT 0
+
+// Pin levels the code under test reads, set by the test.
+inline uint8_t fake_pins[64] = { 0 };
+inline uint16_t fake_analog[64] = { 0 };
+
+inline void
+pinMode(uint8_t, uint8_t)
+{
+}
+
+inline int
+digitalRead(uint8_t pin)
+{
+  return fake_pins[pin];
+}
+
+inline int
+analogRead(uint8_t pin)
+{
+  return fake_analog[pin];
+}
+
+inline void
+analogReadResolution(unsigned int)
+{
+}
+
+struct FakeSerial
+{
+  std::deque<uint8_t> rx; // Host to device.
+  std::vector<uint8_t> tx; // Device to host.
+
+  void begin(uint32_t) {}
+
+  int available() { return static_cast<int>(rx.size()); }
+
+  int availableForWrite() { return 4096; }
+
+  void flush() {}
+
+  int peek() { return rx.empty() ? -1 : rx.front(); }
+
+  int read()
+  {
+    if (rx.empty()) {
+      return -1;
+    }
+    const uint8_t b = rx.front();
+    rx.pop_front();
+    return b;
+  }
+
+  size_t write(uint8_t b)
+  {
+    tx.push_back(b);
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t length)
+  {
+    tx.insert(tx.end(), data, data + length);
+    return length;
+  }
+
+  size_t write(const char* data, size_t length)
+  {
+    return write(reinterpret_cast<const uint8_t*>(data), length);
+  }
+
+  size_t print(const char* text)
+  {
+    return write(reinterpret_cast<const uint8_t*>(text), strlen(text));
+  }
+
+  size_t print(unsigned long value)
+  {
+    char text[16];
+    snprintf(text, sizeof(text), "%lu", value);
+    return print(text);
+  }
+
+  size_t println(unsigned long value) { return print(value) + print("\n"); }
+};
+
+inline FakeSerial Serial;
+
+#if defined(TEENSYDUINO)
+#include "teensy_core.h"
+#elif defined(ARDUINO_ARCH_NRF52)
+#include "nrf_core.h"
+#endif
+
+#endif // FOOTMOUSE_FAKE_ARDUINO_H
@@ -0,0 +1,37 @@
+#ifndef FOOTMOUSE_FAKE_EEPROM_H
+#define FOOTMOUSE_FAKE_EEPROM_H
+
+/*
+ * Teensy's emulated EEPROM as a byte image a test can fill or inspect. It
+ * starts erased, like a board that was never configured.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define E2END 0x437
+
+struct FakeEeprom
+{
+  uint8_t image[E2END + 1];
+
+  FakeEeprom() { erase(); }
+
+  void erase() { memset(image, 0xFF, sizeof(image)); }
+
+  uint8_t& operator[](int index) { return image[index]; }
+
+  uint8_t read(int index) { return image[index]; }
+
+  void update(int index, uint8_t value) { image[index] = value; }
+};
+
+inline FakeEeprom EEPROM;
+
+inline void
+eeprom_read_block(void* buf, const void* addr, uint32_t len)
+{
+  memcpy(buf, EEPROM.image + reinterpret_cast<uintptr_t>(addr), len);
+}
+
+#endif // FOOTMOUSE_FAKE_EEPROM_H
@@ -0,0 +1,389 @@
+#ifndef FOOTMOUSE_FAKE_FREERTOS_H
+#define FOOTMOUSE_FAKE_FREERTOS_H
+
+/*
+ * FreeRTOS on one simulated core. Tasks are ucontext coroutines and code
+ * takes no time: the clock only moves while every task is blocked, or in
+ * delayMicroseconds(). The highest priority task that can run does, and a
+ * task that wakes a higher priority one is preempted. That makes the
+ * interleaving at the tasks' blocking points deterministic; it says nothing
+ * about how long the code between them takes on the MCU.
+ *
+ * The test's main thread is a task above all others, so it changes pins and
+ * plays the host at exact times. Until a task is created (e.g. in the
+ * TinyUSB shim test) blocking calls just advance the clock. One tick is a
+ * millisecond.
+ */
+
+#include <Arduino.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include <deque>
+#include <vector>
+
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+// 32 bits, as on the Cortex-M4 port.
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  pdTRUE
+
+#define portMAX_DELAY     0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) static_cast<TickType_t>(ms)
+
+// Nothing runs between two blocking points.
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+struct FakeQueue
+{
+  size_t item_size;
+  size_t length;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+struct FakeTask;
+
+struct FakeMutex
+{
+  FakeTask* owner = nullptr;
+};
+
+struct FakeTask
+{
+  FakeTask(const char* name, UBaseType_t priority)
+    : name(name)
+    , priority(priority)
+  {
+  }
+
+  const char* name;
+  UBaseType_t priority;
+  void (*fn)(void*) = nullptr;
+  void* arg = nullptr;
+  ucontext_t ctx;
+  std::vector<uint8_t> stack;
+
+  // A blocked task runs again once wake_us passed (if timed) or the object it
+  // waits for is available.
+  bool blocked = false;
+  bool timed = false;
+  uint32_t wake_us = 0;
+  FakeQueue* wait_queue = nullptr;
+  FakeMutex* wait_mutex = nullptr;
+  // Equal priorities take turns.
+  uint64_t last_run = 0;
+};
+
+typedef FakeQueue* QueueHandle_t;
+typedef FakeMutex* SemaphoreHandle_t;
+typedef FakeTask* TaskHandle_t;
+
+struct FakeScheduler
+{
+  FakeTask main_task{ "main", 1000 };
+  std::vector<FakeTask*> tasks;
+  FakeTask* current = &main_task;
+  uint64_t switches = 0;
+};
+
+inline FakeScheduler fake_rtos;
+
+// Host code needs more stack than the firmware's word counts.
+constexpr size_t FAKE_TASK_STACK_BYTES = 256 * 1024;
+
+inline bool
+fake_task_can_run(const FakeTask* t)
+{
+  return !t->blocked || (t->wait_queue && !t->wait_queue->items.empty()) ||
+         (t->wait_mutex && !t->wait_mutex->owner) ||
+         (t->timed && static_cast<int32_t>(fake_micros - t->wake_us) >= 0);
+}
+
+inline FakeTask*
+fake_pick_task()
+{
+  FakeTask* best = nullptr;
+  auto consider = [&best](FakeTask* t) {
+    if (fake_task_can_run(t) &&
+        (!best || t->priority > best->priority ||
+         (t->priority == best->priority && t->last_run < best->last_run))) {
+      best = t;
+    }
+  };
+  consider(&fake_rtos.main_task);
+  for (FakeTask* t : fake_rtos.tasks) {
+    consider(t);
+  }
+  return best;
+}
+
+inline void
+fake_switch_to(FakeTask* next)
+{
+  FakeTask* const prev = fake_rtos.current;
+  next->blocked = false;
+  next->last_run = ++fake_rtos.switches;
+  if (next != prev) {
+    fake_rtos.current = next;
+    swapcontext(&prev->ctx, &next->ctx);
+  }
+}
+
+/**
+ * Block the current task and run the others, moving the clock when all of
+ * them wait, until it can run again. The caller set what it waits for.
+ */
+inline void
+fake_block()
+{
+  fake_rtos.current->blocked = true;
+  for (;;) {
+    FakeTask* next = fake_pick_task();
+    if (next) {
+      fake_switch_to(next);
+      return;
+    }
+
+    const FakeTask* first = nullptr;
+    auto consider = [&first](const FakeTask* t) {
+      if (t->timed && (!first || static_cast<int32_t>(t->wake_us -
+                                                      first->wake_us) < 0)) {
+        first = t;
+      }
+    };
+    consider(&fake_rtos.main_task);
+    for (const FakeTask* t : fake_rtos.tasks) {
+      consider(t);
+    }
+    if (!first) {
+      fprintf(stderr, "FreeRTOS fake: every task waits forever\n");
+      abort();
+    }
+    fake_advance(first->wake_us - fake_micros);
+  }
+}
+
+inline void
+fake_yield_if_preempted()
+{
+  FakeTask* next = fake_pick_task();
+  if (next && next->priority > fake_rtos.current->priority) {
+    fake_switch_to(next);
+  }
+}
+
+inline void
+fake_sleep_until(uint32_t wake_us)
+{
+  FakeTask* const self = fake_rtos.current;
+  self->timed = true;
+  self->wake_us = wake_us;
+  fake_block();
+  self->timed = false;
+}
+
+inline void
+fake_task_entry()
+{
+  FakeTask* const self = fake_rtos.current;
+  self->fn(self->arg);
+  // A task that returns never runs again.
+  fake_block();
+}
+
+inline BaseType_t
+xTaskCreate(void (*fn)(void*),
+            const char* name,
+            uint32_t,
+            void* arg,
+            UBaseType_t priority,
+            TaskHandle_t* handle)
+{
+  FakeTask* t = new FakeTask(name, priority);
+  t->fn = fn;
+  t->arg = arg;
+  t->stack.resize(FAKE_TASK_STACK_BYTES);
+  getcontext(&t->ctx);
+  t->ctx.uc_stack.ss_sp = t->stack.data();
+  t->ctx.uc_stack.ss_size = t->stack.size();
+  t->ctx.uc_link = nullptr;
+  makecontext(&t->ctx, fake_task_entry, 0);
+  fake_rtos.tasks.push_back(t);
+  if (handle) {
+    *handle = t;
+  }
+
+  fake_sleep = [](uint32_t us) { fake_sleep_until(fake_micros + us); };
+  fake_busy_wait_done = fake_yield_if_preempted;
+  fake_yield_if_preempted();
+  return pdPASS;
+}
+
+inline TaskHandle_t
+xTaskGetCurrentTaskHandle()
+{
+  return fake_rtos.current;
+}
+
+inline UBaseType_t
+uxTaskGetStackHighWaterMark(TaskHandle_t)
+{
+  return 0;
+}
+
+inline TickType_t
+xTaskGetTickCount()
+{
+  return millis();
+}
+
+inline void
+vTaskDelay(TickType_t ticks)
+{
+  delay(ticks);
+}
+
+inline void
+vTaskDelayUntil(TickType_t* previous_wake, TickType_t increment)
+{
+  *previous_wake += increment;
+  const uint32_t wake_us = *previous_wake * 1000;
+  if (static_cast<int32_t>(wake_us - fake_micros) > 0) {
+    if (fake_sleep) {
+      fake_sleep_until(wake_us);
+    } else {
+      fake_advance(wake_us - fake_micros);
+    }
+  }
+}
+
+/**
+ * Wait until ready() or the timeout in ticks. Without tasks nothing else
+ * can make ready() true, so the clock just moves to the timeout.
+ */
+template<typename Ready>
+inline bool
+fake_wait(TickType_t timeout,
+          FakeQueue* queue,
+          FakeMutex* mutex,
+          const Ready& ready)
+{
+  const uint32_t deadline_us = fake_micros + timeout * 1000;
+  for (;;) {
+    if (ready()) {
+      return true;
+    }
+    const bool forever = timeout == portMAX_DELAY;
+    if (!forever && static_cast<int32_t>(fake_micros - deadline_us) >= 0) {
+      return false;
+    }
+    if (!fake_sleep) {
+      if (forever) {
+        fprintf(stderr, "FreeRTOS fake: waiting forever without tasks\n");
+        abort();
+      }
+      fake_advance(deadline_us - fake_micros);
+      continue;
+    }
+
+    FakeTask* const self = fake_rtos.current;
+    self->wait_queue = queue;
+    self->wait_mutex = mutex;
+    self->timed = !forever;
+    self->wake_us = deadline_us;
+    fake_block();
+    self->wait_queue = nullptr;
+    self->wait_mutex = nullptr;
+    self->timed = false;
+  }
+}
+
+inline QueueHandle_t
+xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+  return new FakeQueue{ item_size, length, {} };
+}
+
+// Senders never block, the firmware only sends with a timeout of 0.
+inline BaseType_t
+xQueueSend(QueueHandle_t q, const void* item, TickType_t)
+{
+  if (q->items.size() >= q->length) {
+    return pdFALSE;
+  }
+  const uint8_t* p = static_cast<const uint8_t*>(item);
+  q->items.emplace_back(p, p + q->item_size);
+  fake_yield_if_preempted();
+  return pdTRUE;
+}
+
+inline BaseType_t
+xQueueOverwrite(QueueHandle_t q, const void* item)
+{
+  q->items.clear();
+  return xQueueSend(q, item, 0);
+}
+
+inline BaseType_t
+xQueueReceive(QueueHandle_t q, void* item, TickType_t timeout)
+{
+  if (!fake_wait(timeout, q, nullptr, [q]() { return !q->items.empty(); })) {
+    return pdFALSE;
+  }
+  memcpy(item, q->items.front().data(), q->item_size);
+  q->items.pop_front();
+  return pdTRUE;
+}
+
+inline UBaseType_t
+uxQueueMessagesWaiting(QueueHandle_t q)
+{
+  return q->items.size();
+}
+
+inline SemaphoreHandle_t
+xSemaphoreCreateMutex()
+{
+  return new FakeMutex;
+}
+
+inline BaseType_t
+xSemaphoreTake(SemaphoreHandle_t m, TickType_t timeout)
+{
+  FakeTask* const self = fake_rtos.current;
+  if (m->owner == self) {
+    fprintf(stderr, "FreeRTOS fake: %s took a mutex it holds\n", self->name);
+    abort();
+  }
+  if (!fake_wait(timeout, nullptr, m, [m]() { return !m->owner; })) {
+    return pdFALSE;
+  }
+  m->owner = self;
+  return pdTRUE;
+}
+
+inline TaskHandle_t
+xSemaphoreGetMutexHolder(SemaphoreHandle_t m)
+{
+  return m->owner;
+}
+
+inline BaseType_t
+xSemaphoreGive(SemaphoreHandle_t m)
+{
+  if (m->owner != fake_rtos.current) {
+    return pdFALSE;
+  }
+  m->owner = nullptr;
+  fake_yield_if_preempted();
+  return pdTRUE;
+}
+
+#endif // FOOTMOUSE_FAKE_FREERTOS_H
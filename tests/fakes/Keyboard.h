@@ -0,0 +1,7 @@
+#ifndef FOOTMOUSE_FAKE_KEYBOARD_H
+#define FOOTMOUSE_FAKE_KEYBOARD_H
+
+// Part of the fake Teensy core, see teensy_core.h.
+#include "Arduino.h"
+
+#endif // FOOTMOUSE_FAKE_KEYBOARD_H
@@ -0,0 +1,7 @@
+#ifndef FOOTMOUSE_FAKE_ARDUINO_SECRETS_H
+#define FOOTMOUSE_FAKE_ARDUINO_SECRETS_H
+
+// Not in the repository; a placeholder so the sketch builds on the host.
+#define SECRET_BITLOCKER_RECOVERY_KEY "000000-000000-000000-000000"
+
+#endif // FOOTMOUSE_FAKE_ARDUINO_SECRETS_H
@@ -0,0 +1,89 @@
+#ifndef FOOTMOUSE_FAKE_NRF_CORE_H
+#define FOOTMOUSE_FAKE_NRF_CORE_H
+
+/*
+ * The Seeed XIAO nRF52840 core as the sketch uses it: pin names, GPIO port
+ * registers backed by fake_pins, the cycle counter registers and FreeRTOS.
+ */
+
+#include "FreeRTOS.h"
+
+enum
+{
+  D0,
+  D1,
+  D2,
+  D3,
+  D4,
+  D5,
+  D6,
+  D7,
+  D8,
+  D9,
+  D10,
+};
+
+// Port * 32 + bit of each pin, as in the XIAO variant.
+inline const uint32_t g_ADigitalPinMap[] = {
+  2, 3, 28, 29, 4, 5, 32 + 11, 32 + 12, 32 + 13, 32 + 14, 32 + 15,
+};
+
+struct FakeGpioPort
+{
+  // Reads the levels of the pins on this port.
+  struct Input
+  {
+    uint32_t port;
+
+    operator uint32_t() const
+    {
+      uint32_t levels = 0;
+      for (size_t pin = 0; pin <= D10; pin++) {
+        const uint32_t gpio = g_ADigitalPinMap[pin];
+        if (gpio / 32 == port && fake_pins[pin]) {
+          levels |= 1u << (gpio % 32);
+        }
+      }
+      return levels;
+    }
+  } IN;
+};
+
+inline FakeGpioPort fake_gpio_ports[] = { { { 0 } }, { { 1 } } };
+
+#define NRF_P0 (&fake_gpio_ports[0])
+#define NRF_P1 (&fake_gpio_ports[1])
+
+inline void
+analogOversampling(uint32_t)
+{
+}
+
+struct FakeCoreDebug
+{
+  uint32_t DEMCR;
+};
+
+struct FakeDwt
+{
+  uint32_t CTRL;
+  uint32_t CYCCNT;
+};
+
+inline FakeCoreDebug fake_core_debug;
+inline FakeDwt fake_dwt;
+
+#define CoreDebug                   (&fake_core_debug)
+#define DWT                         (&fake_dwt)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1u << 24)
+#define DWT_CTRL_CYCCNTENA_Msk      1u
+
+inline uint32_t SystemCoreClock = 64000000;
+
+// The test drives the main thread itself.
+inline void
+suspendLoop()
+{
+}
+
+#endif // FOOTMOUSE_FAKE_NRF_CORE_H
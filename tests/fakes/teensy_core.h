@@ -0,0 +1,229 @@
+#ifndef FOOTMOUSE_FAKE_TEENSY_CORE_H
+#define FOOTMOUSE_FAKE_TEENSY_CORE_H
+
+/*
+ * The Teensy 4 core as the sketch uses it: cycle counter, core clock,
+ * IntervalTimer and the USB keyboard and mouse. Reports are recorded with
+ * their time instead of going to a host. Until the test sets
+ * usb_configuration the device isn't enumerated and sends fail, as they
+ * would time out on the real core.
+ */
+
+#include "ascii_hid.h"
+#include "tinyusbkeycodes.h"
+
+inline uint32_t F_CPU_ACTUAL = 24000000;
+
+inline uint32_t
+fake_cycle_count()
+{
+  return fake_micros * (F_CPU_ACTUAL / 1000000);
+}
+
+#define ARM_DWT_CYCCNT fake_cycle_count()
+
+extern "C" inline uint32_t
+set_arm_clock(uint32_t frequency)
+{
+  F_CPU_ACTUAL = frequency;
+  return frequency;
+}
+
+inline int
+digitalReadFast(uint8_t pin)
+{
+  return fake_pins[pin];
+}
+
+inline void
+analogReadAveraging(unsigned int)
+{
+}
+
+class IntervalTimer
+{
+public:
+  void priority(uint8_t) {}
+
+  bool begin(void (*isr)(), uint32_t period_us)
+  {
+    fake_timer.isr = isr;
+    fake_timer.period_us = period_us;
+    fake_timer.next_us = fake_micros + period_us;
+    return true;
+  }
+
+  void end() { fake_timer.isr = nullptr; }
+};
+
+extern "C" {
+inline volatile uint8_t usb_configuration = 0;
+}
+
+enum FakeReportKind : uint8_t
+{
+  FAKE_REPORT_KEYBOARD = 1, // modifiers, 0, 6 keys
+  FAKE_REPORT_MOUSE = 2,    // buttons, x, y, wheel
+  FAKE_REPORT_MEDIA = 3,    // usage low byte, high byte
+  FAKE_REPORT_ABS = 4,      // x low, x high, y low, y high
+};
+
+struct FakeUsbReport
+{
+  uint8_t kind;
+  std::vector<uint8_t> data;
+  uint32_t t_us;
+};
+
+struct FakeTeensyUsb
+{
+  std::vector<FakeUsbReport> reports;
+  // Sends fail this many more times, like a host that stopped polling.
+  int fail_sends = 0;
+  uint8_t mouse_buttons = 0;
+
+  int send(uint8_t kind, std::vector<uint8_t> data)
+  {
+    if (!usb_configuration) {
+      return -1;
+    }
+    if (fail_sends > 0) {
+      fail_sends--;
+      return -1;
+    }
+    reports.push_back({ kind, std::move(data), fake_micros });
+    return 0;
+  }
+};
+
+inline FakeTeensyUsb fake_teensy_usb;
+
+inline uint8_t keyboard_modifier_keys = 0;
+inline uint8_t keyboard_keys[6] = { 0 };
+
+inline int
+usb_keyboard_send()
+{
+  std::vector<uint8_t> r = { keyboard_modifier_keys, 0 };
+  r.insert(r.end(), keyboard_keys, keyboard_keys + 6);
+  return fake_teensy_usb.send(FAKE_REPORT_KEYBOARD, r);
+}
+
+inline int
+usb_mouse_buttons(uint8_t left, uint8_t middle, uint8_t right, uint8_t, uint8_t)
+{
+  fake_teensy_usb.mouse_buttons = (left ? MOUSE_LEFT : 0) |
+                                  (middle ? MOUSE_MIDDLE : 0) |
+                                  (right ? MOUSE_RIGHT : 0);
+  return fake_teensy_usb.send(FAKE_REPORT_MOUSE,
+                              { fake_teensy_usb.mouse_buttons, 0, 0, 0 });
+}
+
+class usb_keyboard_class
+{
+public:
+  void begin() {}
+
+  void set_modifier(uint16_t c) { keyboard_modifier_keys = c; }
+  void set_key1(uint8_t c) { keyboard_keys[0] = c; }
+  void set_key2(uint8_t c) { keyboard_keys[1] = c; }
+  void set_key3(uint8_t c) { keyboard_keys[2] = c; }
+  void set_key4(uint8_t c) { keyboard_keys[3] = c; }
+  void set_key5(uint8_t c) { keyboard_keys[4] = c; }
+  void set_key6(uint8_t c) { keyboard_keys[5] = c; }
+  void send_now() { usb_keyboard_send(); }
+
+  void press(uint16_t k) { change(k, true); }
+  void release(uint16_t k) { change(k, false); }
+
+  size_t write(uint8_t c)
+  {
+    press(c);
+    release(c);
+    return 1;
+  }
+
+  size_t print(const char* s)
+  {
+    size_t n = 0;
+    for (; s[n]; n++) {
+      write(s[n]);
+    }
+    return n;
+  }
+
+private:
+  void change(uint16_t k, bool down)
+  {
+    uint8_t mod = 0;
+    uint8_t usage = 0;
+    switch (k & 0xFF00) {
+      case 0xE000:
+        mod = k & 0xFF;
+        break;
+      case 0xE400:
+        fake_teensy_usb.send(
+          FAKE_REPORT_MEDIA,
+          { static_cast<uint8_t>(down ? k & 0xFF : 0), 0 });
+        return;
+      case 0xF000:
+        usage = k & 0xFF;
+        break;
+      case 0:
+        usage = ascii_to_hid_usage(static_cast<char>(k), mod);
+        break;
+      default:
+        return;
+    }
+
+    if (down) {
+      keyboard_modifier_keys |= mod;
+    } else {
+      keyboard_modifier_keys &= ~mod;
+    }
+    for (auto& key : keyboard_keys) {
+      if (usage && key == usage) {
+        key = 0;
+      }
+    }
+    if (down && usage) {
+      for (auto& key : keyboard_keys) {
+        if (!key) {
+          key = usage;
+          break;
+        }
+      }
+    }
+    usb_keyboard_send();
+  }
+};
+
+class usb_mouse_class
+{
+public:
+  void begin() {}
+  void screenSize(uint16_t, uint16_t) {}
+
+  void move(int8_t x, int8_t y, int8_t wheel = 0)
+  {
+    fake_teensy_usb.send(FAKE_REPORT_MOUSE,
+                         { fake_teensy_usb.mouse_buttons,
+                           static_cast<uint8_t>(x),
+                           static_cast<uint8_t>(y),
+                           static_cast<uint8_t>(wheel) });
+  }
+
+  void moveTo(uint16_t x, uint16_t y)
+  {
+    fake_teensy_usb.send(FAKE_REPORT_ABS,
+                         { static_cast<uint8_t>(x),
+                           static_cast<uint8_t>(x >> 8),
+                           static_cast<uint8_t>(y),
+                           static_cast<uint8_t>(y >> 8) });
+  }
+};
+
+inline usb_keyboard_class Keyboard;
+inline usb_mouse_class Mouse;
+
+#endif // FOOTMOUSE_FAKE_TEENSY_CORE_H
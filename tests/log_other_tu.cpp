@@ -0,0 +1,8 @@
+#include "log.h"
+
+// Logs from a second translation unit, see test_log.cpp.
+void
+log_from_other_tu(uint32_t a)
+{
+  log_msg<LOG_INFO>(LOG_MSG_USB_MOUNTED, a);
+}
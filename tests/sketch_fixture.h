@@ -0,0 +1,80 @@
+#ifndef FOOTMOUSE_TESTS_SKETCH_FIXTURE_H
+#define FOOTMOUSE_TESTS_SKETCH_FIXTURE_H
+
+/*
+ * The whole sketch, built for the Teensy or the nRF52 against the fake core,
+ * and helpers to drive it. Include once per test executable.
+ */
+
+#include <algorithm>
+
+#include "foot-mouse-teensy.ino"
+
+#if defined(TEENSYDUINO)
+// Main loop iterations are this far apart.
+constexpr uint32_t LOOP_STEP_US = 10;
+
+static void
+run_loop_until(uint32_t end_us)
+{
+  while (static_cast<int32_t>(end_us - micros()) > 0) {
+    loop();
+    fake_advance(LOOP_STEP_US);
+  }
+}
+
+static std::vector<FakeUsbReport>
+mouse_reports()
+{
+  std::vector<FakeUsbReport> out;
+  for (const auto& r : fake_teensy_usb.reports) {
+    if (r.kind == FAKE_REPORT_MOUSE) {
+      out.push_back(r);
+    }
+  }
+  return out;
+}
+
+#elif defined(ENABLE_NRF52_TASK_SPLIT)
+extern "C" void
+tud_hid_report_complete_cb(uint8_t instance,
+                           uint8_t const* report,
+                           uint16_t len);
+
+// The host polls the HID endpoint this often.
+constexpr uint32_t HOST_POLL_US = 1000;
+constexpr uint8_t REPORT_ID_KEYBOARD = 1;
+constexpr uint8_t REPORT_ID_MOUSE = 2;
+
+/**
+ * Let the tasks run until end_us. At every HOST_POLL_US the host takes the
+ * report in flight, if any.
+ */
+static void
+run_tasks_until(uint32_t end_us)
+{
+  while (static_cast<int32_t>(end_us - micros()) > 0) {
+    const uint32_t to_poll = HOST_POLL_US - micros() % HOST_POLL_US;
+    const uint32_t to_end = end_us - micros();
+    fake_sleep_until(micros() + std::min(to_poll, to_end));
+    if (micros() % HOST_POLL_US == 0 && fake_usb.in_flight) {
+      fake_usb.in_flight = false;
+      tud_hid_report_complete_cb(0, nullptr, 0);
+    }
+  }
+}
+
+static std::vector<FakeHidReport>
+mouse_reports()
+{
+  std::vector<FakeHidReport> out;
+  for (const auto& r : fake_usb.reports) {
+    if (r.id == REPORT_ID_MOUSE) {
+      out.push_back(r);
+    }
+  }
+  return out;
+}
+#endif
+
+#endif // FOOTMOUSE_TESTS_SKETCH_FIXTURE_H
@@ -0,0 +1,37 @@
+#include "abs_pointer.h"
+#include "check.h"
+
+static void
+test_report()
+{
+  const auto r = make_abs_pointer_report(100, ABS_POINTER_CENTER);
+  CHECK_EQ(r.buttons, 0);
+  CHECK_EQ(r.x, 100);
+  CHECK_EQ(r.y, ABS_POINTER_CENTER);
+  CHECK_EQ(r.wheel, 0);
+  CHECK_EQ(r.pan, 0);
+
+  // Out of range fractions stick to the far edge, never wrap negative.
+  const auto edge = make_abs_pointer_report(0xFFFF, ABS_POINTER_MAX + 1);
+  CHECK_EQ(edge.x, ABS_POINTER_MAX);
+  CHECK_EQ(edge.y, ABS_POINTER_MAX);
+}
+
+static void
+test_teensy_grid()
+{
+  CHECK_EQ(abs_fraction_to_teensy_grid(0), 0);
+  CHECK_EQ(abs_fraction_to_teensy_grid(ABS_POINTER_MAX),
+           ABS_POINTER_TEENSY_GRID - 1);
+  CHECK_EQ(abs_fraction_to_teensy_grid(0xFFFF), ABS_POINTER_TEENSY_GRID - 1);
+  CHECK_EQ(abs_fraction_to_teensy_grid(ABS_POINTER_CENTER),
+           (ABS_POINTER_TEENSY_GRID - 1) / 2);
+}
+
+int
+main()
+{
+  test_report();
+  test_teensy_grid();
+  return test_result();
+}
@@ -0,0 +1,212 @@
+#include "analog_pedal.h"
+#include "check.h"
+
+static void
+test_curve()
+{
+  int16_t curve[ANALOG_CURVE_POINTS];
+  for (size_t i = 0; i < ANALOG_CURVE_POINTS; i++) {
+    curve[i] = static_cast<int16_t>(i * 100);
+  }
+  CHECK_EQ(apply_curve(curve, 0), 0);
+  CHECK_EQ(apply_curve(curve, ANALOG_CURVE_SEGMENT), 100);
+  CHECK_EQ(apply_curve(curve, ANALOG_CURVE_SEGMENT / 2), 50);
+  CHECK_EQ(apply_curve(curve, ANALOG_POSITION_MAX),
+           curve[ANALOG_CURVE_POINTS - 2] +
+             100 * (ANALOG_CURVE_SEGMENT - 1) / ANALOG_CURVE_SEGMENT);
+
+  curve[1] = -100;
+  CHECK_EQ(apply_curve(curve, ANALOG_CURVE_SEGMENT / 2), -50);
+}
+
+// Feed a full oversampling group of one value.
+static bool
+feed(AnalogFilter& f, uint16_t raw, uint8_t shift = 0, uint16_t hyst = 24)
+{
+  bool moved = false;
+  for (size_t i = 0; i < ANALOG_OVERSAMPLE; i++) {
+    moved = f.add_sample(raw, shift, hyst);
+  }
+  return moved;
+}
+
+static void
+test_filter_hysteresis()
+{
+  AnalogFilter f;
+  f.reset(1000);
+
+  // Nothing is reported before a full oversampling group.
+  for (size_t i = 0; i + 1 < ANALOG_OVERSAMPLE; i++) {
+    CHECK(!f.add_sample(3000, 0, 24));
+  }
+  CHECK(f.add_sample(3000, 0, 24));
+  CHECK_EQ(f.position(), 3000);
+
+  // Jitter inside the band is held.
+  CHECK(!feed(f, 3020));
+  CHECK(!feed(f, 2980));
+  CHECK_EQ(f.position(), 3000);
+  CHECK(feed(f, 3030));
+  CHECK_EQ(f.position(), 3030);
+
+  // The ends are always reachable.
+  f.reset(10);
+  CHECK(feed(f, 0));
+  CHECK_EQ(f.position(), 0);
+  f.reset(ANALOG_POSITION_MAX - 10);
+  CHECK(feed(f, ANALOG_POSITION_MAX));
+  CHECK_EQ(f.position(), ANALOG_POSITION_MAX);
+}
+
+static void
+test_filter_iir()
+{
+  // With iir_shift 2 a step moves a quarter of the way per group.
+  AnalogFilter f;
+  f.reset(0);
+  CHECK(feed(f, 400, 2, 0));
+  CHECK_EQ(f.position(), 100);
+  CHECK(feed(f, 400, 2, 0));
+  CHECK_EQ(f.position(), 175);
+}
+
+static void
+test_rate_accumulator()
+{
+  RateAccumulator r;
+
+  // 100 steps per second in 1 ms slices: one step every 10 slices, the
+  // remainder carries over.
+  int total = 0;
+  for (int i = 0; i < 1000; i++) {
+    total += r.take(100, 1000);
+  }
+  CHECK_EQ(total, 100);
+
+  total = 0;
+  for (int i = 0; i < 1000; i++) {
+    total += r.take(-33, 1000);
+  }
+  CHECK_EQ(total, -33);
+
+  // One report carries at most 127 steps, the rest is dropped so the output
+  // stops with the pedal.
+  r.reset();
+  CHECK_EQ(r.take(32767, 1000000), 127);
+  CHECK_EQ(r.take(0, 0), 0);
+  r.reset();
+  CHECK_EQ(r.take(-32768, 1000000), -127);
+  CHECK_EQ(r.take(0, 0), 0);
+  // The fraction of a step isn't.
+  CHECK_EQ(r.take(-1, 1), -1);
+}
+
+// Uniform ADC noise in [-amplitude, amplitude] from a fixed seed.
+struct Noise
+{
+  uint32_t x;
+  int amplitude;
+
+  int next()
+  {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return static_cast<int>(x % (2 * amplitude + 1)) - amplitude;
+  }
+};
+
+static uint16_t
+adc(double level, Noise& noise)
+{
+  const int raw = static_cast<int>(level + 0.5) + noise.next();
+  return raw < 0 ? 0 : (raw > ANALOG_POSITION_MAX ? ANALOG_POSITION_MAX : raw);
+}
+
+static constexpr int NOISE_LSB = 8;
+static constexpr uint8_t IIR_SHIFT = AnalogConfig().iir_shift;
+static constexpr uint16_t HYSTERESIS = AnalogConfig().hysteresis;
+
+/**
+ * Ramp from `from` to `to` at `per_sample` positions per ADC sample, then
+ * hold. Returns the largest distance between the reported position and
+ * the noise free level while moving.
+ */
+static double
+ramp_and_hold(AnalogFilter& f,
+              Noise& noise,
+              double from,
+              double to,
+              double per_sample)
+{
+  const double step = to > from ? per_sample : -per_sample;
+  double level = from;
+  double max_lag = 0;
+  while (level != to) {
+    double group_sum = 0;
+    for (size_t i = 0; i < ANALOG_OVERSAMPLE; i++) {
+      level += step;
+      if ((step > 0 && level > to) || (step < 0 && level < to)) {
+        level = to;
+      }
+      group_sum += level;
+      f.add_sample(adc(level, noise), IIR_SHIFT, HYSTERESIS);
+    }
+    const double lag = group_sum / ANALOG_OVERSAMPLE - f.position();
+    max_lag = lag > max_lag ? lag : (-lag > max_lag ? -lag : max_lag);
+  }
+
+  // Settle for ten time constants, then the position must not move.
+  for (size_t i = 0; i < 10 * ANALOG_OVERSAMPLE << IIR_SHIFT; i++) {
+    f.add_sample(adc(to, noise), IIR_SHIFT, HYSTERESIS);
+  }
+  // The position can stop anywhere in the hysteresis band behind the level,
+  // and noise at the band's edge may still move it once, towards the level.
+  // After that it must hold.
+  const uint16_t rest = f.position();
+  CHECK(rest >= to - HYSTERESIS - NOISE_LSB - 1);
+  CHECK(rest <= to + HYSTERESIS + NOISE_LSB + 1);
+  int moves = 0;
+  for (size_t i = 0; i < 60000; i++) {
+    moves += f.add_sample(adc(to, noise), IIR_SHIFT, HYSTERESIS);
+  }
+  CHECK(moves <= 1);
+  const double before = rest - to;
+  const double after = f.position() - to;
+  CHECK((after < 0 ? -after : after) <= (before < 0 ? -before : before));
+  return max_lag;
+}
+
+static void
+test_filter_noise()
+{
+  // Travel at two speeds in both directions, the slowest under a position per
+  // group so the hysteresis band decides when the output moves.
+  const double speeds[] = { 0.2, 1.0, 8.0 };
+  for (uint32_t seed = 1; seed <= 8; seed++) {
+    for (double per_sample : speeds) {
+      Noise noise{ seed, NOISE_LSB };
+      AnalogFilter f;
+      f.reset(500);
+      // A first order IIR trails a ramp by (2^shift - 1) groups' worth of
+      // travel, plus the hysteresis band and the noise.
+      const double bound = per_sample * ANALOG_OVERSAMPLE *
+                             ((1 << IIR_SHIFT) - 1) +
+                           HYSTERESIS + NOISE_LSB + 1;
+      CHECK(ramp_and_hold(f, noise, 500, 3500, per_sample) <= bound);
+      CHECK(ramp_and_hold(f, noise, 3500, 1200, per_sample) <= bound);
+    }
+  }
+}
+
+int
+main()
+{
+  test_curve();
+  test_filter_hysteresis();
+  test_filter_iir();
+  test_rate_accumulator();
+  test_filter_noise();
+  return test_result();
+}
@@ -0,0 +1,70 @@
+#include "bench.h"
+#include "check.h"
+
+static void
+test_summarize()
+{
+  uint32_t samples[] = { 7, 3, 9, 1, 5 };
+  const auto r = bench_summarize(BENCH_CRC32_512, samples, 5);
+  CHECK_EQ(r.id, BENCH_CRC32_512);
+  CHECK_EQ(r.min_cycles, 1);
+  CHECK_EQ(r.median_cycles, 5);
+  CHECK_EQ(r.max_cycles, 9);
+  for (size_t i = 1; i < 5; i++) {
+    CHECK(samples[i - 1] <= samples[i]);
+  }
+
+  const auto empty = bench_summarize(BENCH_LOOP, samples, 0);
+  CHECK_EQ(empty.min_cycles, 0);
+  CHECK_EQ(empty.median_cycles, 0);
+  CHECK_EQ(empty.max_cycles, 0);
+}
+
+static void
+test_run_bench()
+{
+  int calls = 0;
+  run_bench(BENCH_ASCII_TO_HID, [&] { calls++; });
+  CHECK_EQ(calls, BENCH_RUNS);
+
+  // Samples come from the callback as they are.
+  uint32_t next = 0;
+  const auto r = run_bench_sampled(BENCH_HID_REPORT, [&](uint32_t) {
+    next += 10;
+    return next;
+  });
+  CHECK_EQ(r.min_cycles, 10);
+  CHECK_EQ(r.median_cycles, 10 * (BENCH_RUNS / 2 + 1));
+  CHECK_EQ(r.max_cycles, 10 * BENCH_RUNS);
+}
+
+static void
+test_loop_cycle_log()
+{
+  LoopCycleLog log;
+  CHECK_EQ(log.result().max_cycles, 0);
+
+  log.add(5);
+  log.add(3);
+  auto r = log.result();
+  CHECK_EQ(r.id, BENCH_LOOP);
+  CHECK_EQ(r.min_cycles, 3);
+  CHECK_EQ(r.max_cycles, 5);
+
+  // Only the most recent BENCH_RUNS iterations count.
+  for (uint32_t i = 0; i < BENCH_RUNS; i++) {
+    log.add(100 + i);
+  }
+  r = log.result();
+  CHECK_EQ(r.min_cycles, 100);
+  CHECK_EQ(r.max_cycles, 100 + BENCH_RUNS - 1);
+}
+
+int
+main()
+{
+  test_summarize();
+  test_run_bench();
+  test_loop_cycle_log();
+  return test_result();
+}
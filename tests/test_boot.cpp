@@ -0,0 +1,79 @@
+#include "check.h"
+#include "sketch_fixture.h"
+
+// Typical enumeration time after the core started USB.
+constexpr uint32_t MOUNT_DELAY_US = 300 * 1000;
+
+/**
+ * Boot with all pedals plugged in and up, press one before the host
+ * configured the device and check its report goes out once it did.
+ */
+static void
+test_edge_before_mount()
+{
+  // The core's own startup ran before setup().
+  fake_micros = 1000;
+  const uint8_t pin = PEDAL_PINS[1];
+  setup();
+
+  // Sampling starts before USB, so edges during enumeration are captured.
+  const BootLog& log = g_boot_log;
+  const auto t = [&log](BootPhase phase) { return log.t_us[phase]; };
+  CHECK(t(BOOT_SETUP_START) <= t(BOOT_PINS_READY));
+  CHECK(t(BOOT_PINS_READY) <= t(BOOT_CONFIG_LOADED));
+  CHECK(t(BOOT_CONFIG_LOADED) <= t(BOOT_SAMPLING_STARTED));
+  CHECK(t(BOOT_SAMPLING_STARTED) <= t(BOOT_USB_BEGUN));
+  CHECK(t(BOOT_USB_BEGUN) <= t(BOOT_SETUP_DONE));
+  CHECK(buttons[1].enabled);
+
+  const uint32_t edge_us = t(BOOT_SETUP_START) + 50 * 1000;
+  run_loop_until(edge_us);
+  fake_pins[pin] = DIGITAL_READ_PEDAL_DOWN;
+
+  const uint32_t mount_us = t(BOOT_USB_BEGUN) + MOUNT_DELAY_US;
+  run_loop_until(mount_us);
+  CHECK(fake_teensy_usb.reports.empty());
+  CHECK_EQ(g_pedal_events.size(), 1);
+  CHECK_EQ(t(BOOT_FIRST_ACTION), 0);
+
+  usb_configuration = 1;
+  run_loop_until(mount_us + 1000);
+
+  // One press of the middle button, timed from the edge sampled before
+  // mount.
+  auto mouse = mouse_reports();
+  CHECK_EQ(mouse.size(), 1);
+  if (mouse.empty()) {
+    return;
+  }
+  const FakeUsbReport* r = &mouse[0];
+  CHECK_EQ(r->data[0], MOUSE_MIDDLE);
+  CHECK(t(BOOT_FIRST_EDGE) >= edge_us);
+  CHECK(t(BOOT_FIRST_EDGE) < edge_us + 2 * POLL_PERIOD_US);
+  CHECK(t(BOOT_USB_READY) >= mount_us);
+  CHECK(t(BOOT_FIRST_ACTION) >= t(BOOT_USB_READY));
+
+  printf("time_to_first_report %u us after setup() started, %u us after "
+         "mount, edge queued for %u us\n",
+         static_cast<unsigned>(r->t_us - t(BOOT_SETUP_START)),
+         static_cast<unsigned>(r->t_us - mount_us),
+         static_cast<unsigned>(r->t_us - t(BOOT_FIRST_EDGE)));
+
+  // The release isn't held back.
+  const uint32_t release_us = micros() + 100 * 1000;
+  run_loop_until(release_us);
+  fake_pins[pin] = DIGITAL_READ_PEDAL_UP;
+  run_loop_until(release_us + 1000);
+  mouse = mouse_reports();
+  CHECK_EQ(mouse.size(), 2);
+  CHECK_EQ(mouse.back().data[0], 0);
+  CHECK(mouse.back().t_us - release_us <
+        (GLITCH_SAMPLE_CNT + 1) * POLL_PERIOD_US + 2 * LOOP_STEP_US);
+}
+
+int
+main()
+{
+  test_edge_before_mount();
+  return test_result();
+}
@@ -0,0 +1,25 @@
+#include "boot_log.h"
+#include "check.h"
+
+int
+main()
+{
+  BootLog log;
+  CHECK_EQ(log.version, BOOT_LOG_VERSION);
+  CHECK_EQ(log.phase_count, BOOT_PHASE_COUNT);
+  CHECK_EQ(sizeof(log), 4 + 4 * BOOT_PHASE_COUNT);
+
+  // Only the first time a phase is reached counts.
+  log.mark(BOOT_PINS_READY, 1500);
+  log.mark(BOOT_PINS_READY, 9000);
+  CHECK_EQ(log.t_us[BOOT_PINS_READY], 1500);
+
+  // 0 means unset, so a mark at 0 is kept as 1.
+  log.mark(BOOT_SETUP_START, 0);
+  CHECK_EQ(log.t_us[BOOT_SETUP_START], 1);
+  log.mark(BOOT_SETUP_START, 500);
+  CHECK_EQ(log.t_us[BOOT_SETUP_START], 1);
+
+  CHECK_EQ(log.t_us[BOOT_FIRST_EDGE], 0);
+  return test_result();
+}
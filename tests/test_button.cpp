@@ -0,0 +1,166 @@
+#include <array>
+#include <stdint.h>
+
+#include "button.h"
+#include "check.h"
+
+// Samples level every POLL_PERIOD_US from `from` up to `to`. Returns the time
+// of the first accepted edge, 0 if there was none.
+static unsigned long
+feed(Button& btn, int level, unsigned long from, unsigned long to)
+{
+  unsigned long accepted = 0;
+  for (unsigned long t = from; t < to; t += POLL_PERIOD_US) {
+    if (btn.debounce(level, t) && !accepted) {
+      accepted = t;
+    }
+  }
+  return accepted;
+}
+
+static void
+test_edge_time_in_lockout()
+{
+  Button btn(0, 0, DOWN_CLICK);
+  const unsigned long press = DEBOUNCE_RESET;
+
+  const unsigned long accepted =
+    feed(btn, DIGITAL_READ_PEDAL_DOWN, press, press + 1000);
+  CHECK(accepted);
+  CHECK_EQ(btn.edge_time, press);
+
+  // Released while the lockout of the press still runs: accepted when it
+  // ends, but timed from the pin change.
+  const unsigned long release = accepted + DEBOUNCE_RESET / 2;
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_DOWN, accepted, release));
+  const unsigned long end = accepted + 2 * DEBOUNCE_RESET;
+  CHECK_EQ(feed(btn, DIGITAL_READ_PEDAL_UP, release, end),
+           accepted + DEBOUNCE_RESET);
+  CHECK_EQ(btn.edge_time, release);
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_UP);
+}
+
+static void
+test_glitch_counting()
+{
+  Button btn(0, 0, DOWN_CLICK);
+  unsigned long t = DEBOUNCE_RESET;
+  t = feed(btn, DIGITAL_READ_PEDAL_DOWN, t, t + 1000);
+  CHECK(t);
+
+  // Bounce right after the accepted edge is not a glitch.
+  t += POLL_PERIOD_US;
+  btn.debounce(DIGITAL_READ_PEDAL_UP, t);
+  feed(btn, DIGITAL_READ_PEDAL_DOWN, t + POLL_PERIOD_US, t + 1000);
+  CHECK_EQ(btn.rejected_glitches, 0);
+
+  // A single sample spike once the lockout is over is.
+  t += 2 * DEBOUNCE_RESET;
+  btn.debounce(DIGITAL_READ_PEDAL_UP, t);
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_DOWN, t + POLL_PERIOD_US, t + 1000));
+  CHECK_EQ(btn.rejected_glitches, 1);
+}
+
+static void
+test_eager_holdoff()
+{
+  Button btn(0, 0, DOWN_CLICK);
+  btn.set_debounce(DEBOUNCE_EAGER, DEBOUNCE_RESET, 0);
+  const unsigned long press = DEBOUNCE_RESET;
+
+  // The first differing sample is accepted.
+  CHECK(btn.debounce(DIGITAL_READ_PEDAL_DOWN, press));
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_DOWN);
+  CHECK_EQ(btn.edge_time, press);
+
+  // Bounce and an early release are ignored for the hold-off and counted
+  // once as a lockout hit.
+  const unsigned long release = press + DEBOUNCE_RESET / 2;
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_UP, press + POLL_PERIOD_US,
+              press + 4 * POLL_PERIOD_US));
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_DOWN, press + 4 * POLL_PERIOD_US,
+              release));
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_UP, release, press + DEBOUNCE_RESET));
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_DOWN);
+  CHECK_EQ(btn.lockout_hits, 1);
+
+  // The release goes out with the first sample after the hold-off.
+  CHECK_EQ(feed(btn, DIGITAL_READ_PEDAL_UP, press + DEBOUNCE_RESET,
+                press + 2 * DEBOUNCE_RESET),
+           press + DEBOUNCE_RESET);
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_UP);
+  CHECK_EQ(btn.rejected_glitches, 0);
+}
+
+static void
+test_eager_noise_guard()
+{
+  static constexpr uint32_t GUARD_US = 1000;
+  Button btn(0, 0, DOWN_CLICK);
+  btn.set_debounce(DEBOUNCE_EAGER, DEBOUNCE_RESET, GUARD_US);
+  const unsigned long spike = DEBOUNCE_RESET;
+
+  // A one sample spike engages at once, then is undone when the guard
+  // expires: an engage followed by a release.
+  CHECK(btn.debounce(DIGITAL_READ_PEDAL_DOWN, spike));
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_DOWN);
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_UP, spike + POLL_PERIOD_US,
+              spike + GUARD_US));
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_DOWN);
+  const unsigned long reverted =
+    feed(btn, DIGITAL_READ_PEDAL_UP, spike + GUARD_US, spike + 2 * GUARD_US);
+  CHECK(reverted >= spike + GUARD_US);
+  CHECK(reverted < spike + GUARD_US + POLL_PERIOD_US);
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_UP);
+  CHECK_EQ(btn.edge_time, reverted);
+  CHECK_EQ(btn.rejected_glitches, 1);
+
+  // No hold-off after a revert: a real press right after goes out with its
+  // first sample, and is kept once the guard confirms it.
+  const unsigned long press = reverted + POLL_PERIOD_US;
+  CHECK(btn.debounce(DIGITAL_READ_PEDAL_DOWN, press));
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_DOWN, press + POLL_PERIOD_US,
+              press + DEBOUNCE_RESET));
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_DOWN);
+  CHECK_EQ(btn.rejected_glitches, 1);
+}
+
+static void
+test_eager_ignores_integrate_lockout()
+{
+  // DEBOUNCE_RESET is the integrating filter's lockout. Eager mode times
+  // its own hold-off, also from an edge accepted before the switch.
+  static constexpr uint32_t HOLDOFF_US = DEBOUNCE_RESET / 4;
+  Button btn(0, 0, DOWN_CLICK);
+  const unsigned long accepted = feed(
+    btn, DIGITAL_READ_PEDAL_DOWN, DEBOUNCE_RESET, DEBOUNCE_RESET + 1000);
+  CHECK(accepted);
+
+  btn.set_debounce(DEBOUNCE_EAGER, HOLDOFF_US, 0);
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_UP, accepted + POLL_PERIOD_US,
+              accepted + HOLDOFF_US));
+  CHECK_EQ(feed(btn, DIGITAL_READ_PEDAL_UP, accepted + HOLDOFF_US,
+                accepted + DEBOUNCE_RESET),
+           accepted + HOLDOFF_US);
+  CHECK_EQ(btn.state, DIGITAL_READ_PEDAL_UP);
+
+  // Back in DEBOUNCE_INTEGRATE the lockout runs from the eager release.
+  const unsigned long release = accepted + HOLDOFF_US;
+  btn.set_debounce(DEBOUNCE_INTEGRATE, DEBOUNCE_RESET, 0);
+  CHECK(!feed(btn, DIGITAL_READ_PEDAL_DOWN, release + POLL_PERIOD_US,
+              release + DEBOUNCE_RESET));
+  CHECK_EQ(feed(btn, DIGITAL_READ_PEDAL_DOWN, release + DEBOUNCE_RESET,
+                release + 2 * DEBOUNCE_RESET),
+           release + DEBOUNCE_RESET);
+}
+
+int
+main()
+{
+  test_edge_time_in_lockout();
+  test_glitch_counting();
+  test_eager_holdoff();
+  test_eager_noise_guard();
+  test_eager_ignores_integrate_lockout();
+  return test_result();
+}
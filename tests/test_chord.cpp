@@ -0,0 +1,188 @@
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "chord.h"
+
+// Logs the resolved actions, e.g. "0+ 0- C3 ".
+struct Recorder
+{
+  std::string log;
+
+  void single(uint8_t pedal, bool engage)
+  {
+    log += std::to_string(pedal) + (engage ? "+ " : "- ");
+  }
+
+  void chord(const Chord& c)
+  {
+    log += "C" + std::to_string(c.pedal_mask) + " ";
+  }
+};
+
+static ChordEngine<4>
+make_engine()
+{
+  ChordEngine<4> e;
+  e.chords[0].pedal_mask = 0b0011;
+  e.chords[0].window_ms = 50;
+  e.update_members();
+  return e;
+}
+
+static void
+test_non_members_pass_through()
+{
+  auto e = make_engine();
+  Recorder out;
+  e.on_edge(2, true, 0, out);
+  e.on_edge(2, false, 1000, out);
+  CHECK(out.log == "2+ 2- ");
+  CHECK(!e.has_pending());
+}
+
+static void
+test_chord_within_window()
+{
+  auto e = make_engine();
+  Recorder out;
+  e.on_edge(0, true, 0, out);
+  CHECK(e.has_pending());
+  e.on_edge(1, true, 40000, out);
+  CHECK(out.log == "C3 ");
+  CHECK(!e.has_pending());
+
+  // The members' releases are swallowed.
+  e.on_edge(0, false, 100000, out);
+  e.on_edge(1, false, 110000, out);
+  CHECK(out.log == "C3 ");
+}
+
+static void
+test_window_expires()
+{
+  auto e = make_engine();
+  Recorder out;
+  e.on_edge(0, true, 0, out);
+  e.tick(49999, out);
+  CHECK(out.log.empty());
+  e.tick(50000, out);
+  CHECK(out.log == "0+ ");
+
+  // Too late for the chord: the second member acts alone after its own
+  // window.
+  e.on_edge(1, true, 60000, out);
+  CHECK(out.log == "0+ ");
+  e.tick(110000, out);
+  e.on_edge(1, false, 120000, out);
+  e.on_edge(0, false, 130000, out);
+  CHECK(out.log == "0+ 1+ 1- 0- ");
+}
+
+static void
+test_short_solo_press()
+{
+  // Released before the window expired: press and release go out together.
+  auto e = make_engine();
+  Recorder out;
+  e.on_edge(1, true, 0, out);
+  e.on_edge(1, false, 20000, out);
+  CHECK(out.log == "1+ 1- ");
+  CHECK(!e.has_pending());
+}
+
+// Counts of a pedal's engages and releases in a Recorder log.
+static int
+count(const std::string& log, const std::string& token)
+{
+  int n = 0;
+  for (size_t pos = log.find(token); pos != std::string::npos;
+       pos = log.find(token, pos + 1)) {
+    n++;
+  }
+  return n;
+}
+
+/**
+ * Second member pressed offset_us after the first, both held past the
+ * window and then released in either order. tick() runs every
+ * LOOP_STEP_US like the main loop; tick_first decides whether it also runs
+ * at the second edge's time before the edge is handled.
+ */
+static std::string
+press_pair(uint32_t offset_us, bool tick_first, bool release_first_first)
+{
+  static constexpr uint32_t LOOP_STEP_US = 100;
+  auto e = make_engine();
+  Recorder out;
+  e.on_edge(0, true, 0, out);
+  for (uint32_t t = LOOP_STEP_US; t < offset_us; t += LOOP_STEP_US) {
+    e.tick(t, out);
+  }
+  if (tick_first) {
+    e.tick(offset_us, out);
+  }
+  e.on_edge(1, true, offset_us, out);
+
+  const uint32_t held_until = offset_us + 200000;
+  for (uint32_t t = offset_us; t <= held_until; t += LOOP_STEP_US) {
+    e.tick(t, out);
+  }
+  e.on_edge(release_first_first ? 0 : 1, false, held_until, out);
+  e.on_edge(release_first_first ? 1 : 0, false, held_until + 1000, out);
+  CHECK(!e.has_pending());
+
+  // Nothing of the pair is left over for the next press.
+  e.on_edge(0, true, held_until + 300000, out);
+  e.on_edge(0, false, held_until + 310000, out);
+  CHECK(!e.has_pending());
+  return out.log;
+}
+
+static void
+test_second_member_offset_sweep()
+{
+  static constexpr uint32_t WINDOW_US = 50 * 1000;
+  std::vector<uint32_t> offsets;
+  for (uint32_t off = 0; off <= WINDOW_US + 20000; off += 1000) {
+    offsets.push_back(off);
+  }
+  offsets.push_back(WINDOW_US - 1);
+  offsets.push_back(WINDOW_US + 1);
+
+  for (uint32_t off : offsets) {
+    for (bool tick_first : { false, true }) {
+      for (bool release_first_first : { false, true }) {
+        const std::string log =
+          press_pair(off, tick_first, release_first_first);
+        // Strip the trailing solo press of pedal 0.
+        CHECK(log.size() >= 6 && log.substr(log.size() - 6) == "0+ 0- ");
+        const std::string pair = log.substr(0, log.size() - 6);
+        if (off < WINDOW_US) {
+          // Releases of a chord's members are swallowed.
+          CHECK(pair == "C3 ");
+        } else {
+          CHECK(pair == (release_first_first ? "0+ 1+ 0- 1- "
+                                             : "0+ 1+ 1- 0- "));
+        }
+        // Each engage sent is released exactly once.
+        for (const char* p : { "0", "1" }) {
+          CHECK(count(pair, std::string(p) + "+") ==
+                count(pair, std::string(p) + "-"));
+          CHECK(count(pair, std::string(p) + "+") <= 1);
+        }
+      }
+    }
+  }
+}
+
+int
+main()
+{
+  test_non_members_pass_through();
+  test_chord_within_window();
+  test_window_expires();
+  test_short_solo_press();
+  test_second_member_offset_sweep();
+  return test_result();
+}
@@ -0,0 +1,113 @@
+#include <vector>
+
+#include "check.h"
+#include "cpu_clock.h"
+
+// Records switches instead of touching the PLL.
+struct FakeClock
+{
+  std::vector<uint32_t> sets;
+
+  uint32_t set(uint32_t hz)
+  {
+    sets.push_back(hz);
+    return 150;
+  }
+};
+
+constexpr uint32_t IDLE_HZ = 24000000;
+constexpr uint32_t BOOST_HZ = 600000000;
+
+static void
+test_boost_and_quiet()
+{
+  CpuClockGovernor g;
+  FakeClock clock;
+  g.begin(IDLE_HZ, BOOST_HZ, 2000, 100);
+  g.tick(100, clock);
+  g.tick(101, clock);
+  CHECK(clock.sets.empty());
+
+  // Switches wait for the first tick in a new millisecond.
+  g.activity(101);
+  g.tick(101, clock);
+  CHECK(clock.sets.empty());
+  g.tick(102, clock);
+  CHECK_EQ(clock.sets.size(), 1);
+  CHECK_EQ(clock.sets[0], BOOST_HZ);
+  CHECK(g.boosted());
+
+  // Activity restarts the quiet period.
+  g.activity(1500);
+  g.tick(1500, clock);
+  g.tick(3499, clock);
+  CHECK(g.boosted());
+  g.tick(3500, clock);
+  CHECK(!g.boosted());
+  CHECK_EQ(clock.sets.back(), IDLE_HZ);
+
+  const auto t = g.stats(4000);
+  CHECK_EQ(t.idle_hz, IDLE_HZ);
+  CHECK_EQ(t.boost_hz, BOOST_HZ);
+  CHECK_EQ(t.idle_ms, 2 + 500);
+  CHECK_EQ(t.boost_ms, 3398);
+  CHECK_EQ(t.boosts, 1);
+  CHECK_EQ(t.max_switch_us, 150);
+}
+
+static void
+test_configure()
+{
+  CpuClockGovernor g;
+  FakeClock clock;
+  g.begin(IDLE_HZ, BOOST_HZ, 2000, 0);
+
+  // boost_hz 0 disables boosting.
+  g.configure(0, 2000);
+  g.activity(100);
+  g.tick(101, clock);
+  CHECK(!g.boosted());
+  CHECK(clock.sets.empty());
+
+  g.configure(300000000, 100);
+  g.activity(200);
+  g.tick(201, clock);
+  CHECK_EQ(clock.sets.back(), 300000000);
+
+  g.reset_stats(300);
+  const auto t = g.stats(301);
+  CHECK_EQ(t.boost_ms, 1);
+  CHECK_EQ(t.idle_ms, 0);
+  CHECK_EQ(t.boosts, 0);
+
+  // Dropping the boost clock while boosted returns to idle.
+  g.configure(0, 100);
+  g.tick(302, clock);
+  CHECK(!g.boosted());
+  CHECK_EQ(clock.sets.back(), IDLE_HZ);
+}
+
+static void
+test_millis_wrap()
+{
+  CpuClockGovernor g;
+  FakeClock clock;
+  g.begin(IDLE_HZ, BOOST_HZ, 10, 0xFFFFFFF0u);
+  g.activity(0xFFFFFFF8u);
+  g.tick(0xFFFFFFF9u, clock);
+  CHECK(g.boosted());
+  g.tick(1, clock);
+  CHECK(g.boosted());
+  g.tick(2, clock);
+  CHECK(!g.boosted());
+  CHECK_EQ(g.stats(2).boost_ms, 9);
+}
+
+int
+main()
+{
+  test_boost_and_quiet();
+  test_configure();
+  test_millis_wrap();
+  return test_result();
+}
@@ -0,0 +1,110 @@
+"""
+Replay traces through button.h with debounce_replay and run
+debounce_eval.py on recorded traces.
+
+Usage:
+    python test_debounce_eval.py <path to the debounce_replay executable>
+"""
+import os
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.join(os.path.dirname(__file__), "..")
+sys.path.insert(0, ROOT)
+
+import debounce_eval as de  # noqa: E402
+import scope_capture  # noqa: E402
+
+# Keep in sync with constants.h.
+GLITCH_SAMPLE_CNT = 3
+POLL_PERIOD_US = 80
+DEBOUNCE_RESET = 20000
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print(f"FAILED: {what}", file=sys.stderr)
+        failures += 1
+
+
+def replay(algo_cls, transitions, end_us=50000, **params):
+    params = dict(dict(glitch=GLITCH_SAMPLE_CNT,
+                       poll=POLL_PERIOD_US,
+                       reset=DEBOUNCE_RESET),
+                  **params)
+    return de.simulate(algo_cls(**params), transitions, end_us)
+
+
+def test_replay():
+    spike = [(0, 0), (1000, 1), (1100, 0)]
+    edges = replay(de.GlitchBufferDebounce, spike)
+    check(edges == [], f"integrate rejects a one sample spike: {edges}")
+
+    # Eager takes the first differing sample, the release waits for the
+    # hold-off.
+    edges = replay(de.EagerDebounce, spike)
+    check(edges == [(1040.0, 1), (21040.0, 0)],
+          f"eager accepts the spike, releases after the hold-off: {edges}")
+
+    # The release settles inside the lockout and goes out when it ends.
+    press = [(0, 0), (1000, 1), (5000, 0)]
+    edges = replay(de.GlitchBufferDebounce, press)
+    check(edges == [(1200.0, 1), (21200.0, 0)],
+          f"integrate press after 3 samples, release after lockout: {edges}")
+
+    try:
+        replay(de.GlitchBufferDebounce, press, glitch=4)
+        check(False, "glitch=4 isn't built into debounce_replay")
+    except ValueError:
+        pass
+
+
+def write_trace(path, pedals, samples):
+    scope_capture.save_trace(path, {
+        "pedals": pedals,
+        "samples": samples,
+        "trigger_index": 0,
+        "period_us": 10.0,
+    })
+
+
+def test_eval_per_model(replay_path):
+    with tempfile.TemporaryDirectory() as tmp:
+        a = os.path.join(tmp, "a.csv")
+        b = os.path.join(tmp, "b.csv")
+        # Pedal 0 pressed at 10 ms and released at 60 ms, with bounce in b.
+        write_trace(a, [0], [0] * 1000 + [1] * 5000 + [0] * 5000)
+        write_trace(b, [0],
+                    [0] * 1000 + [1, 0] * 10 + [1] * 4980 + [0] * 5000)
+        out = subprocess.run([
+            sys.executable,
+            os.path.join(ROOT, "debounce_eval.py"), "eval", "--trace", a, b,
+            "--replay", replay_path
+        ],
+                             check=True,
+                             capture_output=True,
+                             text=True).stdout
+    lines = out.splitlines()
+    check(f"{a}: {a}:p0" in lines, f"model header for a.csv in:\n{out}")
+    check(f"{b}: {b}:p0" in lines, f"model header for b.csv in:\n{out}")
+    check("synthetic" not in out, f"no synthetic model in:\n{out}")
+    check(sum(" glitch=" in line for line in lines) == 2,
+          f"one row per model in:\n{out}")
+
+
+def main():
+    replay_path = sys.argv[1]
+    de.start_replay(replay_path)
+    test_replay()
+    test_eval_per_model(replay_path)
+    if failures:
+        sys.exit(1)
+    print("ok")
+
+
+if __name__ == "__main__":
+    main()
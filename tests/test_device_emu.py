@@ -0,0 +1,116 @@
+"""
+Run evdev_latency.py's selftest emulator on the host build of the sketch,
+without uinput: modes set and CMD_GET_TIME answered by handle_message()
+over the pty, pedal edges streamed, HID reports turned into key events.
+
+Usage:
+    python test_device_emu.py <path to the device_emu executable>
+"""
+import os
+import struct
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
+
+import evdev_latency as el  # noqa: E402
+import serial_commands as sc  # noqa: E402
+
+# Longer than DEBOUNCE_RESET in constants.h.
+HOLD_S = 0.05
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print(f"FAILED: {what}", file=sys.stderr)
+        failures += 1
+
+
+class Recorder:
+    """Stands in for Uinput."""
+
+    def __init__(self):
+        self.events = []
+
+    def emit(self, events: list[tuple[int, int]]):
+        self.events += events
+
+
+def pedal_edges(data: bytes) -> list[tuple[int, bool]]:
+    """(pedal, engage) of the pedal event notifications in data."""
+    frames, _ = sc.split_reply_frames(data)
+    edges = []
+    for f in frames:
+        if f.notify and f.cmd == el.REPLY_PEDAL_EVENT_FRAME:
+            _, count = struct.unpack_from(el.FRAME_HEADER_FMT, f.payload)
+            offset = struct.calcsize(el.FRAME_HEADER_FMT)
+            size = struct.calcsize(el.PEDAL_EVENT_FMT)
+            for i in range(count):
+                _, _, pedal, _, engage, _ = struct.unpack_from(
+                    el.PEDAL_EVENT_FMT, f.payload, offset + i * size)
+                edges.append((pedal, bool(engage)))
+    return edges
+
+
+def main():
+    out = Recorder()
+    emulator = el.Emulator(sys.argv[1], out)
+    emulator.configure()
+    threading.Thread(target=emulator.serve, daemon=True).start()
+
+    fd = os.open(emulator.port, os.O_RDWR | os.O_NOCTTY)
+    (now_us, ) = struct.unpack("<I",
+                               emulator.transact(fd, sc.CMD_GET_TIME).payload)
+    since_start = (now_us - el.SELFTEST_CLOCK_START_US) & 0xFFFFFFFF
+    check(since_start < 10_000_000, f"device clock started at {now_us}")
+
+    # As run() does.
+    emulator.transact(fd, sc.CMD_IDENTIFY, bytes([sc.PROTOCOL_V2]), seq=2)
+    emulator.transact(fd, sc.CMD_PEDAL_EVENTS_START, seq=3)
+    for pedal in range(len(emulator.modes)):
+        for level in (1, 0):
+            emulator.set_pedal(pedal, level)
+            time.sleep(HOLD_S)
+    data = b""
+    while el.select.select([fd], [], [], 0.2)[0]:
+        data += os.read(fd, 4096)
+    os.close(fd)
+    emulator.close()
+
+    check(
+        pedal_edges(data) == [(0, True), (0, False), (1, True), (1, False),
+                              (2, True), (2, False)],
+        f"pedal edges {pedal_edges(data)}")
+
+    ctrl, s, left = el.KEY_LEFTCTRL, el.LETTER_CODES[0x16], el.BTN_LEFT
+    expected = [
+        (left, 1), (left, 0),  # left
+        (ctrl, 1), (left, 1), (ctrl, 0), (left, 0),  # control_click
+        (ctrl, 1), (s, 1), (ctrl, 0), (s, 0),  # keycombo ctrl+s
+    ]
+    check(out.events == expected, f"host events {out.events}")
+
+    # keycombo fires on engage only.
+    check(
+        sorted(emulator.expected) == [("control_click", "down"),
+                                      ("control_click", "up"),
+                                      ("keycombo", "down"), ("left", "down"),
+                                      ("left", "up")],
+        f"edges with host events {sorted(emulator.expected)}")
+    for key, samples in emulator.expected.items():
+        delay_ms = el.SELFTEST_MODES[el.sc.modes[key[0]]]
+        # The glitch filter and a few loop passes, scheduling aside.
+        check(all(delay_ms < ms < delay_ms + 10 for ms in samples),
+              f"{key} took {samples} ms")
+
+    if failures:
+        sys.exit(1)
+    print("ok")
+
+
+if __name__ == "__main__":
+    main()
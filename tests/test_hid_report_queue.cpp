@@ -0,0 +1,181 @@
+#include "check.h"
+#include "hid_report_queue.h"
+
+static HidReport
+keyboard(uint8_t modifiers, uint8_t key)
+{
+  HidReport r{};
+  r.report_id = 1;
+  r.kind = HID_REPORT_STATE;
+  r.len = HID_REPORT_MAX_LEN;
+  r.data[0] = modifiers;
+  r.data[2] = key;
+  return r;
+}
+
+static HidReport
+event(uint8_t value)
+{
+  HidReport r{};
+  r.report_id = 3;
+  r.kind = HID_REPORT_EVENT;
+  r.len = 4;
+  r.data[0] = value;
+  return r;
+}
+
+// Send the head as the endpoint would, succeeding or not.
+template<size_t N>
+static bool
+send_head(HidReportQueue<N>& q, bool ok, HidReport* out = nullptr)
+{
+  HidReport r;
+  if (!q.take_next(r)) {
+    return false;
+  }
+  if (out) {
+    *out = r;
+  }
+  q.send_done(r, ok);
+  return ok;
+}
+
+static void
+test_fifo_and_completion()
+{
+  HidReportQueue<4> q;
+  CHECK(q.push(event(1)));
+  CHECK(q.push(event(2)));
+
+  HidReport r;
+  CHECK(send_head(q, true, &r));
+  CHECK_EQ(r.data[0], 1);
+
+  // One report in flight at a time.
+  CHECK(!q.take_next(r));
+  q.on_complete();
+  CHECK_EQ(q.depth(), 1);
+
+  CHECK(send_head(q, true, &r));
+  CHECK_EQ(r.data[0], 2);
+  q.on_complete();
+  CHECK(q.empty());
+  CHECK(!q.take_next(r));
+  CHECK_EQ(q.stats.sent, 2);
+  CHECK_EQ(q.stats.bytes_sent, 8);
+}
+
+static void
+test_failed_send_is_retried()
+{
+  HidReportQueue<4> q;
+  q.push(event(1));
+  q.push(event(2));
+
+  // The endpoint is busy: the head stays first in line.
+  HidReport r;
+  CHECK(!send_head(q, false, &r));
+  CHECK(!send_head(q, false, &r));
+  CHECK_EQ(q.stats.send_failures, 2);
+  CHECK_EQ(q.depth(), 2);
+
+  CHECK(send_head(q, true, &r));
+  CHECK_EQ(r.data[0], 1);
+  q.on_complete();
+  CHECK(send_head(q, true, &r));
+  CHECK_EQ(r.data[0], 2);
+}
+
+static void
+test_completion_before_send_done()
+{
+  // The completion callback can run between the send and send_done().
+  HidReportQueue<4> q;
+  q.push(event(1));
+  q.push(event(2));
+
+  HidReport first;
+  CHECK(q.take_next(first));
+  q.on_complete();
+  HidReport second;
+  CHECK(q.take_next(second));
+  q.send_done(first, true);
+
+  // The second report is still in flight.
+  HidReport r;
+  CHECK(!q.take_next(r));
+  q.send_done(second, true);
+  q.on_complete();
+  CHECK(q.empty());
+  CHECK_EQ(q.stats.sent, 2);
+}
+
+static void
+test_in_flight_head_is_never_merged()
+{
+  HidReportQueue<4> q;
+  q.push(keyboard(0, 4));
+  HidReport r;
+  CHECK(q.take_next(r));
+
+  // Would supersede the head if it weren't in flight.
+  q.push(keyboard(0x02, 4));
+  CHECK_EQ(q.depth(), 2);
+  CHECK_EQ(q.stats.coalesced, 0);
+
+  // Pure presses behind it merge.
+  q.push(keyboard(0x06, 4));
+  CHECK_EQ(q.depth(), 2);
+  CHECK_EQ(q.stats.coalesced, 1);
+
+  // A release doesn't.
+  q.push(keyboard(0x02, 4));
+  CHECK_EQ(q.depth(), 3);
+}
+
+static void
+test_full_queue_keeps_latest_state()
+{
+  HidReportQueue<2> q;
+  q.push(event(1));
+  q.push(keyboard(0, 4));
+  CHECK_EQ(q.free_slots(), 0);
+
+  // The pending state report is overwritten, events are refused.
+  CHECK(q.push(keyboard(0, 0)));
+  CHECK(!q.push(event(2)));
+  CHECK_EQ(q.stats.dropped, 2);
+
+  HidReport r;
+  send_head(q, true);
+  q.on_complete();
+  send_head(q, true, &r);
+  CHECK_EQ(r.data[2], 0);
+  CHECK_EQ(q.stats.peak_depth, 2);
+}
+
+static void
+test_abort_in_flight()
+{
+  HidReportQueue<2> q;
+  q.push(event(1));
+  send_head(q, true);
+
+  // Bus reset: no completion will come, the report is sent again.
+  q.abort_in_flight();
+  HidReport r;
+  CHECK(q.take_next(r));
+  CHECK_EQ(r.data[0], 1);
+}
+
+int
+main()
+{
+  test_fifo_and_completion();
+  test_failed_send_is_retried();
+  test_completion_before_send_done();
+  test_in_flight_head_is_never_merged();
+  test_full_queue_keeps_latest_state();
+  test_abort_in_flight();
+  return test_result();
+}
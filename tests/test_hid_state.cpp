@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include "check.h"
+#include "hid_state.h"
+
+// Records what reached the endpoint instead of sending it.
+struct FakeEndpoint
+{
+  bool is_ready = true;
+  bool fail = false;
+  int keyboard_reports = 0;
+  int mouse_reports = 0;
+  uint8_t modifiers = 0;
+  uint8_t keys[HID_KEY_SLOTS] = { 0 };
+  uint8_t buttons = 0;
+
+  bool ready() { return is_ready; }
+
+  bool send_keyboard(uint8_t m, const uint8_t* k)
+  {
+    if (fail) {
+      return false;
+    }
+    keyboard_reports++;
+    modifiers = m;
+    memcpy(keys, k, sizeof(keys));
+    return true;
+  }
+
+  bool send_mouse_buttons(uint8_t b)
+  {
+    if (fail) {
+      return false;
+    }
+    mouse_reports++;
+    buttons = b;
+    return true;
+  }
+
+  int reports() const { return keyboard_reports + mouse_reports; }
+};
+
+static void
+test_key_packing()
+{
+  HidState s;
+  CHECK(s.press(0xF000 | 4));
+  CHECK(s.press(0xF000 | 5));
+  CHECK(s.press(0xF000 | 4));
+  CHECK(s.press(0xE000 | 0x02));
+  CHECK_EQ(s.keys[0], 4);
+  CHECK_EQ(s.keys[1], 5);
+  CHECK_EQ(s.keys[2], 0);
+  CHECK_EQ(s.modifiers, 0x02);
+
+  CHECK(s.release(0xF000 | 4));
+  CHECK_EQ(s.keys[0], 5);
+  CHECK_EQ(s.keys[1], 0);
+
+  // Media keys aren't part of the keyboard report.
+  CHECK(!s.press(0xE400 | 0xCD));
+  CHECK_EQ(s.keys[1], 0);
+}
+
+static void
+test_one_report_per_tick()
+{
+  HidStateModel model;
+  FakeEndpoint ep;
+
+  // Becoming ready sends the full (empty) state once.
+  model.commit(ep, 0);
+  CHECK_EQ(ep.keyboard_reports, 1);
+  CHECK_EQ(ep.mouse_reports, 1);
+
+  // Nothing changed, nothing sent.
+  model.commit(ep, 1);
+  CHECK_EQ(ep.reports(), 2);
+
+  // Three pedals change in the same tick: one keyboard report.
+  model.state.press(0xF000 | 4);
+  model.state.press(0xF000 | 5);
+  model.state.press(0xE000 | 0x01);
+  model.commit(ep, 2);
+  CHECK_EQ(ep.keyboard_reports, 2);
+  CHECK_EQ(ep.mouse_reports, 1);
+  CHECK_EQ(ep.keys[0], 4);
+  CHECK_EQ(ep.keys[1], 5);
+  CHECK_EQ(ep.modifiers, 0x01);
+
+  // Press and release within a tick is invisible on the wire.
+  model.state.press_buttons(1);
+  model.state.release_buttons(1);
+  model.commit(ep, 3);
+  CHECK_EQ(ep.reports(), 3);
+
+  model.state.press_buttons(1);
+  model.commit(ep, 4);
+  CHECK_EQ(ep.mouse_reports, 2);
+  CHECK_EQ(ep.buttons, 1);
+  CHECK_EQ(model.stats.keyboard_reports, 2);
+  CHECK_EQ(model.stats.mouse_reports, 2);
+}
+
+static void
+test_failed_send_is_retried()
+{
+  HidStateModel model;
+  FakeEndpoint ep;
+  model.commit(ep, 0);
+
+  ep.fail = true;
+  model.state.press(0xF000 | 4);
+  model.commit(ep, 1);
+  CHECK_EQ(model.stats.send_failures, 1);
+  CHECK_EQ(ep.keys[0], 0);
+
+  ep.fail = false;
+  model.commit(ep, 2);
+  CHECK_EQ(ep.keys[0], 4);
+  CHECK_EQ(ep.keyboard_reports, 2);
+}
+
+static void
+test_resync()
+{
+  HidStateModel model;
+  FakeEndpoint ep;
+  model.commit(ep, 0);
+  CHECK_EQ(model.stats.resyncs, 1);
+
+  // A held key is sent again every HID_RESYNC_MS.
+  model.state.press(0xF000 | 4);
+  model.commit(ep, 10);
+  CHECK_EQ(ep.keyboard_reports, 2);
+  model.commit(ep, 10 + HID_RESYNC_MS - 1);
+  CHECK_EQ(ep.keyboard_reports, 2);
+  model.commit(ep, 10 + HID_RESYNC_MS);
+  CHECK_EQ(ep.keyboard_reports, 3);
+  CHECK_EQ(ep.mouse_reports, 2);
+  model.commit(ep, 10 + 2 * HID_RESYNC_MS);
+  CHECK_EQ(ep.keyboard_reports, 4);
+
+  // After the release, one more resync and then silence.
+  model.state.release(0xF000 | 4);
+  const uint32_t released = 20 + 2 * HID_RESYNC_MS;
+  model.commit(ep, released);
+  CHECK_EQ(ep.keyboard_reports, 5);
+  const int before = ep.reports();
+  for (uint32_t t = released + 1; t < released + 4 * HID_RESYNC_MS; t++) {
+    model.commit(ep, t);
+  }
+  CHECK_EQ(ep.reports(), before + 2);
+  CHECK_EQ(ep.keys[0], 0);
+
+  // Losing the endpoint (suspend, unmount) resends everything on return.
+  ep.is_ready = false;
+  model.commit(ep, 5000);
+  CHECK_EQ(ep.reports(), before + 2);
+  ep.is_ready = true;
+  model.commit(ep, 5001);
+  CHECK_EQ(ep.reports(), before + 4);
+}
+
+int
+main()
+{
+  test_key_packing();
+  test_one_report_per_tick();
+  test_failed_send_is_retried();
+  test_resync();
+  return test_result();
+}
@@ -0,0 +1,92 @@
+#include "check.h"
+#include "log.h"
+
+void
+log_from_other_tu(uint32_t a);
+
+static void
+drain()
+{
+  LogRecord r;
+  while (log_ring().pop(r)) {
+  }
+  log_ring().dropped = 0;
+  log_ring().peak_depth = 0;
+}
+
+static void
+test_levels_and_fields()
+{
+  drain();
+  fake_micros = 1234;
+  log_msg<LOG_WARN>(LOG_MSG_FRAME_TRUNCATED, 3, 7);
+  log_msg<LOG_DEBUG>(LOG_MSG_TYPE_STRING, 1); // Above LOG_MAX_LEVEL.
+
+  LogRecord r;
+  CHECK(log_ring().pop(r));
+  CHECK_EQ(r.t_us, 1234);
+  CHECK_EQ(r.level, LOG_WARN);
+  CHECK_EQ(r.id, LOG_MSG_FRAME_TRUNCATED);
+  CHECK_EQ(r.a, 3);
+  CHECK_EQ(r.b, 7);
+  CHECK(log_ring().empty());
+}
+
+static void
+test_one_ring_across_translation_units()
+{
+  drain();
+  log_from_other_tu(42);
+  LogRecord r;
+  CHECK(log_ring().pop(r));
+  CHECK_EQ(r.id, LOG_MSG_USB_MOUNTED);
+  CHECK_EQ(r.a, 42);
+}
+
+static void
+test_full_ring_drops()
+{
+  drain();
+  for (uint32_t i = 0; i < LOG_RING_LEN + 3; i++) {
+    log_msg<LOG_INFO>(LOG_MSG_RELEASE_ALL, i);
+  }
+  CHECK_EQ(log_ring().size(), LOG_RING_LEN);
+  CHECK_EQ(log_ring().dropped, 3);
+
+  // The oldest messages are kept.
+  LogRecord r;
+  CHECK(log_ring().pop(r));
+  CHECK_EQ(r.a, 0);
+  drain();
+}
+
+static void
+test_wrap()
+{
+  // Many times around the ring, popping as a frame's worth is waiting.
+  drain();
+  uint32_t expected = 0;
+  for (uint32_t i = 0; i < 10 * LOG_RING_LEN + 5; i++) {
+    log_msg<LOG_INFO>(LOG_MSG_RELEASE_ALL, i);
+    if (log_ring().size() >= LOG_FRAME_RECORDS) {
+      LogRecord r;
+      while (log_ring().pop(r)) {
+        CHECK_EQ(r.a, expected);
+        expected++;
+      }
+    }
+  }
+  CHECK_EQ(log_ring().dropped, 0);
+  CHECK_EQ(expected + log_ring().size(), 10 * LOG_RING_LEN + 5);
+  CHECK(log_ring().peak_depth <= LOG_FRAME_RECORDS);
+}
+
+int
+main()
+{
+  test_levels_and_fields();
+  test_one_ring_across_translation_units();
+  test_full_ring_drops();
+  test_wrap();
+  return test_result();
+}
@@ -0,0 +1,170 @@
+#include "check.h"
+#include "sketch_fixture.h"
+
+using View = decltype(memview);
+
+// Pedal 0's mode in profiles 1 to 3, profile 0 keeps the defaults.
+constexpr int PROFILE_MODES[] = { 0,
+                                  MODE_MOUSE_RIGHT,
+                                  MODE_SCROLL_BAR,
+                                  MODE_FUNCTION };
+
+static View
+make_view()
+{
+  View view{};
+  for (uint8_t p = 1; p < PROFILE_COUNT; p++) {
+    view.profiles[p][0] = { static_cast<uint8_t>(PROFILE_MODES[p]), UP_CLICK };
+  }
+  view.rules[0] = { 0b011, 2 };
+  view.rules[1] = { 0b111, 1 };
+  // Points past the profiles, never selected.
+  view.rules[2] = { 0b001, PROFILE_COUNT };
+  view.default_profile = 3;
+  return view;
+}
+
+static void
+write_eeprom(const View& view, uint8_t version)
+{
+  EEPROM.erase();
+  EEPROM[flashed_index] = version;
+  memcpy(EEPROM.image + starting_index, &view, sizeof(view));
+}
+
+/**
+ * Run setup() with pedal i plugged in when bit i of connected_mask is set.
+ */
+static void
+boot(uint8_t connected_mask)
+{
+  for (size_t i = 0; i < buttons.size(); i++) {
+    buttons[i].reset_to_defaults();
+    buttons[i].enabled = true;
+    fake_pins[buttons[i].pin] = (connected_mask >> i) & 1
+                                  ? DIGITAL_READ_CONNECTED_PEDAL
+                                  : DIGITAL_READ_DISCONNECTED_PEDAL;
+  }
+  memview = View{};
+  g_active_profile = 0;
+  setup();
+}
+
+static void
+test_exact_match()
+{
+  write_eeprom(make_view(), memory_layout_version);
+
+  boot(0b011);
+  CHECK_EQ(g_active_profile, 2);
+  CHECK_EQ(buttons[0].mode, MODE_SCROLL_BAR);
+  CHECK_EQ(buttons[0].trigger_direction, UP_CLICK);
+  // A mode of 0 keeps the pedal's default.
+  CHECK_EQ(buttons[1].mode, buttons[1].default_mode);
+  CHECK(!buttons[2].enabled);
+
+  boot(0b111);
+  CHECK_EQ(g_active_profile, 1);
+  CHECK_EQ(buttons[0].mode, MODE_MOUSE_RIGHT);
+  CHECK(buttons[2].enabled);
+}
+
+static void
+test_fallback()
+{
+  View view = make_view();
+  write_eeprom(view, memory_layout_version);
+
+  // No rule for this set of pedals.
+  boot(0b110);
+  CHECK_EQ(g_active_profile, 3);
+  CHECK_EQ(buttons[0].mode, MODE_FUNCTION);
+
+  // The matching rule names a profile that doesn't exist.
+  boot(0b001);
+  CHECK_EQ(g_active_profile, 3);
+
+  // So does the default, profile 0 is used.
+  view.default_profile = PROFILE_COUNT;
+  write_eeprom(view, memory_layout_version);
+  boot(0b110);
+  CHECK_EQ(g_active_profile, 0);
+  CHECK_EQ(buttons[0].mode, buttons[0].default_mode);
+  CHECK_EQ(buttons[0].trigger_direction, buttons[0].default_inverted);
+}
+
+static void
+test_uninitialized()
+{
+  // Never written: nothing is loaded and the defaults stay.
+  EEPROM.erase();
+  boot(0b111);
+  CHECK_EQ(memview.default_profile, 0);
+  CHECK_EQ(g_active_profile, 0);
+  CHECK_EQ(buttons[0].mode, buttons[0].default_mode);
+
+  // Written with an older layout, which would be read misaligned.
+  write_eeprom(make_view(), memory_layout_version - 1);
+  boot(0b111);
+  CHECK_EQ(memview.default_profile, 0);
+  CHECK_EQ(memview.rules[1].profile, 0);
+  CHECK_EQ(g_active_profile, 0);
+  CHECK_EQ(buttons[0].mode, buttons[0].default_mode);
+}
+
+/**
+ * A pedal held across a profile switch that changes its mode must not leave
+ * the old mode's button pressed.
+ */
+static void
+test_release_on_mode_change()
+{
+  View view = make_view();
+  view.profiles[1][1] = { MODE_MOUSE_RIGHT, DOWN_CLICK };
+  view.profiles[2][1] = { MODE_MOUSE_MIDDLE, DOWN_CLICK };
+  write_eeprom(view, memory_layout_version);
+  boot(0b011);
+  CHECK_EQ(buttons[1].mode, MODE_MOUSE_MIDDLE);
+
+  usb_configuration = 1;
+  const uint8_t pin = buttons[1].pin;
+  // The first commit after mount sends the idle state.
+  run_loop_until(micros() + DEBOUNCE_RESET);
+  const size_t idle = mouse_reports().size();
+  fake_pins[pin] = DIGITAL_READ_PEDAL_DOWN;
+  run_loop_until(micros() + 1000);
+  CHECK_EQ(mouse_reports().size(), idle + 1);
+  CHECK_EQ(fake_teensy_usb.mouse_buttons, MOUSE_MIDDLE);
+
+  // Same mode: the button stays pressed.
+  apply_profile(2);
+  run_loop_until(micros() + 1000);
+  CHECK_EQ(mouse_reports().size(), idle + 1);
+  CHECK_EQ(fake_teensy_usb.mouse_buttons, MOUSE_MIDDLE);
+
+  // New mode: the middle button is released right away.
+  apply_profile(1);
+  CHECK_EQ(buttons[1].mode, MODE_MOUSE_RIGHT);
+  run_loop_until(micros() + 1000);
+  CHECK_EQ(mouse_reports().size(), idle + 2);
+  CHECK_EQ(fake_teensy_usb.mouse_buttons, 0);
+
+  // And the release under the new mode sends nothing more.
+  run_loop_until(micros() + DEBOUNCE_RESET);
+  fake_pins[pin] = DIGITAL_READ_PEDAL_UP;
+  run_loop_until(micros() + DEBOUNCE_RESET);
+  CHECK_EQ(mouse_reports().size(), idle + 2);
+  for (const auto& r : mouse_reports()) {
+    CHECK(!(r.data[0] & MOUSE_RIGHT));
+  }
+}
+
+int
+main()
+{
+  test_exact_match();
+  test_fallback();
+  test_uninitialized();
+  test_release_on_mode_change();
+  return test_result();
+}
@@ -0,0 +1,222 @@
+#include <vector>
+
+#include "check.h"
+#include "serial-msg-parsing.h"
+
+static uint32_t
+crc_of(std::vector<uint8_t> bytes)
+{
+  return crc::update_crc(0xFFFFFFFF, bytes.data(), bytes.size()) ^ 0xFFFFFFFF;
+}
+
+static void
+put_varint(std::vector<uint8_t>& out, uint32_t value)
+{
+  do {
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    out.push_back(value ? b | 0x80 : b);
+  } while (value);
+}
+
+// A v2 request as the host sends it.
+static std::vector<uint8_t>
+request_v2(uint8_t seq, uint8_t cmd, const std::vector<uint8_t>& payload)
+{
+  std::vector<uint8_t> body = { PROTOCOL_V2, seq, cmd };
+  put_varint(body, payload.size());
+  body.insert(body.end(), payload.begin(), payload.end());
+  const uint32_t crc = crc_of(body);
+
+  std::vector<uint8_t> frame = { V2_SOF };
+  frame.insert(frame.end(), body.begin(), body.end());
+  for (int i = 0; i < 4; i++) {
+    frame.push_back(crc >> (8 * i));
+  }
+  return frame;
+}
+
+static void
+receive(const std::vector<uint8_t>& bytes)
+{
+  Serial.rx.assign(bytes.begin(), bytes.end());
+  Serial.tx.clear();
+}
+
+struct DecodedReply
+{
+  bool ok = false;
+  uint8_t version = 0;
+  uint8_t seq = 0;
+  uint8_t cmd = 0;
+  uint8_t status = 0;
+  std::vector<uint8_t> payload;
+};
+
+// Parse one v2 device frame from the start of tx.
+static DecodedReply
+decode_reply(const std::vector<uint8_t>& tx)
+{
+  DecodedReply r;
+  if (tx.size() < 10 || tx[0] != V2_SOF) {
+    return r;
+  }
+  r.version = tx[1];
+  r.seq = tx[2];
+  r.cmd = tx[3];
+  r.status = tx[4];
+  size_t i = 5;
+  uint32_t length = 0;
+  for (int shift = 0; i < tx.size(); shift += 7) {
+    length |= static_cast<uint32_t>(tx[i] & 0x7F) << shift;
+    if (!(tx[i++] & 0x80)) {
+      break;
+    }
+  }
+  if (i + length + 4 != tx.size()) {
+    return r;
+  }
+  r.payload.assign(tx.begin() + i, tx.begin() + i + length);
+  uint32_t crc = 0;
+  for (int b = 0; b < 4; b++) {
+    crc |= static_cast<uint32_t>(tx[i + length + b]) << (8 * b);
+  }
+  // The crc covers everything after sof.
+  r.ok = crc == crc_of({ tx.begin() + 1, tx.begin() + i + length });
+  return r;
+}
+
+static void
+test_crc()
+{
+  // The standard check value of CRC-32.
+  CHECK_EQ(crc_of({ '1', '2', '3', '4', '5', '6', '7', '8', '9' }),
+           0xCBF43926);
+}
+
+static void
+test_request_round_trip()
+{
+  uint8_t buf[STRING_BUFFER_SIZE];
+  SerialMsgHeader header;
+
+  std::vector<uint8_t> payload(300);
+  for (size_t i = 0; i < payload.size(); i++) {
+    payload[i] = i * 7;
+  }
+  receive(request_v2(42, CMD_IDENTIFY, payload));
+  CHECK_EQ(validate_frame_v2_and_get_payload(&header, buf, sizeof(buf)),
+           STATUS_OK);
+  CHECK_EQ(header.cmd, CMD_IDENTIFY);
+  CHECK_EQ(header.length, 300);
+  CHECK(0 == memcmp(buf, payload.data(), payload.size()));
+  CHECK_EQ(g_request.seq, 42);
+  CHECK_EQ(g_request.version, PROTOCOL_V2);
+  CHECK(Serial.rx.empty());
+}
+
+static void
+test_request_errors()
+{
+  uint8_t buf[16];
+  SerialMsgHeader header;
+
+  auto frame = request_v2(1, CMD_IDENTIFY, { 1, 2, 3 });
+  frame[6] ^= 0x01;
+  receive(frame);
+  CHECK_EQ(validate_frame_v2_and_get_payload(&header, buf, sizeof(buf)),
+           STATUS_BAD_CRC);
+
+  frame = request_v2(1, CMD_IDENTIFY, { 1, 2, 3 });
+  frame.pop_back();
+  receive(frame);
+  CHECK_EQ(validate_frame_v2_and_get_payload(&header, buf, sizeof(buf)),
+           STATUS_TIMEOUT);
+
+  receive(request_v2(1, CMD_IDENTIFY, std::vector<uint8_t>(17)));
+  CHECK_EQ(validate_frame_v2_and_get_payload(&header, buf, sizeof(buf)),
+           STATUS_TOO_BIG);
+
+  frame = request_v2(1, CMD_IDENTIFY, {});
+  frame[1] = PROTOCOL_V1;
+  receive(frame);
+  CHECK_EQ(validate_frame_v2_and_get_payload(&header, buf, sizeof(buf)),
+           STATUS_BAD_FRAME);
+
+  // A varint longer than V2_MAX_VARINT_BYTES.
+  receive({ V2_SOF, PROTOCOL_V2, 1, CMD_IDENTIFY, 0x80, 0x80, 0x80, 0x01 });
+  CHECK_EQ(validate_frame_v2_and_get_payload(&header, buf, sizeof(buf)),
+           STATUS_BAD_FRAME);
+}
+
+static void
+test_reply_round_trip()
+{
+  g_request = RequestContext();
+  g_request.version = PROTOCOL_V2;
+  g_request.seq = 9;
+  Serial.tx.clear();
+
+  std::vector<uint8_t> payload(200, 0x5A);
+  send_binary_reply(CMD_IDENTIFY, payload.data(), payload.size());
+  auto r = decode_reply(Serial.tx);
+  CHECK(r.ok);
+  CHECK_EQ(r.version, PROTOCOL_V2 | V2_REPLY_FLAG);
+  CHECK_EQ(r.seq, 9);
+  CHECK_EQ(r.cmd, CMD_IDENTIFY);
+  CHECK_EQ(r.status, STATUS_OK);
+  CHECK(r.payload == payload);
+  CHECK(g_request.replied);
+
+  // Nothing more once the command replied.
+  Serial.tx.clear();
+  finish_request(CMD_IDENTIFY, STATUS_OK);
+  CHECK(Serial.tx.empty());
+
+  // A command without a reply gets an empty ACK/NAK.
+  g_request.replied = false;
+  finish_request(CMD_IDENTIFY, STATUS_BAD_PARAM);
+  r = decode_reply(Serial.tx);
+  CHECK(r.ok);
+  CHECK_EQ(r.status, STATUS_BAD_PARAM);
+  CHECK(r.payload.empty());
+}
+
+static void
+test_notify_follows_protocol()
+{
+  Serial.tx.clear();
+  g_protocol_version = PROTOCOL_V2;
+  notify_begin(0xF0, 1);
+  const uint8_t b = 7;
+  reply_write(&b, 1);
+  reply_end();
+  const auto r = decode_reply(Serial.tx);
+  CHECK(r.ok);
+  CHECK_EQ(r.version, PROTOCOL_V2 | V2_REPLY_FLAG | V2_NOTIFY_FLAG);
+  CHECK_EQ(r.seq, 0);
+
+  // v1: the plain reply header, no crc.
+  Serial.tx.clear();
+  g_protocol_version = PROTOCOL_V1;
+  notify_begin(0xF0, 1);
+  reply_write(&b, 1);
+  reply_end();
+  CHECK_EQ(Serial.tx.size(), sizeof(SerialReplyHeader) + 1);
+  SerialReplyHeader header;
+  memcpy(&header, Serial.tx.data(), sizeof(header));
+  CHECK_EQ(header.sof, REPLY_SOF);
+  CHECK_EQ(header.length, 1);
+  CHECK_EQ(header.cmd, 0xF0);
+}
+
+int
+main()
+{
+  test_crc();
+  test_request_round_trip();
+  test_request_errors();
+  test_reply_round_trip();
+  test_notify_follows_protocol();
+  return test_result();
+}
@@ -0,0 +1,226 @@
+/*
+ * The nRF52 task split on the simulated scheduler of fakes/FreeRTOS.h. Tasks
+ * interleave at their blocking points as under FreeRTOS but code takes no
+ * time, so the latencies measured here are what the task structure adds:
+ * the input task's tick and sample burst, the HID task and the host's poll.
+ */
+#include <stdio.h>
+
+#include <vector>
+
+#include "check.h"
+#include "sketch_fixture.h"
+
+// Pedal 1 is a middle click on press.
+constexpr size_t PEDAL = 1;
+
+static void
+boot()
+{
+  fake_micros = 1000;
+  for (size_t i = 0; i < buttons.size(); i++) {
+    fake_pins[buttons[i].pin] = DIGITAL_READ_CONNECTED_PEDAL;
+  }
+  setup();
+  // The first commit after mount sends the idle state.
+  run_tasks_until(micros() + 50000);
+}
+
+/**
+ * Wait for the next mouse report after `seen` and return its send time, or
+ * 0 if none came by `deadline_us`.
+ */
+static uint32_t
+next_mouse_report(size_t seen, uint32_t deadline_us)
+{
+  while (mouse_reports().size() == seen &&
+         static_cast<int32_t>(deadline_us - micros()) > 0) {
+    run_tasks_until(micros() + 100);
+  }
+  const auto reports = mouse_reports();
+  return reports.size() > seen ? reports[seen].t_us : 0;
+}
+
+/**
+ * Press and release the pedal at every phase of the input task's tick and
+ * bound the time from the pin edge to the report handed to the endpoint.
+ */
+static void
+test_edge_to_report()
+{
+  const uint8_t pin = buttons[PEDAL].pin;
+  uint32_t min_us = UINT32_MAX;
+  uint32_t max_us = 0;
+  uint64_t total_us = 0;
+  size_t count = 0;
+
+  auto measure = [&](uint8_t level, uint8_t mouse_buttons) {
+    const size_t seen = mouse_reports().size();
+    fake_pins[pin] = level;
+    const uint32_t edge_us = micros();
+    const uint32_t sent_us = next_mouse_report(seen, edge_us + 20000);
+    CHECK(sent_us != 0);
+    if (!sent_us) {
+      return;
+    }
+    CHECK_EQ(mouse_reports()[seen].data[0], mouse_buttons);
+    const uint32_t latency = sent_us - edge_us;
+    min_us = std::min(min_us, latency);
+    max_us = std::max(max_us, latency);
+    total_us += latency;
+    count++;
+  };
+
+  for (uint32_t phase = 0; phase < 1000; phase += 50) {
+    run_tasks_until(micros() - micros() % 1000 + 1000 + phase);
+    measure(DIGITAL_READ_PEDAL_DOWN, MOUSE_MIDDLE);
+    run_tasks_until(micros() + 50000);
+    run_tasks_until(micros() - micros() % 1000 + 1000 + phase);
+    measure(DIGITAL_READ_PEDAL_UP, 0);
+    run_tasks_until(micros() + 50000);
+  }
+
+  printf("edge_to_report_us: min %u avg %u max %u over %zu edges\n",
+         min_us,
+         count ? static_cast<unsigned>(total_us / count) : 0,
+         max_us,
+         count);
+  // A tick to notice the edge, a burst to accept it and a host poll when a
+  // resync report holds the endpoint.
+  CHECK(max_us <= INPUT_TASK_PERIOD_MS * 1000 +
+                    GLITCH_SAMPLE_CNT * POLL_PERIOD_US + HOST_POLL_US);
+}
+
+// A v2 request as the host sends it.
+static std::vector<uint8_t>
+request_v2(uint8_t cmd, const std::vector<uint8_t>& payload)
+{
+  std::vector<uint8_t> body = { PROTOCOL_V2, 1, cmd };
+  uint32_t len = payload.size();
+  do {
+    body.push_back(len > 0x7F ? (len & 0x7F) | 0x80 : len);
+    len >>= 7;
+  } while (len);
+  body.insert(body.end(), payload.begin(), payload.end());
+  const uint32_t crc =
+    crc::update_crc(0xFFFFFFFF, body.data(), body.size()) ^ 0xFFFFFFFF;
+
+  std::vector<uint8_t> frame = { V2_SOF };
+  frame.insert(frame.end(), body.begin(), body.end());
+  for (int i = 0; i < 4; i++) {
+    frame.push_back(crc >> (8 * i));
+  }
+  return frame;
+}
+
+static size_t
+keyboard_report_count()
+{
+  size_t n = 0;
+  for (const auto& r : fake_usb.reports) {
+    n += r.id == REPORT_ID_KEYBOARD;
+  }
+  return n;
+}
+
+/**
+ * A short press while a serial command types a long string is sent right
+ * away and not lost: the input task doesn't wait for the command and the
+ * command doesn't hold the HID state while it waits for the endpoint.
+ */
+static void
+test_press_while_typing()
+{
+  constexpr size_t CHARS = 200;
+  std::vector<uint8_t> text(CHARS, 'a');
+  text.push_back('\0');
+  const size_t keyboard_before = keyboard_report_count();
+  const size_t seen = mouse_reports().size();
+  const auto request = request_v2(CMD_SEND_ASCII_KEYS, text);
+  Serial.rx.assign(request.begin(), request.end());
+
+  run_tasks_until(micros() + 50000);
+  const size_t typed = keyboard_report_count() - keyboard_before;
+  CHECK(typed > 0);
+  CHECK(typed < 2 * CHARS);
+
+  const uint8_t pin = buttons[PEDAL].pin;
+  fake_pins[pin] = DIGITAL_READ_PEDAL_DOWN;
+  const uint32_t press_us = micros();
+  run_tasks_until(micros() + 10000);
+  fake_pins[pin] = DIGITAL_READ_PEDAL_UP;
+  const uint32_t release_us = micros();
+  // The release is accepted once the press's lockout ends.
+  run_tasks_until(press_us + DEBOUNCE_RESET + 10000);
+
+  // Resyncs may repeat a state, look for the changes.
+  const auto reports = mouse_reports();
+  std::vector<FakeHidReport> changes;
+  uint8_t last = 0;
+  for (size_t i = seen; i < reports.size(); i++) {
+    if (reports[i].data[0] != last) {
+      changes.push_back(reports[i]);
+      last = reports[i].data[0];
+    }
+  }
+  CHECK_EQ(changes.size(), 2);
+  if (changes.size() == 2) {
+    CHECK_EQ(changes[0].data[0], MOUSE_MIDDLE);
+    CHECK_EQ(changes[1].data[0], 0);
+    printf("while typing: press after %u us, release after %u us\n",
+           changes[0].t_us - press_us,
+           changes[1].t_us - release_us);
+    // Queued behind the report in flight, a character and a resync.
+    const uint32_t bound = INPUT_TASK_PERIOD_MS * 1000 +
+                           GLITCH_SAMPLE_CNT * POLL_PERIOD_US +
+                           4 * HOST_POLL_US;
+    CHECK(changes[0].t_us - press_us <= bound);
+    CHECK(changes[1].t_us - press_us <= DEBOUNCE_RESET + bound);
+  }
+  // Still typing.
+  CHECK(keyboard_report_count() - keyboard_before < 2 * CHARS);
+
+  run_tasks_until(micros() + 2 * CHARS * HOST_POLL_US);
+  CHECK(keyboard_report_count() - keyboard_before >= 2 * CHARS);
+}
+
+/**
+ * Debounce settings reach the input task's own copy through the mailbox.
+ */
+static void
+test_debounce_settings()
+{
+  const CmdPayloadSetDebounce eager{ PEDAL, DEBOUNCE_EAGER, 5000, 0 };
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(&eager);
+  const auto request =
+    request_v2(CMD_SET_DEBOUNCE, std::vector<uint8_t>(p, p + sizeof(eager)));
+  Serial.rx.assign(request.begin(), request.end());
+  run_tasks_until(micros() + 50000);
+  CHECK(Serial.rx.empty());
+  CHECK_EQ(buttons[PEDAL].debounce_mode, DEBOUNCE_EAGER);
+  CHECK_EQ(g_input_debouncers[PEDAL].debounce_mode, DEBOUNCE_EAGER);
+  CHECK_EQ(g_input_debouncers[PEDAL].holdoff_us, 5000);
+
+  // Accepted on the first sample of the next burst.
+  const uint8_t pin = buttons[PEDAL].pin;
+  const uint32_t tick_us = micros() - micros() % 1000 + 2000;
+  run_tasks_until(tick_us - 500);
+  const size_t seen = mouse_reports().size();
+  fake_pins[pin] = DIGITAL_READ_PEDAL_DOWN;
+  run_tasks_until(tick_us + POLL_PERIOD_US);
+  CHECK_EQ(g_input_debouncers[PEDAL].state, DIGITAL_READ_PEDAL_DOWN);
+  CHECK_EQ(g_input_debouncers[PEDAL].edge_time, tick_us);
+  CHECK(next_mouse_report(seen, micros() + 20000) != 0);
+  fake_pins[pin] = DIGITAL_READ_PEDAL_UP;
+  run_tasks_until(micros() + 50000);
+}
+
+int
+main()
+{
+  boot();
+  test_edge_to_report();
+  test_press_while_typing();
+  test_debounce_settings();
+  return test_result();
+}
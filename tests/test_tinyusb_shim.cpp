@@ -0,0 +1,573 @@
+/*
+ * Conformance of the TinyUSB shim with the Teensy HID stack. Every pedal
+ * mode and keyboard API use of the sketch runs against the shim on a fake
+ * endpoint and against a model of Teensy's usb_keyboard / usb_mouse. The
+ * host must see the same state transitions from both. Report counts and
+ * bytes are printed per action.
+ */
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "hid_state.h"
+#include "tinyusbhidshim.h"
+
+extern "C" void
+tud_hid_report_complete_cb(uint8_t instance,
+                           uint8_t const* report,
+                           uint16_t len);
+
+// The host polls faster than any delay in an action: collect everything.
+static void
+play_host()
+{
+  while (fake_usb.in_flight) {
+    fake_usb.in_flight = false;
+    tud_hid_report_complete_cb(0, nullptr, 0);
+  }
+}
+
+constexpr uint16_t MEDIA_PLAY_PAUSE = 0xE4CD;
+constexpr uint16_t MEDIA_VOL_UP = 0xE4E9;
+constexpr uint16_t MEDIA_PLAY = 0xE4B0;
+constexpr uint16_t MEDIA_PAUSE = 0xE4B1;
+constexpr uint16_t K_A = 0xF004;
+constexpr uint16_t K_B = 0xF005;
+constexpr uint16_t K_F18 = 0xF06D;
+constexpr uint16_t K_F20 = 0xF06F;
+constexpr uint16_t M_CTRL = 0xE001;
+constexpr uint16_t M_SHIFT = 0xE002;
+constexpr uint16_t M_ALT = 0xE004;
+constexpr uint16_t M_GUI = 0xE008;
+
+/**
+ * Teensy semantics: a report per call that changes the state, media keys
+ * on the consumer report, write() presses and releases.
+ */
+struct TeensyReference
+{
+  std::vector<FakeHidReport>* out;
+  uint8_t mod = 0;
+  uint8_t keys[6] = { 0 };
+  uint16_t consumer = 0;
+
+  void send_keyboard_report()
+  {
+    std::vector<uint8_t> r = { mod, 0 };
+    r.insert(r.end(), keys, keys + 6);
+    out->push_back({ 1, r });
+  }
+
+  void send_consumer_report()
+  {
+    const uint8_t lo = consumer & 0xFF;
+    const uint8_t hi = consumer >> 8;
+    out->push_back({ 3, { lo, hi } });
+  }
+
+  static void split(uint16_t k, uint8_t& key, uint8_t& m)
+  {
+    key = m = 0;
+    if ((k >> 8) == 0xE0) {
+      m = k & 0xFF;
+    } else if ((k >> 8) == 0xF0) {
+      key = k & 0xFF;
+    } else if ((k >> 8) == 0) {
+      key = ascii_to_hid_usage(static_cast<char>(k), m);
+    }
+  }
+
+  void press_key(uint8_t key, uint8_t m)
+  {
+    bool changed = false;
+    if (m && (mod & m) != m) {
+      mod |= m;
+      changed = true;
+    }
+    if (key && std::find(keys, keys + 6, key) == keys + 6) {
+      uint8_t* slot = std::find(keys, keys + 6, 0);
+      if (slot != keys + 6) {
+        *slot = key;
+        changed = true;
+      }
+    }
+    if (changed) {
+      send_keyboard_report();
+    }
+  }
+
+  void release_key(uint8_t key, uint8_t m)
+  {
+    bool changed = false;
+    if (m && (mod & m)) {
+      mod &= ~m;
+      changed = true;
+    }
+    for (auto& k : keys) {
+      if (key && k == key) {
+        k = 0;
+        changed = true;
+      }
+    }
+    if (changed) {
+      send_keyboard_report();
+    }
+  }
+
+  bool press(uint16_t k)
+  {
+    if ((k >> 8) == 0xE4) {
+      if (consumer != (k & 0xFF)) {
+        consumer = k & 0xFF;
+        send_consumer_report();
+      }
+      return true;
+    }
+    uint8_t key, m;
+    split(k, key, m);
+    press_key(key, m);
+    return true;
+  }
+
+  bool release(uint16_t k)
+  {
+    if ((k >> 8) == 0xE4) {
+      if (consumer == (k & 0xFF)) {
+        consumer = 0;
+        send_consumer_report();
+      }
+      return true;
+    }
+    uint8_t key, m;
+    split(k, key, m);
+    release_key(key, m);
+    return true;
+  }
+
+  void write(char c)
+  {
+    uint8_t m = 0;
+    const uint8_t key = ascii_to_hid_usage(c, m);
+    if (key) {
+      press_key(key, m);
+      release_key(key, m);
+    }
+  }
+
+  bool send_state(uint8_t m, const uint8_t* k)
+  {
+    mod = m;
+    memcpy(keys, k, sizeof(keys));
+    send_keyboard_report();
+    return true;
+  }
+
+  bool set_buttons(uint8_t b)
+  {
+    out->push_back({ 2, { b, 0, 0, 0, 0 } });
+    return true;
+  }
+};
+
+struct ShimBackend
+{
+  HIDCompat::KeyboardTinyUsbShim kb;
+  HIDCompat::MouseTinyUsbShim mouse;
+
+  bool press(uint16_t k) { return kb.press(k); }
+  bool release(uint16_t k) { return kb.release(k); }
+  void write(char c) { kb.write(c); }
+  bool send_state(uint8_t m, const uint8_t* k) { return kb.send_state(m, k); }
+  bool set_buttons(uint8_t b) { return mouse.set_buttons(b); }
+};
+
+/**
+ * The sketch's action layer (send_input(), fire_macro(), type_string()) on
+ * top of either backend.
+ */
+template<typename Backend>
+struct Sketch
+{
+  struct Sink
+  {
+    Backend* b;
+    bool ready() { return true; }
+    bool send_keyboard(uint8_t m, const uint8_t* k)
+    {
+      return b->send_state(m, k);
+    }
+    bool send_mouse_buttons(uint8_t x) { return b->set_buttons(x); }
+  };
+
+  Backend& b;
+  HidStateModel hid;
+  Sink sink;
+
+  explicit Sketch(Backend& backend)
+    : b(backend)
+    , sink{ &backend }
+  {
+  }
+
+  void commit()
+  {
+    hid.commit(sink, millis());
+    play_host();
+  }
+
+  void press(uint16_t k)
+  {
+    if (!hid.state.press(k)) {
+      b.press(k);
+    }
+  }
+
+  void release(uint16_t k)
+  {
+    if (!hid.state.release(k)) {
+      b.release(k);
+    }
+  }
+
+  void click(uint8_t x)
+  {
+    hid.state.press_buttons(x);
+    commit();
+    hid.state.release_buttons(x);
+    commit();
+  }
+
+  void macro(const std::vector<uint16_t>& ks)
+  {
+    for (auto k : ks) {
+      press(k);
+    }
+    commit();
+    delay(1);
+    for (auto k : ks) {
+      release(k);
+    }
+  }
+
+  void type(const char* s)
+  {
+    for (; *s; s++) {
+      b.write(*s);
+    }
+    hid.request_resync();
+  }
+
+  void send_input(int mode, bool engage, const std::vector<uint16_t>& ks)
+  {
+    switch (mode) {
+      case MODE_MOUSE_LEFT:
+      case MODE_MOUSE_MIDDLE:
+      case MODE_MOUSE_RIGHT:
+        if (engage) {
+          hid.state.press_buttons(mode);
+        } else {
+          hid.state.release_buttons(mode);
+        }
+        break;
+      case MODE_MOUSE_RIGHT_QUICK_FIRE:
+        if (engage) {
+          click(MOUSE_RIGHT);
+        }
+        break;
+      case MODE_MOUSE_DOUBLE:
+        if (engage) {
+          click(MOUSE_LEFT);
+          click(MOUSE_LEFT);
+        }
+        break;
+      case MODE_CTRL_CLICK:
+      case MODE_SHIFT_CLICK:
+      case MODE_SHIFT_MIDDLE_CLICK:
+      case MODE_ORBIT: {
+        const uint16_t m = mode == MODE_CTRL_CLICK ? M_CTRL : M_SHIFT;
+        const uint8_t button =
+          (mode == MODE_CTRL_CLICK || mode == MODE_SHIFT_CLICK) ? MOUSE_LEFT
+                                                                : MOUSE_MIDDLE;
+        if (engage) {
+          press(m);
+          commit();
+          delay(20);
+          hid.state.press_buttons(button);
+        } else {
+          release(m);
+          hid.state.release_buttons(button);
+        }
+      } break;
+      case MODE_SCROLL_BAR:
+        press(K_F18);
+        commit();
+        release(K_F18);
+        break;
+      case MODE_SCROLL_ANYWHERE:
+        if (engage) {
+          press(K_F20);
+        } else {
+          release(K_F20);
+        }
+        break;
+      case MODE_KEYCOMBO:
+        if (engage) {
+          macro(ks);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  void pedal(int mode, const std::vector<uint16_t>& ks)
+  {
+    send_input(mode, true, ks);
+    commit();
+    delay(5);
+    send_input(mode, false, ks);
+    commit();
+  }
+};
+
+struct Action
+{
+  const char* name;
+  std::function<void(Sketch<ShimBackend>&)> shim;
+  std::function<void(Sketch<TeensyReference>&)> reference;
+};
+
+// The same steps for both backends.
+#define ACTION(name, body)                                                     \
+  Action                                                                       \
+  {                                                                            \
+    name, [](auto& s) { body; }, [](auto& s) { body; }                         \
+  }
+
+static std::vector<Action>
+actions()
+{
+  std::vector<Action> a;
+  auto mode = [&](const char* name, int m, std::vector<uint16_t> ks = {}) {
+    a.push_back({ name,
+                  [=](auto& s) { s.pedal(m, ks); },
+                  [=](auto& s) { s.pedal(m, ks); } });
+  };
+  mode("mouse_left", MODE_MOUSE_LEFT);
+  mode("mouse_middle", MODE_MOUSE_MIDDLE);
+  mode("mouse_right", MODE_MOUSE_RIGHT);
+  mode("right_quick_fire", MODE_MOUSE_RIGHT_QUICK_FIRE);
+  mode("mouse_double", MODE_MOUSE_DOUBLE);
+  mode("ctrl_click", MODE_CTRL_CLICK);
+  mode("shift_click", MODE_SHIFT_CLICK);
+  mode("shift_middle_click", MODE_SHIFT_MIDDLE_CLICK);
+  mode("orbit", MODE_ORBIT);
+  mode("scroll_bar", MODE_SCROLL_BAR);
+  mode("scroll_anywhere", MODE_SCROLL_ANYWHERE);
+  mode("combo_ctrl_alt_del", MODE_KEYCOMBO, { M_CTRL, M_ALT, 0xF04C });
+  mode("combo_gui_l", MODE_KEYCOMBO, { M_GUI, 0xF00F });
+  mode("combo_ascii_A", MODE_KEYCOMBO, { 'A' });
+  mode("combo_media_play", MODE_KEYCOMBO, { MEDIA_PLAY_PAUSE });
+  mode("combo_shift_media", MODE_KEYCOMBO, { M_SHIFT, MEDIA_VOL_UP });
+  a.push_back(ACTION("type_string", s.type("Hi, 42!")));
+  a.push_back(ACTION("type_with_held_key", s.press(K_B); s.commit();
+                     s.type("a");
+                     s.commit();
+                     s.release(K_B);
+                     s.commit()));
+  // The raw Keyboard API, as used by the sketch's fallbacks.
+  a.push_back(ACTION("api_key_with_alt", s.b.press(M_ALT); s.b.press(K_A);
+                     s.b.release(K_A);
+                     s.b.release(M_ALT)));
+  a.push_back(ACTION("api_ascii_shifted", s.b.press('A'); s.b.release('A')));
+  a.push_back(ACTION("api_media_switch", s.b.press(MEDIA_PLAY);
+                     s.b.press(MEDIA_PAUSE);
+                     s.b.release(MEDIA_PAUSE);
+                     s.b.release(MEDIA_PLAY)));
+  return a;
+}
+
+/**
+ * What the host sees: one entry per device state change. Key slot order is
+ * ignored and reports that repeat the device's last state are dropped.
+ */
+static std::vector<std::string>
+transitions(const std::vector<FakeHidReport>& reports)
+{
+  std::vector<std::string> out;
+  std::string last[4] = { "", "kb 00 []", "mouse 00", "consumer 0000" };
+  for (const auto& r : reports) {
+    char buf[64];
+    if (r.id == 1) {
+      std::vector<uint8_t> k(r.data.begin() + 2, r.data.end());
+      k.erase(std::remove(k.begin(), k.end(), 0), k.end());
+      std::sort(k.begin(), k.end());
+      std::string keys;
+      for (auto x : k) {
+        snprintf(buf, sizeof(buf), "%02x ", x);
+        keys += buf;
+      }
+      snprintf(buf, sizeof(buf), "kb %02x [%s]", r.data[0], keys.c_str());
+    } else if (r.id == 2) {
+      snprintf(buf, sizeof(buf), "mouse %02x", r.data[0]);
+    } else if (r.id == 3) {
+      snprintf(buf, sizeof(buf), "consumer %02x%02x", r.data[1], r.data[0]);
+    } else {
+      continue;
+    }
+    if (last[r.id] != buf) {
+      last[r.id] = buf;
+      out.push_back(buf);
+    }
+  }
+  return out;
+}
+
+static size_t
+bytes(const std::vector<FakeHidReport>& reports)
+{
+  size_t n = 0;
+  for (const auto& r : reports) {
+    n += r.data.size();
+  }
+  return n;
+}
+
+static void
+test_matches_teensy()
+{
+  size_t totals[4] = { 0 };
+  printf("%-22s %8s %8s %10s %10s\n",
+         "action",
+         "shim_rep",
+         "shim_B",
+         "teensy_rep",
+         "teensy_B");
+
+  for (auto& action : actions()) {
+    ShimBackend shim;
+    Sketch<ShimBackend> s{ shim };
+    s.commit(); // Initial resync.
+    fake_usb.reports.clear();
+    action.shim(s);
+    play_host();
+    const auto shim_reports = fake_usb.reports;
+
+    std::vector<FakeHidReport> reference_reports;
+    TeensyReference reference{ &reference_reports };
+    Sketch<TeensyReference> r{ reference };
+    r.commit();
+    reference_reports.clear();
+    action.reference(r);
+
+    const auto got = transitions(shim_reports);
+    const auto want = transitions(reference_reports);
+    printf("%-22s %8zu %8zu %10zu %10zu\n",
+           action.name,
+           shim_reports.size(),
+           bytes(shim_reports),
+           reference_reports.size(),
+           bytes(reference_reports));
+    totals[0] += shim_reports.size();
+    totals[1] += bytes(shim_reports);
+    totals[2] += reference_reports.size();
+    totals[3] += bytes(reference_reports);
+
+    if (got != want) {
+      fprintf(stderr, "%s: shim | teensy\n", action.name);
+      for (size_t i = 0; i < std::max(got.size(), want.size()); i++) {
+        fprintf(stderr,
+                "  %-26s | %s\n",
+                i < got.size() ? got[i].c_str() : "",
+                i < want.size() ? want[i].c_str() : "");
+      }
+    }
+    CHECK(got == want);
+
+    shim.kb.releaseAll();
+    play_host();
+  }
+
+  printf("%-22s %8zu %8zu %10zu %10zu\n",
+         "total",
+         totals[0],
+         totals[1],
+         totals[2],
+         totals[3]);
+}
+
+static void
+test_busy_endpoint()
+{
+  HIDCompat::KeyboardTinyUsbShim kb;
+  fake_usb.reports.clear();
+
+  // The send fails, the report stays queued and goes out on service().
+  fake_usb.fail_sends = 1;
+  kb.press(K_A);
+  CHECK_EQ(fake_usb.failed_sends, 1);
+  CHECK(fake_usb.reports.empty());
+
+  HIDCompat::service();
+  CHECK_EQ(fake_usb.reports.size(), 1);
+  CHECK_EQ(fake_usb.reports[0].data[2], K_A & 0xFF);
+
+  // Reports queue behind the in-flight one and keep their order.
+  kb.press(K_B);
+  kb.release(K_A);
+  CHECK_EQ(fake_usb.reports.size(), 1);
+  play_host();
+  CHECK_EQ(fake_usb.reports.size(), 3);
+  CHECK_EQ(fake_usb.reports[1].data[3], K_B & 0xFF);
+  CHECK_EQ(fake_usb.reports[2].data[2], K_B & 0xFF);
+  CHECK_EQ(HIDCompat::get_tx_queue_stats().send_failures, 1);
+
+  kb.releaseAll();
+  play_host();
+}
+
+static void
+test_bus_reset()
+{
+  HIDCompat::KeyboardTinyUsbShim kb;
+  fake_usb.reports.clear();
+
+  kb.press(K_A);
+  CHECK_EQ(fake_usb.reports.size(), 1);
+  CHECK(fake_usb.in_flight);
+
+  // The reset cancels the transfer, no completion callback comes.
+  fake_usb.mounted = false;
+  fake_usb.in_flight = false;
+  kb.press(K_B);
+  HIDCompat::service();
+  CHECK_EQ(fake_usb.reports.size(), 1);
+
+  // After the remount the aborted report goes out again, then the rest.
+  fake_usb.mounted = true;
+  HIDCompat::service();
+  CHECK_EQ(fake_usb.reports.size(), 2);
+  CHECK(fake_usb.reports[1].data == fake_usb.reports[0].data);
+  play_host();
+  CHECK_EQ(fake_usb.reports.size(), 3);
+  CHECK_EQ(fake_usb.reports[2].data[2], K_A & 0xFF);
+  CHECK_EQ(fake_usb.reports[2].data[3], K_B & 0xFF);
+
+  // And later reports aren't stuck behind it.
+  kb.releaseAll();
+  play_host();
+  CHECK_EQ(fake_usb.reports.size(), 4);
+  CHECK_EQ(fake_usb.reports[3].data[2], 0);
+}
+
+int
+main()
+{
+  fake_delay_hook = play_host;
+  test_matches_teensy();
+  test_busy_endpoint();
+  test_bus_reset();
+  return test_result();
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+
+#include "check.h"
+#include "trace.h"
+
+// Commands traced at once, more than the ring holds.
+constexpr size_t BURST = TRACE_RING_LEN + 44;
+
+static void
+flush()
+{
+  fake_advance(TRACE_FLUSH_MS * 1000);
+  service_trace();
+}
+
+/**
+ * Trace a press whose report goes out after micros() wrapped, a burst that
+ * overflows the ring and a release, servicing the ring as the main loop
+ * would. The serial output is written to the file named by the argument for
+ * test_trace_to_chrome.py to decode.
+ */
+int
+main(int argc, char** argv)
+{
+  fake_micros = 0xFFFFFFFF - 149;
+  trace_start();
+
+  trace(TRACE_PIN_EDGE, 0, DIGITAL_READ_PEDAL_DOWN);
+  // Partial frames wait for the flush interval.
+  service_trace();
+  CHECK(Serial.tx.empty());
+  fake_advance(200);
+  trace(TRACE_DEBOUNCE_ACCEPT, 0, DIGITAL_READ_PEDAL_DOWN);
+  fake_advance(100);
+  trace(TRACE_REPORT_SENT, 0 | TRACE_ENGAGE_BIT, MODE_MOUSE_LEFT);
+  CHECK_EQ(fake_micros, 150);
+
+  flush();
+  CHECK(!Serial.tx.empty());
+  CHECK(g_trace_ring.empty());
+
+  for (size_t i = 0; i < BURST; i++) {
+    trace(TRACE_CMD_RECEIVED, TRACE_NO_PEDAL, CMD_ECHO);
+  }
+  CHECK_EQ(g_trace_ring.dropped, BURST - TRACE_RING_LEN);
+  for (size_t i = 0; i < TRACE_RING_LEN / TRACE_FRAME_RECORDS; i++) {
+    service_trace();
+  }
+  CHECK(g_trace_ring.empty());
+
+  fake_advance(5000);
+  trace(TRACE_PIN_EDGE, 0, DIGITAL_READ_PEDAL_UP);
+  fake_advance(400);
+  trace(TRACE_DEBOUNCE_ACCEPT, 0, DIGITAL_READ_PEDAL_UP);
+  trace(TRACE_REPORT_SENT, 0, MODE_MOUSE_LEFT);
+  flush();
+  CHECK(g_trace_ring.empty());
+
+  trace_stop();
+  trace(TRACE_PIN_EDGE, 0, DIGITAL_READ_PEDAL_DOWN);
+  CHECK(g_trace_ring.empty());
+
+  if (argc > 1) {
+    FILE* out = fopen(argv[1], "wb");
+    CHECK(out);
+    if (out) {
+      fwrite(Serial.tx.data(), 1, Serial.tx.size(), out);
+      fclose(out);
+    }
+  }
+  return test_result();
+}
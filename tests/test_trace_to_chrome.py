@@ -0,0 +1,86 @@
+"""
+Decode what trace() and service_trace() sent in test_trace with
+trace_to_chrome.py.
+
+Usage:
+    python test_trace_to_chrome.py <path to the test_trace executable>
+"""
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
+
+import trace_to_chrome as ttc  # noqa: E402
+
+# Keep in sync with test_trace.cpp and constants.h.
+TRACE_RING_LEN = 256
+BURST = TRACE_RING_LEN + 44
+WRAP_EDGE_US = (1 << 32) - 150
+CMD_ECHO = 7
+MODE_MOUSE_LEFT = 1
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print(f"FAILED: {what}", file=sys.stderr)
+        failures += 1
+
+
+def capture(test_trace: str) -> bytes:
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "trace.bin")
+        subprocess.run([test_trace, path], check=True)
+        with open(path, "rb") as f:
+            return f.read()
+
+
+def main():
+    data = capture(sys.argv[1])
+
+    frames = list(ttc.iter_frames(data))
+    dropped = [struct.unpack_from(ttc.FRAME_HEADER_FMT, f)[0] for f in frames]
+    check(len(frames) == 1 + TRACE_RING_LEN // 32 + 1,
+          f"frame count {len(frames)}")
+    check(dropped[0] == 0, "no drops before the burst")
+    check(dropped[-1] == BURST - TRACE_RING_LEN,
+          f"dropped {dropped[-1]} after the burst")
+
+    records = list(ttc.iter_records(data))
+    commands = [r for r in records if r[1] == ttc.TRACE_CMD_RECEIVED]
+    check(len(commands) + dropped[-1] == BURST,
+          "every traced command was sent or counted as dropped")
+    check(all(r[3] == CMD_ECHO for r in commands), "command args")
+    times = [r[0] for r in records]
+    check(times == sorted(times), "timestamps unwrapped in order")
+    check(times[0] == WRAP_EDGE_US, f"first record at {times[0]}")
+    check(times[-1] > 1 << 32, "records after the wrap")
+
+    events = ttc.to_chrome_trace(data)["traceEvents"]
+    spans = [e for e in events if e["ph"] == "X"]
+    check([s["name"] for s in spans] == ["press", "release"],
+          f"spans {[s['name'] for s in spans]}")
+    if len(spans) == 2:
+        press, release = spans
+        # Edge before the wrap, report after it.
+        check(press["ts"] == WRAP_EDGE_US, f"press at {press['ts']}")
+        check(press["dur"] == 300, f"press took {press['dur']} us")
+        check(press["args"] == {"mode": MODE_MOUSE_LEFT, "engage": True},
+              f"press args {press['args']}")
+        check(release["dur"] == 400, f"release took {release['dur']} us")
+        check(release["tid"] == "pedal 0", f"release on {release['tid']}")
+    check(all(e["tid"] == "commands" for e in events
+              if e["name"] == "command received"), "commands thread")
+
+    if failures:
+        print(f"{failures} check(s) failed", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
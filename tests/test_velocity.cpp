@@ -0,0 +1,84 @@
+#include "check.h"
+#include "velocity.h"
+
+struct Recorder
+{
+  int presses = 0;
+  int releases = 0;
+  uint32_t travel_us = 0;
+
+  void press(const VelocityConfig&, uint32_t t)
+  {
+    presses++;
+    travel_us = t;
+  }
+
+  void release(const VelocityConfig&, uint32_t) { releases++; }
+};
+
+static void
+test_scroll_lines()
+{
+  VelocityConfig c;
+  c.threshold_us = 10000;
+
+  c.scroll_max = 5;
+  CHECK_EQ(c.scroll_lines(5000), 5);
+  CHECK_EQ(c.scroll_lines(10000), 5);
+  CHECK_EQ(c.scroll_lines(20000), 2);
+  CHECK_EQ(c.scroll_lines(1000000), 1);
+
+  // Scrolling the other way must not go through unsigned math.
+  c.scroll_max = -5;
+  CHECK_EQ(c.scroll_lines(5000), -5);
+  CHECK_EQ(c.scroll_lines(20000), -2);
+  CHECK_EQ(c.scroll_lines(1000000), -1);
+
+  c.scroll_max = INT8_MIN;
+  c.threshold_us = 0xFFFFFFFF;
+  CHECK_EQ(c.scroll_lines(0xFFFFFFFF), INT8_MIN);
+  c.threshold_us = 4000000000u;
+  CHECK_EQ(c.scroll_lines(4000000001u), INT8_MIN + 1);
+}
+
+static void
+test_travel_timing()
+{
+  VelocityEngine v;
+  v.configs[0].contact_a = 1;
+  v.configs[0].contact_b = 2;
+  v.configs[0].threshold_us = 10000;
+  v.configs[0].max_travel_us = 50000;
+  Recorder out;
+
+  CHECK(!v.on_edge(0, true, 0, out));
+
+  CHECK(v.on_edge(1, true, 1000, out));
+  CHECK(v.has_pending());
+  CHECK(v.on_edge(2, true, 8000, out));
+  CHECK_EQ(out.presses, 1);
+  CHECK_EQ(out.travel_us, 7000);
+  CHECK(v.configs[0].is_fast(out.travel_us));
+
+  // Released on the first contact to open, once.
+  CHECK(v.on_edge(2, false, 20000, out));
+  CHECK(v.on_edge(1, false, 21000, out));
+  CHECK_EQ(out.releases, 1);
+
+  // A press that stalls before contact_b fires as slow.
+  v.on_edge(1, true, 100000, out);
+  v.tick(120000, out);
+  CHECK_EQ(out.presses, 1);
+  v.tick(150000, out);
+  CHECK_EQ(out.presses, 2);
+  CHECK_EQ(out.travel_us, 50000);
+  CHECK(!v.has_pending());
+}
+
+int
+main()
+{
+  test_scroll_lines();
+  test_travel_timing();
+  return test_result();
+}
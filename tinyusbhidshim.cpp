@@ -1,7 +1,8 @@
 // TinyUSB-based compatibility shim that provides the minimal
 // Keyboard / Mouse API used by this sketch.
 // - Implements: begin(), write(), press(), release(), releaseAll()
-// - Implements: begin(), press(), release(), click()
+// - Implements: begin(), press(), release(), click(), move()
+// - Implements: begin(), moveTo() for the absolute pointer
 
 // Prevent compiling if not using an architecture that uses tinyusb.
 #if defined(ARDUINO_ARCH_NRF52)
@@ -14,13 +15,13 @@
 #include "FreeRTOS.h"
 #include <Adafruit_TinyUSB.h>
 
+#include "hid_report_queue.h"
+#include "log.h"
 #include "tinyusbkeycodes.h"
 
 static_assert(CFG_TUD_HID);
 static_assert(CFG_TUD_CDC);
 
-#define FALSE 0
-
 namespace HIDCompat {
 
 // Report ID
@@ -29,26 +30,32 @@ enum
   RID_KEYBOARD = 1,
   RID_MOUSE,
   RID_CONSUMER_CONTROL, // Media, volume etc ..
+  RID_ABS_POINTER,
 };
 
 static Adafruit_USBD_HID usb_hid;
 static bool initialized = false;
 
 // Using a composite device also requires report_id's in report function calls.
-// composite HID report: keyboard (ID 1), mouse (ID 2), consumer (ID 3)
+// composite HID report: keyboard (ID 1), mouse (ID 2), consumer (ID 3),
+// absolute pointer (ID 4)
 static uint8_t const desc_hid_report[] = {
   TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(RID_KEYBOARD)),
   TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(RID_MOUSE)),
-  // TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(RID_CONSUMER_CONTROL))
+  TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(RID_CONSUMER_CONTROL)),
+  TUD_HID_REPORT_DESC_ABSMOUSE(HID_REPORT_ID(RID_ABS_POINTER)),
 };
 
+static_assert(sizeof(AbsPointerReport) == sizeof(hid_abs_mouse_report_t),
+              "Absolute pointer report layout must match TinyUSB.");
+
 static void
 init_usb()
 {
   // This is for the modern version 3.X
   // Seedstudio includes TinyUSB 1.X in its board package.
   if (!TinyUSBDevice.isInitialized()) {
-    Serial.println("Initializing usb.");
+    log_msg<LOG_INFO>(LOG_MSG_USB_INIT);
 
     TinyUSBDevice.begin(0);
   }
@@ -73,13 +80,13 @@ init_usb()
     // usb_hid.setStringDescriptor("nRF52xTUSB");
 
     if (!usb_hid.begin()) {
-      Serial.println("Failed to begin usb_hid.");
+      log_msg<LOG_ERROR>(LOG_MSG_USB_HID_BEGIN_FAILED);
     }
 
     // If already enumerated, additional class driverr begin() e.g msc, hid,
     // midi won't take effect until re-enumeration.
     if (TinyUSBDevice.mounted()) {
-      Serial.println("tusb already mounted.");
+      log_msg<LOG_INFO>(LOG_MSG_USB_REMOUNT);
       TinyUSBDevice.detach();
       delay(10);
       TinyUSBDevice.attach();
@@ -89,35 +96,134 @@ init_usb()
   }
 }
 
-static bool
-make_usb_ready(Adafruit_USBD_HID& usb)
+/*
+ * Reports are queued and handed to the endpoint one at a time. The next report
+ * is sent from the report-complete callback, so callers never wait on the host.
+ */
+struct UsbHidEndpoint
+{
+  bool ready()
+  {
+    return TinyUSBDevice.mounted() && !TinyUSBDevice.suspended() &&
+           usb_hid.ready();
+  }
+
+  bool send(uint8_t report_id, const uint8_t* data, uint8_t len)
+  {
+    return usb_hid.sendReport(report_id, data, len);
+  }
+};
+
+static UsbHidEndpoint endpoint;
+static HidReportQueue<HID_TX_QUEUE_SIZE> tx_queue;
+static bool remote_wakeup_requested = false;
+
+static void
+request_remote_wakeup()
 {
-  if (TinyUSBDevice.suspended()) {
-    // Wake up host if we are in suspend mode
-    // and REMOTE_WAKEUP feature is enabled by host.
-    Serial.println("Performing remote wakeup");
+  if (!TinyUSBDevice.suspended()) {
+    remote_wakeup_requested = false;
+    return;
+  }
+
+  // Wake up host if we are in suspend mode and REMOTE_WAKEUP feature is
+  // enabled by host. Only ask once per suspend.
+  if (!remote_wakeup_requested) {
     TinyUSBDevice.remoteWakeup();
+    remote_wakeup_requested = true;
+  }
+}
+
+/*
+ * Hand the next queued report to the endpoint. Only the queue is touched
+ * inside the critical section; sendReport() may block on the USB stack and
+ * must not run with the scheduler and interrupts masked.
+ */
+static void
+pump_tx_queue()
+{
+  if (!endpoint.ready()) {
+    return;
+  }
+
+  HidReport report;
+  taskENTER_CRITICAL();
+  const bool taken = tx_queue.take_next(report);
+  taskEXIT_CRITICAL();
+  if (!taken) {
+    return;
   }
 
-  for (size_t i = 0; i < 1000; i++) {
-    if (usb.ready()) {
-      // Serial.printf("USB Ready Count: %d\n", i);
+  const bool sent = endpoint.send(report.report_id, report.data, report.len);
+
+  taskENTER_CRITICAL();
+  tx_queue.send_done(report, sent);
+  taskEXIT_CRITICAL();
+}
+
+static bool
+enqueue_report(uint8_t report_id,
+               HidReportKind kind,
+               const void* data,
+               uint8_t len)
+{
+  HidReport report;
+  report.report_id = report_id;
+  report.kind = kind;
+  report.len = len;
+  memcpy(report.data, data, len);
+
+  request_remote_wakeup();
+
+  taskENTER_CRITICAL();
+  bool result = tx_queue.push(report);
+  taskEXIT_CRITICAL();
+
+  pump_tx_queue();
+  return result;
+}
+
+/*
+ * Wait, bounded, until the queue can take 'slots' more reports. Only used on
+ * paths where every intermediate report matters, e.g. typing text.
+ */
+bool
+wait_for_queue_space(size_t slots)
+{
+  for (size_t i = 0; i < HID_TX_QUEUE_WAIT_MS; i++) {
+    taskENTER_CRITICAL();
+    bool has_space = tx_queue.free_slots() >= slots;
+    taskEXIT_CRITICAL();
+
+    if (has_space) {
       return true;
-    } else {
-      vTaskDelay(1);
-      continue;
     }
+    vTaskDelay(1);
   }
-
   return false;
 }
 
-static void
-flush()
+void
+service()
 {
-  // Send Report will wait for usb to become available again, so it's okay to
-  // have no timeout before returning.
-  tud_task_ext(0, FALSE);
+  request_remote_wakeup();
+
+  if (!TinyUSBDevice.mounted()) {
+    // A bus reset cancels the transfer without a completion callback.
+    taskENTER_CRITICAL();
+    tx_queue.abort_in_flight();
+    taskEXIT_CRITICAL();
+  }
+  pump_tx_queue();
+}
+
+HidQueueStats
+get_tx_queue_stats()
+{
+  taskENTER_CRITICAL();
+  HidQueueStats stats = tx_queue.stats;
+  taskEXIT_CRITICAL();
+  return stats;
 }
 
 void
@@ -129,22 +235,19 @@ KeyboardTinyUsbShim::begin()
 bool
 KeyboardTinyUsbShim::send_report()
 {
-  // // report id = 0, modifiers, 6 keycodes
-  // // tud_hid_keyboard_report(0, _mod, _keys);
-
-  if (!make_usb_ready(usb_hid)) {
-    Serial.println("usb_hid not ready");
-    return false;
-  }
-
-  if (usb_hid.ready()) {
-    // return usb_hid.keyboardReport(RID_KEYBOARD, _mod, _keys);
-    bool result = usb_hid.keyboardReport(RID_KEYBOARD, _mod, _keys);
-    flush();
-    return result;
-  }
+  // Modifiers, reserved, 6 keycodes.
+  uint8_t report[HID_REPORT_MAX_LEN] = { _mod, 0 };
+  memcpy(&report[2], _keys, sizeof(_keys));
+  return enqueue_report(RID_KEYBOARD, HID_REPORT_STATE, report, sizeof(report));
+}
 
-  return false;
+bool
+KeyboardTinyUsbShim::send_consumer_report()
+{
+  // One 16-bit usage, 0 when released. Usages aren't bitmaps, so the queue
+  // must not merge these like keyboard state.
+  return enqueue_report(
+    RID_CONSUMER_CONTROL, HID_REPORT_EVENT, &_consumer, sizeof(_consumer));
 }
 
 /*
@@ -185,57 +288,11 @@ KeyboardTinyUsbShim::remove_key(uint8_t scode)
   memcpy(_keys, tmp, sizeof(_keys));
 }
 
-uint8_t
-KeyboardTinyUsbShim::ascii_to_hid_usage_id(char c, uint8_t& out_mod)
-{
-  out_mod = 0;
-  if (c >= 'a' && c <= 'z')
-    return 0x04 + (c - 'a'); // a..z
-  if (c >= 'A' && c <= 'Z') {
-    out_mod = (uint8_t)(MODIFIERKEY_SHIFT & 0xFF);
-    return 0x04 + (c - 'A');
-  }
-  if (c >= '1' && c <= '9')
-    return 0x1E + (c - '1'); // 1..9
-  if (c == '0')
-    return 0x27;
-  if (c == ' ')
-    return 0x2C;
-  if (c == '\n' || c == '\r')
-    return 0x28; // Enter
-  if (c == '\t')
-    return 0x2B; // Tab
-  if (c == '-')
-    return 0x2D;
-  if (c == '=')
-    return 0x2E;
-  if (c == '[')
-    return 0x2F;
-  if (c == ']')
-    return 0x30;
-  if (c == '\\')
-    return 0x31;
-  if (c == ';')
-    return 0x33;
-  if (c == '\'')
-    return 0x34;
-  if (c == '`')
-    return 0x35;
-  if (c == ',')
-    return 0x36;
-  if (c == '.')
-    return 0x37;
-  if (c == '/')
-    return 0x38;
-  // Add more mappings as required.
-  return 0;
-}
-
 void
 KeyboardTinyUsbShim::write(char c)
 {
   uint8_t mod = 0;
-  uint8_t uid = ascii_to_hid_usage_id(c, mod);
+  uint8_t uid = ascii_to_hid_usage(c, mod);
   uint8_t prev_mod = _mod;
   uint8_t prev_keys[6];
 
@@ -244,9 +301,12 @@ KeyboardTinyUsbShim::write(char c)
 
   memcpy(prev_keys, _keys, sizeof(_keys));
 
+  // Both the press and the release have to reach the host.
+  wait_for_queue_space(2);
+
+  // Held keys stay down, as on Teensy.
   _mod |= mod;
-  memset(_keys, 0, sizeof(_keys));
-  _keys[0] = uid;
+  add_key(uid);
   send_report();
 
   // Release & Restore
@@ -259,7 +319,7 @@ void
 KeyboardTinyUsbShim::print(const char* s)
 {
   int len = strlen(s);
-  Serial.print(len);
+  log_msg<LOG_DEBUG>(LOG_MSG_TYPE_STRING, len);
 
   for (int i = 0; i <= len; i++) {
     write(s[i]);
@@ -267,24 +327,34 @@ KeyboardTinyUsbShim::print(const char* s)
   }
 }
 
-/*
-Currently only accepts Macros.
-TODO: Should I remove ASCII interface compliance?
-*/
 bool
 KeyboardTinyUsbShim::press(uint16_t k)
 {
   // Using Paul's Teensy key mapping.
-  if ((k & 0xFF00) == 0xE000) {
-    _mod |= (uint8_t)(k & 0xFF);
-    // Serial.println("treat common modifiers");
-  } else if ((k & 0xFF00) == 0) {
-    uint8_t mod = 0;
-    uint8_t uid = ascii_to_hid_usage_id((uint8_t)k, mod);
-    _mod |= mod;
-    add_key((uint8_t)uid);
-  } else {
-    add_key((uint8_t)k);
+  switch (k & 0xFF00) {
+    case 0xE000:
+      _mod |= (uint8_t)(k & 0xFF);
+      break;
+    case 0xE400:
+      // The descriptor has room for one usage, a new media key replaces the
+      // held one.
+      _consumer = k & 0xFF;
+      return send_consumer_report();
+    case 0xF000:
+      add_key((uint8_t)k);
+      break;
+    case 0: {
+      uint8_t mod = 0;
+      uint8_t uid = ascii_to_hid_usage((uint8_t)k, mod);
+      if (!uid) {
+        return false;
+      }
+      _mod |= mod;
+      add_key(uid);
+    } break;
+    default:
+      // E.g. system control keys, which aren't in the report descriptor.
+      return false;
   }
   return send_report();
 }
@@ -292,11 +362,31 @@ KeyboardTinyUsbShim::press(uint16_t k)
 bool
 KeyboardTinyUsbShim::release(uint16_t k)
 {
-  if (k & 0xE000) {
-    _mod &= ~(uint8_t)(k & 0xFF);
-    // Serial.println("treat common modifiers");
-  } else {
-    remove_key((uint8_t)k);
+  switch (k & 0xFF00) {
+    case 0xE000:
+      _mod &= ~(uint8_t)(k & 0xFF);
+      break;
+    case 0xE400:
+      if (_consumer != (k & 0xFF)) {
+        return true;
+      }
+      _consumer = 0;
+      return send_consumer_report();
+    case 0xF000:
+      remove_key((uint8_t)k);
+      break;
+    case 0: {
+      // Like Teensy, also releases the shift a character was typed with.
+      uint8_t mod = 0;
+      uint8_t uid = ascii_to_hid_usage((uint8_t)k, mod);
+      if (!uid) {
+        return false;
+      }
+      _mod &= ~mod;
+      remove_key(uid);
+    } break;
+    default:
+      return false;
   }
   return send_report();
 }
@@ -304,13 +394,25 @@ KeyboardTinyUsbShim::release(uint16_t k)
 bool
 KeyboardTinyUsbShim::releaseAll()
 {
-  Serial.println("releasing all keys");
+  log_msg<LOG_DEBUG>(LOG_MSG_RELEASE_ALL);
 
+  if (_consumer) {
+    _consumer = 0;
+    send_consumer_report();
+  }
   _mod = 0;
   memset(_keys, 0, sizeof(_keys));
   return send_report();
 }
 
+bool
+KeyboardTinyUsbShim::send_state(uint8_t modifiers, const uint8_t* keys)
+{
+  _mod = modifiers;
+  memcpy(_keys, keys, sizeof(_keys));
+  return send_report();
+}
+
 /* MouseCompat */
 void
 MouseTinyUsbShim::begin()
@@ -318,30 +420,33 @@ MouseTinyUsbShim::begin()
   init_usb();
 }
 
+bool
+MouseTinyUsbShim::send_report()
+{
+  // Buttons, x, y, wheel, pan.
+  uint8_t report[5] = { _buttons, 0, 0, 0, 0 };
+  return enqueue_report(RID_MOUSE, HID_REPORT_STATE, report, sizeof(report));
+}
+
 bool
 MouseTinyUsbShim::press(uint8_t buttons)
 {
   _buttons |= buttons;
-
-  if (!make_usb_ready(usb_hid)) {
-    Serial.println("usb_hid not ready");
-    return false;
-  }
-
-  return usb_hid.mouseButtonPress(RID_MOUSE, _buttons);
+  return send_report();
 }
 
 bool
 MouseTinyUsbShim::release(uint8_t buttons)
 {
   _buttons &= ~buttons;
+  return send_report();
+}
 
-  if (!make_usb_ready(usb_hid)) {
-    Serial.println("usb_hid not ready");
-    return false;
-  }
-
-  return usb_hid.mouseReport(RID_MOUSE, _buttons, 0, 0, 0, 0);
+bool
+MouseTinyUsbShim::set_buttons(uint8_t buttons)
+{
+  _buttons = buttons;
+  return send_report();
 }
 
 void
@@ -352,6 +457,49 @@ MouseTinyUsbShim::click(uint8_t buttons)
   release(buttons);
 }
 
+bool
+MouseTinyUsbShim::move(int8_t x, int8_t y, int8_t wheel)
+{
+  uint8_t report[5] = { _buttons,
+                        static_cast<uint8_t>(x),
+                        static_cast<uint8_t>(y),
+                        static_cast<uint8_t>(wheel),
+                        0 };
+  return enqueue_report(RID_MOUSE, HID_REPORT_EVENT, report, sizeof(report));
+}
+
+/* AbsPointerCompat */
+void
+AbsPointerTinyUsbShim::begin()
+{
+  init_usb();
+}
+
+bool
+AbsPointerTinyUsbShim::moveTo(uint16_t x, uint16_t y)
+{
+  auto report = make_abs_pointer_report(x, y);
+  return enqueue_report(
+    RID_ABS_POINTER, HID_REPORT_EVENT, &report, sizeof(report));
+}
+
 } // namespace HIDCompat
 
+// Overrides the weak TinyUSB callback. Runs in the USB device task once the
+// host has collected the previous report.
+extern "C" void
+tud_hid_report_complete_cb(uint8_t instance,
+                           uint8_t const* report,
+                           uint16_t len)
+{
+  (void)instance;
+  (void)report;
+  (void)len;
+
+  taskENTER_CRITICAL();
+  HIDCompat::tx_queue.on_complete();
+  taskEXIT_CRITICAL();
+  HIDCompat::pump_tx_queue();
+}
+
 #endif
\ No newline at end of file
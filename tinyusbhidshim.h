@@ -4,12 +4,34 @@
 
 #include <Adafruit_TinyUSB.h>
 
+#include "abs_pointer.h"
+#include "ascii_hid.h"
+#include "hid_report_queue.h"
 #include "tinyusbkeycodes.h"
 
 #define USING_TINY_USB
 
 namespace HIDCompat {
 
+// Reports waiting for the host. Sized for a full key combo press & release.
+constexpr size_t HID_TX_QUEUE_SIZE = 32;
+
+// Upper bound on waiting for queue space when typing text.
+constexpr size_t HID_TX_QUEUE_WAIT_MS = 100;
+
+// Sends queued reports that couldn't go out yet (e.g. not mounted, host
+// suspended). Call from the main loop.
+void
+service();
+
+HidQueueStats
+get_tx_queue_stats();
+
+// Waits up to HID_TX_QUEUE_WAIT_MS for this many free report slots. Returns
+// false if the host didn't take enough reports by then.
+bool
+wait_for_queue_space(size_t slots);
+
 class KeyboardTinyUsbShim
 {
 public:
@@ -19,18 +41,22 @@ public:
   // Can't do symbols?
   void print(const char* s);
   
-  // Also accepts ASCII keys.
+  // Teensy keycodes: modifiers (0xE0xx), usage IDs (0xF0xx), media keys
+  // (0xE4xx) and ASCII characters. Returns false for anything else.
   bool press(uint16_t k);
   bool release(uint16_t k);
   bool releaseAll();
+  // Replace the whole pressed state, see hid_state.h.
+  bool send_state(uint8_t modifiers, const uint8_t* keys);
 
 private:
   uint8_t _mod = 0;
   uint8_t _keys[6] = { 0 };
+  uint16_t _consumer = 0;
   bool send_report();
+  bool send_consumer_report();
   void add_key(uint8_t usage);
   void remove_key(uint8_t usage);
-  uint8_t ascii_to_hid_usage_id(char c, uint8_t& out_mod);
 };
 
 class MouseTinyUsbShim
@@ -40,8 +66,22 @@ public:
   bool press(uint8_t buttons);
   bool release(uint8_t buttons);
   void click(uint8_t buttons = MOUSE_LEFT);
+  // Relative movement and wheel, same as Teensy's Mouse.move().
+  bool move(int8_t x, int8_t y, int8_t wheel = 0);
+  // Replace the pressed button bitmap, see hid_state.h.
+  bool set_buttons(uint8_t buttons);
 
 private:
   uint8_t _buttons = 0;
+  bool send_report();
+};
+
+class AbsPointerTinyUsbShim
+{
+public:
+  void begin();
+
+  // Coordinates are screen fractions in the range [0, ABS_POINTER_MAX].
+  bool moveTo(uint16_t x, uint16_t y);
 };
 } // namespace HIDCompat
\ No newline at end of file
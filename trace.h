@@ -0,0 +1,154 @@
+#ifndef FOOTMOUSE_TRACE_H
+#define FOOTMOUSE_TRACE_H
+
+#include <Arduino.h>
+
+#include "constants.h"
+#include "critical_section.h"
+#include "log.h"
+#include "serial-msg-parsing.h"
+#include "spsc_ring.h"
+
+// Unsolicited frames use codes above the command range.
+constexpr uint32_t REPLY_TRACE_FRAME = 0xF0;
+constexpr uint32_t REPLY_LOG_FRAME = 0xF1;
+constexpr uint32_t REPLY_PEDAL_EVENT_FRAME = 0xF2;
+constexpr uint32_t REPLY_SCOPE_FRAME = 0xF3;
+
+enum TraceEventType : uint8_t
+{
+  TRACE_PIN_EDGE = 1,        // arg: raw pin level
+  TRACE_DEBOUNCE_ACCEPT = 2, // arg: debounced state
+  TRACE_REPORT_SENT = 3,     // arg: pedal mode, pedal: engage in bit 7
+  TRACE_CMD_RECEIVED = 4,    // arg: command code
+};
+
+constexpr uint8_t TRACE_NO_PEDAL = 0x7F;
+constexpr uint8_t TRACE_ENGAGE_BIT = 0x80;
+
+struct __attribute__((packed)) TraceRecord
+{
+  uint32_t t_us;
+  uint8_t type;
+  uint8_t pedal;
+  uint16_t arg;
+};
+
+static_assert(sizeof(TraceRecord) == 8, "");
+
+// Header of trace and log frames.
+struct __attribute__((packed)) TraceFrameHeader
+{
+  uint32_t dropped; // Records lost to a full ring since it was last cleared.
+  uint16_t count;
+  uint16_t reserved;
+};
+
+SpscRing<TraceRecord, TRACE_RING_LEN> g_trace_ring;
+volatile bool g_trace_enabled = false;
+unsigned long g_trace_last_flush_ms = 0;
+
+/**
+ * Records come from the sampling interrupt and the main loop (or several
+ * tasks), so pushes are serialized by briefly masking interrupts. Restores the
+ * previous mask so it is safe to use inside an interrupt. The timestamp is
+ * taken under the mask too, so records in the ring are in time order.
+ */
+static inline void
+trace(TraceEventType type, uint8_t pedal, uint16_t arg)
+{
+  if (!g_trace_enabled) {
+    return;
+  }
+
+  IrqGuard guard;
+  const TraceRecord record{ static_cast<uint32_t>(micros()), type, pedal, arg };
+  g_trace_ring.push(record);
+}
+
+void
+trace_start()
+{
+  TraceRecord discard;
+  while (g_trace_ring.pop(discard)) {
+  }
+  g_trace_ring.dropped = 0;
+  g_trace_last_flush_ms = millis();
+  g_trace_enabled = true;
+}
+
+void
+trace_stop()
+{
+  g_trace_enabled = false;
+}
+
+/**
+ * Send up to max_records records from the ring as one unsolicited frame.
+ * Never blocks: if the serial TX buffer can't take the whole frame, the
+ * records stay in the ring for the next call. Returns true if sent.
+ */
+template<typename Record, size_t CAP>
+static bool
+send_ring_frame(uint32_t code, SpscRing<Record, CAP>& ring, size_t max_records)
+{
+  const size_t waiting = ring.size();
+  const size_t count = waiting < max_records ? waiting : max_records;
+  const size_t length = sizeof(TraceFrameHeader) + count * sizeof(Record);
+
+  if (static_cast<size_t>(Serial.availableForWrite()) <
+      REPLY_FRAME_OVERHEAD + length) {
+    return false;
+  }
+
+  TraceFrameHeader frame;
+  frame.dropped = ring.dropped;
+  frame.count = count;
+  frame.reserved = 0;
+
+  notify_begin(code, length);
+  reply_write(&frame, sizeof(frame));
+  for (size_t i = 0; i < count; i++) {
+    Record record;
+    ring.pop(record);
+    reply_write(&record, sizeof(record));
+  }
+  reply_end();
+  return true;
+}
+
+/**
+ * Send buffered records as one frame when a frame's worth is waiting or the
+ * flush interval expired.
+ */
+void
+service_trace()
+{
+  const size_t waiting = g_trace_ring.size();
+  if (0 == waiting) {
+    g_trace_last_flush_ms = millis();
+    return;
+  }
+
+  if (waiting < TRACE_FRAME_RECORDS &&
+      (millis() - g_trace_last_flush_ms) < TRACE_FLUSH_MS) {
+    return;
+  }
+
+  if (send_ring_frame(REPLY_TRACE_FRAME, g_trace_ring, TRACE_FRAME_RECORDS)) {
+    g_trace_last_flush_ms = millis();
+  }
+}
+
+/**
+ * Log messages are rare, send them as soon as the port has room.
+ */
+void
+service_log()
+{
+  if (!log_ring().empty()) {
+    send_ring_frame(REPLY_LOG_FRAME, log_ring(), LOG_FRAME_RECORDS);
+  }
+}
+
+#endif // FOOTMOUSE_TRACE_H
@@ -0,0 +1,153 @@
+"""
+Record the footmouse binary event trace and convert it to Chrome trace JSON.
+Open the result in chrome://tracing or https://ui.perfetto.dev.
+
+Usage:
+    python trace_to_chrome.py record trace.bin --seconds 10
+    python trace_to_chrome.py convert trace.bin trace.json
+"""
+import argparse
+import json
+import struct
+import time
+
+import serial_commands as sc
+
+REPLY_TRACE_FRAME = 0xF0
+
+FRAME_HEADER_FMT = "<IHxx"
+RECORD_FMT = "<IBBH"
+
+TRACE_PIN_EDGE = 1
+TRACE_DEBOUNCE_ACCEPT = 2
+TRACE_REPORT_SENT = 3
+TRACE_CMD_RECEIVED = 4
+
+TRACE_NO_PEDAL = 0x7F
+TRACE_ENGAGE_BIT = 0x80
+
+EVENT_NAMES = {
+    TRACE_PIN_EDGE: "pin edge",
+    TRACE_DEBOUNCE_ACCEPT: "debounce accept",
+    TRACE_REPORT_SENT: "report sent",
+    TRACE_CMD_RECEIVED: "command received",
+}
+
+
+def iter_frames(data: bytes):
+    """Yield the payload of every trace frame in a raw capture."""
+    frames, _ = sc.split_reply_frames(data)
+    for frame in frames:
+        if frame.cmd == REPLY_TRACE_FRAME:
+            yield frame.payload
+
+
+def iter_records(data: bytes):
+    """Yield (t_us, type, pedal, arg) with timestamps unwrapped to 64 bits."""
+    record_size = struct.calcsize(RECORD_FMT)
+    frame_header_size = struct.calcsize(FRAME_HEADER_FMT)
+    last_raw = None
+    offset = 0
+    dropped_seen = 0
+
+    for frame in iter_frames(data):
+        dropped, count = struct.unpack_from(FRAME_HEADER_FMT, frame)
+        if dropped != dropped_seen:
+            print(f"warning: {dropped - dropped_seen} records dropped "
+                  "on device")
+            dropped_seen = dropped
+        for i in range(count):
+            t, type_, pedal, arg = struct.unpack_from(
+                RECORD_FMT, frame, frame_header_size + i * record_size)
+            # micros() wraps every ~71 minutes. Only a large step back is a
+            # wrap, a small one is records slightly out of order.
+            if last_raw is not None and last_raw - t > 1 << 31:
+                offset += 1 << 32
+            last_raw = t
+            yield t + offset, type_, pedal, arg
+
+
+def to_chrome_trace(data: bytes) -> dict:
+    events = []
+    pending_edge = {}
+
+    for t, type_, pedal, arg in iter_records(data):
+        engage = bool(pedal & TRACE_ENGAGE_BIT)
+        idx = pedal & ~TRACE_ENGAGE_BIT
+        tid = "commands" if idx == TRACE_NO_PEDAL else f"pedal {idx}"
+        args = {"arg": arg}
+        if type_ == TRACE_REPORT_SENT:
+            args = {"mode": arg, "engage": engage}
+
+        events.append({
+            "name": EVENT_NAMES.get(type_, f"event {type_}"),
+            "ph": "i",
+            "s": "t",
+            "ts": t,
+            "pid": "footmouse",
+            "tid": tid,
+            "args": args,
+        })
+
+        # Span from the first raw pin change until the HID action went out.
+        if type_ == TRACE_PIN_EDGE:
+            pending_edge.setdefault(idx, t)
+        elif type_ == TRACE_REPORT_SENT and idx in pending_edge:
+            start = pending_edge.pop(idx)
+            events.append({
+                "name": "press" if engage else "release",
+                "ph": "X",
+                "ts": start,
+                "dur": t - start,
+                "pid": "footmouse",
+                "tid": tid,
+                "args": args,
+            })
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def record(path: str, seconds: float):
+    import serial
+
+    port = sc.find_footmouse_com_port_name()
+    if not port:
+        return
+
+    with serial.Serial(port, sc.BAUD_RATE, timeout=0.1) as s, \
+            open(path, "wb") as out:
+        s.write(sc.get_structured_bytes(sc.CMD_TRACE_START))
+        deadline = time.monotonic() + seconds
+        try:
+            while time.monotonic() < deadline:
+                out.write(s.read(max(1, s.in_waiting)))
+        finally:
+            s.write(sc.get_structured_bytes(sc.CMD_TRACE_STOP))
+            # Collect the final partial frame.
+            out.write(s.read(4096))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest="action", required=True)
+
+    rec = sub.add_parser("record", help="capture the raw trace stream")
+    rec.add_argument("output")
+    rec.add_argument("--seconds", type=float, default=10.0)
+
+    conv = sub.add_parser("convert", help="raw capture to Chrome trace JSON")
+    conv.add_argument("input")
+    conv.add_argument("output")
+
+    args = parser.parse_args()
+    if args.action == "record":
+        record(args.output, args.seconds)
+    else:
+        with open(args.input, "rb") as f:
+            trace = to_chrome_trace(f.read())
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,211 @@
+#ifndef FOOTMOUSE_VELOCITY_H
+#define FOOTMOUSE_VELOCITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+/**
+ * A pedal wired to two jack contacts that close one after the other as it
+ * travels, e.g. the tip and ring of one TRS jack. contact_a closes at the
+ * start of the travel, contact_b at the end. Both are pedal indices.
+ *
+ * A press with a travel time of at most threshold_us runs fast_mode, a
+ * slower one slow_mode. With a non-zero scroll_max the press scrolls
+ * instead: scroll_max lines at threshold_us or faster, proportionally fewer
+ * for slower presses, at least one.
+ *
+ * contact_a == contact_b marks an unused slot.
+ */
+struct VelocityConfig
+{
+  uint8_t contact_a = 0;
+  uint8_t contact_b = 0;
+  uint8_t fast_mode = MODE_NONE;
+  uint8_t slow_mode = MODE_NONE;
+  int8_t scroll_max = 0;
+  uint32_t threshold_us = 0;
+  // A press that doesn't reach contact_b within this counts as slow.
+  uint32_t max_travel_us = 0;
+
+  bool used() const { return contact_a != contact_b; }
+
+  bool is_fast(uint32_t travel_us) const { return travel_us <= threshold_us; }
+
+  int8_t scroll_lines(uint32_t travel_us) const
+  {
+    if (is_fast(travel_us)) {
+      return scroll_max;
+    }
+    // Signed 64 bit: threshold_us is unsigned and would drag a negative
+    // scroll_max into unsigned math.
+    int64_t lines = static_cast<int64_t>(scroll_max) *
+                    static_cast<int64_t>(threshold_us) /
+                    static_cast<int64_t>(travel_us);
+    if (lines == 0) {
+      return scroll_max > 0 ? 1 : -1;
+    }
+    if (lines > INT8_MAX) {
+      lines = INT8_MAX;
+    } else if (lines < INT8_MIN) {
+      lines = INT8_MIN;
+    }
+    return static_cast<int8_t>(lines);
+  }
+};
+
+/**
+ * Times the travel between the two contacts of each VelocityConfig from the
+ * debounced edges of its pedals. edge_us of each edge is when the pin first
+ * changed, so debounce delay cancels out of the travel time and the
+ * resolution is the sampling period.
+ *
+ * The press is classified when contact_b engages, so it goes out as soon as
+ * a plain pedal on contact_b would. It is released on the first disengage of
+ * either contact. Presses abandoned before contact_b are dropped unless they
+ * stay down for max_travel_us, then they fire as slow.
+ *
+ * The Output type must provide:
+ *   void press(const VelocityConfig& config, uint32_t travel_us);
+ *   void release(const VelocityConfig& config, uint32_t travel_us);
+ */
+class VelocityEngine
+{
+public:
+  VelocityConfig configs[VELOCITY_PAIR_COUNT];
+
+  /**
+   * Call after editing configs. Cancels presses in progress.
+   */
+  void reset()
+  {
+    for (auto& s : slots) {
+      s = Slot();
+    }
+  }
+
+  bool has_pending() const
+  {
+    for (const auto& s : slots) {
+      if (s.phase == PHASE_TRAVEL) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Returns false if the pedal isn't a contact of any pair, in which case
+   * the edge is left to the caller.
+   */
+  template<typename Output>
+  bool on_edge(uint8_t pedal, bool engage, uint32_t edge_us, Output& out)
+  {
+    for (size_t i = 0; i < VELOCITY_PAIR_COUNT; i++) {
+      const auto& c = configs[i];
+      if (!c.used()) {
+        continue;
+      }
+      if (pedal == c.contact_a) {
+        on_contact_a(i, engage, edge_us, out);
+        return true;
+      }
+      if (pedal == c.contact_b) {
+        on_contact_b(i, engage, edge_us, out);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Fire presses that timed out before reaching contact_b. Call
+   * periodically.
+   */
+  template<typename Output>
+  void tick(uint32_t now_us, Output& out)
+  {
+    for (size_t i = 0; i < VELOCITY_PAIR_COUNT; i++) {
+      auto& s = slots[i];
+      if (s.phase == PHASE_TRAVEL &&
+          now_us - s.start_us >= configs[i].max_travel_us) {
+        press(i, configs[i].max_travel_us, out);
+      }
+    }
+  }
+
+private:
+  enum Phase : uint8_t
+  {
+    PHASE_IDLE,
+    PHASE_TRAVEL,  // contact_a engaged, timing.
+    PHASE_PRESSED, // Action sent.
+    PHASE_RELEASED // Action released, waiting for contact_a to open.
+  };
+
+  struct Slot
+  {
+    Phase phase = PHASE_IDLE;
+    uint32_t start_us = 0;
+    uint32_t travel_us = 0;
+  };
+
+  Slot slots[VELOCITY_PAIR_COUNT];
+
+  template<typename Output>
+  void press(size_t i, uint32_t travel_us, Output& out)
+  {
+    slots[i].phase = PHASE_PRESSED;
+    slots[i].travel_us = travel_us;
+    out.press(configs[i], travel_us);
+  }
+
+  template<typename Output>
+  void release(size_t i, Output& out)
+  {
+    out.release(configs[i], slots[i].travel_us);
+  }
+
+  template<typename Output>
+  void on_contact_a(size_t i, bool engage, uint32_t edge_us, Output& out)
+  {
+    auto& s = slots[i];
+    if (engage) {
+      // After a press whose contact_a edge was missed, RELEASED never sees
+      // contact_a open.
+      if (s.phase == PHASE_IDLE || s.phase == PHASE_RELEASED) {
+        s.phase = PHASE_TRAVEL;
+        s.start_us = edge_us;
+      }
+      return;
+    }
+
+    if (s.phase == PHASE_PRESSED) {
+      release(i, out);
+    }
+    s.phase = PHASE_IDLE;
+  }
+
+  template<typename Output>
+  void on_contact_b(size_t i, bool engage, uint32_t edge_us, Output& out)
+  {
+    auto& s = slots[i];
+    if (engage) {
+      if (s.phase == PHASE_TRAVEL) {
+        press(i, edge_us - s.start_us, out);
+      } else if (s.phase == PHASE_IDLE) {
+        // contact_a was missed, e.g. it is worn. Can't time it.
+        press(i, 0, out);
+      }
+      return;
+    }
+
+    if (s.phase == PHASE_PRESSED) {
+      release(i, out);
+      s.phase = PHASE_RELEASED;
+    }
+  }
+};
+
+#endif // FOOTMOUSE_VELOCITY_H